@@ -13,14 +13,24 @@ static char worker_start_docstring[] = "TODO";
 
 static char create_simulator_docstring[] = "TODO";
 static char load_network_docstring[] = "TODO";
+static char load_network_arrays_docstring[] =
+    "Load a network from the arrays that would be stored in the components group of a "
+    "network file, without writing them to a file.";
 static char finalize_build_docstring[] = "TODO";
 
 static char run_n_steps_docstring[] = "TODO";
-static char get_probe_data_docstring[] = "TODO";
-static char get_signal_value_docstring[] = "TODO";
+static char get_probe_data_docstring[] = "Give up the samples of a probe gathered since they were last asked for.";
+static char get_signal_value_docstring[] =
+    "Give a read-only view of the current value of a base signal on the master.";
 static char reset_simulator_docstring[] = "TODO";
 static char close_simulator_docstring[] = "TODO";
+static char checkpoint_simulator_docstring[] = "Write the state of the simulator to a checkpoint file.";
+static char restore_simulator_docstring[] = "Restore the state of the simulator from a checkpoint file.";
+static char rebalance_simulator_docstring[] =
+    "Move components between processes to balance the costs measured during the last run.";
 static char create_PyFunc_docstring[] = "TODO";
+static char set_PyFunc_dispatcher_docstring[] =
+    "Set the function that the calls of each batch of python functions are passed to.";
 
 extern "C" PyObject* mpi_sim_init(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_finalize(PyObject *self, PyObject *args);
@@ -31,6 +41,7 @@ extern "C" PyObject* mpi_sim_worker_start(PyObject *self, PyObject *args);
 
 extern "C" PyObject* mpi_sim_create_simulator(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_load_network(PyObject *self, PyObject *args);
+extern "C" PyObject* mpi_sim_load_network_arrays(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_finalize_build(PyObject *self, PyObject *args);
 
 extern "C" PyObject* mpi_sim_run_n_steps(PyObject *self, PyObject *args);
@@ -38,7 +49,11 @@ extern "C" PyObject* mpi_sim_get_probe_data(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_get_signal_value(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_reset_simulator(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_close_simulator(PyObject *self, PyObject *args);
+extern "C" PyObject* mpi_sim_checkpoint_simulator(PyObject *self, PyObject *args);
+extern "C" PyObject* mpi_sim_restore_simulator(PyObject *self, PyObject *args);
+extern "C" PyObject* mpi_sim_rebalance_simulator(PyObject *self, PyObject *args);
 extern "C" PyObject* mpi_sim_create_PyFunc(PyObject *self, PyObject *args);
+extern "C" PyObject* mpi_sim_set_PyFunc_dispatcher(PyObject *self, PyObject *args);
 
 static PyMethodDef module_functions[] = {
     {"init", mpi_sim_init, METH_VARARGS, init_docstring},
@@ -50,6 +65,7 @@ static PyMethodDef module_functions[] = {
 
     {"create_simulator", mpi_sim_create_simulator, METH_VARARGS, create_simulator_docstring},
     {"load_network", mpi_sim_load_network, METH_VARARGS, load_network_docstring},
+    {"load_network_arrays", mpi_sim_load_network_arrays, METH_VARARGS, load_network_arrays_docstring},
     {"finalize_build", mpi_sim_finalize_build, METH_VARARGS, finalize_build_docstring},
 
     {"run_n_steps", mpi_sim_run_n_steps, METH_VARARGS, run_n_steps_docstring},
@@ -57,7 +73,11 @@ static PyMethodDef module_functions[] = {
     {"get_signal_value", mpi_sim_get_signal_value, METH_VARARGS, get_signal_value_docstring},
     {"reset_simulator", mpi_sim_reset_simulator, METH_VARARGS, reset_simulator_docstring},
     {"close_simulator", mpi_sim_close_simulator, METH_VARARGS, close_simulator_docstring},
+    {"checkpoint_simulator", mpi_sim_checkpoint_simulator, METH_VARARGS, checkpoint_simulator_docstring},
+    {"restore_simulator", mpi_sim_restore_simulator, METH_VARARGS, restore_simulator_docstring},
+    {"rebalance_simulator", mpi_sim_rebalance_simulator, METH_VARARGS, rebalance_simulator_docstring},
     {"create_PyFunc", mpi_sim_create_PyFunc, METH_VARARGS, create_PyFunc_docstring},
+    {"set_PyFunc_dispatcher", mpi_sim_set_PyFunc_dispatcher, METH_VARARGS, set_PyFunc_dispatcher_docstring},
     {NULL, NULL, 0, NULL}
 };
 
@@ -90,6 +110,11 @@ MOD_INIT(mpi_sim)
     /* Load `numpy` functionality. */
     import_array();
 
+#if PY_VERSION_HEX < 0x03070000
+    /* Python functions may be called from the thread of the PyFuncRunner. */
+    PyEval_InitThreads();
+#endif
+
     return MOD_SUCCESS_VAL(m);
 }
 
@@ -157,16 +182,30 @@ extern "C" PyObject *mpi_sim_worker_start(PyObject *self, PyObject *args){
 }
 
 unique_ptr<Simulator> simulator;
+PyFuncRunner pyfunc_runner;
 
 extern "C" PyObject *mpi_sim_create_simulator(PyObject *self, PyObject *args){
-    if(!PyArg_ParseTuple(args, "")){
+    const char *options = "";
+    if(!PyArg_ParseTuple(args, "|s", &options)){
+        return NULL;
+    }
+
+    SimulatorConfig config;
+
+    // The PyFuncs of the last simulator are about to be destroyed.
+    pyfunc_runner.clear();
+
+    try{
+        config.set_from_string(options);
+    }catch(const runtime_error& e){
+        PyErr_SetString(PyExc_ValueError, e.what());
         return NULL;
     }
 
     if(n_processors_available == 1){
-        simulator = unique_ptr<Simulator>(new Simulator(false));
+        simulator = unique_ptr<Simulator>(new Simulator(config));
     }else{
-        simulator = unique_ptr<Simulator>(new MpiSimulator(false));
+        simulator = unique_ptr<Simulator>(new MpiSimulator(config));
     }
 
     Py_INCREF(Py_None);
@@ -185,6 +224,173 @@ extern "C" PyObject *mpi_sim_load_network(PyObject *self, PyObject *args){
     return Py_None;
 }
 
+/* Holds references to the arrays of a network handed over by python, so that
+ * the network can be read where python stored it. */
+struct PyArrayOwner{
+    vector<PyObject*> arrays;
+
+    // May be destroyed when the chunk that kept the network is, with or without the GIL.
+    ~PyArrayOwner(){
+        PyGILState_STATE state = PyGILState_Ensure();
+        for(PyObject* array: arrays){
+            Py_DECREF(array);
+        }
+        PyGILState_Release(state);
+    }
+};
+
+// The numpy type of the elements of a packed dataset, or NPY_NOTYPE for the
+// datasets of records and strings, which must already be laid out as in memory.
+static int packed_numpy_type(int d){
+    switch(d){
+        case PACKED_SIGNAL_KEYS:
+        case PACKED_OP_ARG_STARTS:
+        case PACKED_OP_SIGNALS:
+        case PACKED_OP_INDEX_DATA:
+            return NPY_LONGLONG;
+
+        case PACKED_SIGNAL_SHAPES:
+        case PACKED_SIGNAL_STRIDES:
+        case PACKED_OP_TYPES:
+            return NPY_INT;
+
+        case PACKED_SIGNALS:
+            return NPY_DTYPE;
+
+        case PACKED_OP_INDICES:
+        case PACKED_OP_REALS:
+            return NPY_DOUBLE;
+
+        default:
+            return NPY_NOTYPE;
+    }
+}
+
+// Copy a sequence of integers out of a python object, which may be None.
+template<typename T>
+static bool copy_integers(PyObject* obj, int type, vector<T>& out){
+    if(obj == Py_None){
+        return true;
+    }
+
+    PyObject* array = PyArray_FROMANY(obj, type, 0, 0, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if(array == NULL){
+        return false;
+    }
+
+    const T* data = (const T*) PyArray_DATA((PyArrayObject*) array);
+    out.assign(data, data + PyArray_SIZE((PyArrayObject*) array));
+    Py_DECREF(array);
+
+    return true;
+}
+
+/* Arguments are dt, the number of components, the probe info as a packed
+ * array of null-terminated strings, a dict from the name of each packed
+ * dataset to a pair (data, offsets), the component graph and the component
+ * mapping (or None), as nengo_mpi/model.py stores them in a network file.
+ * Arrays that already have the type and layout the chunk reads are used where
+ * they are; only the master's copies of the rows of other processes are made,
+ * to scatter them. */
+extern "C" PyObject *mpi_sim_load_network_arrays(PyObject *self, PyObject *args){
+    double dt;
+    int n_components;
+    PyObject *probe_info, *datasets, *component_graph, *component_mapping;
+
+    if(!PyArg_ParseTuple(args, "diOO!OO", &dt, &n_components, &probe_info,
+                         &PyDict_Type, &datasets, &component_graph, &component_mapping)){
+        return NULL;
+    }
+
+    auto network = make_shared<PackedNetwork>();
+    auto owner = make_shared<PyArrayOwner>();
+    network->owner = owner;
+
+    NetworkHeader& header = network->header;
+    header.n_components = n_components;
+    header.dt = dt;
+    header.op_format = BINARY_OP_FORMAT;
+    header.component_layout = PACKED_COMPONENT_LAYOUT;
+
+    PyObject* probe_array = PyArray_FROM_OF(probe_info, NPY_ARRAY_IN_ARRAY);
+    if(probe_array == NULL){
+        return NULL;
+    }
+
+    const char* probe_chars = PyArray_BYTES((PyArrayObject*) probe_array);
+    size_t n_probe_chars = PyArray_NBYTES((PyArrayObject*) probe_array);
+
+    size_t start = 0;
+    for(size_t i = 0; i < n_probe_chars; i++){
+        if(probe_chars[i] == '\0'){
+            header.probe_info.push_back(string(probe_chars + start, i - start));
+            start = i + 1;
+        }
+    }
+
+    Py_DECREF(probe_array);
+
+    if(!copy_integers(component_graph, NPY_LONGLONG, header.component_graph) ||
+            !copy_integers(component_mapping, NPY_INT, header.component_mapping)){
+        return NULL;
+    }
+
+    for(int d = 0; d < N_PACKED_DATASETS; d++){
+        PyObject* pair = PyDict_GetItemString(datasets, packed_dataset_name(d));
+        PyObject *data, *offsets;
+
+        if(pair == NULL || !PyArg_ParseTuple(pair, "OO", &data, &offsets)){
+            PyErr_Format(
+                PyExc_ValueError, "Expected a pair (data, offsets) for packed dataset %s.",
+                packed_dataset_name(d));
+            return NULL;
+        }
+
+        int type = packed_numpy_type(d);
+        PyObject* array = type == NPY_NOTYPE ?
+            PyArray_FROM_OF(data, NPY_ARRAY_IN_ARRAY) :
+            PyArray_FROMANY(data, type, 0, 0, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+
+        if(array == NULL){
+            return NULL;
+        }
+
+        owner->arrays.push_back(array);
+
+        PyArrayObject* arr = (PyArrayObject*) array;
+        if(size_t(PyArray_ITEMSIZE(arr)) != packed_element_size(d)){
+            PyErr_Format(
+                PyExc_ValueError, "Packed dataset %s has elements of %d bytes, but %d are expected.",
+                packed_dataset_name(d), int(PyArray_ITEMSIZE(arr)), int(packed_element_size(d)));
+            return NULL;
+        }
+
+        long long row_size = 1;
+        for(int i = 1; i < PyArray_NDIM(arr); i++){
+            row_size *= PyArray_DIM(arr, i);
+        }
+
+        network->datasets.push_back((const char*) PyArray_DATA(arr));
+        network->sizes.push_back(PyArray_NBYTES(arr));
+        header.row_sizes.push_back(row_size);
+
+        header.offsets.push_back(vector<long long>());
+        if(!copy_integers(offsets, NPY_LONGLONG, header.offsets.back())){
+            return NULL;
+        }
+    }
+
+    try{
+        simulator->from_network(network);
+    }catch(const exception& e){
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 extern "C" PyObject *mpi_sim_finalize_build(PyObject *self, PyObject *args){
     if(!PyArg_ParseTuple(args, "")){
         return NULL;
@@ -203,48 +409,74 @@ extern "C" PyObject *mpi_sim_run_n_steps(PyObject *self, PyObject *args){
         return NULL;
     }
 
-    simulator->run_n_steps(n_steps, progress, log_filename);
+    // The GIL is released while the simulation runs, and only taken to call
+    // python functions (see PyFuncRunner), so that pipelined python functions
+    // can be called from another thread while the simulation goes on.
+    PyThreadState* thread_state = PyEval_SaveThread();
+
+    try{
+        simulator->run_n_steps(n_steps, progress, log_filename);
+        pyfunc_runner.wait_all();
+
+    }catch(const PythonException& e){
+        // The python error is already set.
+        pyfunc_runner.drain();
+        PyEval_RestoreThread(thread_state);
+        return NULL;
+
+    }catch(const exception& e){
+        pyfunc_runner.drain();
+        PyEval_RestoreThread(thread_state);
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    PyEval_RestoreThread(thread_state);
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+static void free_shared_data(PyObject* capsule){
+    delete (shared_ptr<dtype>*) PyCapsule_GetPointer(capsule, NULL);
+}
+
 extern "C" PyObject *mpi_sim_get_probe_data(PyObject *self, PyObject *args){
     key_type probe_key;
     if(!PyArg_ParseTuple(args, "L", &probe_key)){
         return NULL;
     }
 
-    vector<Signal> data = simulator->get_probe_data(probe_key);
+    ProbeBlock block = simulator->get_probe_block(probe_key);
 
-    PyObject *lst = PyList_New(0);
-    if(lst == NULL){
-        return NULL;
-    }
+    npy_intp shape[3] = {npy_intp(block.n_rows), npy_intp(block.shape1), npy_intp(block.shape2)};
 
-    PyObject *array;
-    npy_intp shape[2];
-    int ndim, success;
+    if(block.n_rows == 0){
+        return PyArray_ZEROS(3, shape, NPY_DTYPE, 0);
+    }
 
-    for (auto& d: data){
-        shape[0] = d.shape1;
-        if(d.ndim == 1){
-            shape[1] = 0;
-            ndim = 1;
-        }else{
-            shape[1] = d.shape2;
-            ndim = 2;
-        }
+    // The array is a view of the block, which the array keeps alive
+    // through a capsule holding a reference to it.
+    PyObject* array = PyArray_SimpleNewFromData(3, shape, NPY_DTYPE, block.data.get());
+    if(array == NULL){
+        return NULL;
+    }
 
-        array = PyArray_SimpleNew(ndim, shape, NPY_DOUBLE);
-        if (array == NULL) return NULL; // TODO
-        d.copy_to_buffer((dtype*)(PyArray_DATA((PyArrayObject*)(array))));
+    shared_ptr<dtype>* owner = new shared_ptr<dtype>(block.data);
+    PyObject* capsule = PyCapsule_New(owner, NULL, free_shared_data);
+    if(capsule == NULL){
+        delete owner;
+        Py_DECREF(array);
+        return NULL;
+    }
 
-        success = PyList_Append(lst, array);
-        if(success < 0) return NULL; // TODO
+    // Steals the reference to the capsule, even if it fails.
+    if(PyArray_SetBaseObject((PyArrayObject*)array, capsule) < 0){
+        Py_DECREF(array);
+        return NULL;
     }
 
-    return lst;
+    return array;
 }
 
 extern "C" PyObject *mpi_sim_get_signal_value(PyObject *self, PyObject *args){
@@ -254,22 +486,33 @@ extern "C" PyObject *mpi_sim_get_signal_value(PyObject *self, PyObject *args){
     }
 
     Signal signal = simulator->get_signal(signal_key);
-    PyObject *array;
-    npy_intp shape[2];
-    int ndim, success;
-
-    shape[0] = signal.shape1;
-    if(signal.ndim == 1){
-        shape[1] = 0;
-        ndim = 1;
-    }else{
-        shape[1] = signal.shape2;
-        ndim = 2;
+
+    npy_intp shape[2] = {npy_intp(signal.shape1), npy_intp(signal.shape2)};
+    npy_intp strides[2] = {
+        npy_intp(signal.stride1 * sizeof(dtype)), npy_intp(signal.stride2 * sizeof(dtype))};
+    int ndim = signal.ndim == 1 ? 1 : 2;
+
+    // A read-only view of the signal, which keeps its memory alive through a
+    // capsule, like the arrays of get_probe_data.
+    PyObject* array = PyArray_New(
+        &PyArray_Type, ndim, shape, NPY_DTYPE, strides, signal.raw_data, 0, 0, NULL);
+    if(array == NULL){
+        return NULL;
     }
 
-    array = PyArray_SimpleNew(ndim, shape, NPY_DOUBLE);
-    if (array == NULL) return NULL; // TODO
-    signal.copy_to_buffer((dtype*)(PyArray_DATA((PyArrayObject*)(array))));
+    shared_ptr<dtype>* owner = new shared_ptr<dtype>(signal.data);
+    PyObject* capsule = PyCapsule_New(owner, NULL, free_shared_data);
+    if(capsule == NULL){
+        delete owner;
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    // Steals the reference to the capsule, even if it fails.
+    if(PyArray_SetBaseObject((PyArrayObject*)array, capsule) < 0){
+        Py_DECREF(array);
+        return NULL;
+    }
 
     return array;
 }
@@ -292,19 +535,68 @@ extern "C" PyObject *mpi_sim_close_simulator(PyObject *self, PyObject *args){
     }
 
     simulator->close();
+    pyfunc_runner.clear();
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+extern "C" PyObject *mpi_sim_checkpoint_simulator(PyObject *self, PyObject *args){
+    const char *filename;
+    if(!PyArg_ParseTuple(args, "s", &filename)){
+        return NULL;
+    }
+
+    simulator->checkpoint(filename);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+extern "C" PyObject *mpi_sim_restore_simulator(PyObject *self, PyObject *args){
+    const char *filename;
+    if(!PyArg_ParseTuple(args, "s", &filename)){
+        return NULL;
+    }
+
+    simulator->restore(filename);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+extern "C" PyObject *mpi_sim_rebalance_simulator(PyObject *self, PyObject *args){
+    if(!PyArg_ParseTuple(args, "")){
+        return NULL;
+    }
+
+    bool moved;
+
+    // The PyFuncs are remade, with the GIL held, if the chunk is rebuilt.
+    try{
+        moved = simulator->rebalance();
+    }catch(const PythonException& e){
+        return NULL;
+    }catch(const exception& e){
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    // The batches of the runner belong to PyFuncs that no longer exist.
+    if(moved){
+        pyfunc_runner.clear();
+    }
+
+    return PyBool_FromLong(moved);
+}
+
 extern "C" PyObject *mpi_sim_create_PyFunc(PyObject *self, PyObject *args){
     PyObject *callback;
     char *time_string, *input_string, *output_string;
-    PyArrayObject *py_time_buffer, *py_input_buffer, *py_output_buffer;
     float index;
 
-    if(!PyArg_ParseTuple(args, "OsssOOOf", &callback, &time_string, &input_string, &output_string,
-                         &py_time_buffer, &py_input_buffer, &py_output_buffer, &index)){
+    if(!PyArg_ParseTuple(args, "Osssf", &callback, &time_string, &input_string, &output_string,
+                         &index)){
         return NULL;
     }
 
@@ -312,62 +604,163 @@ extern "C" PyObject *mpi_sim_create_PyFunc(PyObject *self, PyObject *args){
         PyErr_SetString(PyExc_TypeError, "Parameter ``callback`` must be callable.");
         return NULL;
     }
+
+    bool pipelined = simulator->get_config().async_pyfuncs;
+
+    // The factory holds a reference to the callback for as long as the
+    // simulator may remake the PyFunc.
     Py_INCREF(callback);
+    shared_ptr<PyObject> fn(callback, [](PyObject* o){ Py_XDECREF(o); });
 
-    Signal time = simulator->get_signal_view(time_string);
-    build_dbg("Time signal: " << time);
+    string time_str(time_string), input_str(input_string), output_str(output_string);
 
-    Signal input = simulator->get_signal_view(input_string);
-    build_dbg("Input signal: " << input);
+    OpFactory make_pyfunc = [=](MpiSimulatorChunk& chunk){
+        Signal time = chunk.get_signal_view(time_str);
+        build_dbg("Time signal: " << time);
 
-    Signal output = simulator->get_signal_view(output_string);
-    build_dbg("Output signal: " << output);
+        Signal input = chunk.get_signal_view(input_str);
+        build_dbg("Input signal: " << input);
 
-    dtype* time_buffer = (dtype*)(PyArray_DATA(py_time_buffer));
-    dtype* input_buffer = (dtype*)(PyArray_DATA(py_input_buffer));
-    dtype* output_buffer = (dtype*)(PyArray_DATA(py_output_buffer));
+        Signal output = chunk.get_signal_view(output_str);
+        build_dbg("Output signal: " << output);
 
-    auto pyfunc = unique_ptr<Operator>(
-        new PyFunc(callback, time, input, output, time_buffer, input_buffer, output_buffer));
+        return unique_ptr<Operator>(new PyFunc(fn.get(), time, input, output, pipelined));
+    };
 
-    simulator->add_pyfunc(index, move(pyfunc));
+    try{
+        simulator->add_pyfunc(index, make_pyfunc);
+    }catch(const PythonException& e){
+        return NULL;
+    }catch(const exception& e){
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-PyFunc::PyFunc(
-    PyObject* fn, Signal time, Signal input, Signal output,
-    dtype* time_buffer, dtype* input_buffer, dtype* output_buffer)
-:fn(fn), time(time), input(input), output(output),
-time_buffer(time_buffer), input_buffer(input_buffer), output_buffer(output_buffer){
-}
+extern "C" PyObject *mpi_sim_set_PyFunc_dispatcher(PyObject *self, PyObject *args){
+    PyObject *dispatcher;
 
-void PyFunc::operator() (){
-    // TODO: currently assuming pyfuncs only accept and return vectors.
-    for(unsigned i = 0; i < time.shape1; i++){
-        time_buffer[i] = time(i);
+    if(!PyArg_ParseTuple(args, "O", &dispatcher)){
+        return NULL;
     }
 
-    for(unsigned i = 0; i < input.shape1; i++){
-        input_buffer[i] = input(i);
+    if (!PyCallable_Check(dispatcher)) {
+        PyErr_SetString(PyExc_TypeError, "Parameter ``dispatcher`` must be callable.");
+        return NULL;
     }
 
-    PyObject* arglist = Py_BuildValue("()");
-    PyObject* result = PyObject_CallObject(fn, arglist);
-    Py_DECREF(arglist);
-    if(result == NULL){
+    pyfunc_runner.set_dispatcher(dispatcher);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+void run_pyfunc_batch(Operator* const* ops, unsigned n_ops){
+    pyfunc_runner.run(ops, n_ops);
+}
+
+// A 1-D array of the values of ``signal''. If ``view'' and the signal is
+// contiguous, the array is a view of the signal's memory, read-only unless
+// ``writeable''; otherwise it is a buffer of zeros of its own.
+static PyObject* signal_array(const Signal& signal, bool view, bool writeable, bool& is_view){
+    npy_intp shape[1] = {npy_intp(signal.shape1)};
+    PyObject* array;
+
+    is_view = view && signal.is_contiguous;
+    if(is_view){
+        array = PyArray_SimpleNewFromData(1, shape, NPY_DTYPE, signal.raw_data);
+    }else{
+        array = PyArray_ZEROS(1, shape, NPY_DTYPE, 0);
+    }
+
+    if(array == NULL){
         throw PythonException();
     }
 
-    for(unsigned i = 0; i < output.shape1; i++){
-        output(i) = output_buffer[i];
+    if(is_view && !writeable){
+        PyArray_CLEARFLAGS((PyArrayObject*)array, NPY_ARRAY_WRITEABLE);
+    }
+
+    return array;
+}
+
+static dtype* array_data(PyObject* array){
+    return (dtype*)(PyArray_DATA((PyArrayObject*)(array)));
+}
+
+PyFunc::PyFunc(PyObject* fn, Signal time, Signal input, Signal output, bool pipelined)
+:fn(fn), time(time), input(input), output(output), pipelined(pipelined),
+time_array(NULL), input_array(NULL), output_array(NULL), call(NULL){
+
+    Py_INCREF(fn);
+
+    try{
+        time_array = signal_array(time, !pipelined, false, time_is_view);
+        input_array = signal_array(input, !pipelined, false, input_is_view);
+        output_array = signal_array(output, !pipelined, true, output_is_view);
+
+        call = PyTuple_Pack(4, fn, time_array, input_array, output_array);
+        if(call == NULL){
+            throw PythonException();
+        }
+    }catch(const PythonException& e){
+        Py_XDECREF(time_array);
+        Py_XDECREF(input_array);
+        Py_XDECREF(output_array);
+        Py_DECREF(fn);
+        throw;
+    }
+
+    declare_read(time);
+    declare_read(input);
+    declare_write(output);
+}
+
+void PyFunc::operator() (){
+    Operator* op = this;
+    pyfunc_runner.run(&op, 1);
+}
+
+// TODO: currently assuming pyfuncs only accept and return vectors.
+void PyFunc::copy_inputs(){
+    if(!time_is_view){
+        dtype* t = array_data(time_array);
+        for(unsigned i = 0; i < time.shape1; i++){
+            t[i] = time(i);
+        }
+    }
+
+    if(!input_is_view){
+        dtype* x = array_data(input_array);
+        for(unsigned i = 0; i < input.shape1; i++){
+            x[i] = input(i);
+        }
+    }
+}
+
+void PyFunc::copy_output(){
+    if(!output_is_view){
+        const dtype* y = array_data(output_array);
+        for(unsigned i = 0; i < output.shape1; i++){
+            output(i) = y[i];
+        }
     }
 
     run_dbg(*this);
 }
 
+void PyFunc::reset(unsigned seed){
+    pyfunc_runner.reset();
+}
+
 PyFunc::~PyFunc(){
+    Py_XDECREF(call);
+    Py_XDECREF(time_array);
+    Py_XDECREF(input_array);
+    Py_XDECREF(output_array);
     Py_XDECREF(fn);
 }
 
@@ -382,23 +775,242 @@ string PyFunc::to_string() const{
     out << "Output: " << endl;
     out << output << endl << endl;
 
-    out << "time_buffer: " << time_buffer << endl;
-    for(int i = 0; i < time.shape1; i++){
-        out << time_buffer[i] << ",";
+    out << "pipelined: " << pipelined << endl;
+    out << "time_is_view: " << time_is_view << endl;
+    out << "input_is_view: " << input_is_view << endl;
+    out << "output_is_view: " << output_is_view << endl;
+
+    return out.str();
+}
+
+PyFuncRunner::PyFuncRunner()
+:dispatcher(NULL), stopping(false), error_type(NULL), error_value(NULL), error_traceback(NULL){
+}
+
+// Python may already be finalized, so references are not released here.
+PyFuncRunner::~PyFuncRunner(){
+    if(worker.joinable()){
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            stopping = true;
+        }
+
+        queue_ready.notify_all();
+        worker.join();
     }
-    out << endl;
+}
 
-    out << "input_buffer: " << input_buffer << endl;
-    for(int i = 0; i < input.shape1; i++){
-        out << input_buffer[i] << ",";
+void PyFuncRunner::set_dispatcher(PyObject* dispatcher){
+    Py_INCREF(dispatcher);
+    Py_XDECREF(this->dispatcher);
+    this->dispatcher = dispatcher;
+}
+
+PyFuncRunner::Batch& PyFuncRunner::get_batch(Operator* const* ops, unsigned n_ops){
+    auto found = batches.find(ops[0]);
+    if(found != batches.end() && found->second->ops.size() == n_ops){
+        return *found->second;
     }
-    out << endl;
 
-    out << "output_buffer: " << output_buffer << endl;
-    for(int i = 0; i < output.shape1; i++){
-        out << output_buffer[i] << ",";
+    if(dispatcher == NULL){
+        throw logic_error("PyFuncs were run before the PyFunc dispatcher was set.");
     }
-    out << endl;
 
-    return out.str();
+    unique_ptr<Batch> batch(new Batch());
+    batch->pending = false;
+    batch->has_result = false;
+
+    for(unsigned i = 0; i < n_ops; i++){
+        batch->ops.push_back(static_cast<PyFunc*>(ops[i]));
+
+        if(batch->ops[i]->is_pipelined() != batch->ops[0]->is_pipelined()){
+            throw logic_error("A batch of PyFuncs mixes pipelined and unpipelined PyFuncs.");
+        }
+    }
+
+    PyGILState_STATE gil = PyGILState_Ensure();
+
+    batch->calls = PyTuple_New(n_ops);
+    for(unsigned i = 0; batch->calls != NULL && i < n_ops; i++){
+        PyObject* call = batch->ops[i]->get_call();
+        Py_INCREF(call);
+        PyTuple_SET_ITEM(batch->calls, i, call);
+    }
+
+    if(found != batches.end()){
+        Py_XDECREF(found->second->calls);
+    }
+
+    PyGILState_Release(gil);
+
+    if(batch->calls == NULL){
+        throw runtime_error("Could not create the calls of a batch of PyFuncs.");
+    }
+
+    Batch& result = *batch;
+    batches[ops[0]] = move(batch);
+    return result;
+}
+
+void PyFuncRunner::run(Operator* const* ops, unsigned n_ops){
+    Batch& batch = get_batch(ops, n_ops);
+
+    if(!batch.ops.front()->is_pipelined()){
+        for(PyFunc* op: batch.ops){
+            op->copy_inputs();
+        }
+
+        call(batch);
+        rethrow_error();
+
+        for(PyFunc* op: batch.ops){
+            op->copy_output();
+        }
+
+        return;
+    }
+
+    // The outputs computed from the inputs of the previous step.
+    wait(batch);
+
+    if(batch.has_result){
+        for(PyFunc* op: batch.ops){
+            op->copy_output();
+        }
+    }
+
+    for(PyFunc* op: batch.ops){
+        op->copy_inputs();
+    }
+
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        batch.pending = true;
+        queue.push_back(&batch);
+
+        if(!worker.joinable()){
+            worker = thread(&PyFuncRunner::worker_loop, this);
+        }
+    }
+
+    queue_ready.notify_one();
+}
+
+void PyFuncRunner::call(Batch& batch){
+    PyGILState_STATE gil = PyGILState_Ensure();
+
+    PyObject* result = PyObject_CallFunctionObjArgs(dispatcher, batch.calls, NULL);
+
+    if(result == NULL){
+        lock_guard<mutex> lock(queue_mutex);
+
+        // Only the first error is kept.
+        if(error_type == NULL){
+            PyErr_Fetch(&error_type, &error_value, &error_traceback);
+        }else{
+            PyErr_Clear();
+        }
+    }
+
+    Py_XDECREF(result);
+    PyGILState_Release(gil);
+}
+
+void PyFuncRunner::wait(Batch& batch){
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        batch_done.wait(lock, [&batch]{ return !batch.pending; });
+    }
+
+    rethrow_error();
+}
+
+void PyFuncRunner::rethrow_error(){
+    PyObject *type, *value, *traceback;
+
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        type = error_type;
+        value = error_value;
+        traceback = error_traceback;
+        error_type = error_value = error_traceback = NULL;
+    }
+
+    if(type != NULL){
+        PyGILState_STATE gil = PyGILState_Ensure();
+        PyErr_Restore(type, value, traceback);
+        PyGILState_Release(gil);
+
+        throw PythonException();
+    }
+}
+
+void PyFuncRunner::worker_loop(){
+    while(true){
+        Batch* batch;
+
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [this]{ return stopping || !queue.empty(); });
+
+            if(queue.empty()){
+                return;
+            }
+
+            batch = queue.front();
+        }
+
+        call(*batch);
+
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            queue.pop_front();
+            batch->pending = false;
+            batch->has_result = true;
+        }
+
+        batch_done.notify_all();
+    }
+}
+
+void PyFuncRunner::drain(){
+    unique_lock<mutex> lock(queue_mutex);
+    batch_done.wait(lock, [this]{ return queue.empty(); });
+}
+
+void PyFuncRunner::wait_all(){
+    drain();
+    rethrow_error();
+}
+
+void PyFuncRunner::reset(){
+    lock_guard<mutex> lock(queue_mutex);
+
+    for(auto& kv: batches){
+        kv.second->has_result = false;
+    }
+
+    Py_CLEAR(error_type);
+    Py_CLEAR(error_value);
+    Py_CLEAR(error_traceback);
+}
+
+void PyFuncRunner::clear(){
+    if(worker.joinable()){
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            stopping = true;
+        }
+
+        queue_ready.notify_all();
+        worker.join();
+        stopping = false;
+    }
+
+    for(auto& kv: batches){
+        Py_XDECREF(kv.second->calls);
+    }
+
+    batches.clear();
+    queue.clear();
 }
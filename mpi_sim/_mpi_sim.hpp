@@ -8,7 +8,13 @@
 #include <string>
 #include <list>
 #include <vector>
+#include <deque>
+#include <map>
+#include <memory>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "signal.hpp"
 #include "operator.hpp"
@@ -21,16 +27,46 @@ public:
     PythonException(const string& message):runtime_error(message){};
 };
 
+class PyFunc;
+
+// BatchRunner for PyFuncs, which calls python once for the whole batch (see PyFuncRunner).
+void run_pyfunc_batch(Operator* const* ops, unsigned n_ops);
+
+/* Calls a python function with the values of a time signal and an input
+ * signal, and writes what it returns to an output signal. The function is
+ * called as fn(t, x, y) with numpy arrays t, x and y, and writes its result
+ * into y. Where the signals are contiguous, the arrays are views of their
+ * memory, so nothing is copied; x and t are then read-only.
+ *
+ * If ``pipelined'', the function is called by the thread of the PyFuncRunner
+ * while the simulation goes on, so the arrays are always buffers of their
+ * own: each call writes the result of the previous call to the output
+ * signal, and hands the current inputs to the function. */
 class PyFunc: public Operator{
 public:
-    PyFunc(
-        PyObject* fn, Signal time, Signal input, Signal output,
-        dtype* time_buffer, dtype* input_buffer, dtype* output_buffer);
+    PyFunc(PyObject* fn, Signal time, Signal input, Signal output, bool pipelined);
     ~PyFunc();
 
+    virtual string classname() const { return "PyFunc"; }
+    virtual BatchRunner batch_runner() const { return run_pyfunc_batch; }
+
     void operator()();
     virtual string to_string() const;
 
+    virtual void reset(unsigned seed);
+
+    // Calls into the python interpreter.
+    virtual bool thread_safe() const{ return false; }
+
+    bool is_pipelined() const{ return pipelined; }
+
+    // The tuple (fn, t, x, y) of the function and the arrays it is called with.
+    PyObject* get_call() const{ return call; }
+
+    // Copy the signals that python doesn't see in place to and from the arrays.
+    void copy_inputs();
+    void copy_output();
+
 private:
     PyObject* fn;
 
@@ -38,7 +74,82 @@ private:
     Signal input;
     Signal output;
 
-    dtype* time_buffer;
-    dtype* input_buffer;
-    dtype* output_buffer;
+    const bool pipelined;
+
+    PyObject* time_array;
+    PyObject* input_array;
+    PyObject* output_array;
+    PyObject* call;
+
+    bool time_is_view;
+    bool input_is_view;
+    bool output_is_view;
+};
+
+/* Runs the python functions of batches of consecutive PyFuncs, passing the
+ * (fn, t, x, y) tuples of a whole batch to a single call of a dispatcher
+ * supplied by python, so each batch pays for one call into the interpreter.
+ *
+ * The simulation runs without the GIL (see mpi_sim_run_n_steps), and the GIL
+ * is taken for each call. Batches of pipelined PyFuncs are instead queued for
+ * a thread of the runner's own, which makes the calls while the simulation
+ * goes on; the next run of a batch first waits for its previous call. A
+ * python exception raised by a call is kept, and rethrown as a
+ * PythonException by ``run'' or ``wait_all'', with the python error set. */
+class PyFuncRunner{
+public:
+    PyFuncRunner();
+    ~PyFuncRunner();
+
+    // The python function that every batch is passed to, as a tuple of calls.
+    void set_dispatcher(PyObject* dispatcher);
+
+    // Run a batch of PyFuncs, which must all be pipelined or all not be.
+    void run(Operator* const* ops, unsigned n_ops);
+
+    // Wait for every queued batch to be called, then rethrow any error of
+    // the calls. drain only waits. Must not be called with the GIL held.
+    void wait_all();
+    void drain();
+
+    // Forget the results of pipelined calls, so the next run starts afresh.
+    void reset();
+
+    // Stop the thread and drop every batch. Must be called with the GIL held.
+    void clear();
+
+private:
+    struct Batch{
+        vector<PyFunc*> ops;
+        PyObject* calls;
+        bool pending;
+        bool has_result;
+    };
+
+    Batch& get_batch(Operator* const* ops, unsigned n_ops);
+
+    // Call the dispatcher on a batch. Takes the GIL.
+    void call(Batch& batch);
+
+    // Wait until the batch has been called, and rethrow any error of the call.
+    void wait(Batch& batch);
+    void rethrow_error();
+
+    void worker_loop();
+
+    PyObject* dispatcher;
+    // Keyed by the first op of each batch.
+    map<Operator*, unique_ptr<Batch>> batches;
+
+    thread worker;
+    mutex queue_mutex;
+    condition_variable queue_ready;
+    condition_variable batch_done;
+    deque<Batch*> queue;
+    bool stopping;
+
+    // The python exception of a failed call, from PyErr_Fetch.
+    PyObject* error_type;
+    PyObject* error_value;
+    PyObject* error_traceback;
 };
@@ -0,0 +1,260 @@
+#include "checkpoint.hpp"
+
+static void check_status(herr_t status, string what, string filename){
+    if(status < 0){
+        stringstream msg;
+        msg << "Could not " << what << " checkpoint " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+template<typename T>
+static void write_attribute(hid_t file, string name, hid_t type, const T& value){
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attr = H5Acreate2(file, name.c_str(), type, space, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attr, type, &value);
+    H5Aclose(attr);
+    H5Sclose(space);
+}
+
+template<typename T>
+static void read_attribute(hid_t file, string name, hid_t type, T& value, string filename){
+    if(H5Aexists(file, name.c_str()) <= 0){
+        stringstream msg;
+        msg << "File " << filename << " is not a nengo_mpi checkpoint: "
+            << "it has no " << name << " attribute." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    hid_t attr = H5Aopen(file, name.c_str(), H5P_DEFAULT);
+    H5Aread(attr, type, &value);
+    H5Aclose(attr);
+}
+
+void write_checkpoint(
+        string filename, const CheckpointInfo& info, const string& state, MPI_Comm comm){
+
+    int rank = 0, n_processors = 1;
+    if(comm != MPI_COMM_NULL){
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &n_processors);
+    }
+
+    // Position of each process's block in the state dataset.
+    long long state_size = state.size();
+    vector<long long> sizes(n_processors, state_size);
+
+    if(comm != MPI_COMM_NULL){
+        MPI_Allgather(&state_size, 1, MPI_LONG_LONG, sizes.data(), 1, MPI_LONG_LONG, comm);
+    }
+
+    vector<long long> offsets(n_processors + 1, 0);
+    for(int i = 0; i < n_processors; i++){
+        offsets[i+1] = offsets[i] + sizes[i];
+    }
+
+    string tmp_filename = filename + ".tmp";
+
+    hid_t file_plist = H5Pcreate(H5P_FILE_ACCESS);
+    hid_t write_plist = H5Pcreate(H5P_DATASET_XFER);
+
+    if(comm != MPI_COMM_NULL){
+        H5Pset_fapl_mpio(file_plist, comm, MPI_INFO_NULL);
+        H5Pset_dxpl_mpio(write_plist, H5FD_MPIO_COLLECTIVE);
+    }
+
+    hid_t file = H5Fcreate(tmp_filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, file_plist);
+    H5Pclose(file_plist);
+
+    if(file < 0){
+        H5Pclose(write_plist);
+        check_status(file, "create", tmp_filename);
+    }
+
+    write_attribute(file, "checkpoint_format", H5T_NATIVE_INT, CHECKPOINT_FORMAT);
+    write_attribute(file, "n_processors", H5T_NATIVE_INT, n_processors);
+    write_attribute(file, "step", H5T_NATIVE_ULLONG, (unsigned long long) info.step);
+    write_attribute(file, "seed", H5T_NATIVE_UINT, info.seed);
+    write_attribute(file, "dt", H5T_NATIVE_DTYPE, info.dt);
+    write_attribute(file, "dtype_size", H5T_NATIVE_INT, int(sizeof(dtype)));
+
+    // Every process takes part in both writes; only rank 0 writes the offsets.
+    hsize_t offsets_dims[] = {hsize_t(n_processors + 1)};
+    hid_t offsets_space = H5Screate_simple(1, offsets_dims, NULL);
+    hid_t offsets_dset = H5Dcreate(
+        file, "state_offsets", H5T_NATIVE_LLONG, offsets_space,
+        H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+    hid_t offsets_mem_space = H5Screate_simple(1, offsets_dims, NULL);
+    if(rank != 0){
+        H5Sselect_none(offsets_space);
+        H5Sselect_none(offsets_mem_space);
+    }
+
+    herr_t status = H5Dwrite(
+        offsets_dset, H5T_NATIVE_LLONG, offsets_mem_space, offsets_space,
+        write_plist, offsets.data());
+
+    H5Sclose(offsets_mem_space);
+    H5Sclose(offsets_space);
+    H5Dclose(offsets_dset);
+
+    hsize_t state_dims[] = {hsize_t(offsets.back())};
+    hid_t state_space = H5Screate_simple(1, state_dims, NULL);
+    hid_t state_dset = H5Dcreate(
+        file, "state", H5T_NATIVE_CHAR, state_space,
+        H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+    hsize_t block_dims[] = {hsize_t(max(state_size, 1ll))};
+    hid_t state_mem_space = H5Screate_simple(1, block_dims, NULL);
+
+    if(state_size > 0){
+        hsize_t start[] = {hsize_t(offsets[rank])};
+        hsize_t count[] = {hsize_t(state_size)};
+        H5Sselect_hyperslab(state_space, H5S_SELECT_SET, start, NULL, count, NULL);
+    }else{
+        H5Sselect_none(state_space);
+        H5Sselect_none(state_mem_space);
+    }
+
+    char dummy[1];
+    status = min(status, H5Dwrite(
+        state_dset, H5T_NATIVE_CHAR, state_mem_space, state_space,
+        write_plist, state_size > 0 ? state.data() : dummy));
+
+    H5Sclose(state_mem_space);
+    H5Sclose(state_space);
+    H5Dclose(state_dset);
+    H5Pclose(write_plist);
+
+    status = min(status, H5Fclose(file));
+    check_status(status, "write", tmp_filename);
+
+    if(comm != MPI_COMM_NULL){
+        MPI_Barrier(comm);
+    }
+
+    int renamed = 0;
+    if(rank == 0){
+        renamed = rename(tmp_filename.c_str(), filename.c_str());
+    }
+
+    if(comm != MPI_COMM_NULL){
+        MPI_Bcast(&renamed, 1, MPI_INT, 0, comm);
+    }
+
+    if(renamed != 0){
+        stringstream msg;
+        msg << "Could not move checkpoint " << tmp_filename << " to " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+string read_checkpoint(string filename, CheckpointInfo& info, MPI_Comm comm){
+    int rank = 0, n_processors = 1;
+    if(comm != MPI_COMM_NULL){
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &n_processors);
+    }
+
+    hid_t file_plist = H5Pcreate(H5P_FILE_ACCESS);
+    hid_t read_plist = H5Pcreate(H5P_DATASET_XFER);
+
+    if(comm != MPI_COMM_NULL){
+        H5Pset_fapl_mpio(file_plist, comm, MPI_INFO_NULL);
+        H5Pset_dxpl_mpio(read_plist, H5FD_MPIO_COLLECTIVE);
+    }
+
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, file_plist);
+    H5Pclose(file_plist);
+
+    if(file < 0){
+        H5Pclose(read_plist);
+        check_status(file, "open", filename);
+    }
+
+    string state;
+
+    try{
+        int format, file_n_processors, dtype_size;
+        unsigned long long step;
+
+        read_attribute(file, "checkpoint_format", H5T_NATIVE_INT, format, filename);
+
+        if(format != CHECKPOINT_FORMAT){
+            stringstream msg;
+            msg << "Checkpoint " << filename << " has format " << format
+                << ", but this version of nengo_mpi reads format "
+                << CHECKPOINT_FORMAT << "." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        read_attribute(file, "n_processors", H5T_NATIVE_INT, file_n_processors, filename);
+
+        if(file_n_processors != n_processors){
+            stringstream msg;
+            msg << "Checkpoint " << filename << " was written by " << file_n_processors
+                << " processes, but is being restored by " << n_processors << "." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        read_attribute(file, "dtype_size", H5T_NATIVE_INT, dtype_size, filename);
+
+        if(dtype_size != int(sizeof(dtype))){
+            stringstream msg;
+            msg << "Checkpoint " << filename << " was written by a build of nengo_mpi "
+                << "with a different precision." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        read_attribute(file, "step", H5T_NATIVE_ULLONG, step, filename);
+        read_attribute(file, "seed", H5T_NATIVE_UINT, info.seed, filename);
+        read_attribute(file, "dt", H5T_NATIVE_DTYPE, info.dt, filename);
+        info.step = step;
+
+        vector<long long> offsets(n_processors + 1);
+        hid_t offsets_dset = H5Dopen(file, "state_offsets", H5P_DEFAULT);
+        herr_t status = H5Dread(
+            offsets_dset, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, read_plist, offsets.data());
+        H5Dclose(offsets_dset);
+        check_status(status, "read", filename);
+
+        long long state_size = offsets[rank+1] - offsets[rank];
+        state.resize(state_size);
+
+        hid_t state_dset = H5Dopen(file, "state", H5P_DEFAULT);
+        hid_t state_space = H5Dget_space(state_dset);
+
+        hsize_t block_dims[] = {hsize_t(max(state_size, 1ll))};
+        hid_t state_mem_space = H5Screate_simple(1, block_dims, NULL);
+
+        if(state_size > 0){
+            hsize_t start[] = {hsize_t(offsets[rank])};
+            hsize_t count[] = {hsize_t(state_size)};
+            H5Sselect_hyperslab(state_space, H5S_SELECT_SET, start, NULL, count, NULL);
+        }else{
+            H5Sselect_none(state_space);
+            H5Sselect_none(state_mem_space);
+        }
+
+        char dummy[1];
+        status = H5Dread(
+            state_dset, H5T_NATIVE_CHAR, state_mem_space, state_space,
+            read_plist, state_size > 0 ? &state[0] : dummy);
+
+        H5Sclose(state_mem_space);
+        H5Sclose(state_space);
+        H5Dclose(state_dset);
+        check_status(status, "read", filename);
+
+    }catch(...){
+        H5Pclose(read_plist);
+        H5Fclose(file);
+        throw;
+    }
+
+    H5Pclose(read_plist);
+    H5Fclose(file);
+
+    return state;
+}
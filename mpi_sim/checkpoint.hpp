@@ -0,0 +1,132 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <vector>
+#include <exception>
+#include <cstdint>
+#include <cstdio> // rename
+#include <algorithm>
+
+#include <mpi.h>
+#include <hdf5.h>
+
+#include <boost/circular_buffer.hpp>
+
+#include "typedef.hpp"
+#include "debug.hpp"
+
+using namespace std;
+
+// Version of the layout of checkpoint files, stored in their ``checkpoint_format''
+// attribute.
+const int CHECKPOINT_FORMAT = 3;
+
+/* Information stored with a checkpoint that is the same on every process. */
+struct CheckpointInfo{
+    // Number of steps simulated since the simulator was last reset.
+    uint64_t step;
+
+    // Seed that the simulator was last reset with. Restoring a checkpoint
+    // resets the simulator with this seed before overwriting its state, which
+    // recreates any operator state derived from the seed (e.g. the images of a
+    // SpaunStimulus).
+    unsigned seed;
+
+    dtype dt;
+};
+
+/* Write a checkpoint, consisting of the info and one block of state per
+ * process. In parallel (comm not MPI_COMM_NULL), every process in comm must
+ * call this; the file is written collectively, with the blocks of all
+ * processes concatenated into a single dataset. The checkpoint is written to a
+ * temporary file that replaces ``filename'' once it is complete, so an
+ * existing checkpoint is never left half overwritten. */
+void write_checkpoint(
+    string filename, const CheckpointInfo& info, const string& state, MPI_Comm comm);
+
+/* Read the info and this process's block of state from a checkpoint written
+ * by write_checkpoint with the same number of processes. Every process in comm
+ * must call this. Throws a runtime_error if the checkpoint can't be used. */
+string read_checkpoint(string filename, CheckpointInfo& info, MPI_Comm comm);
+
+/* Helpers used by operators, probes and chunks to save their state to, and
+ * load it from, a block of checkpoint state. Values are stored in their
+ * in-memory representation, so checkpoints can only be restored by a build of
+ * nengo_mpi for the same platform and precision. */
+template<typename T>
+void write_state(ostream& out, const T& value){
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void read_state(istream& in, T& value){
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+
+    if(!in){
+        throw runtime_error("Checkpoint state ended unexpectedly.");
+    }
+}
+
+inline void write_state(ostream& out, const string& s){
+    write_state(out, uint64_t(s.size()));
+    out.write(s.data(), s.size());
+}
+
+inline void read_state(istream& in, string& s){
+    uint64_t size;
+    read_state(in, size);
+
+    s.resize(size);
+    in.read(&s[0], size);
+
+    if(!in){
+        throw runtime_error("Checkpoint state ended unexpectedly.");
+    }
+}
+
+template<typename T>
+void write_state(ostream& out, const vector<T>& v){
+    write_state(out, uint64_t(v.size()));
+    out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template<typename T>
+void read_state(istream& in, vector<T>& v){
+    uint64_t size;
+    read_state(in, size);
+
+    v.resize(size);
+    in.read(reinterpret_cast<char*>(v.data()), size * sizeof(T));
+
+    if(!in){
+        throw runtime_error("Checkpoint state ended unexpectedly.");
+    }
+}
+
+// Circular buffers keep their capacity, which is set when the operator is built.
+template<typename T>
+void write_state(ostream& out, const boost::circular_buffer<T>& buffer){
+    write_state(out, uint64_t(buffer.size()));
+    for(const T& value: buffer){
+        write_state(out, value);
+    }
+}
+
+template<typename T>
+void read_state(istream& in, boost::circular_buffer<T>& buffer){
+    uint64_t size;
+    read_state(in, size);
+
+    if(size > buffer.capacity()){
+        throw runtime_error("Checkpoint state does not fit in a circular buffer.");
+    }
+
+    buffer.clear();
+    for(uint64_t i = 0; i < size; i++){
+        T value;
+        read_state(in, value);
+        buffer.push_back(value);
+    }
+}
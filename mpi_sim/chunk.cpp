@@ -3,438 +3,2747 @@
 // in bytes, for each process.
 #define MAX_RUNTIME_OUTPUT_SIZE 5000
 
-MpiSimulatorChunk::MpiSimulatorChunk(bool collect_timings)
-:dt(0.001), rank(0), n_processors(1), collect_timings(collect_timings){
+// in bytes; every base signal loaded from a file starts on a boundary of this size.
+#define SIGNAL_ALIGNMENT 64
 
+// DotIncs with constant matrices that have at most this fraction of nonzero
+// entries are replaced by SparseDotIncs.
+#define SPARSE_DOT_INC_DENSITY 0.25
+
+// Largest matrix (number of elements) that is stacked into a BatchedDotInc,
+// and how many operators past the first DotInc of a batch to look for others.
+#define MAX_BATCHED_DOT_INC_SIZE 4096
+#define DOT_INC_BATCH_WINDOW 64
+
+// How many operators past the first synapse of a group to look for others
+// with the same filter.
+#define SYNAPSE_BATCH_WINDOW 64
+
+// When components are rebalanced between simulations, the operators are timed
+// on one step in this many, to measure how much each component costs.
+#define REBALANCE_SAMPLE_EVERY 10
+
+static shared_ptr<dtype> allocate_aligned(unsigned size){
+    void* memory = NULL;
+
+    if(posix_memalign(&memory, SIGNAL_ALIGNMENT, max(size, 1u) * sizeof(dtype)) != 0){
+        throw bad_alloc();
+    }
+
+    return shared_ptr<dtype>(static_cast<dtype*>(memory), free);
+}
+
+// Elements in a block of SIGNAL_ALIGNMENT bytes
+const unsigned ALIGNMENT_STRIDE = SIGNAL_ALIGNMENT / sizeof(dtype);
+
+inline unsigned align_offset(unsigned offset){
+    return (offset + ALIGNMENT_STRIDE - 1) / ALIGNMENT_STRIDE * ALIGNMENT_STRIDE;
+}
+
+inline bool compare_op_spec_ptr(const OpSpec* left, const OpSpec* right){
+    return left->index < right->index;
 }
 
-MpiSimulatorChunk::MpiSimulatorChunk(int rank, int n_processors, bool collect_timings)
-:dt(0.001), rank(rank), n_processors(n_processors), collect_timings(collect_timings){
+MpiSimulatorChunk::MpiSimulatorChunk(SimulatorConfig config)
+:dt(0.001), rank(0), n_processors(1), comm(MPI_COMM_NULL),
+node_comm(MPI_COMM_NULL), shared_window(MPI_WIN_NULL), seed(0), steps_since_reset(0),
+n_trials(config.n_trials), current_trial(0), current_component(0), process_cost(0.0),
+signal_bytes(0), print_memory(config.report_memory), collect_timings(config.collect_timings), trace_file(config.trace_file),
+profile_file(config.profile_file),
+n_threads(config.n_threads), backend(config.backend), learning_every(config.learning_every),
+quiescence(config.quiescence), realtime(config.realtime), zero_copy(config.zero_copy),
+sparse_spikes(config.sparse_spikes), shared_memory(config.shared_memory),
+flush_every(config.flush_every), async_flush(config.async_flush),
+leader_load(config.leader_load), mapping_mode(config.mapping), rebalance(config.rebalance),
+checkpoint_every(config.checkpoint_every), checkpoint_file(config.checkpoint_file),
+log_options(config.log_options()){
+    init_backend();
+}
+
+MpiSimulatorChunk::MpiSimulatorChunk(int rank, int n_processors, SimulatorConfig config)
+:dt(0.001), rank(rank), n_processors(n_processors), comm(MPI_COMM_NULL),
+node_comm(MPI_COMM_NULL), shared_window(MPI_WIN_NULL), seed(0),
+steps_since_reset(0), n_trials(config.n_trials), current_trial(0), current_component(0),
+process_cost(0.0), signal_bytes(0), print_memory(config.report_memory), collect_timings(config.collect_timings),
+trace_file(config.trace_file), profile_file(config.profile_file), n_threads(config.n_threads), backend(config.backend),
+learning_every(config.learning_every), quiescence(config.quiescence), realtime(config.realtime),
+zero_copy(config.zero_copy),
+sparse_spikes(config.sparse_spikes), shared_memory(config.shared_memory),
+flush_every(config.flush_every), async_flush(config.async_flush),
+leader_load(config.leader_load), mapping_mode(config.mapping), rebalance(config.rebalance),
+checkpoint_every(config.checkpoint_every), checkpoint_file(config.checkpoint_file),
+log_options(config.log_options()){
     stringstream ss;
     ss << "Chunk " << rank;
     label = ss.str();
+
+    init_backend();
+}
+
+void MpiSimulatorChunk::init_backend(){
+    if(backend.compare("cuda") != 0){
+        return;
+    }
+
+#ifdef NENGO_MPI_CUDA
+    // Device operators share one stream, so they keep to the order of the schedule.
+    if(n_threads > 1){
+        throw runtime_error("The cuda backend runs the operators of each process on one thread.");
+    }
+
+    device = unique_ptr<DeviceContext>(new DeviceContext());
+    build_dbg("Simulating on " << device->to_string() << endl);
+#else
+    throw runtime_error("nengo_mpi was built without the cuda backend.");
+#endif
+}
+
+shared_ptr<dtype> MpiSimulatorChunk::allocate_signals(unsigned size){
+#ifdef NENGO_MPI_CUDA
+    // Managed memory is aligned to at least 256 bytes.
+    if(device){
+        return allocate_managed(size);
+    }
+#endif
+
+    return allocate_aligned(size);
+}
+
+void MpiSimulatorChunk::from_file(string filename, MPI_Comm comm){
+    this->filename = filename;
+
+    if(rank == 0){
+        cout << "Loading nengo network from file." << endl;
+    }
+
+    NetworkFile network_file(filename, comm, leader_load, mapping_mode, mapping);
+    load(network_file);
+}
+
+void MpiSimulatorChunk::from_network(shared_ptr<const PackedNetwork> network, MPI_Comm comm){
+    if(rebalance > 0.0){
+        this->network = network;
+    }
+
+    if(rank == 0){
+        cout << "Loading nengo network from memory." << endl;
+    }
+
+    NetworkFile network_file(network, comm, mapping_mode, mapping);
+    load(network_file);
+}
+
+void MpiSimulatorChunk::load(NetworkFile& network_file){
+    const NetworkHeader& header = network_file.get_header();
+    mapping = network_file.get_mapping();
+
+    if(rank == 0){
+        build_dbg(mapping.to_string());
+        cout << "Network has " << header.n_components << " components." << endl;
+    }
+
+    dt = header.dt;
+
+    // Build each component as soon as possible, to free the data read for it.
+    vector<NetworkComponent> components = network_file.read_components();
+
+    if(n_trials > 1){
+        for(auto& component: components){
+            find_trial_signals(component, trial_keys);
+        }
+    }
+
+    vector<int> component_indices = network_file.my_components();
+    for(unsigned i = 0; i < components.size(); i++){
+        current_component = component_indices[i];
+        add_component(components[i]);
+        components[i] = NetworkComponent();
+    }
+
+    // All processes need info about all active probes
+    // for purposes of writing results to the HDF5 file.
+    for(const string& probe_str: header.probe_info){
+        probe_info.push_back(ProbeSpec(probe_str));
+    }
+}
+
+void MpiSimulatorChunk::add_component(const NetworkComponent& component){
+    unsigned n_signals = component.signal_keys.size();
+
+    // All base signals of the component are stored in a single aligned arena,
+    // apart from those with a copy per trial, which have an arena of their own.
+    // Signals shared with a component added before are already stored.
+    vector<pair<key_type, unsigned>> signal_sizes, trial_signal_sizes;
+    for(unsigned i = 0; i < n_signals; i++){
+        key_type key = component.signal_keys[i];
+        unsigned size = component.signal_shapes[2*i] * component.signal_shapes[2*i + 1];
+
+        if(signal_map.count(key)){
+            continue;
+        }else if(trial_keys.count(key)){
+            trial_signal_sizes.push_back(make_pair(key, size));
+        }else{
+            signal_sizes.push_back(make_pair(key, size));
+        }
+    }
+
+    map<key_type, unsigned> signal_offsets;
+    unsigned arena_size = layout_base_signals(component.op_specs, signal_sizes, signal_offsets);
+    shared_ptr<dtype> arena = allocate_signals(arena_size);
+
+    // The trial arena holds the first trial's copies, then the second's, and so on.
+    map<key_type, unsigned> trial_signal_offsets;
+    unsigned trial_size = align_offset(layout_base_signals(
+        component.op_specs, trial_signal_sizes, trial_signal_offsets));
+
+    shared_ptr<dtype> trial_arena;
+    if(!trial_keys.empty()){
+        trial_arena = allocate_signals(trial_size * n_trials);
+    }
+
+    signal_bytes += (size_t(arena_size) + size_t(trial_size) * n_trials) * sizeof(dtype);
+
+    size_t signal_offset = 0;
+
+    for(unsigned i = 0; i < n_signals; i++){
+        key_type key = component.signal_keys[i];
+        bool per_trial = trial_keys.count(key) > 0;
+
+        signal_components[key].insert(current_component);
+
+        unsigned size = component.signal_shapes[2*i] * component.signal_shapes[2*i + 1];
+        if(signal_offset + size > component.signals.size()){
+            throw runtime_error("Network file has too few values for the signals of a component.");
+        }
+
+        if(signal_map.count(key)){
+            // Only checked against the stored signal, through a view of the file's values.
+            Signal values(
+                component.signal_shapes[2*i], component.signal_shapes[2*i + 1],
+                shared_ptr<dtype>(shared_ptr<dtype>(),
+                                  const_cast<dtype*>(component.signals.data()) + signal_offset),
+                component.signal_labels[i]);
+
+            values.stride1 = component.signal_strides[2*i];
+            values.stride2 = component.signal_strides[2*i + 1];
+
+            store_base_signal(key, values);
+            signal_offset += size;
+            continue;
+        }
+
+        unsigned n_copies = per_trial ? n_trials : 1;
+        vector<Signal> copies;
+
+        for(unsigned trial = 0; trial < n_copies; trial++){
+            // Each signal gets its own pointer into the arena,
+            // so that it still looks like a separate base signal.
+            dtype* signal_data = per_trial ?
+                trial_arena.get() + trial * trial_size + trial_signal_offsets.at(key) :
+                arena.get() + signal_offsets.at(key);
+
+            Signal signal = Signal(
+                component.signal_shapes[2*i], component.signal_shapes[2*i + 1],
+                shared_ptr<dtype>(per_trial ? trial_arena : arena, signal_data),
+                component.signal_labels[i]);
+
+            memcpy(signal.raw_data, component.signals.data() + signal_offset,
+                   signal.size * sizeof(dtype));
+
+            signal.stride1 = component.signal_strides[2*i];
+            signal.stride2 = component.signal_strides[2*i + 1];
+
+            copies.push_back(signal);
+        }
+
+        signal_offset += size;
+
+        if(per_trial){
+            trial_signals[key] = copies;
+        }
+
+        store_base_signal(key, copies.front());
+    }
+
+    // The copies of an operator are added one after another, so that
+    // they stay next to each other once the operators are sorted.
+    for(auto& op_spec: component.op_specs){
+        op_components[op_spec.index] = current_component;
+
+        for(current_trial = 0; current_trial < n_trials; current_trial++){
+            add_op(op_spec);
+        }
+
+        current_trial = 0;
+    }
+
+    for(auto& probe_str: component.probes){
+        add_probe(ProbeSpec(probe_str));
+    }
+}
+
+void MpiSimulatorChunk::find_trial_signals(
+        const NetworkComponent& component, set<key_type>& keys){
+
+    MpiSimulatorChunk scratch(rank, n_processors, SimulatorConfig());
+    scratch.mapping = mapping;
+    scratch.add_component(component);
+
+    set<const dtype*> written;
+    for(Operator* op: scratch.operator_list){
+        // Every trial has the same step and time.
+        if(op == (Operator*) scratch.time_update.get()){
+            continue;
+        }
+
+        for(const Signal& signal: op->get_writes()){
+            written.insert(signal.data.get());
+        }
+    }
+
+    for(const MPIOpRecord& recv: scratch.recv_records){
+        written.insert(recv.content.data.get());
+    }
+
+    for(auto& kv: scratch.signal_map){
+        if(written.count(kv.second.data.get())){
+            keys.insert(kv.first);
+        }
+    }
+}
+
+unsigned MpiSimulatorChunk::layout_base_signals(
+        const vector<OpSpec>& op_specs, const vector<pair<key_type, unsigned>>& signal_sizes,
+        map<key_type, unsigned>& offsets){
+
+    map<key_type, unsigned> sizes(signal_sizes.begin(), signal_sizes.end());
+
+    // Transferred signals must be packed without padding, so they come first.
+    unsigned total_size = zero_copy ? layout_mpi_signals(op_specs, sizes, offsets) : 0;
+
+    auto place = [&](key_type key){
+        auto size = sizes.find(key);
+
+        if(size != sizes.end() && !offsets.count(key)){
+            total_size = align_offset(total_size);
+            offsets[key] = total_size;
+            total_size += size->second;
+        }
+    };
+
+    vector<const OpSpec*> sorted_specs;
+    for(auto& op_spec: op_specs){
+        sorted_specs.push_back(&op_spec);
+    }
+
+    stable_sort(sorted_specs.begin(), sorted_specs.end(), compare_op_spec_ptr);
+
+    vector<key_type> keys;
+    for(const OpSpec* op_spec: sorted_specs){
+        keys.clear();
+        op_spec->signal_keys(keys);
+
+        for(key_type key: keys){
+            place(key);
+        }
+    }
+
+    // Signals that no operator uses (e.g. ones that are only probed)
+    for(auto& kv: signal_sizes){
+        place(kv.first);
+    }
+
+    return total_size;
+}
+
+unsigned MpiSimulatorChunk::layout_mpi_signals(
+        const vector<OpSpec>& op_specs, const map<key_type, unsigned>& signal_sizes,
+        map<key_type, unsigned>& offsets){
+
+    // Keyed by whether the transfer is a send, and by the other process.
+    map<pair<bool, int>, vector<pair<float, key_type>>> transfers;
+
+    for(auto& op_spec: op_specs){
+        bool is_send = op_spec.type == OP_MPI_SEND;
+        bool is_recv = op_spec.type == OP_MPI_RECV;
+
+        if(n_processors == 1 || !(is_send || is_recv)){
+            continue;
+        }
+
+        int other = mapping.process_of(op_spec.integer(0));
+        bool is_update = op_spec.n_arguments() > 3 && bool(op_spec.integer(3));
+
+        if(other == rank || (is_recv && is_update)){
+            continue;
+        }
+
+        key_type signal_key = op_spec.key(2);
+        transfers[make_pair(is_send, other)].push_back(make_pair(op_spec.index, signal_key));
+    }
+
+    unsigned total_size = 0;
+    for(auto& kv: transfers){
+        stable_sort(kv.second.begin(), kv.second.end(), compare_first_lt<float, key_type>);
+
+        for(auto& transfer: kv.second){
+            auto size = signal_sizes.find(transfer.second);
+
+            // A signal sent to several processes can only be adjacent to the
+            // signals that it is sent with in one of the messages.
+            if(size == signal_sizes.end() || offsets.count(transfer.second)){
+                continue;
+            }
+
+            offsets[transfer.second] = total_size;
+            total_size += size->second;
+        }
+    }
+
+    return total_size;
+}
+
+void MpiSimulatorChunk::finalize_build(){
+    finalize_build(MPI_COMM_NULL);
+}
+
+void MpiSimulatorChunk::finalize_build(MPI_Comm comm){
+    this->comm = comm;
+
+    if(n_processors != 1){
+        sim_log = unique_ptr<SimulationLog>(
+            new ParallelSimulationLog(mapping, rank, probe_info, dt, comm, log_options));
+    }else{
+        sim_log = unique_ptr<SimulationLog>(new SimulationLog(probe_info, dt, log_options));
+    }
+
+    save_init_values();
+
+    find_spike_signals(comm);
+
+    if(comm != MPI_COMM_NULL){
+        build_mpi_groups(comm);
+    }
+
+    // Important: ensures ops are executed in correct order
+    operator_list.sort(compare_op_ptr);
+
+    optimize_dot_incs();
+
+    merge_sliced_copies();
+
+    merge_synapses();
+
+    optimize_learning_rules();
+
+    if(quiescence > 0){
+        gate_quiescent_ops();
+    }
+
+    schedule_mpi_ops();
+
+    if(comm != MPI_COMM_NULL && shared_memory){
+        build_shared_transport();
+    }
+
+    if(zero_copy){
+        place_mpi_waits();
+    }
+
+#ifdef NENGO_MPI_CUDA
+    if(device){
+        place_device_syncs();
+    }
+#endif
+
+    for(auto& send: mpi_sends){
+        send->set_communicator(comm);
+        send->init_request();
+    }
+
+    for(auto& recv: mpi_recvs){
+        recv->set_communicator(comm);
+        recv->init_request();
+    }
+
+    build_schedule();
+
+    if(n_threads > 1){
+        build_parallel_schedule();
+        thread_pool = unique_ptr<ThreadPool>(new ThreadPool(n_threads));
+    }
+
+    // The operators that replaced others write to the same signals.
+    for(key_type key: written_signal_keys()){
+        if(!signal_init_value.count(key)){
+            stringstream msg;
+            msg << "While finalizing the build on rank " << rank << ", found an operator "
+                << "writing to signal " << key << ", which has no initial value." << endl;
+            throw logic_error(msg.str());
+        }
+    }
+
+    if(print_memory){
+        report_memory();
+    }
 }
 
-void MpiSimulatorChunk::from_file(string filename, hid_t file_plist, hid_t read_plist){
-    herr_t err;
-    hid_t dspace, attr;
+void MpiSimulatorChunk::build_schedule(){
+    op_schedule.assign(operator_list.begin(), operator_list.end());
+    batch_schedule.clear();
+
+    for(unsigned i = 0; i < op_schedule.size(); i++){
+        BatchRunner runner = op_schedule[i]->batch_runner();
+
+        if(!batch_schedule.empty() && batch_schedule.back().runner == runner){
+            batch_schedule.back().n_ops++;
+        }else{
+            batch_schedule.push_back({runner, i, 1});
+        }
+    }
+
+    build_dbg(
+        "Built schedule with " << op_schedule.size() << " operators in "
+        << batch_schedule.size() << " batches." << endl);
+}
+
+inline bool compare_record_indices(const MPIOpRecord& left, const MPIOpRecord& right){
+    return left.index < right.index;
+}
+
+void MpiSimulatorChunk::build_mpi_groups(MPI_Comm comm){
+    stable_sort(send_records.begin(), send_records.end(), compare_record_indices);
+    stable_sort(recv_records.begin(), recv_records.end(), compare_record_indices);
+
+    // Group the sends. A group stays open for new members until the next receive.
+    vector<vector<const MPIOpRecord*>> send_groups;
+    map<pair<int, bool>, unsigned> open_groups;
+
+    unsigned next_recv = 0;
+    for(const MPIOpRecord& send: send_records){
+        while(next_recv < recv_records.size() && recv_records[next_recv].index < send.index){
+            open_groups.clear();
+            next_recv++;
+        }
+
+        if(!send.can_merge){
+            send_groups.push_back({&send});
+            continue;
+        }
+
+        auto key = make_pair(send.other, send.is_update);
+        auto open = open_groups.find(key);
+
+        if(open == open_groups.end()){
+            open_groups[key] = send_groups.size();
+            send_groups.push_back({&send});
+        }else{
+            send_groups[open->second].push_back(&send);
+        }
+    }
+
+    // Create the sends, and for each destination, a description of its groups:
+    // the number of groups, followed by the size of each group and, for each
+    // of its members, the tag and whether the member is sent as spikes.
+    map<int, vector<int>> group_info;
+
+    for(auto& group: send_groups){
+        vector<Signal> contents;
+        vector<bool> spikes;
+        vector<int>& info = group_info[group.front()->other];
+
+        if(info.empty()){
+            info.push_back(0);
+        }
+
+        info[0]++;
+        info.push_back(group.size());
+
+        for(const MPIOpRecord* send: group){
+            contents.push_back(send->content);
+            contents.insert(
+                contents.end(), send->trial_contents.begin(), send->trial_contents.end());
+
+            bool is_spikes = sparse_spikes && is_spike_signal(send->content);
+            for(const Signal& trial_content: send->trial_contents){
+                is_spikes = is_spikes && is_spike_signal(trial_content);
+            }
+
+            spikes.resize(contents.size(), is_spikes);
+
+            info.push_back(send->tag);
+            info.push_back(int(is_spikes));
+        }
+
+        auto mpi_send = unique_ptr<MPISend>(
+            new MPISend(group.front()->other, group.front()->tag, contents, zero_copy, spikes));
+        mpi_send->set_index(group.back()->index);
+        operator_list.push_back((Operator *) mpi_send.get());
+        mpi_sends.push_back(move(mpi_send));
+    }
+
+    vector<MPI_Request> requests;
+    for(auto& kv: group_info){
+        requests.push_back(MPI_REQUEST_NULL);
+        MPI_Isend(
+            kv.second.data(), kv.second.size(), MPI_INT, kv.first,
+            mpi_group_tag, comm, &requests.back());
+    }
+
+    // Receive the group descriptions from every process we receive from.
+    map<pair<int, int>, const MPIOpRecord*> recvs_by_tag;
+    for(const MPIOpRecord& recv: recv_records){
+        recvs_by_tag[make_pair(recv.other, recv.tag)] = &recv;
+    }
+
+    set<int> sources;
+    for(const MPIOpRecord& recv: recv_records){
+        sources.insert(recv.other);
+    }
+
+    unsigned n_grouped = 0;
+    for(int src: sources){
+        MPI_Status status;
+        MPI_Probe(src, mpi_group_tag, comm, &status);
+
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+
+        vector<int> info(count);
+        MPI_Recv(info.data(), count, MPI_INT, src, mpi_group_tag, comm, &status);
+
+        unsigned pos = 1;
+        for(int g = 0; g < info[0]; g++){
+            int group_size = info[pos++];
+
+            vector<Signal> contents;
+            vector<bool> spikes;
+            const MPIOpRecord* first = NULL;
+            int group_tag = info[pos];
+
+            for(int m = 0; m < group_size; m++){
+                int tag = info[pos++];
+                bool is_spikes = bool(info[pos++]);
+
+                auto found = recvs_by_tag.find(make_pair(src, tag));
+                if(found == recvs_by_tag.end()){
+                    stringstream msg;
+                    msg << "Chunk " << rank << " was told that process " << src
+                        << " will send it a signal with tag " << tag
+                        << ", but has no matching MpiRecv.";
+                    throw logic_error(msg.str());
+                }
+
+                const MPIOpRecord* recv = found->second;
+
+                if(first != NULL && recv->is_update != first->is_update){
+                    stringstream msg;
+                    msg << "Chunk " << rank << " got a group of signals from process "
+                        << src << " with mismatching values of is_update.";
+                    throw logic_error(msg.str());
+                }
+
+                if(first == NULL || recv->index < first->index){
+                    first = recv;
+                }
+
+                contents.push_back(recv->content);
+                contents.insert(
+                    contents.end(), recv->trial_contents.begin(), recv->trial_contents.end());
+                spikes.resize(contents.size(), is_spikes);
+                n_grouped++;
+            }
+
+            auto mpi_recv = unique_ptr<MPIRecv>(
+                new MPIRecv(src, group_tag, contents, first->is_update, zero_copy, spikes));
+            mpi_recv->set_index(first->index);
+            operator_list.push_back((Operator *) mpi_recv.get());
+            mpi_recvs.push_back(move(mpi_recv));
+        }
+    }
+
+    if(n_grouped != recv_records.size()){
+        stringstream msg;
+        msg << "Chunk " << rank << " has " << recv_records.size()
+            << " MpiRecvs, but only " << n_grouped
+            << " of them are matched by sends from other processes.";
+        throw logic_error(msg.str());
+    }
+
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    build_dbg(
+        "Grouped " << send_records.size() << " sends into " << mpi_sends.size()
+        << " messages, and " << recv_records.size() << " receives into "
+        << mpi_recvs.size() << " messages." << endl);
+}
+
+static bool any_base_in(const vector<Signal>& signals, const set<const dtype*>& bases){
+    for(const Signal& signal: signals){
+        if(bases.count(signal.data.get())){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MpiSimulatorChunk::optimize_dot_incs(){
+    // Base arrays written by some operator. Matrices stored in them may change.
+    set<const dtype*> written;
+    for(Operator* op: operator_list){
+        for(const Signal& signal: op->get_writes()){
+            written.insert(signal.data.get());
+        }
+    }
+
+    auto constant_dot_inc = [&](Operator* op) -> DotInc*{
+        DotInc* dot_inc = dynamic_cast<DotInc*>(op);
+
+        if(dot_inc && dot_inc->is_matrix_vector() &&
+                !written.count(dot_inc->get_A().data.get())){
+            return dot_inc;
+        }
+
+        return NULL;
+    };
+
+    auto is_sparse = [](const Signal& A){
+        unsigned n_nonzero = 0;
+        for(unsigned i = 0; i < A.shape1; i++){
+            for(unsigned j = 0; j < A.shape2; j++){
+                n_nonzero += A(i, j) != 0.0;
+            }
+        }
+
+        return n_nonzero <= SPARSE_DOT_INC_DENSITY * A.size;
+    };
+
+    set<Operator*> replaced;
+    unsigned n_sparse = 0, n_batches = 0, n_batched = 0, n_small = 0, n_trial_dot_incs = 0;
+
+    // The copies of a dense DotInc in every trial, which are next to each
+    // other and share A, are computed together.
+    for(auto it = operator_list.begin(); it != operator_list.end() && n_trials > 1; it++){
+        DotInc* first = constant_dot_inc(*it);
+        if(!first || trial_of(first) != 0 || is_sparse(first->get_A())){
+            continue;
+        }
+
+        vector<Signal> X, Y;
+        auto member = it;
+        for(unsigned trial = 0; trial < n_trials && member != operator_list.end(); trial++){
+            DotInc* dot_inc = constant_dot_inc(*member);
+
+            if(!dot_inc || trial_of(dot_inc) != trial ||
+                    dot_inc->get_A().raw_data != first->get_A().raw_data){
+                break;
+            }
+
+            X.push_back(dot_inc->get_X());
+            Y.push_back(dot_inc->get_Y());
+            member++;
+        }
+
+        unsigned X_stride, Y_stride;
+        bool fixed_strides = X.size() == n_trials &&
+            X.front().data.get() != Y.front().data.get() &&
+            TrialDotInc::fixed_trial_stride(X, X_stride) &&
+            TrialDotInc::fixed_trial_stride(Y, Y_stride);
+
+        if(!fixed_strides){
+            continue;
+        }
+
+        auto trial_dot_inc = unique_ptr<Operator>(new TrialDotInc(first->get_A(), X, Y));
+        trial_dot_inc->set_index(first->get_index());
+
+        for(auto copy = it; copy != member; copy++){
+            replaced.insert(*copy);
+        }
+
+        *it = trial_dot_inc.get();
+        operator_list.erase(next(it), member);
+
+        operator_store.push_back(move(trial_dot_inc));
+        n_trial_dot_incs++;
+    }
+
+    // Sparse matrices
+    for(auto it = operator_list.begin(); it != operator_list.end(); it++){
+        DotInc* dot_inc = constant_dot_inc(*it);
+        if(!dot_inc){
+            continue;
+        }
+
+        const Signal& A = dot_inc->get_A();
+
+        if(is_sparse(A)){
+            auto sparse = unique_ptr<Operator>(
+                new SparseDotInc(A, dot_inc->get_X(), dot_inc->get_Y()));
+            sparse->set_index(dot_inc->get_index());
+
+            replaced.insert(*it);
+            *it = sparse.get();
+            operator_store.push_back(move(sparse));
+            n_sparse++;
+        }
+    }
+
+    // Small dense matrices applied to the same X. A later DotInc can join
+    // the batch of an earlier one if it can be moved up to the earlier one's
+    // position: nothing in between writes X or touches the later one's Y.
+    auto batchable = [&](Operator* op) -> DotInc*{
+        DotInc* dot_inc = constant_dot_inc(op);
+        bool small = dot_inc && dot_inc->get_A().size <= MAX_BATCHED_DOT_INC_SIZE;
+        bool distinct = dot_inc &&
+            dot_inc->get_X().data.get() != dot_inc->get_Y().data.get();
+        return small && distinct ? dot_inc : NULL;
+    };
+
+    for(auto it = operator_list.begin(); it != operator_list.end(); it++){
+        DotInc* first = batchable(*it);
+        if(!first){
+            continue;
+        }
+
+        const Signal& X = first->get_X();
+        vector<list<Operator*>::iterator> members = {it};
+
+        set<const dtype*> touched, overwritten;
+
+        auto other = next(it);
+        for(unsigned i = 0; i < DOT_INC_BATCH_WINDOW && other != operator_list.end(); i++, other++){
+            DotInc* dot_inc = batchable(*other);
+
+            bool same_X = dot_inc &&
+                dot_inc->get_X().raw_data == X.raw_data &&
+                dot_inc->get_X().shape1 == X.shape1 &&
+                dot_inc->get_X().stride1 == X.stride1;
+
+            if(same_X && !touched.count(dot_inc->get_Y().data.get())){
+                members.push_back(other);
+                continue;
+            }
+
+            if(any_base_in((*other)->get_writes(), {X.data.get()})){
+                break;
+            }
+
+            for(const Signal& signal: (*other)->get_reads()){
+                touched.insert(signal.data.get());
+            }
+
+            for(const Signal& signal: (*other)->get_writes()){
+                touched.insert(signal.data.get());
+            }
+        }
+
+        if(members.size() < 2){
+            continue;
+        }
+
+        vector<Signal> A, Y;
+        vector<pair<float, double>> shares;
+        for(auto member: members){
+            DotInc* dot_inc = static_cast<DotInc*>(*member);
+            A.push_back(dot_inc->get_A());
+            Y.push_back(dot_inc->get_Y());
+            shares.push_back({dot_inc->get_index(), double(dot_inc->get_A().size)});
+            replaced.insert(*member);
+        }
+
+        auto batched = unique_ptr<Operator>(new BatchedDotInc(A, X, Y));
+        batched->set_index(first->get_index());
+        merged_shares[batched.get()] = shares;
+
+        *it = batched.get();
+        for(unsigned i = 1; i < members.size(); i++){
+            operator_list.erase(members[i]);
+        }
+
+        operator_store.push_back(move(batched));
+        n_batches++;
+        n_batched += members.size();
+    }
+
+    // Whatever is left with a small dimension gets a kernel unrolled for it.
+    // These don't need A to be constant.
+    for(auto it = operator_list.begin(); it != operator_list.end(); it++){
+        DotInc* dot_inc = dynamic_cast<DotInc*>(*it);
+        if(!dot_inc){
+            continue;
+        }
+
+        auto small = make_small_dot_inc(*dot_inc);
+        if(!small){
+            continue;
+        }
+
+        small->set_index(dot_inc->get_index());
+
+        replaced.insert(*it);
+        *it = small.get();
+        operator_store.push_back(move(small));
+        n_small++;
+    }
+
+    for(Operator* op: replaced){
+        op_trials.erase(op);
+    }
+
+    operator_store.remove_if(
+        [&](const unique_ptr<Operator>& op){ return replaced.count(op.get()) > 0; });
+
+    build_dbg(
+        "Replaced " << n_sparse << " DotIncs with SparseDotIncs, "
+        << n_batched << " DotIncs with " << n_batches << " BatchedDotIncs, "
+        << n_small << " DotIncs with SmallDotIncs, and "
+        << "the DotIncs of every trial with " << n_trial_dot_incs << " TrialDotIncs." << endl);
+}
+
+void MpiSimulatorChunk::merge_sliced_copies(){
+    unsigned n_merged = 0;
+    set<Operator*> replaced;
+
+    for(auto it = operator_list.begin(); it != operator_list.end(); it++){
+        SlicedCopy* first = dynamic_cast<SlicedCopy*>(*it);
+        if(!first){
+            continue;
+        }
+
+        auto other = next(it);
+        while(other != operator_list.end()){
+            SlicedCopy* copy = dynamic_cast<SlicedCopy*>(*other);
+            if(!copy || trial_of(copy) != trial_of(first)){
+                break;
+            }
+
+            unsigned n_first = first->get_n_assignments();
+            if(!first->merge(*copy)){
+                break;
+            }
+
+            auto& shares = merged_shares[first];
+            if(shares.empty()){
+                shares.push_back({first->get_index(), double(n_first)});
+            }
+            shares.push_back({copy->get_index(), double(copy->get_n_assignments())});
+
+            replaced.insert(copy);
+            other = operator_list.erase(other);
+            n_merged++;
+        }
+    }
+
+    for(Operator* op: replaced){
+        op_trials.erase(op);
+    }
+
+    operator_store.remove_if(
+        [&](const unique_ptr<Operator>& op){ return replaced.count(op.get()) > 0; });
+
+    build_dbg("Merged " << n_merged << " SlicedCopies into the copies before them." << endl);
+}
+
+/* Merge synapses of type T into the first earlier synapse with the same
+ * filter that they can be moved up to, and return how many were merged.
+ * The group is updated in lockstep, reading all inputs before writing any
+ * output, so a synapse can only join if nothing between it and the first
+ * writes what it reads or touches its output, and its input is not the
+ * output of a synapse already in the group. The filter parameters of both
+ * must not be written by any operator, since they are compared by value. */
+template<class T>
+static unsigned merge_synapses_of_type(
+        list<Operator*>& operator_list, const set<const dtype*>& written,
+        set<Operator*>& replaced,
+        map<const Operator*, vector<pair<float, double>>>& merged_shares){
+
+    auto constant_filter = [&](T* synapse){
+        for(const Signal& signal: synapse->get_reads()){
+            bool is_input = false;
+            for(const Signal& input: synapse->get_inputs()){
+                is_input |= input.data.get() == signal.data.get();
+            }
+
+            if(!is_input && written.count(signal.data.get())){
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    unsigned n_merged = 0;
+
+    for(auto it = operator_list.begin(); it != operator_list.end(); it++){
+        T* first = dynamic_cast<T*>(*it);
+        if(!first || !constant_filter(first)){
+            continue;
+        }
+
+        set<const dtype*> touched, overwritten, outputs;
+        for(const Signal& signal: first->get_writes()){
+            outputs.insert(signal.data.get());
+        }
+
+        auto other = next(it);
+        for(unsigned i = 0; i < SYNAPSE_BATCH_WINDOW && other != operator_list.end(); i++){
+            T* synapse = dynamic_cast<T*>(*other);
+
+            bool can_join = synapse && constant_filter(synapse) &&
+                first->can_merge(*synapse) &&
+                !any_base_in(synapse->get_reads(), overwritten) &&
+                !any_base_in(synapse->get_reads(), outputs) &&
+                !any_base_in(synapse->get_writes(), touched);
+
+            if(can_join){
+                auto& shares = merged_shares[first];
+                if(shares.empty()){
+                    shares.push_back({first->get_index(), double(first->get_n_elements())});
+                }
+                shares.push_back({synapse->get_index(), double(synapse->get_n_elements())});
+
+                first->merge(*synapse);
+
+                for(const Signal& signal: synapse->get_writes()){
+                    outputs.insert(signal.data.get());
+                }
+
+                replaced.insert(synapse);
+                other = operator_list.erase(other);
+                n_merged++;
+                continue;
+            }
+
+            for(const Signal& signal: (*other)->get_reads()){
+                touched.insert(signal.data.get());
+            }
+
+            for(const Signal& signal: (*other)->get_writes()){
+                touched.insert(signal.data.get());
+                overwritten.insert(signal.data.get());
+            }
+
+            other++;
+        }
+    }
+
+    return n_merged;
+}
+
+void MpiSimulatorChunk::merge_synapses(){
+    set<const dtype*> written;
+    for(Operator* op: operator_list){
+        for(const Signal& signal: op->get_writes()){
+            written.insert(signal.data.get());
+        }
+    }
+
+    set<Operator*> replaced;
+
+    unsigned n_simple = merge_synapses_of_type<SimpleSynapse>(
+        operator_list, written, replaced, merged_shares);
+    unsigned n_synapse = merge_synapses_of_type<Synapse>(
+        operator_list, written, replaced, merged_shares);
+    unsigned n_triangle = merge_synapses_of_type<TriangleSynapse>(
+        operator_list, written, replaced, merged_shares);
+
+    for(Operator* op: replaced){
+        op_trials.erase(op);
+    }
+
+    operator_store.remove_if(
+        [&](const unique_ptr<Operator>& op){ return replaced.count(op.get()) > 0; });
+
+    build_dbg(
+        "Merged " << n_simple << " SimpleSynapses, " << n_synapse << " Synapses and "
+        << n_triangle << " TriangleSynapses into earlier ones with the same filter." << endl);
+}
+
+// Whether a and b are the same view of the same memory.
+static bool same_view(const Signal& a, const Signal& b){
+    return a.raw_data == b.raw_data && a.shape1 == b.shape1 && a.shape2 == b.shape2 &&
+        a.stride1 == b.stride1 && a.stride2 == b.stride2;
+}
+
+// Whether op adds a single value times delta to some target, and if so, the target and value.
+static bool adds_delta(const Operator* op, const Signal& delta, Signal& target, Signal& scale){
+    const ElementwiseInc* elementwise = dynamic_cast<const ElementwiseInc*>(op);
+    const DotInc* dot_inc = dynamic_cast<const DotInc*>(op);
+
+    if(elementwise){
+        target = elementwise->get_Y();
+        scale = elementwise->get_A();
+        return same_view(elementwise->get_X(), delta) && scale.size == 1 &&
+            target.data.get() != delta.data.get();
+    }
+
+    if(dot_inc && dot_inc->is_scalar()){
+        target = dot_inc->get_Y();
+        scale = dot_inc->get_A();
+        return same_view(dot_inc->get_X(), delta) && scale.size == 1 &&
+            target.data.get() != delta.data.get();
+    }
+
+    return false;
+}
+
+void MpiSimulatorChunk::optimize_learning_rules(){
+    unsigned n_rules = 0, n_fused = 0;
+    set<Operator*> replaced, fused;
+
+    for(auto it = operator_list.begin(); it != operator_list.end();){
+        LearningRule* rule = dynamic_cast<LearningRule*>(*it);
+        if(!rule || fused.count(rule)){
+            it++;
+            continue;
+        }
+
+        n_rules++;
+        if(learning_every > 1 && time_update){
+            rule->set_interval(learning_every, time_update->get_step());
+        }
+
+        // The rule is moved down past the operators before the first one
+        // that reads delta, so none of them may write what the rule reads or
+        // touch delta.
+        set<const dtype*> rule_reads, delta_base = {rule->get_delta().data.get()};
+        for(const Signal& signal: rule->get_reads()){
+            rule_reads.insert(signal.data.get());
+        }
+
+        auto reader = next(it);
+        while(reader != operator_list.end() &&
+                !any_base_in((*reader)->get_reads(), delta_base) &&
+                !any_base_in((*reader)->get_writes(), rule_reads) &&
+                !any_base_in((*reader)->get_writes(), delta_base)){
+            reader++;
+        }
+
+        Signal target, scale;
+        if(reader == operator_list.end() ||
+                !adds_delta(*reader, rule->get_delta(), target, scale)){
+            it++;
+            continue;
+        }
+
+        rule->apply_to(target, scale);
+        fused.insert(rule);
+        replaced.insert(*reader);
+
+        *reader = rule;
+        it = operator_list.erase(it);
+        n_fused++;
+    }
+
+    for(Operator* op: replaced){
+        op_trials.erase(op);
+    }
+
+    operator_store.remove_if(
+        [&](const unique_ptr<Operator>& op){ return replaced.count(op.get()) > 0; });
+
+    build_dbg(
+        "Fused the updates of " << n_fused << " of " << n_rules << " learning rules "
+        << "into the rules, which update every " << learning_every << " steps." << endl);
+}
+
+void MpiSimulatorChunk::gate_quiescent_ops(){
+    unsigned n_gated = 0;
+
+    for(Operator* op: operator_list){
+        if(op->set_quiescence(quiescence)){
+            n_gated++;
+        }
+    }
+
+    build_dbg(
+        "Operators that skip their work while their inputs are within " << quiescence
+        << " of zero: " << n_gated << " of " << operator_list.size() << "." << endl);
+}
+
+// Whether op accesses any of the base signals of contents, either at all or only by writing.
+static bool accesses_contents(
+        const Operator* op, const vector<Signal>& contents, bool writes_only){
+
+    for(int write = writes_only; write < 2; write++){
+        for(const Signal& signal: write ? op->get_writes() : op->get_reads()){
+            for(const Signal& content: contents){
+                if(signal.data.get() == content.data.get()){
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+void MpiSimulatorChunk::schedule_mpi_ops(){
+    unsigned n_moved = 0;
+
+    // Receives first, so that a send of received data ends up after its receive.
+    for(auto& recv: mpi_recvs){
+        auto location = find(
+            operator_list.begin(), operator_list.end(), (Operator*) recv.get());
+
+        auto first_user = next(location);
+        while(first_user != operator_list.end() &&
+                !accesses_contents(*first_user, recv->get_contents(), false)){
+            first_user++;
+        }
+
+        if(first_user != next(location)){
+            if(first_user != operator_list.end()){
+                recv->set_index((*first_user)->get_index());
+            }
+
+            operator_list.splice(first_user, operator_list, location);
+            n_moved++;
+        }
+    }
+
+    for(auto& send: mpi_sends){
+        auto location = find(
+            operator_list.begin(), operator_list.end(), (Operator*) send.get());
+
+        auto last_writer = location;
+        while(last_writer != operator_list.begin()){
+            if(accesses_contents(*prev(last_writer), send->get_contents(), true)){
+                break;
+            }
+
+            last_writer--;
+        }
+
+        // last_writer now points just past the last op that writes the contents.
+        if(last_writer != location){
+            if(last_writer != operator_list.begin()){
+                send->set_index((*prev(last_writer))->get_index());
+            }
+
+            operator_list.splice(last_writer, operator_list, location);
+            n_moved++;
+        }
+    }
+
+    build_dbg(
+        "Moved " << n_moved << " of " << mpi_sends.size() + mpi_recvs.size()
+        << " MPI operators." << endl);
+}
+
+void MpiSimulatorChunk::build_shared_transport(){
+#ifdef NENGO_MPI_SHARED_MEMORY
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+
+    int node_size;
+    MPI_Comm_size(node_comm, &node_size);
+
+    if(node_size == 1){
+        MPI_Comm_free(&node_comm);
+        return;
+    }
+
+    // The rank within the node of each process on it.
+    vector<int> ranks(node_size);
+    MPI_Allgather(&rank, 1, MPI_INT, ranks.data(), 1, MPI_INT, node_comm);
+
+    map<int, int> node_ranks;
+    for(int i = 0; i < node_size; i++){
+        node_ranks[ranks[i]] = i;
+    }
+
+    // Each process holds the mailboxes of its own sends, so that they are
+    // written to memory that is local to the writer.
+    vector<MPISend*> local_sends;
+    vector<MPI_Aint> offsets;
+    MPI_Aint n_bytes = 0;
+
+    for(auto& send: mpi_sends){
+        if(node_ranks.count(send->get_dst())){
+            local_sends.push_back(send.get());
+            offsets.push_back(n_bytes);
+            n_bytes += SharedMailbox::bytes(send->get_size());
+        }
+    }
+
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, (char*) "alloc_shared_noncontig", (char*) "true");
+
+    char* base;
+    MPI_Win_allocate_shared(n_bytes, 1, info, node_comm, &base, &shared_window);
+    MPI_Info_free(&info);
+
+    // The mailboxes are only accessed through their atomics, but
+    // an access epoch is open while the window exists, as the
+    // memory model of MPI windows requires.
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_window);
+
+    for(unsigned i = 0; i < local_sends.size(); i++){
+        local_sends[i]->use_mailbox(new (base + offsets[i]) SharedMailbox());
+    }
+
+    MPI_Win_sync(shared_window);
+
+    // Tell each receiver where in our memory its mailbox is. The tag
+    // of the message is the tag of the transfer, which identifies it.
+    vector<MPI_Request> requests(local_sends.size());
+    for(unsigned i = 0; i < local_sends.size(); i++){
+        MPISend* send = local_sends[i];
+        MPI_Isend(
+            &offsets[i], 1, MPI_AINT, send->get_dst(), send->get_tag(), comm, &requests[i]);
+    }
+
+    unsigned n_local_recvs = 0;
+    for(auto& recv: mpi_recvs){
+        auto node_rank = node_ranks.find(recv->get_src());
+        if(node_rank == node_ranks.end()){
+            continue;
+        }
+
+        MPI_Aint offset;
+        MPI_Recv(
+            &offset, 1, MPI_AINT, recv->get_src(), recv->get_tag(), comm, MPI_STATUS_IGNORE);
+
+        MPI_Aint src_bytes;
+        int disp_unit;
+        char* src_base;
+        MPI_Win_shared_query(shared_window, node_rank->second, &src_bytes, &disp_unit, &src_base);
+
+        recv->use_mailbox(reinterpret_cast<SharedMailbox*>(src_base + offset));
+        n_local_recvs++;
+    }
+
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    MPI_Win_sync(shared_window);
+
+    build_dbg(
+        "Chunk " << rank << " sends " << local_sends.size() << " and receives "
+        << n_local_recvs << " messages through shared memory." << endl);
+#endif
+}
+
+void MpiSimulatorChunk::free_shared_transport(){
+    if(shared_window == MPI_WIN_NULL){
+        return;
+    }
+
+    MPI_Win_unlock_all(shared_window);
+    MPI_Win_free(&shared_window);
+    MPI_Comm_free(&node_comm);
+}
+
+void MpiSimulatorChunk::place_mpi_waits(){
+    unsigned n_in_place = 0;
+
+    for(auto& send: mpi_sends){
+        // Sends through a mailbox copy their contents when they run.
+        if(!send->is_in_place() || send->uses_mailbox()){
+            continue;
+        }
+
+        const vector<Signal>& contents = send->get_contents();
+        auto writes_contents = [&](const Operator* op){
+            return accesses_contents(op, contents, true);
+        };
+
+        auto send_location = find(
+            operator_list.begin(), operator_list.end(), (Operator*) send.get());
+
+        // If the contents are written after the send in the same step, we
+        // would have to wait for the message to be received within the step
+        // in which it was sent, which can deadlock. Those sends use a buffer.
+        if(find_if(next(send_location), operator_list.end(), writes_contents) !=
+                operator_list.end()){
+            send->set_in_place(false);
+            continue;
+        }
+
+        n_in_place++;
+
+        auto first_writer = find_if(operator_list.begin(), send_location, writes_contents);
+
+        if(first_writer != send_location){
+            auto wait = unique_ptr<MPIWait>(new MPIWait(send.get()));
+            wait->set_index((*first_writer)->get_index());
+            operator_list.insert(first_writer, (Operator *) wait.get());
+            mpi_waits.push_back(move(wait));
+        }
+    }
+
+    unsigned n_recvs_in_place = 0;
+    for(auto& recv: mpi_recvs){
+        n_recvs_in_place += recv->is_in_place();
+    }
+
+    build_dbg(
+        n_in_place << " of " << mpi_sends.size() << " MPISends and "
+        << n_recvs_in_place << " of " << mpi_recvs.size()
+        << " MPIRecvs transfer in place." << endl);
+}
+
+void MpiSimulatorChunk::place_device_syncs(){
+#ifdef NENGO_MPI_CUDA
+    auto on_device = [](const Operator* op){
+        return dynamic_cast<const DeviceDotInc*>(op) ||
+            dynamic_cast<const DeviceLIF*>(op) ||
+            dynamic_cast<const DeviceSimpleSynapse*>(op);
+    };
+
+    // Base signals used by device operators queued since the last DeviceSync.
+    set<const dtype*> pending;
+    unsigned n_syncs = 0, n_device_ops = 0;
+
+    auto place_sync = [&](list<Operator*>::iterator position){
+        auto sync = unique_ptr<Operator>(new DeviceSync(*device));
+        sync->set_index((*prev(position))->get_index());
+
+        operator_list.insert(position, sync.get());
+        operator_store.push_back(move(sync));
+        pending.clear();
+        n_syncs++;
+    };
+
+    for(auto it = operator_list.begin(); it != operator_list.end(); it++){
+        Operator* op = *it;
+
+        if(on_device(op)){
+            for(const Signal& signal: op->get_reads()){
+                pending.insert(signal.data.get());
+            }
+
+            for(const Signal& signal: op->get_writes()){
+                pending.insert(signal.data.get());
+            }
+
+            n_device_ops++;
+            continue;
+        }
+
+        if(pending.empty()){
+            continue;
+        }
+
+        bool declared = !op->get_reads().empty() || !op->get_writes().empty();
+
+        if(!declared || any_base_in(op->get_reads(), pending) ||
+                any_base_in(op->get_writes(), pending)){
+            place_sync(it);
+        }
+    }
+
+    if(!pending.empty()){
+        place_sync(operator_list.end());
+    }
+
+    build_dbg(
+        "Placed " << n_syncs << " DeviceSyncs among " << n_device_ops
+        << " device operators." << endl);
+#endif
+}
+
+// A region of memory accessed by an operator, along with the level the operator
+// was assigned to. lo and hi are the first and last elements that may be touched.
+struct SignalAccess{
+    const dtype* lo;
+    const dtype* hi;
+    bool write;
+    unsigned level;
+};
+
+static SignalAccess get_signal_access(const Signal& signal, bool write, unsigned level){
+    ptrdiff_t extent1 = ptrdiff_t(signal.shape1 - 1) * signal.stride1;
+    ptrdiff_t extent2 = ptrdiff_t(signal.shape2 - 1) * signal.stride2;
+
+    const dtype* lo = signal.raw_data + min(extent1, ptrdiff_t(0)) + min(extent2, ptrdiff_t(0));
+    const dtype* hi = signal.raw_data + max(extent1, ptrdiff_t(0)) + max(extent2, ptrdiff_t(0));
+
+    return {lo, hi, write, level};
+}
+
+void MpiSimulatorChunk::build_parallel_schedule(){
+    // Accesses made so far, keyed by the base array being accessed
+    map<const dtype*, vector<SignalAccess>> accesses;
+
+    vector<unsigned> op_levels(op_schedule.size());
+    unsigned n_levels = 0;
+    int last_serial_level = -1;
+
+    for(unsigned i = 0; i < op_schedule.size(); i++){
+        Operator* op = op_schedule[i];
+        unsigned level = op->thread_safe() ? 0 : unsigned(last_serial_level + 1);
+
+        for(int write = 0; write < 2; write++){
+            for(const Signal& signal: write ? op->get_writes() : op->get_reads()){
+                if(signal.size == 0){
+                    continue;
+                }
+
+                SignalAccess access = get_signal_access(signal, write, 0);
+
+                for(const SignalAccess& previous: accesses[signal.data.get()]){
+                    bool overlap = access.lo <= previous.hi && previous.lo <= access.hi;
+
+                    if(overlap && (write || previous.write)){
+                        level = max(level, previous.level + 1);
+                    }
+                }
+            }
+        }
+
+        for(int write = 0; write < 2; write++){
+            for(const Signal& signal: write ? op->get_writes() : op->get_reads()){
+                if(signal.size != 0){
+                    accesses[signal.data.get()].push_back(
+                        get_signal_access(signal, write, level));
+                }
+            }
+        }
+
+        if(!op->thread_safe()){
+            last_serial_level = level;
+        }
+
+        op_levels[i] = level;
+        n_levels = max(n_levels, level + 1);
+    }
+
+    level_schedule.assign(n_levels, OpLevel());
+    for(unsigned i = 0; i < op_schedule.size(); i++){
+        Operator* op = op_schedule[i];
+        OpLevel& level = level_schedule[op_levels[i]];
+
+        if(op->thread_safe()){
+            level.parallel_ops.push_back(op);
+        }else{
+            level.serial_ops.push_back(op);
+        }
+    }
+
+    level_counters = unique_ptr<atomic<unsigned>[]>(new atomic<unsigned>[n_levels]);
+
+    build_dbg(
+        "Built parallel schedule with " << n_levels << " levels for "
+        << n_threads << " threads." << endl);
+}
+
+void MpiSimulatorChunk::find_spike_signals(MPI_Comm comm){
+    spike_regions.clear();
+
+    // The memory each spiking operator writes its spikes to, keyed by base array.
+    map<const dtype*, vector<SignalAccess>> outputs;
+    for(Operator* op: operator_list){
+        const Signal* output = op->spike_output();
+
+        if(output != NULL && output->is_contiguous && output->size > 0){
+            outputs[output->data.get()].push_back(get_signal_access(*output, true, 0));
+        }
+    }
+
+    // Anything else written to the same memory may not be a spike.
+    // Such regions are marked by clearing their ``write'' flag.
+    auto check_write = [&](const Signal& signal){
+        auto found = outputs.find(signal.data.get());
+        if(found == outputs.end() || signal.size == 0){
+            return;
+        }
+
+        SignalAccess access = get_signal_access(signal, true, 0);
+        for(SignalAccess& output: found->second){
+            if(access.lo <= output.hi && output.lo <= access.hi){
+                output.write = false;
+            }
+        }
+    };
+
+    for(Operator* op: operator_list){
+        const Signal* output = op->spike_output();
+
+        for(const Signal& signal: op->get_writes()){
+            bool is_output = output != NULL &&
+                signal.raw_data == output->raw_data && signal.size == output->size;
+
+            if(!is_output){
+                check_write(signal);
+            }
+        }
+    }
+
+    for(const MPIOpRecord& recv: recv_records){
+        check_write(recv.content);
+        for(const Signal& trial_content: recv.trial_contents){
+            check_write(trial_content);
+        }
+    }
+
+    for(auto& kv: outputs){
+        for(const SignalAccess& output: kv.second){
+            if(output.write){
+                spike_regions.push_back(make_pair(output.lo, output.hi));
+            }
+        }
+    }
+
+    // Every process creates the datasets of every probe, so they
+    // all need to know which probes are recorded as spike events.
+    if(!log_options.spike_events){
+        return;
+    }
+
+    vector<int> spike_probes(probe_info.size(), 0);
+    for(unsigned i = 0; i < probe_info.size(); i++){
+        auto probe = probe_map.find(probe_info[i].probe_key);
+
+        // Reduced samples aren't spikes, even if the probed signal is.
+        if(probe != probe_map.end() && probe->second->get_reduction().is_identity()){
+            spike_probes[i] = 1;
+            for(const Signal& signal: probe->second->get_trial_signals()){
+                spike_probes[i] = spike_probes[i] && is_spike_signal(signal);
+            }
+        }
+    }
+
+    if(comm != MPI_COMM_NULL){
+        MPI_Allreduce(
+            MPI_IN_PLACE, spike_probes.data(), spike_probes.size(), MPI_INT, MPI_MAX, comm);
+    }
+
+    set<key_type> spike_probe_keys;
+    for(unsigned i = 0; i < probe_info.size(); i++){
+        if(spike_probes[i]){
+            spike_probe_keys.insert(probe_info[i].probe_key);
+        }
+    }
+
+    sim_log->set_spike_probes(spike_probe_keys);
+
+    build_dbg(
+        "Found " << spike_regions.size() << " spike outputs and "
+        << spike_probe_keys.size() << " spike probes." << endl);
+}
+
+bool MpiSimulatorChunk::is_spike_signal(const Signal& signal) const{
+    if(signal.size == 0){
+        return false;
+    }
+
+    SignalAccess access = get_signal_access(signal, false, 0);
+    for(auto& region: spike_regions){
+        if(region.first <= access.lo && access.hi <= region.second){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MpiSimulatorChunk::run_n_steps(int steps, bool progress){
+
+    stringstream ss;
+    ss << "chunk_" << rank << "_dbg";
+    dbgfile(ss.str());
+
+    if(rank == 0){
+        sim_log->prep_for_simulation(log_filename, steps);
+    }else{
+        sim_log->prep_for_simulation();
+    }
+
+    if(checkpoint_every > 0 && checkpoint_file.empty()){
+        throw runtime_error("Checkpoints are to be written, but no checkpoint file was given.");
+    }
+
+    bool async = sim_log->is_ready() && async_flush;
+
+    if(async && n_processors != 1){
+        // The parallel log writes through MPI-IO, so the writer thread
+        // makes MPI calls at the same time as the main thread.
+        int level;
+        MPI_Query_thread(&level);
+
+        if(level < MPI_THREAD_MULTIPLE){
+            dbg("MPI_THREAD_MULTIPLE not supported, probe data will be written synchronously." << endl);
+            async = false;
+        }
+    }
+
+    // Operators are timed one at a time for the runtimes and the profile.
+    const bool time_ops = collect_timings || !profile_file.empty();
+
+    unique_ptr<RealtimePacer> pacer;
+    if(realtime > 0.0){
+        pacer = unique_ptr<RealtimePacer>(new RealtimePacer(dt / realtime));
+    }
+
+    // Every name is registered before the log writer starts recording. The
+    // pacer only needs the time each step waits for messages, so the tracer
+    // keeps no spans for it.
+    tracer.reset();
+    if(time_ops || !trace_file.empty() || pacer){
+        bool keep_spans = time_ops || !trace_file.empty();
+        tracer = unique_ptr<Tracer>(new Tracer(keep_spans ? DEFAULT_MAX_TRACE_EVENTS : 0));
+        tracer->add_name("flush probes");
+        tracer->add_name("write log");
+        tracer->add_name("wait for log writes");
+
+        for(auto& send: mpi_sends){
+            send->set_tracer(tracer.get());
+        }
+
+        for(auto& recv: mpi_recvs){
+            recv->set_tracer(tracer.get());
+        }
+    }
+
+    log_writer.reset();
+    if(async){
+        log_writer = unique_ptr<AsyncLogWriter>(new AsyncLogWriter(sim_log.get(), tracer.get()));
+    }
+
+    // With a writer, one buffer is filled while the other is being written.
+    unsigned probe_flush_every = sim_log->is_ready() ? flush_every : 0;
+    unsigned n_buffers = async ? 2 : 1;
+
+    for(auto& kv: probe_map){
+        (kv.second)->init_for_simulation(steps, probe_flush_every, n_buffers);
+    }
+
+    // Only the master reports its progress, which it does from a thread of its own.
+    unique_ptr<ProgressReporter> reporter;
+    if(rank == 0){
+        reporter = unique_ptr<ProgressReporter>(new ProgressReporter(steps, progress));
+    }
+
+    map<string, double> per_class_average_timings;
+    double per_op_timings[op_schedule.size()];
+    fill_n(per_op_timings, op_schedule.size(), 0.0);
+
+    // With a trace, each operator call is recorded under its class.
+    vector<unsigned> op_trace_names;
+    if(time_ops && !trace_file.empty()){
+        for(auto& op: op_schedule){
+            op_trace_names.push_back(tracer->add_name(op->classname()));
+        }
+    }
+
+    // MPI operators mostly wait for other processes, so misses aren't pinned on them.
+    vector<unsigned> op_pacer_classes;
+    if(pacer){
+        for(auto& op: op_schedule){
+            string class_name = op->classname();
+            bool blamed = class_name.compare(0, 3, "MPI") != 0;
+            op_pacer_classes.push_back(pacer->add_class(class_name, blamed));
+        }
+    }
+
+    int n_steps = 0;
+
+    if(tracer){
+        tracer->begin_run(comm);
+    }
+
+    for(auto& recv: mpi_recvs){
+        recv->init();
+    }
+
+    if(pacer){
+        pacer->begin_run(comm);
+    }
+
+    auto begin_step = [&](unsigned step){
+        if(pacer){
+            pacer->begin_step();
+        }
+
+        if(tracer){
+            tracer->begin_step();
+        }
+
+        dbg("Beginning step: " << step << endl);
+
+        bool write_checkpoint = (
+            checkpoint_every > 0 && step != 0 && steps_since_reset % checkpoint_every == 0);
+
+        if((step % flush_every == 0 && step != 0) || write_checkpoint){
+            dbg("Flushing probes." << endl);
+            flush_probes();
+        }
+
+        // Every chunk reaches the same step at the same time, so
+        // they all take part in writing the checkpoint.
+        if(write_checkpoint){
+            dbg("Writing checkpoint." << endl);
+            wait_for_probe_writes();
+            checkpoint(checkpoint_file);
+        }
+    };
+
+    auto end_step = [&](){
+        n_steps++;
+        steps_since_reset++;
+        for(auto& kv: probe_map){
+            (kv.second)->gather(n_steps);
+        }
+
+        if(reporter){
+            reporter->step_done();
+        }
+
+        if(tracer){
+            tracer->end_step();
+        }
+
+        if(pacer){
+            pacer->end_step(tracer->get_step_waits().back());
+        }
+    };
+
+    // To measure the cost of each component for rebalancing, only some steps
+    // are timed. In real time, every step is timed so that a missed deadline
+    // can be pinned on a class of operator, unless the steps are threaded.
+    const unsigned time_every = (time_ops || (pacer && !thread_pool)) ?
+        1 : (rebalance > 0.0 ? REBALANCE_SAMPLE_EVERY : 0);
+    unsigned n_timed_steps = 0;
+
+    auto run_step = [&](unsigned step){
+        begin_step(step);
+
+        if(time_every > 0 && step % time_every == 0){
+            int op_index = 0;
+            for(auto& op: op_schedule){
+                double op_begin = wall_time();
+
+                // Call the operator
+                (*op)();
+
+                double op_end = wall_time();
+                per_op_timings[op_index] += op_end - op_begin;
+
+                if(!op_trace_names.empty()){
+                    tracer->record(op_trace_names[op_index], op_begin, op_end);
+                }
+
+                if(pacer){
+                    pacer->charge(op_pacer_classes[op_index], op_end - op_begin);
+                }
+
+                op_index++;
+            }
+
+            n_timed_steps++;
+        }else{
+            Operator* const* ops = op_schedule.data();
+            for(auto& batch: batch_schedule){
+                // Call every operator in the batch
+                batch.runner(ops + batch.start, batch.n_ops);
+            }
+        }
+
+        end_step();
+    };
+
+    if(thread_pool && !time_ops){
+        // Timed steps are run by the main thread on its own, and the steps
+        // between them by the thread pool.
+        unsigned step = 0;
+        while(step < unsigned(steps)){
+            if(time_every > 0 && step % time_every == 0){
+                run_step(step++);
+                continue;
+            }
+
+            unsigned first = step;
+            unsigned n = time_every > 0 ?
+                min(steps - step, time_every - step % time_every) : steps - step;
+
+            run_threaded(n, [&](unsigned s){ begin_step(first + s); }, end_step);
+            step += n;
+        }
+    }else{
+        for(unsigned step = 0; step < steps; ++step){
+            run_step(step);
+        }
+    }
+
+    flush_probes();
+    wait_for_probe_writes();
+    log_writer.reset();
+    reporter.reset();
+
+    if(pacer){
+        string report = pacer->report(comm);
+        if(rank == 0){
+            cout << report;
+        }
+    }
+
+    if(rebalance > 0.0 && n_timed_steps > 0){
+        measure_component_costs(n_timed_steps, per_op_timings);
+    }
+
+    for(auto& send : mpi_sends){
+        send->complete();
+    }
+
+    for(auto& recv : mpi_recvs){
+        recv->complete();
+    }
+
+    clsdbgfile();
+
+    if(tracer){
+        if(!trace_file.empty()){
+            tracer->write(trace_file, comm);
+        }
+
+        if(collect_timings){
+            process_timing_data(n_steps, per_class_average_timings, per_op_timings);
+        }
+
+        if(!profile_file.empty()){
+            write_profile(n_steps, per_op_timings);
+        }
+
+        for(auto& send: mpi_sends){
+            send->set_tracer(NULL);
+        }
+
+        for(auto& recv: mpi_recvs){
+            recv->set_tracer(NULL);
+        }
+
+        tracer.reset();
+    }
+}
+
+void MpiSimulatorChunk::run_threaded(
+        int steps, function<void(unsigned)> begin_step, function<void()> end_step){
+
+    const unsigned n_levels = level_schedule.size();
+
+    // If anything throws, every thread still has to reach each barrier, so the
+    // exception is stored and the remaining operators in the step are skipped.
+    // The threads then stop together at the beginning of the next step, and the
+    // exception is rethrown once they have all left the pool.
+    exception_ptr error;
+    mutex error_mutex;
+    atomic<bool> failed(false);
+
+    // Only written by the main thread before the barrier that begins each step.
+    bool stop = false;
+
+    auto fail = [&](){
+        lock_guard<mutex> lock(error_mutex);
+        if(!error){
+            error = current_exception();
+        }
+        failed.store(true);
+    };
+
+    thread_pool->run([&](unsigned thread_id){
+        for(unsigned step = 0; step < steps; ++step){
+            if(thread_id == 0){
+                try{
+                    begin_step(step);
+                }catch(...){
+                    fail();
+                }
+
+                for(unsigned l = 0; l < n_levels; l++){
+                    level_counters[l].store(0, memory_order_relaxed);
+                }
+
+                stop = failed.load();
+            }
+
+            thread_pool->barrier();
+
+            if(stop){
+                return;
+            }
+
+            for(unsigned l = 0; l < n_levels; l++){
+                OpLevel& level = level_schedule[l];
+
+                if(!failed.load(memory_order_relaxed)){
+                    try{
+                        if(thread_id == 0){
+                            for(Operator* op: level.serial_ops){
+                                (*op)();
+                            }
+                        }
+
+                        // Threads take operators from the level one at a
+                        // time until there are none left.
+                        const unsigned n_ops = level.parallel_ops.size();
+                        unsigned i = level_counters[l].fetch_add(1, memory_order_relaxed);
+                        while(i < n_ops){
+                            (*level.parallel_ops[i])();
+                            i = level_counters[l].fetch_add(1, memory_order_relaxed);
+                        }
+                    }catch(...){
+                        fail();
+                    }
+                }
+
+                thread_pool->barrier();
+            }
+
+            if(thread_id == 0){
+                try{
+                    end_step();
+                }catch(...){
+                    fail();
+                }
+            }
+        }
+    });
+
+    if(error){
+        rethrow_exception(error);
+    }
+}
+
+void MpiSimulatorChunk::reset(unsigned seed){
+    this->seed = seed;
+    steps_since_reset = 0;
+
+    for(Operator* op: operator_list){
+        op->reset(seed + trial_of(op));
+    }
+
+    for(auto& kv: probe_map){
+        (kv.second)->reset();
+    }
+
+    // Signals without an initial value are read-only.
+    for(auto& kv: signal_init_value){
+        Signal sig = signal_map.at(kv.first);
+        sig.fill_with(kv.second);
+
+        auto trials = trial_signals.find(kv.first);
+        if(trials != trial_signals.end()){
+            for(unsigned trial = 1; trial < trials->second.size(); trial++){
+                trials->second[trial].fill_with(kv.second);
+            }
+        }
+    }
+}
+
+void MpiSimulatorChunk::checkpoint(string filename){
+    // Base signals that no operator writes to still hold the
+    // values they were loaded with, and are not saved.
+    set<const dtype*> written;
+    for(Operator* op: op_schedule){
+        for(const Signal& signal: op->get_writes()){
+            written.insert(signal.data.get());
+        }
+    }
+
+    stringstream out;
+
+    vector<key_type> keys;
+    for(auto& kv: signal_map){
+        if(written.count(kv.second.data.get())){
+            keys.push_back(kv.first);
+        }
+    }
+
+    // The values of a signal in every trial are saved together.
+    write_state(out, uint64_t(keys.size()));
+    for(key_type key: keys){
+        auto trials = trial_signals.find(key);
+        const vector<Signal>& copies =
+            trials != trial_signals.end() ? trials->second : vector<Signal>{signal_map.at(key)};
+
+        vector<dtype> values;
+        for(const Signal& signal: copies){
+            values.insert(values.end(), signal.raw_data, signal.raw_data + signal.size);
+        }
+
+        write_state(out, key);
+        write_state(out, values);
+    }
+
+    // Operators are identified by their position in the schedule, which is
+    // the same whenever the network is loaded with the same configuration.
+    write_state(out, uint64_t(op_schedule.size()));
+    for(Operator* op: op_schedule){
+        stringstream op_out;
+        op->save_state(op_out);
+
+        write_state(out, op->classname());
+        write_state(out, op_out.str());
+    }
+
+    CheckpointInfo info;
+    info.step = steps_since_reset;
+    info.seed = seed;
+    info.dt = dt;
+
+    write_checkpoint(filename, info, out.str(), comm);
+
+    if(rank == 0){
+        cout << "Wrote checkpoint of step " << steps_since_reset << " to " << filename << "." << endl;
+    }
+}
+
+void MpiSimulatorChunk::restore(string filename){
+    CheckpointInfo info;
+    stringstream in(read_checkpoint(filename, info, comm));
+
+    if(info.dt != dt){
+        stringstream msg;
+        msg << "Checkpoint " << filename << " was written for a network with dt = "
+            << info.dt << ", but the network has dt = " << dt << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    // Recreates the state that is derived from the seed, and is not saved.
+    reset(info.seed);
+
+    uint64_t n_signals;
+    read_state(in, n_signals);
+
+    for(uint64_t i = 0; i < n_signals; i++){
+        key_type key;
+        vector<dtype> values;
+        read_state(in, key);
+        read_state(in, values);
+
+        auto location = signal_map.find(key);
+        auto trials = trial_signals.find(key);
+        unsigned n_copies = trials != trial_signals.end() ? trials->second.size() : 1;
+
+        if(location == signal_map.end() || location->second.size * n_copies != values.size()){
+            stringstream msg;
+            msg << "Checkpoint " << filename << " has a signal with key " << key
+                << " that does not match any signal on rank " << rank << ". "
+                << "Was it written for a different network, or number of trials?" << endl;
+            throw runtime_error(msg.str());
+        }
+
+        for(unsigned trial = 0; trial < n_copies; trial++){
+            const Signal& signal = n_copies > 1 ? trials->second[trial] : location->second;
+            memcpy(signal.raw_data, values.data() + trial * signal.size,
+                   signal.size * sizeof(dtype));
+        }
+    }
 
-    unsigned ndim;
-    hsize_t dset_shape[2];
-    char* str_ptr;
+    uint64_t n_ops;
+    read_state(in, n_ops);
 
-    hid_t str_type = H5Tcopy(H5T_C_S1);
-    H5Tset_strpad(str_type, H5T_STR_NULLPAD);
+    if(n_ops != op_schedule.size()){
+        stringstream msg;
+        msg << "Checkpoint " << filename << " has " << n_ops << " operators on rank "
+            << rank << ", but the chunk has " << op_schedule.size() << ". "
+            << "It must be restored into the same network, simulated with "
+            << "the same options." << endl;
+        throw runtime_error(msg.str());
+    }
 
-    hid_t f = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, file_plist);
+    for(Operator* op: op_schedule){
+        string classname, state;
+        read_state(in, classname);
+        read_state(in, state);
 
-    // Get n_components
-    int n_components;
-    attr = H5Aopen(f, "n_components", H5P_DEFAULT);
-    H5Aread(attr, H5T_NATIVE_INT, &n_components);
-    H5Aclose(attr);
+        if(classname != op->classname()){
+            stringstream msg;
+            msg << "Checkpoint " << filename << " has a " << classname << " on rank "
+                << rank << " where the chunk has a " << op->classname() << "." << endl;
+            throw runtime_error(msg.str());
+        }
 
-    if(rank == 0){
-        cout << "Loading nengo network from file." << endl;
-        cout << "Network has " << n_components << " components." << endl;
+        stringstream op_in(state);
+        op->load_state(op_in);
     }
 
-    // Get dt
-    attr = H5Aopen(f, "dt", H5P_DEFAULT);
-    H5Aread(attr, H5T_NATIVE_DOUBLE, &dt);
-    H5Aclose(attr);
+    steps_since_reset = info.step;
 
-    int component = rank;
-    while(component < n_components){
+    for(auto& kv: probe_map){
+        (kv.second)->reset(steps_since_reset);
+    }
 
-        stringstream ss;
-        ss << component;
+    if(rank == 0){
+        cout << "Restored checkpoint of step " << steps_since_reset << " from " << filename << "." << endl;
+    }
+}
 
-        // Open the group assigned to my component
-        hid_t component_group = H5Gopen(f, ss.str().c_str(), H5P_DEFAULT);
+void MpiSimulatorChunk::measure_component_costs(unsigned n_steps, const double per_op_timings[]){
+    component_costs.assign(mapping.get_n_components(), 0.0);
+    process_cost = 0.0;
 
-        // signal keys
-        hid_t signal_keys = H5Dopen(component_group, "signal_keys", H5P_DEFAULT);
+    // As in the profile, the MPI operators mostly measure other processes.
+    for(unsigned i = 0; i < op_schedule.size(); i++){
+        const Operator* op = op_schedule[i];
+        if(dynamic_cast<const MPIOperator*>(op) || dynamic_cast<const MPIWait*>(op)){
+            continue;
+        }
 
-        dspace = H5Dget_space(signal_keys);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+        double seconds = per_op_timings[i] / n_steps;
 
-        assert(ndim == 1);
+        vector<pair<float, double>> shares{make_pair(op->get_index(), 1.0)};
+        auto merged = merged_shares.find(op);
+        if(merged != merged_shares.end()){
+            shares = merged->second;
+        }
 
-        hsize_t n_signals = dset_shape[0];
+        double total = 0.0;
+        for(auto& share: shares){
+            total += share.second;
+        }
 
-        auto signal_keys_buffer = unique_ptr<key_type[]>(new key_type[n_signals]);
-        err = H5Dread(
-            signal_keys, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL,
-            read_plist, signal_keys_buffer.get());
+        // Operators that don't come from the network file, such as the
+        // TimeUpdate and python functions, stay with the process.
+        for(auto& share: shares){
+            auto component = op_components.find(share.first);
+            if(component != op_components.end()){
+                component_costs[component->second] += seconds * share.second / total;
+            }else{
+                process_cost += seconds * share.second / total;
+            }
+        }
+    }
+}
 
-        H5Dclose(signal_keys);
+bool MpiSimulatorChunk::plan_rebalance(ComponentMapping& new_mapping){
+    if(rebalance <= 0.0 || comm == MPI_COMM_NULL){
+        return false;
+    }
 
-        // signal shapes
-        hid_t signal_shapes = H5Dopen(component_group, "signal_shapes", H5P_DEFAULT);
+    // Every chunk has run the same simulations, so either all have costs or none do.
+    if(component_costs.empty()){
+        return false;
+    }
 
-        dspace = H5Dget_space(signal_shapes);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+    const int n_components = mapping.get_n_components();
 
-        assert(dset_shape[0] == n_signals);
-        assert(n_signals == 0 || dset_shape[1] == 2);
-        assert(n_signals == 0 || ndim == 2);
+    // The costs are summed on the master, which decides for everyone.
+    vector<double> costs(n_components, 0.0), process_costs(n_processors, 0.0);
+    MPI_Reduce(
+        component_costs.data(), costs.data(), n_components, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Gather(&process_cost, 1, MPI_DOUBLE, process_costs.data(), 1, MPI_DOUBLE, 0, comm);
 
-        auto signal_shapes_buffer = unique_ptr<short[]>(new short[2 * n_signals]);
-        err = H5Dread(
-            signal_shapes, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL,
-            read_plist, signal_shapes_buffer.get());
+    vector<int> assignment(n_components);
+    int moved = 0;
 
-        H5Dclose(signal_shapes);
+    if(rank == 0){
+        new_mapping = mapping;
+        moved = rebalance_components(new_mapping, costs, process_costs, rebalance);
 
-        // signal strides
-        hid_t signal_strides = H5Dopen(component_group, "signal_strides", H5P_DEFAULT);
+        for(int c = 0; c < n_components; c++){
+            assignment[c] = new_mapping.process_of(c);
+        }
 
-        dspace = H5Dget_space(signal_strides);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+        if(moved){
+            int n_moved = 0;
+            for(int c = 0; c < n_components; c++){
+                n_moved += assignment[c] != mapping.process_of(c);
+            }
 
-        assert(dset_shape[0] == n_signals);
-        assert(n_signals == 0 || dset_shape[1] == 2);
-        assert(n_signals == 0 || ndim == 2);
+            cout << "Rebalancing moves " << n_moved << " of " << n_components
+                 << " components between processes." << endl;
+        }
+    }
 
-        auto signal_strides_buffer = unique_ptr<short[]>(new short[2 * n_signals]);
-        err = H5Dread(
-            signal_strides, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL,
-            read_plist, signal_strides_buffer.get());
+    MPI_Bcast(&moved, 1, MPI_INT, 0, comm);
+    MPI_Bcast(assignment.data(), n_components, MPI_INT, 0, comm);
 
-        H5Dclose(signal_strides);
+    new_mapping = ComponentMapping(n_components, n_processors, assignment);
 
-        // signal labels
-        hid_t labels = H5Dopen(component_group, "signal_labels", H5P_DEFAULT);
+    return moved;
+}
 
-        dspace = H5Dget_space(labels);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+map<const dtype*, pair<key_type, unsigned>> MpiSimulatorChunk::base_signal_keys() const{
+    map<const dtype*, pair<key_type, unsigned>> keys;
 
-        assert(ndim == 1);
+    for(auto& kv: signal_map){
+        keys[kv.second.data.get()] = make_pair(kv.first, 0u);
+    }
 
-        auto label_buffer = unique_ptr<char>(new char[dset_shape[0]]);
-        err = H5Dread(labels, str_type, H5S_ALL, H5S_ALL, read_plist, label_buffer.get());
-        H5Dclose(labels);
+    for(auto& kv: trial_signals){
+        for(unsigned trial = 1; trial < kv.second.size(); trial++){
+            keys[kv.second[trial].data.get()] = make_pair(kv.first, trial);
+        }
+    }
 
-        // signals
-        hid_t signals = H5Dopen(component_group, "signals", H5P_DEFAULT);
+    return keys;
+}
 
-        dspace = H5Dget_space(signals);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+set<key_type> MpiSimulatorChunk::written_signal_keys() const{
+    map<const dtype*, pair<key_type, unsigned>> keys = base_signal_keys();
 
-        assert(ndim == 1);
+    set<const dtype*> written;
+    for(Operator* op: operator_list){
+        for(const Signal& signal: op->get_writes()){
+            written.insert(signal.data.get());
+        }
+    }
 
-        auto signal_buffer = unique_ptr<dtype>(new dtype[dset_shape[0]]);
+    for(const MPIOpRecord& recv: recv_records){
+        written.insert(recv.content.data.get());
+    }
 
-        err = H5Dread(
-            signals, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
-            read_plist, signal_buffer.get());
+    set<key_type> written_keys;
+    for(const dtype* data: written){
+        auto base = keys.find(data);
+        if(base != keys.end()){
+            written_keys.insert(base->second.first);
+        }
+    }
 
-        H5Dclose(signals);
+    return written_keys;
+}
 
-        long long signal_offset = 0;
-        str_ptr = label_buffer.get();
+// FNV-1a hash of the bytes of ``size'' values.
+static uint64_t hash_values(const dtype* values, unsigned size){
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
 
-        int shape[2];
-        short stride[2];
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < size * sizeof(dtype); i++){
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
 
-        // Read signals for component, one at a time
-        // Name of the dataset containing a signal is equal to the signal key
-        for(int i = 0; i < n_signals; i++){
-            shape[0] = signal_shapes_buffer[2*i];
-            shape[1] = signal_shapes_buffer[2*i + 1];
+    return hash;
+}
 
-            stride[0] = signal_strides_buffer[2*i];
-            stride[1] = signal_strides_buffer[2*i + 1];
+void MpiSimulatorChunk::save_init_values(){
+    signal_init_value.clear();
 
-            // Get the signal data
-            Signal signal = Signal(shape[0], shape[1], 0.0, string(str_ptr));
-            memcpy(signal.raw_data, signal_buffer.get() + signal_offset,
-                   signal.size * sizeof(dtype));
+    // Many signals, such as the states of neurons and synapses, start out the
+    // same (usually at zero), so the copies are looked up by their contents.
+    map<pair<uint64_t, unsigned>, vector<Signal>> copies;
 
-            signal.stride1 = stride[0];
-            signal.stride2 = stride[1];
+    for(key_type key: written_signal_keys()){
+        Signal value = signal_map.at(key).deep_copy();
+        auto& candidates = copies[make_pair(hash_values(value.raw_data, value.size), value.size)];
 
-            signal_offset += signal.size;
+        auto same = find_if(candidates.begin(), candidates.end(), [&](const Signal& other){
+            return other.shape1 == value.shape1 && other.shape2 == value.shape2 &&
+                memcmp(other.raw_data, value.raw_data, value.size * sizeof(dtype)) == 0;
+        });
 
-            while(*str_ptr != '\0'){
-                str_ptr++;
-            }
+        if(same != candidates.end()){
+            signal_init_value[key] = *same;
+        }else{
+            candidates.push_back(value);
+            signal_init_value[key] = value;
+        }
+    }
 
-            if(i < n_signals-1){
-                str_ptr++;
-            }
+    build_dbg(
+        "Saved initial values of " << signal_init_value.size() << " of "
+        << signal_map.size() << " base signals." << endl);
+}
 
-            add_base_signal(signal_keys_buffer[i], signal);
+size_t MpiSimulatorChunk::init_value_bytes() const{
+    set<const dtype*> counted;
+    size_t init_bytes = 0;
+    for(auto& kv: signal_init_value){
+        if(counted.insert(kv.second.raw_data).second){
+            init_bytes += kv.second.size * sizeof(dtype);
         }
+    }
 
-        // Read operators for component
+    return init_bytes;
+}
 
-        // Open the dataset
-        hid_t operators = H5Dopen(component_group, "operators", H5P_DEFAULT);
+size_t MpiSimulatorChunk::operator_buffer_bytes() const{
+    size_t op_bytes = 0;
+    for(Operator* op: operator_list){
+        op_bytes += op->buffer_bytes();
+    }
 
-        // Get number of ops
-        int n_operators;
-        attr = H5Aopen(operators, "n_strings", H5P_DEFAULT);
-        H5Aread(attr, H5T_NATIVE_INT, &n_operators);
-        H5Aclose(attr);
+    return op_bytes;
+}
 
-        // Get its dimensions
-        dspace = H5Dget_space(operators);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+void MpiSimulatorChunk::report_memory(){
+    vector<uint64_t> bytes = {signal_bytes, init_value_bytes(), operator_buffer_bytes()};
+    vector<uint64_t> all_bytes(bytes);
+    vector<int> node_leaders(1, 0);
 
-        // Read the data set
-        auto op_buffer = unique_ptr<char>(new char[dset_shape[0]]);
-        err = H5Dread(operators, str_type, H5S_ALL, H5S_ALL, read_plist, op_buffer.get());
-        H5Dclose(operators);
+    if(comm != MPI_COMM_NULL){
+        // Processes on the same node are grouped by the lowest rank among them.
+        MPI_Comm node;
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
 
-        // Add the ops
-        str_ptr = op_buffer.get();
+        int leader = rank;
+        MPI_Bcast(&leader, 1, MPI_INT, 0, node);
+        MPI_Comm_free(&node);
 
-        for(int op_idx=0; op_idx < n_operators; op_idx++){
-            string op_str = string(str_ptr);
+        all_bytes.resize(bytes.size() * n_processors);
+        node_leaders.resize(n_processors);
 
-            add_op(OpSpec(op_str));
+        MPI_Gather(
+            bytes.data(), bytes.size(), MPI_UINT64_T,
+            all_bytes.data(), bytes.size(), MPI_UINT64_T, 0, comm);
+        MPI_Gather(&leader, 1, MPI_INT, node_leaders.data(), 1, MPI_INT, 0, comm);
+    }
 
-            while(*str_ptr != '\0'){
-                str_ptr++;
-            }
+    if(rank != 0){
+        return;
+    }
 
-            if(op_idx < n_operators-1){
-                str_ptr++;
-            }
+    unsigned n_ranks = node_leaders.size();
+    vector<uint64_t> totals(bytes.size(), 0);
+    map<int, uint64_t> node_totals;
+    uint64_t max_total = 0;
+    int max_rank = 0;
+
+    for(unsigned r = 0; r < n_ranks; r++){
+        uint64_t total = 0;
+        for(unsigned i = 0; i < bytes.size(); i++){
+            totals[i] += all_bytes[r * bytes.size() + i];
+            total += all_bytes[r * bytes.size() + i];
         }
 
-        // Read probes for component
+        node_totals[node_leaders[r]] += total;
+
+        if(total > max_total){
+            max_total = total;
+            max_rank = r;
+        }
+    }
 
-        // Open the dataset
-        hid_t probes = H5Dopen(component_group, "probes", H5P_DEFAULT);
+    auto max_node = max_element(
+        node_totals.begin(), node_totals.end(),
+        [](const pair<const int, uint64_t>& left, const pair<const int, uint64_t>& right){
+            return left.second < right.second;
+        });
 
-        // Get number of probes
-        int n_probes;
-        attr = H5Aopen(probes, "n_strings", H5P_DEFAULT);
-        H5Aread(attr, H5T_NATIVE_INT, &n_probes);
-        H5Aclose(attr);
+    const double mib = 1024.0 * 1024.0;
+    stringstream out;
+    out << fixed << setprecision(1);
+    out << "Memory per process, on average: " << totals[0] / mib / n_ranks << " MiB of signals, "
+        << totals[1] / mib / n_ranks << " MiB of initial values, "
+        << totals[2] / mib / n_ranks << " MiB of operator buffers." << endl;
+    out << "Most on one process: " << max_total / mib << " MiB, on rank " << max_rank << ". "
+        << "Most on one node: " << max_node->second / mib << " MiB, on the node of rank "
+        << max_node->first << "." << endl;
+
+    cout << out.str();
+}
 
-        // Get its dimensions
-        dspace = H5Dget_space(probes);
-        ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-        H5Sclose(dspace);
+// The parts of the state moved to one process by migrate_from.
+struct MigratingState{
+    MigratingState(): n_signals(0), n_outputs(0), n_ops(0){}
 
-        // Read the data set
-        auto probe_buffer = unique_ptr<char>(new char[dset_shape[0]]);
-        err = H5Dread(probes, str_type, H5S_ALL, H5S_ALL, read_plist, probe_buffer.get());
-        H5Dclose(probes);
+    uint64_t n_signals;
+    stringstream signals;
 
-        // Add the probes
-        str_ptr = probe_buffer.get();
+    uint64_t n_outputs;
+    stringstream outputs;
 
-        for(int probe_idx=0; probe_idx < n_probes; probe_idx++){
-            string probe_str = string(str_ptr);
-            add_probe(ProbeSpec(probe_str));
+    uint64_t n_ops;
+    stringstream ops;
+};
 
-            while(*str_ptr != '\0'){
-                str_ptr++;
-            }
+vector<string> MpiSimulatorChunk::save_migrating_state(const ComponentMapping& new_mapping){
+    vector<MigratingState> states(n_processors);
 
-            if(probe_idx < n_probes-1){
-                str_ptr++;
-            }
+    auto processes_of = [&](const set<int>& components, set<int>& processes){
+        for(int c: components){
+            processes.insert(new_mapping.process_of(c));
+        }
+    };
+
+    // A value received from another process is sent on by the process
+    // that computed it, to wherever its receivers now are.
+    set<const dtype*> written;
+    for(Operator* op: op_schedule){
+        if(dynamic_cast<MPIRecv*>(op)){
+            continue;
         }
 
-        H5Gclose(component_group);
-
-        component += n_processors;
+        for(const Signal& signal: op->get_writes()){
+            written.insert(signal.data.get());
+        }
     }
 
-    // Read probe info - all processes need info about all active probes
-    // for purposes of writing results to the HDF5 file.
+    for(auto& kv: signal_map){
+        key_type key = kv.first;
+        if(!written.count(kv.second.data.get())){
+            continue;
+        }
 
-    // Open the dataset
-    hid_t probe_info_dset = H5Dopen(f, "probe_info", H5P_DEFAULT);
+        set<int> processes;
+        processes_of(signal_components.at(key), processes);
 
-    // Get total number of probes in simulation
-    int n_total_probes;
-    attr = H5Aopen(probe_info_dset, "n_strings", H5P_DEFAULT);
-    H5Aread(attr, H5T_NATIVE_INT, &n_total_probes);
-    H5Aclose(attr);
+        auto sends = send_components.find(key);
+        if(sends != send_components.end()){
+            processes_of(sends->second, processes);
+        }
 
-    // Get its dimensions
-    dspace = H5Dget_space(probe_info_dset);
-    ndim = H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
-    H5Sclose(dspace);
+        auto trials = trial_signals.find(key);
+        const vector<Signal>& copies =
+            trials != trial_signals.end() ? trials->second : vector<Signal>{kv.second};
 
-    // Read the data set
-    auto probe_buffer = unique_ptr<char>(new char[dset_shape[0]]);
-    err = H5Dread(probe_info_dset, str_type, H5S_ALL, H5S_ALL, read_plist, probe_buffer.get());
-    H5Dclose(probe_info_dset);
+        vector<dtype> values;
+        for(const Signal& signal: copies){
+            values.insert(values.end(), signal.raw_data, signal.raw_data + signal.size);
+        }
 
-    str_ptr = probe_buffer.get();
+        for(int p: processes){
+            write_state(states[p].signals, key);
+            write_state(states[p].signals, values);
+            states[p].n_signals++;
+        }
+    }
 
-    for(int probe_idx=0; probe_idx < n_total_probes; probe_idx++){
-        string probe_str = string(str_ptr);
-        probe_info.push_back(probe_str);
+    map<const dtype*, pair<key_type, unsigned>> keys = base_signal_keys();
 
-        while(*str_ptr != '\0'){
-            str_ptr++;
+    for(Operator* op: op_schedule){
+        if(dynamic_cast<MPIOperator*>(op) || dynamic_cast<MPIWait*>(op)){
+            continue;
         }
 
-        if(probe_idx < n_total_probes-1){
-            str_ptr++;
+        // An output is identified by where it lies in its base signal, and its
+        // filter may be anywhere among the components that contain that signal.
+        vector<Signal> outputs = op->get_state_outputs();
+        for(unsigned i = 0; i < outputs.size(); i++){
+            auto base = keys.find(outputs[i].data.get());
+            if(base == keys.end()){
+                throw logic_error("The output of a filter is not in any base signal.");
+            }
+
+            stringstream out;
+            op->save_output_state(i, out);
+
+            set<int> processes;
+            processes_of(signal_components.at(base->second.first), processes);
+
+            for(int p: processes){
+                write_state(states[p].outputs, base->second.first);
+                write_state(states[p].outputs, base->second.second);
+                write_state(states[p].outputs, uint64_t(outputs[i].raw_data - outputs[i].data.get()));
+                write_state(states[p].outputs, out.str());
+                states[p].n_outputs++;
+            }
         }
-    }
 
-    H5Fclose(f);
-}
+        if(!outputs.empty()){
+            continue;
+        }
 
-void MpiSimulatorChunk::finalize_build(){
-    finalize_build(MPI_COMM_NULL);
-}
+        stringstream out;
+        op->save_state(out);
 
-void MpiSimulatorChunk::finalize_build(MPI_Comm comm){
-    if(n_processors != 1){
-        sim_log = unique_ptr<SimulationLog>(
-            new ParallelSimulationLog(n_processors, rank, probe_info, dt, comm));
-    }else{
-        sim_log = unique_ptr<SimulationLog>(new SimulationLog(probe_info, dt));
-    }
+        auto component = op_components.find(op->get_index());
+        if(out.str().empty() || component == op_components.end()){
+            continue;
+        }
 
-    for(auto& send: mpi_sends){
-        send->set_communicator(comm);
+        MigratingState& state = states[new_mapping.process_of(component->second)];
+        write_state(state.ops, op->get_index());
+        write_state(state.ops, trial_of(op));
+        write_state(state.ops, op->classname());
+        write_state(state.ops, out.str());
+        state.n_ops++;
     }
 
-    for(auto& recv: mpi_recvs){
-        recv->set_communicator(comm);
+    vector<string> blocks;
+    for(MigratingState& state: states){
+        stringstream block;
+        write_state(block, state.n_signals);
+        block << state.signals.str();
+        write_state(block, state.n_outputs);
+        block << state.outputs.str();
+        write_state(block, state.n_ops);
+        block << state.ops.str();
+
+        blocks.push_back(block.str());
     }
 
-    // Important: ensures ops are executed in correct order
-    operator_list.sort(compare_op_ptr);
+    return blocks;
 }
 
-void MpiSimulatorChunk::run_n_steps(int steps, bool progress){
+// Send blocks[p] to process p, and return the block that each process sent to this one.
+static vector<string> exchange_blocks(const vector<string>& blocks, MPI_Comm comm){
+    int n_processors;
+    MPI_Comm_size(comm, &n_processors);
 
-    stringstream ss;
-    ss << "chunk_" << rank << "_dbg";
-    dbgfile(ss.str());
+    vector<int> send_counts(n_processors), send_offsets(n_processors + 1, 0);
+    for(int p = 0; p < n_processors; p++){
+        if(blocks[p].size() > size_t(INT_MAX) - send_offsets[p]){
+            throw runtime_error("State moved between processes is too large to send.");
+        }
 
-    if(rank == 0){
-        sim_log->prep_for_simulation(log_filename, steps);
-    }else{
-        sim_log->prep_for_simulation();
+        send_counts[p] = blocks[p].size();
+        send_offsets[p+1] = send_offsets[p] + send_counts[p];
     }
 
-    int flush_every = sim_log->is_ready() ? FLUSH_PROBES_EVERY : 0;
+    vector<int> recv_counts(n_processors), recv_offsets(n_processors + 1, 0);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
 
-    for(auto& kv: probe_map){
-        (kv.second)->init_for_simulation(steps, flush_every);
-    }
+    for(int p = 0; p < n_processors; p++){
+        if(recv_counts[p] > INT_MAX - recv_offsets[p]){
+            throw runtime_error("State moved between processes is too large to receive.");
+        }
 
-    ez::ezETAProgressBar eta(steps);
-    if(progress){
-        eta.start();
+        recv_offsets[p+1] = recv_offsets[p] + recv_counts[p];
     }
 
-    map<string, double> per_class_average_timings;
-    double per_op_timings[operator_list.size()];
-    fill_n(per_op_timings, operator_list.size(), 0.0);
-    vector<double> step_times;
+    string send_data;
+    for(const string& block: blocks){
+        send_data += block;
+    }
 
-    int n_steps = 0;
+    vector<char> recv_data(max(recv_offsets.back(), 1));
+    MPI_Alltoallv(
+        &send_data[0], send_counts.data(), send_offsets.data(), MPI_CHAR,
+        recv_data.data(), recv_counts.data(), recv_offsets.data(), MPI_CHAR, comm);
 
-    for(auto& recv: mpi_recvs){
-        recv->init();
+    vector<string> received;
+    for(int p = 0; p < n_processors; p++){
+        received.push_back(string(recv_data.data() + recv_offsets[p], recv_counts[p]));
     }
 
-    for(unsigned step = 0; step < steps; ++step){
-        clock_t begin = clock();
+    return received;
+}
+
+void MpiSimulatorChunk::migrate_from(MpiSimulatorChunk& old){
+    // Recreates the state that is derived from the seed, and is not moved.
+    reset(old.seed);
+
+    vector<string> blocks = exchange_blocks(old.save_migrating_state(mapping), comm);
 
-        if(!progress && rank == 0 && step % 100 == 0){
-            cout << "Master beginning step: " << step << endl;
+    // Where the state of each filter output and other operator goes.
+    map<const dtype*, pair<key_type, unsigned>> keys = base_signal_keys();
+    map<tuple<key_type, unsigned, uint64_t>, pair<Operator*, unsigned>> filter_outputs;
+    map<pair<float, unsigned>, Operator*> ops;
+
+    for(Operator* op: op_schedule){
+        if(dynamic_cast<MPIOperator*>(op) || dynamic_cast<MPIWait*>(op)){
+            continue;
         }
 
-        dbg("Beginning step: " << step << endl);
+        vector<Signal> outputs = op->get_state_outputs();
+        for(unsigned i = 0; i < outputs.size(); i++){
+            const pair<key_type, unsigned>& base = keys.at(outputs[i].data.get());
+            uint64_t offset = outputs[i].raw_data - outputs[i].data.get();
+            filter_outputs[make_tuple(base.first, base.second, offset)] = make_pair(op, i);
+        }
 
-        if(step % FLUSH_PROBES_EVERY == 0 && step != 0){
-            dbg("Flushing probes." << endl);
-            flush_probes();
+        if(outputs.empty()){
+            ops[make_pair(op->get_index(), trial_of(op))] = op;
         }
+    }
 
-        if(collect_timings){
-            int op_index = 0;
-            for(auto& op: operator_list){
-                clock_t op_begin = clock();
+    // Values computed by more than one process are the same on all of them.
+    set<key_type> signals_loaded;
+    set<tuple<key_type, unsigned, uint64_t>> outputs_loaded;
 
-                // Call the operator
-                (*op)();
+    for(const string& block: blocks){
+        stringstream in(block);
 
-                clock_t op_end = clock();
+        uint64_t n_signals;
+        read_state(in, n_signals);
 
-                if(collect_timings){
-                    per_op_timings[op_index] += double(op_end - op_begin) / CLOCKS_PER_SEC;
-                }
+        for(uint64_t i = 0; i < n_signals; i++){
+            key_type key;
+            vector<dtype> values;
+            read_state(in, key);
+            read_state(in, values);
 
-                op_index++;
+            auto location = signal_map.find(key);
+            auto trials = trial_signals.find(key);
+            unsigned n_copies = trials != trial_signals.end() ? trials->second.size() : 1;
+
+            if(location == signal_map.end() || location->second.size * n_copies != values.size()){
+                stringstream msg;
+                msg << "Signal with key " << key << " was moved to rank " << rank
+                    << ", which has no matching signal." << endl;
+                throw logic_error(msg.str());
             }
-        }else{
-            for(auto& op: operator_list){
-                // Call the operator
-                (*op)();
+
+            if(!signals_loaded.insert(key).second){
+                continue;
             }
 
+            for(unsigned trial = 0; trial < n_copies; trial++){
+                const Signal& signal = n_copies > 1 ? trials->second[trial] : location->second;
+                memcpy(signal.raw_data, values.data() + trial * signal.size,
+                       signal.size * sizeof(dtype));
+            }
         }
 
-        n_steps++;
-        for(auto& kv: probe_map){
-            (kv.second)->gather(n_steps);
-        }
+        uint64_t n_outputs;
+        read_state(in, n_outputs);
+
+        for(uint64_t i = 0; i < n_outputs; i++){
+            key_type key;
+            unsigned trial;
+            uint64_t offset;
+            string state;
+            read_state(in, key);
+            read_state(in, trial);
+            read_state(in, offset);
+            read_state(in, state);
+
+            // Other components that contain the output also get its state.
+            auto output = make_tuple(key, trial, offset);
+            auto filter = filter_outputs.find(output);
+            if(filter == filter_outputs.end() || !outputs_loaded.insert(output).second){
+                continue;
+            }
 
-        if(progress){
-            ++eta;
+            stringstream op_in(state);
+            filter->second.first->load_output_state(filter->second.second, op_in);
         }
 
-        clock_t end = clock();
-        step_times.push_back(double(end - begin) / CLOCKS_PER_SEC);
-    }
+        uint64_t n_ops;
+        read_state(in, n_ops);
 
-    flush_probes();
+        for(uint64_t i = 0; i < n_ops; i++){
+            float index;
+            unsigned trial;
+            string classname, state;
+            read_state(in, index);
+            read_state(in, trial);
+            read_state(in, classname);
+            read_state(in, state);
 
-    for(auto& send : mpi_sends){
-        send->complete();
-    }
+            auto op = ops.find(make_pair(index, trial));
+            if(op == ops.end() || classname != op->second->classname()){
+                stringstream msg;
+                msg << "The state of a " << classname << " with index " << index
+                    << " was moved to rank " << rank << ", which has no such operator." << endl;
+                throw logic_error(msg.str());
+            }
 
-    for(auto& recv : mpi_recvs){
-        recv->complete();
+            stringstream op_in(state);
+            op->second->load_state(op_in);
+        }
     }
 
-    clsdbgfile();
-
-    if(collect_timings){
-        process_timing_data(
-            n_steps, per_class_average_timings, per_op_timings, step_times);
+    if(outputs_loaded.size() != filter_outputs.size()){
+        stringstream msg;
+        msg << "Rank " << rank << " was sent the state of " << outputs_loaded.size()
+            << " of the " << filter_outputs.size() << " outputs of its filters." << endl;
+        throw logic_error(msg.str());
     }
-}
 
-void MpiSimulatorChunk::reset(unsigned seed){
-    for(Operator* op: operator_list){
-        op->reset(seed + op->get_seed_modifier());
+    // The contents of update receives now hold what their sender computed on the last step.
+    for(auto& recv: mpi_recvs){
+        recv->hold_contents();
     }
 
-    // TODO: store whether signals are read-only, only reset if they are not.
-    for(auto& kv: signal_map){
-        key_type key = kv.first;
-        Signal sig = signal_map.at(key);
-        Signal init_value = signal_init_value.at(key);
-        sig.fill_with(init_value);
+    steps_since_reset = old.steps_since_reset;
+
+    for(auto& kv: probe_map){
+        (kv.second)->reset(steps_since_reset);
     }
 }
 
 void MpiSimulatorChunk::add_base_signal(key_type key, Signal signal){
+    if(store_base_signal(key, signal)){
+        signal_bytes += size_t(signal.size) * sizeof(dtype);
+    }
+}
+
+bool MpiSimulatorChunk::store_base_signal(key_type key, Signal signal){
 
     auto key_location = signal_map.find(key);
 
@@ -446,10 +2755,12 @@ void MpiSimulatorChunk::add_base_signal(key_type key, Signal signal){
 
             throw logic_error(msg.str());
         }
-    }else{
-        signal_init_value[key] = signal.deep_copy();
-        signal_map[key] = signal;
+
+        return false;
     }
+
+    signal_map[key] = signal;
+    return true;
 }
 
 Signal MpiSimulatorChunk::get_signal_view(
@@ -457,13 +2768,6 @@ Signal MpiSimulatorChunk::get_signal_view(
         unsigned shape1, unsigned shape2, int stride1, int stride2,
         unsigned offset){
 
-    if(signal_map.find(key) == signal_map.end()){
-        stringstream msg;
-        msg << "In MpiSimulatorChunk, could not find a signal "
-            << "with key " << key << "." << endl;
-        throw out_of_range(msg.str());
-    }
-
     build_dbg("Getting view with args -");
     build_dbg("label: " << label);
     build_dbg("key: " << key);
@@ -474,7 +2778,7 @@ Signal MpiSimulatorChunk::get_signal_view(
     build_dbg("stride2: " << stride2);
     build_dbg("offset: " << offset);
 
-    auto view = signal_map.at(key).get_view(
+    auto view = base_signal(key).get_view(
         label, ndim, shape1, shape2, stride1, stride2, offset);
 
     build_dbg("Retrieved view: " << view);
@@ -493,60 +2797,75 @@ Signal MpiSimulatorChunk::get_signal_view(string ss){
 }
 
 Signal MpiSimulatorChunk::get_signal(key_type key){
-    if(signal_map.find(key) == signal_map.end()){
+    return base_signal(key);
+}
+
+const Signal& MpiSimulatorChunk::base_signal(key_type key) const{
+    if(current_trial > 0){
+        auto trials = trial_signals.find(key);
+        if(trials != trial_signals.end()){
+            return trials->second.at(current_trial);
+        }
+    }
+
+    auto location = signal_map.find(key);
+    if(location == signal_map.end()){
         stringstream msg;
         msg << "In MpiSimulatorChunk, could not find a signal "
             << "with key " << key << "." << endl;
         throw out_of_range(msg.str());
     }
 
-    return signal_map.at(key);
+    return location->second;
+}
+
+unsigned MpiSimulatorChunk::trial_of(const Operator* op) const{
+    auto trial = op_trials.find(op);
+    return trial != op_trials.end() ? trial->second : 0;
 }
 
 void MpiSimulatorChunk::add_op(OpSpec op_spec){
-    string type_string = op_spec.type_string;
-    vector<string>& args = op_spec.arguments;
     float index = op_spec.index;
 
     try{
-        if(type_string.compare("TimeUpdate") == 0){
-            Signal step = get_signal_view(args[0]);
-            Signal time = get_signal_view(args[1]);
-            dtype dt = boost::lexical_cast<dtype>(args[2]);
+        if(op_spec.type == OP_TIME_UPDATE){
+            Signal step = get_signal_view(op_spec.signal(0));
+            Signal time = get_signal_view(op_spec.signal(1));
+            dtype dt = op_spec.real(2);
 
             add_time_update(
                 index,
                 unique_ptr<TimeUpdate>(new TimeUpdate(step, time, dt)));
 
-        }else if(type_string.compare("Reset") == 0){
-            Signal dst = get_signal_view(args[0]);
-            dtype value = boost::lexical_cast<dtype>(args[1]);
+        }else if(op_spec.type == OP_RESET){
+            Signal dst = get_signal_view(op_spec.signal(0));
+            dtype value = op_spec.real(1);
 
             add_op(index, unique_ptr<Operator>(new Reset(dst, value)));
 
-        }else if(type_string.compare("Copy") == 0){
+        }else if(op_spec.type == OP_COPY){
 
-            Signal dst = get_signal_view(args[0]);
-            Signal src = get_signal_view(args[1]);
+            Signal dst = get_signal_view(op_spec.signal(0));
+            Signal src = get_signal_view(op_spec.signal(1));
 
             add_op(index, unique_ptr<Operator>(new Copy(dst, src)));
 
-        }else if(type_string.compare("SlicedCopy") == 0){
-            Signal src = get_signal_view(args[0]);
-            Signal dst = get_signal_view(args[1]);
+        }else if(op_spec.type == OP_SLICED_COPY){
+            Signal src = get_signal_view(op_spec.signal(0));
+            Signal dst = get_signal_view(op_spec.signal(1));
 
-            int start_src = boost::lexical_cast<int>(args[2]);
-            int stop_src = boost::lexical_cast<int>(args[3]);
-            int step_src = boost::lexical_cast<int>(args[4]);
+            int start_src = op_spec.integer(2);
+            int stop_src = op_spec.integer(3);
+            int step_src = op_spec.integer(4);
 
-            int start_dst = boost::lexical_cast<int>(args[5]);
-            int stop_dst = boost::lexical_cast<int>(args[6]);
-            int step_dst = boost::lexical_cast<int>(args[7]);
+            int start_dst = op_spec.integer(5);
+            int stop_dst = op_spec.integer(6);
+            int step_dst = op_spec.integer(7);
 
-            vector<int> seq_src = python_list_to_index_vector(args[8]);
-            vector<int> seq_dst = python_list_to_index_vector(args[9]);
+            vector<int> seq_src = op_spec.indices(8);
+            vector<int> seq_dst = op_spec.indices(9);
 
-            bool inc = bool(boost::lexical_cast<int>(args[10]));
+            bool inc = bool(op_spec.integer(10));
 
             add_op(index, unique_ptr<Operator>(
                 new SlicedCopy(
@@ -555,64 +2874,81 @@ void MpiSimulatorChunk::add_op(OpSpec op_spec){
                     start_dst, stop_dst, step_dst,
                     seq_src, seq_dst, inc)));
 
-        }else if(type_string.compare("DotInc") == 0){
-            Signal A = get_signal_view(args[0]);
-            Signal X = get_signal_view(args[1]);
-            Signal Y = get_signal_view(args[2]);
+        }else if(op_spec.type == OP_DOT_INC){
+            Signal A = get_signal_view(op_spec.signal(0));
+            Signal X = get_signal_view(op_spec.signal(1));
+            Signal Y = get_signal_view(op_spec.signal(2));
+
+#ifdef NENGO_MPI_CUDA
+            if(device && DeviceDotInc::supports(A, X, Y)){
+                add_op(index, unique_ptr<Operator>(new DeviceDotInc(*device, A, X, Y)));
+                return;
+            }
+#endif
 
             add_op(index, unique_ptr<Operator>(new DotInc(A, X, Y)));
 
-        }else if(type_string.compare("ElementwiseInc") == 0){
-            Signal A = get_signal_view(args[0]);
-            Signal X = get_signal_view(args[1]);
-            Signal Y = get_signal_view(args[2]);
+        }else if(op_spec.type == OP_ELEMENTWISE_INC){
+            Signal A = get_signal_view(op_spec.signal(0));
+            Signal X = get_signal_view(op_spec.signal(1));
+            Signal Y = get_signal_view(op_spec.signal(2));
 
             add_op(index, unique_ptr<Operator>(new ElementwiseInc(A, X, Y)));
 
-        }else if(type_string.compare("LIF") == 0){
-            int n_neurons = boost::lexical_cast<int>(args[0]);
-            dtype tau_rc = boost::lexical_cast<dtype>(args[1]);
-            dtype tau_ref = boost::lexical_cast<dtype>(args[2]);
-            dtype min_voltage = boost::lexical_cast<dtype>(args[3]);
-            dtype dt = boost::lexical_cast<dtype>(args[4]);
-
-            Signal J = get_signal_view(args[5]);
-            Signal output = get_signal_view(args[6]);
-            Signal voltage = get_signal_view(args[7]);
-            Signal ref_time = get_signal_view(args[8]);
+        }else if(op_spec.type == OP_LIF){
+            int n_neurons = op_spec.integer(0);
+            dtype tau_rc = op_spec.real(1);
+            dtype tau_ref = op_spec.real(2);
+            dtype min_voltage = op_spec.real(3);
+            dtype dt = op_spec.real(4);
+
+            Signal J = get_signal_view(op_spec.signal(5));
+            Signal output = get_signal_view(op_spec.signal(6));
+            Signal voltage = get_signal_view(op_spec.signal(7));
+            Signal ref_time = get_signal_view(op_spec.signal(8));
+
+#ifdef NENGO_MPI_CUDA
+            if(device){
+                add_op(index, unique_ptr<Operator>(
+                    new DeviceLIF(
+                        *device, n_neurons, tau_rc, tau_ref, min_voltage,
+                        dt, J, output, voltage, ref_time)));
+                return;
+            }
+#endif
 
             add_op(index, unique_ptr<Operator>(
                 new LIF(
                     n_neurons, tau_rc, tau_ref, min_voltage,
                     dt, J, output, voltage, ref_time)));
 
-        }else if(type_string.compare("LIFRate") == 0){
-            int n_neurons = boost::lexical_cast<int>(args[0]);
-            dtype tau_rc = boost::lexical_cast<dtype>(args[1]);
-            dtype tau_ref = boost::lexical_cast<dtype>(args[2]);
+        }else if(op_spec.type == OP_LIF_RATE){
+            int n_neurons = op_spec.integer(0);
+            dtype tau_rc = op_spec.real(1);
+            dtype tau_ref = op_spec.real(2);
 
-            Signal J = get_signal_view(args[3]);
-            Signal output = get_signal_view(args[4]);
+            Signal J = get_signal_view(op_spec.signal(3));
+            Signal output = get_signal_view(op_spec.signal(4));
 
             add_op(index, unique_ptr<Operator>(
                 new LIFRate(n_neurons, tau_rc, tau_ref, J, output)));
 
-        }else if(type_string.compare("AdaptiveLIF") == 0){
-            int n_neurons = boost::lexical_cast<int>(args[0]);
+        }else if(op_spec.type == OP_ADAPTIVE_LIF){
+            int n_neurons = op_spec.integer(0);
 
-            dtype tau_n = boost::lexical_cast<dtype>(args[1]);
-            dtype inc_n = boost::lexical_cast<dtype>(args[2]);
+            dtype tau_n = op_spec.real(1);
+            dtype inc_n = op_spec.real(2);
 
-            dtype tau_rc = boost::lexical_cast<dtype>(args[3]);
-            dtype tau_ref = boost::lexical_cast<dtype>(args[4]);
-            dtype min_voltage = boost::lexical_cast<dtype>(args[5]);
-            dtype dt = boost::lexical_cast<dtype>(args[6]);
+            dtype tau_rc = op_spec.real(3);
+            dtype tau_ref = op_spec.real(4);
+            dtype min_voltage = op_spec.real(5);
+            dtype dt = op_spec.real(6);
 
-            Signal J = get_signal_view(args[7]);
-            Signal output = get_signal_view(args[8]);
-            Signal voltage = get_signal_view(args[9]);
-            Signal ref_time = get_signal_view(args[10]);
-            Signal adaptation = get_signal_view(args[11]);
+            Signal J = get_signal_view(op_spec.signal(7));
+            Signal output = get_signal_view(op_spec.signal(8));
+            Signal voltage = get_signal_view(op_spec.signal(9));
+            Signal ref_time = get_signal_view(op_spec.signal(10));
+            Signal adaptation = get_signal_view(op_spec.signal(11));
 
             add_op(index, unique_ptr<Operator>(
                 new AdaptiveLIF(
@@ -620,133 +2956,139 @@ void MpiSimulatorChunk::add_op(OpSpec op_spec){
                     min_voltage, dt, J, output, voltage, ref_time,
                     adaptation)));
 
-        }else if(type_string.compare("AdaptiveLIFRate") == 0){
-            int n_neurons = boost::lexical_cast<int>(args[0]);
+        }else if(op_spec.type == OP_ADAPTIVE_LIF_RATE){
+            int n_neurons = op_spec.integer(0);
 
-            dtype tau_n = boost::lexical_cast<dtype>(args[1]);
-            dtype inc_n = boost::lexical_cast<dtype>(args[2]);
+            dtype tau_n = op_spec.real(1);
+            dtype inc_n = op_spec.real(2);
 
-            dtype tau_rc = boost::lexical_cast<dtype>(args[3]);
-            dtype tau_ref = boost::lexical_cast<dtype>(args[4]);
+            dtype tau_rc = op_spec.real(3);
+            dtype tau_ref = op_spec.real(4);
 
-            dtype dt = boost::lexical_cast<dtype>(args[5]);
+            dtype dt = op_spec.real(5);
 
-            Signal J = get_signal_view(args[6]);
-            Signal output = get_signal_view(args[7]);
-            Signal adaptation = get_signal_view(args[8]);
+            Signal J = get_signal_view(op_spec.signal(6));
+            Signal output = get_signal_view(op_spec.signal(7));
+            Signal adaptation = get_signal_view(op_spec.signal(8));
 
             add_op(index, unique_ptr<Operator>(
                 new AdaptiveLIFRate(
                     n_neurons, tau_n, inc_n, tau_rc, tau_ref,
                     dt, J, output, adaptation)));
 
-        }else if(type_string.compare("RectifiedLinear") == 0){
-            int n_neurons = boost::lexical_cast<int>(args[0]);
+        }else if(op_spec.type == OP_RECTIFIED_LINEAR){
+            int n_neurons = op_spec.integer(0);
 
-            Signal J = get_signal_view(args[1]);
-            Signal output = get_signal_view(args[2]);
+            Signal J = get_signal_view(op_spec.signal(1));
+            Signal output = get_signal_view(op_spec.signal(2));
 
             add_op(index, unique_ptr<Operator>(new RectifiedLinear(n_neurons, J, output)));
 
-        }else if(type_string.compare("Sigmoid") == 0){
-            int n_neurons = boost::lexical_cast<int>(args[0]);
-            dtype tau_ref = boost::lexical_cast<dtype>(args[1]);
+        }else if(op_spec.type == OP_SIGMOID){
+            int n_neurons = op_spec.integer(0);
+            dtype tau_ref = op_spec.real(1);
 
-            Signal J = get_signal_view(args[2]);
-            Signal output = get_signal_view(args[3]);
+            Signal J = get_signal_view(op_spec.signal(2));
+            Signal output = get_signal_view(op_spec.signal(3));
 
             add_op(index, unique_ptr<Operator>(new Sigmoid(n_neurons, tau_ref, J, output)));
 
-        }else if(type_string.compare("NoDenSynapse") == 0){
+        }else if(op_spec.type == OP_NO_DEN_SYNAPSE){
 
-            Signal input = get_signal_view(args[0]);
-            Signal output = get_signal_view(args[1]);
-            dtype b = boost::lexical_cast<dtype>(args[2]);
+            Signal input = get_signal_view(op_spec.signal(0));
+            Signal output = get_signal_view(op_spec.signal(1));
+            dtype b = op_spec.real(2);
 
             add_op(index, unique_ptr<Operator>(new NoDenSynapse(input, output, b)));
 
-        }else if(type_string.compare("SimpleSynapse") == 0){
+        }else if(op_spec.type == OP_SIMPLE_SYNAPSE){
 
-            Signal input = get_signal_view(args[0]);
-            Signal output = get_signal_view(args[1]);
-            dtype a = boost::lexical_cast<dtype>(args[2]);
-            dtype b = boost::lexical_cast<dtype>(args[3]);
+            Signal input = get_signal_view(op_spec.signal(0));
+            Signal output = get_signal_view(op_spec.signal(1));
+            dtype a = op_spec.real(2);
+            dtype b = op_spec.real(3);
+
+#ifdef NENGO_MPI_CUDA
+            if(device){
+                add_op(index, unique_ptr<Operator>(
+                    new DeviceSimpleSynapse(*device, input, output, a, b)));
+                return;
+            }
+#endif
 
             add_op(index, unique_ptr<Operator>(new SimpleSynapse(input, output, a, b)));
 
-        }else if(type_string.compare("Synapse") == 0){
+        }else if(op_spec.type == OP_SYNAPSE){
 
-            Signal input = get_signal_view(args[0]);
-            Signal output = get_signal_view(args[1]);
+            Signal input = get_signal_view(op_spec.signal(0));
+            Signal output = get_signal_view(op_spec.signal(1));
 
-            Signal numerator = python_list_to_signal(args[2], false);
-            Signal denominator = python_list_to_signal(args[3], false);
+            Signal numerator = op_spec.values(2);
+            Signal denominator = op_spec.values(3);
 
             add_op(index, unique_ptr<Operator>(new Synapse(input, output, numerator, denominator)));
 
-        }else if(type_string.compare("TriangleSynapse") == 0){
+        }else if(op_spec.type == OP_TRIANGLE_SYNAPSE){
 
-            Signal input = get_signal_view(args[0]);
-            Signal output = get_signal_view(args[1]);
+            Signal input = get_signal_view(op_spec.signal(0));
+            Signal output = get_signal_view(op_spec.signal(1));
 
-            dtype n0 = boost::lexical_cast<dtype>(args[2]);
-            dtype ndiff = boost::lexical_cast<dtype>(args[3]);
-            int n_taps = boost::lexical_cast<int>(args[4]);
+            dtype n0 = op_spec.real(2);
+            dtype ndiff = op_spec.real(3);
+            int n_taps = op_spec.integer(4);
 
             add_op(index, unique_ptr<Operator>(new TriangleSynapse(input, output, n0, ndiff, n_taps)));
 
-        }else if(type_string.compare("WhiteNoise") == 0){
+        }else if(op_spec.type == OP_WHITE_NOISE){
 
-            Signal output = get_signal_view(args[0]);
+            Signal output = get_signal_view(op_spec.signal(0));
 
-            dtype mean = boost::lexical_cast<dtype>(args[1]);
-            dtype std = boost::lexical_cast<dtype>(args[2]);
+            dtype mean = op_spec.real(1);
+            dtype std = op_spec.real(2);
 
-            bool do_scale = bool(boost::lexical_cast<int>(args[3]));
-            bool inc = bool(boost::lexical_cast<int>(args[4]));
+            bool do_scale = bool(op_spec.integer(3));
+            bool inc = bool(op_spec.integer(4));
 
-            dtype dt = boost::lexical_cast<dtype>(args[5]);
+            dtype dt = op_spec.real(5);
 
             add_op(index, unique_ptr<Operator>(
                 new WhiteNoise(output, mean, std, do_scale, inc, dt)));
 
-        }else if(type_string.compare("WhiteSignal") == 0){
+        }else if(op_spec.type == OP_WHITE_SIGNAL){
 
-            bool get_size = true;
-            Signal coefs = python_list_to_signal(args[0], get_size);
+            Signal coefs = op_spec.matrix(0);
 
-            Signal output = get_signal_view(args[1]);
-            Signal time = get_signal_view(args[2]);
-            dtype dt = boost::lexical_cast<dtype>(args[3]);
+            Signal output = get_signal_view(op_spec.signal(1));
+            Signal time = get_signal_view(op_spec.signal(2));
+            dtype dt = op_spec.real(3);
 
             auto op = unique_ptr<Operator>(
                 new WhiteSignal(coefs, output, time, dt));
             add_op(index, move(op));
 
-        }else if(type_string.compare("PresentInput") == 0){
+        }else if(op_spec.type == OP_PRESENT_INPUT){
 
-            bool get_size = true;
-            Signal input = python_list_to_signal(args[0], get_size);
+            Signal input = op_spec.matrix(0);
 
-            Signal output = get_signal_view(args[1]);
-            Signal time = get_signal_view(args[2]);
+            Signal output = get_signal_view(op_spec.signal(1));
+            Signal time = get_signal_view(op_spec.signal(2));
 
-            dtype presentation_time = boost::lexical_cast<dtype>(args[3]);
-            dtype dt = boost::lexical_cast<dtype>(args[4]);
+            dtype presentation_time = op_spec.real(3);
+            dtype dt = op_spec.real(4);
 
             auto op = unique_ptr<Operator>(
                 new PresentInput(input, output, time, presentation_time, dt));
             add_op(index, move(op));
 
-        }else if(type_string.compare("BCM") == 0){
+        }else if(op_spec.type == OP_BCM){
 
-            Signal pre_filtered = get_signal_view(args[0]);
-            Signal post_filtered = get_signal_view(args[1]);
-            Signal theta = get_signal_view(args[2]);
-            Signal delta = get_signal_view(args[3]);
+            Signal pre_filtered = get_signal_view(op_spec.signal(0));
+            Signal post_filtered = get_signal_view(op_spec.signal(1));
+            Signal theta = get_signal_view(op_spec.signal(2));
+            Signal delta = get_signal_view(op_spec.signal(3));
 
-            dtype learning_rate = boost::lexical_cast<dtype>(args[4]);
-            dtype dt = boost::lexical_cast<dtype>(args[5]);
+            dtype learning_rate = op_spec.real(4);
+            dtype dt = op_spec.real(5);
 
             auto op = unique_ptr<Operator>(
                 new BCM(
@@ -754,86 +3096,84 @@ void MpiSimulatorChunk::add_op(OpSpec op_spec){
                     delta, learning_rate, dt));
             add_op(index, move(op));
 
-        }else if(type_string.compare("Oja") == 0){
+        }else if(op_spec.type == OP_OJA){
 
-            Signal pre_filtered = get_signal_view(args[0]);
-            Signal post_filtered = get_signal_view(args[1]);
-            Signal weights = get_signal_view(args[2]);
-            Signal delta = get_signal_view(args[3]);
+            Signal pre_filtered = get_signal_view(op_spec.signal(0));
+            Signal post_filtered = get_signal_view(op_spec.signal(1));
+            Signal weights = get_signal_view(op_spec.signal(2));
+            Signal delta = get_signal_view(op_spec.signal(3));
 
-            dtype learning_rate = boost::lexical_cast<dtype>(args[4]);
-            dtype dt = boost::lexical_cast<dtype>(args[5]);
-            dtype beta = boost::lexical_cast<dtype>(args[6]);
+            dtype learning_rate = op_spec.real(4);
+            dtype dt = op_spec.real(5);
+            dtype beta = op_spec.real(6);
 
             add_op(index, unique_ptr<Operator>(
                 new Oja(
                     pre_filtered, post_filtered, weights, delta, learning_rate, dt, beta)));
 
-        }else if(type_string.compare("Voja") == 0){
+        }else if(op_spec.type == OP_VOJA){
 
-            Signal pre_decoded = get_signal_view(args[0]);
-            Signal post_filtered = get_signal_view(args[1]);
-            Signal scaled_encoders = get_signal_view(args[2]);
-            Signal delta = get_signal_view(args[3]);
-            Signal learning_signal = get_signal_view(args[4]);
+            Signal pre_decoded = get_signal_view(op_spec.signal(0));
+            Signal post_filtered = get_signal_view(op_spec.signal(1));
+            Signal scaled_encoders = get_signal_view(op_spec.signal(2));
+            Signal delta = get_signal_view(op_spec.signal(3));
+            Signal learning_signal = get_signal_view(op_spec.signal(4));
 
-            Signal scale = python_list_to_signal(args[5], false);
+            Signal scale = op_spec.values(5);
 
-            dtype learning_rate = boost::lexical_cast<dtype>(args[6]);
-            dtype dt = boost::lexical_cast<dtype>(args[7]);
+            dtype learning_rate = op_spec.real(6);
+            dtype dt = op_spec.real(7);
 
             add_op(index, unique_ptr<Operator>(
                 new Voja(
                     pre_decoded, post_filtered, scaled_encoders, delta,
                     learning_signal, scale, learning_rate, dt)));
 
-        }else if(type_string.compare("MpiSend") == 0){
+        }else if(op_spec.type == OP_MPI_SEND){
+
+            send_components[op_spec.key(2)].insert(op_spec.integer(0));
 
             if(n_processors > 1){
-                int dst = boost::lexical_cast<int>(args[0]);
-                dst = dst % n_processors;
+                int dst = mapping.process_of(op_spec.integer(0));
                 if(dst != rank){
 
-                    int tag = boost::lexical_cast<int>(args[1]);
-                    key_type signal_key = boost::lexical_cast<key_type>(args[2]);
+                    int tag = op_spec.integer(1);
+                    key_type signal_key = op_spec.key(2);
                     Signal content = get_signal(signal_key);
 
-                    add_mpi_send(index, dst, tag, content);
+                    // Older network files don't say whether a send is an update.
+                    bool can_merge = op_spec.n_arguments() > 3;
+                    bool is_update = can_merge && bool(op_spec.integer(3));
+
+                    add_mpi_send(index, dst, tag, content, is_update, can_merge);
                 }
             }
 
-        }else if(type_string.compare("MpiRecv") == 0){
+        }else if(op_spec.type == OP_MPI_RECV){
 
             if(n_processors > 1){
-                int src = boost::lexical_cast<int>(args[0]);
-                src = src % n_processors;
+                int src = mapping.process_of(op_spec.integer(0));
 
                 if(src != rank){
-                    int tag = boost::lexical_cast<int>(args[1]);
-                    key_type signal_key = boost::lexical_cast<key_type>(args[2]);
+                    int tag = op_spec.integer(1);
+                    key_type signal_key = op_spec.key(2);
                     Signal content = get_signal(signal_key);
-                    bool is_update = bool(boost::lexical_cast<int>(args[3]));
+                    bool is_update = bool(op_spec.integer(3));
 
                     add_mpi_recv(index, src, tag, content, is_update);
                 }
             }
 
-        }else if(type_string.compare("SpaunStimulus") == 0){
-            Signal output = get_signal_view(args[0]);
-            Signal time = get_signal_view(args[1]);
+        }else if(op_spec.type == OP_SPAUN_STIMULUS){
+            Signal output = get_signal_view(op_spec.signal(0));
+            Signal time = get_signal_view(op_spec.signal(1));
 
-            string stim_seq_str = args[2];
-            boost::trim_if(stim_seq_str, boost::is_any_of("[]"));
-            boost::replace_all(stim_seq_str, "\"", "");
-            boost::replace_all(stim_seq_str, "\'", "");
+            vector<string> stim_seq = op_spec.strings(2);
 
-            vector<string> stim_seq;
-            boost::split(stim_seq, stim_seq_str, boost::is_any_of(","));
+            dtype present_interval = op_spec.real(3);
+            dtype present_blanks = op_spec.real(4);
 
-            dtype present_interval = boost::lexical_cast<dtype>(args[3]);
-            dtype present_blanks = boost::lexical_cast<dtype>(args[4]);
-
-            int identifier = boost::lexical_cast<int>(args[5]);
+            int identifier = op_spec.integer(5);
 
             auto op = unique_ptr<Operator>(
                 new SpaunStimulus(
@@ -844,7 +3184,7 @@ void MpiSimulatorChunk::add_op(OpSpec op_spec){
 
         }else{
             stringstream msg;
-            msg << "Received an operator type that nengo_mpi can't handle: " << type_string;
+            msg << "Received an operator type that nengo_mpi can't handle: " << op_spec.type_string;
             throw runtime_error(msg.str());
         }
 
@@ -852,13 +3192,7 @@ void MpiSimulatorChunk::add_op(OpSpec op_spec){
         stringstream msg;
         msg << "Caught bad lexical cast while extracting operator from OpSpec "
                "with error " << e.what() << endl;
-        msg << "The operator type was: " << type_string << endl;
-        msg << "The arguments were: " << endl;
-        int i = 0;
-        for(auto& s: args){
-            msg << i << ": " << s << endl;
-            i++;
-        }
+        msg << op_spec.to_string();
 
         throw runtime_error(msg.str());
     }
@@ -868,6 +3202,10 @@ void MpiSimulatorChunk::add_op(float index, unique_ptr<Operator> op){
     build_dbg(
         "At index " << index << ", adding op:" << endl << *(op.get()));
 
+    if(current_trial > 0){
+        op_trials[op.get()] = current_trial;
+    }
+
     operator_list.push_back(op.get());
     op->set_index(index);
     operator_store.push_back(move(op));
@@ -881,23 +3219,48 @@ void MpiSimulatorChunk::add_time_update(float index, unique_ptr<TimeUpdate> time
     }
 }
 
-void MpiSimulatorChunk::add_mpi_send(float index, int dst, int tag, Signal content){
-    auto mpi_send = unique_ptr<MPISend>(new MPISend(dst, tag, content));
-    operator_list.push_back((Operator *) mpi_send.get());
-    mpi_send->set_index(index);
-    mpi_sends.push_back(move(mpi_send));
+// The record of the first trial's copy of a transfer, which is the
+// latest record with the same process and tag.
+static MPIOpRecord& find_first_trial_record(vector<MPIOpRecord>& records, int other, int tag){
+    for(auto record = records.rbegin(); record != records.rend(); record++){
+        if(record->other == other && record->tag == tag){
+            return *record;
+        }
+    }
+
+    stringstream msg;
+    msg << "Adding a later trial's copy of an MPI transfer with tag " << tag
+        << ", but the first trial has no such transfer." << endl;
+    throw logic_error(msg.str());
+}
+
+void MpiSimulatorChunk::add_mpi_send(
+        float index, int dst, int tag, Signal content, bool is_update, bool can_merge){
+
+    if(current_trial > 0){
+        find_first_trial_record(send_records, dst, tag).trial_contents.push_back(content);
+    }else{
+        send_records.push_back({index, dst, tag, content, is_update, can_merge});
+    }
 }
 
 void MpiSimulatorChunk::add_mpi_recv(float index, int src, int tag, Signal content, bool is_update){
-    auto mpi_recv = unique_ptr<MPIRecv>(new MPIRecv(src, tag, content, is_update));
-    operator_list.push_back((Operator *) mpi_recv.get());
-    mpi_recv->set_index(index);
-    mpi_recvs.push_back(move(mpi_recv));
+    if(current_trial > 0){
+        find_first_trial_record(recv_records, src, tag).trial_contents.push_back(content);
+    }else{
+        recv_records.push_back({index, src, tag, content, is_update, true});
+    }
 }
 
 void MpiSimulatorChunk::add_probe(ProbeSpec ps){
-    Signal signal = get_signal_view(ps.signal_spec);
-    probe_map[ps.probe_key] = shared_ptr<Probe>(new Probe(signal, ps.period));
+    vector<Signal> signals;
+    for(current_trial = 0; current_trial < n_trials; current_trial++){
+        signals.push_back(get_signal_view(ps.signal_spec));
+    }
+
+    current_trial = 0;
+
+    probe_map[ps.probe_key] = shared_ptr<Probe>(new Probe(signals, ps.period, ps.reduction, dt));
 }
 
 void MpiSimulatorChunk::set_log_filename(string lf){
@@ -914,30 +3277,69 @@ bool MpiSimulatorChunk::is_logging(){
 }
 
 void MpiSimulatorChunk::close_simulation_log(){
+    log_writer.reset();
     sim_log->close();
 }
 
 void MpiSimulatorChunk::flush_probes(){
     if(sim_log->is_ready()){
+        double begin = wall_time();
+        vector<ProbeWrite> writes;
+
         for(auto& kv : probe_map){
             unsigned n_rows = 0;
             shared_ptr<dtype> buffer = (kv.second)->flush_to_buffer(n_rows);
+            writes.push_back(ProbeWrite(kv.first, buffer, n_rows));
+        }
 
-            try{
-                sim_log->write(kv.first, buffer, n_rows);
-            }catch(out_of_range& e){
-                stringstream msg;
-                msg << "Trying to write to simulation log on rank " << rank << " using "
-                       "invalid probe key: " << kv.first << "." << endl;
-                throw out_of_range(msg.str());
+        try{
+            if(log_writer){
+                log_writer->submit(move(writes));
+            }else{
+                double write_begin = wall_time();
+                sim_log->write_batch(writes);
+
+                if(tracer){
+                    tracer->record(tracer->add_name("write log"), write_begin, wall_time());
+                }
+            }
+        }catch(out_of_range& e){
+            stringstream msg;
+            msg << "Trying to write to simulation log on rank " << rank << ": "
+                << e.what();
+            throw out_of_range(msg.str());
+        }
+
+        if(tracer){
+            tracer->record(tracer->add_name("flush probes"), begin, wall_time());
+        }
+    }
+}
+
+void MpiSimulatorChunk::wait_for_probe_writes(){
+    if(log_writer){
+        try{
+            double begin = wall_time();
+            log_writer->wait();
+
+            if(tracer){
+                tracer->record(tracer->add_name("wait for log writes"), begin, wall_time());
             }
+        }catch(out_of_range& e){
+            stringstream msg;
+            msg << "Trying to write to simulation log on rank " << rank << ": "
+                << e.what();
+            throw out_of_range(msg.str());
         }
     }
 }
 
 void MpiSimulatorChunk::process_timing_data(
         int n_steps, const map<string, double>& per_class_average_timings,
-        const double per_op_timings[], const vector<double>& step_times){
+        const double per_op_timings[]){
+
+    const vector<double>& step_times = tracer->get_step_times();
+    const vector<double>& step_waits = tracer->get_step_waits();
 
     double sum = std::accumulate(step_times.begin(), step_times.end(), 0.0);
     double mean = sum / step_times.size();
@@ -955,7 +3357,7 @@ void MpiSimulatorChunk::process_timing_data(
     map<string, double> class_cumulative;
 
     int op_index = 0;
-    for(auto& op: operator_list){
+    for(auto& op: op_schedule){
         string class_name = op->classname();
 
         class_count[class_name] += 1;
@@ -975,6 +3377,8 @@ void MpiSimulatorChunk::process_timing_data(
 
     runtimes_ss << endl << "Rank " << rank << " runtimes." << endl;
     runtimes_ss << "Mean seconds-per-step: " << mean << ", stdev: " << stdev << endl;
+    runtimes_ss << "Mean seconds-per-step waiting for messages: "
+        << std::accumulate(step_waits.begin(), step_waits.end(), 0.0) / step_waits.size() << endl;
 
     for(auto& p : class_cumulative){
         string class_name = p.first;
@@ -989,10 +3393,23 @@ void MpiSimulatorChunk::process_timing_data(
         runtimes_ss << class_name << "_slowest_op" << delim << endl << *class_slowest_op[class_name] << endl;
     }
 
+    // Time that the MPI operators spent blocked, which is included in their runtimes.
+    double send_wait = 0.0, recv_wait = 0.0;
+    for(auto& send: mpi_sends){
+        send_wait += send->get_wait_time();
+    }
+
+    for(auto& recv: mpi_recvs){
+        recv_wait += recv->get_wait_time();
+    }
+
+    runtimes_ss << "MPISend_wait_cumulative" << delim << send_wait / double(n_steps) << endl;
+    runtimes_ss << "MPIRecv_wait_cumulative" << delim << recv_wait / double(n_steps) << endl;
+
     vector<pair<double, Operator*>> op_runtimes;
 
     op_index = 0;
-    for(auto op: operator_list){
+    for(auto op: op_schedule){
         op_runtimes.push_back({per_op_timings[op_index], op});
         op_index++;
     }
@@ -1012,6 +3429,58 @@ void MpiSimulatorChunk::process_timing_data(
     sim_log->write_file("_runtimes", rank, MAX_RUNTIME_OUTPUT_SIZE, runtimes_ss.str());
 }
 
+void MpiSimulatorChunk::write_profile(int n_steps, const double per_op_timings[]){
+    stringstream out;
+    out.precision(9);
+
+    if(rank == 0){
+        out << "kind,rank,index,class,peer,tag,seconds_per_step,bytes_per_step" << endl;
+    }
+
+    // The MPI operators spend most of their time waiting for other processes,
+    // so messages are profiled by their size instead.
+    for(unsigned i = 0; i < op_schedule.size(); i++){
+        const Operator* op = op_schedule[i];
+        if(dynamic_cast<const MPIOperator*>(op) || dynamic_cast<const MPIWait*>(op)){
+            continue;
+        }
+
+        double seconds = per_op_timings[i] / n_steps;
+
+        auto merged = merged_shares.find(op);
+        if(merged == merged_shares.end()){
+            out << "op," << rank << "," << op->get_index() << "," << op->classname()
+                << ",,," << seconds << "," << endl;
+            continue;
+        }
+
+        double total = 0.0;
+        for(auto& share: merged->second){
+            total += share.second;
+        }
+
+        string merged_class = dynamic_cast<const BatchedDotInc*>(op) ? "DotInc" : op->classname();
+
+        for(auto& share: merged->second){
+            out << "op," << rank << "," << share.first << "," << merged_class << ",,,"
+                << seconds * share.second / total << "," << endl;
+        }
+    }
+
+    // Each send before grouping is a connection to another process.
+    for(const MPIOpRecord& send: send_records){
+        unsigned n_values = send.content.size;
+        for(const Signal& trial_content: send.trial_contents){
+            n_values += trial_content.size;
+        }
+
+        out << "send," << rank << "," << send.index << ",," << send.other << ","
+            << send.tag << ",," << n_values * sizeof(dtype) << endl;
+    }
+
+    write_in_rank_order(profile_file, out.str(), comm, "cost profile");
+}
+
 string MpiSimulatorChunk::to_string() const{
     stringstream out;
 
@@ -1,16 +1,24 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <list>
 #include <string>
 #include <sstream>
+#include <iomanip>
 #include <vector>
 #include <memory> // unique_ptr
+#include <atomic>
+#include <mutex>
+#include <functional>
 #include <algorithm> // sort_stable
 #include <utility> // pair
+#include <tuple>
+#include <climits>
 #include <exception>
 #include <string>
 #include <assert.h>
+#include <cstdlib> // posix_memalign
 
 #include <mpi.h>
 
@@ -23,34 +31,130 @@
 #include "probe.hpp"
 #include "sim_log.hpp"
 #include "psim_log.hpp"
-#include "ezProgressBar-2.1.1/ezETAProgressBar.hpp"
+#include "log_writer.hpp"
+#include "trace.hpp"
+#include "config.hpp"
+#include "thread_pool.hpp"
+#include "net_file.hpp"
+#include "device.hpp"
+#include "progress.hpp"
+#include "realtime.hpp"
 
 #include "typedef.hpp"
 #include "debug.hpp"
 
-// How frequently to flush the probe buffers, in units of number of steps.
-const int FLUSH_PROBES_EVERY = 1000;
+/* A run of consecutive operators in the chunk's schedule that all
+ * have the same concrete type, and can therefore be executed by a
+ * single BatchRunner without any virtual calls. */
+struct OpBatch{
+    BatchRunner runner;
+    unsigned start;
+    unsigned n_ops;
+};
+
+/* A wavefront of the chunk's operator dependency graph, used when the chunk is
+ * run with more than one thread. No operator in a level reads or writes a signal
+ * that another operator in the same level writes, so the operators in a level can
+ * run in any order, or concurrently, once every earlier level has completed.
+ * Operators that are not thread safe are run in index order by the main thread. */
+struct OpLevel{
+    vector<Operator*> serial_ops;
+    vector<Operator*> parallel_ops;
+};
+
+/* A send or receive of a single signal, as read from the network file. These are
+ * merged into MPISend and MPIRecv operators, each of which transfers a group of
+ * signals, when the chunk is finalized. ``other'' is the destination process
+ * of a send, or the source process of a receive. */
+struct MPIOpRecord{
+    float index;
+    int other;
+    int tag;
+    Signal content;
+    bool is_update;
+
+    // False for sends read from network files that predate grouping, which
+    // don't record is_update for sends.
+    bool can_merge;
+
+    // The same signal in trials 1 and up, which is transferred in the same message.
+    vector<Signal> trial_contents;
+};
 
 /* An MpiSimulatorChunk represents the portion of a Nengo
  * network that is simulated by a single MPI process. */
 class MpiSimulatorChunk{
 
 public:
-    MpiSimulatorChunk(bool collect_timings);
-    MpiSimulatorChunk(int rank, int n_processors, bool collect_timings);
+    MpiSimulatorChunk(SimulatorConfig config);
+    MpiSimulatorChunk(int rank, int n_processors, SimulatorConfig config);
     string classname() const { return "MpiSimulatorChunk"; }
 
-    /* Add simulation objects to the chunk from an HDF5 file. */
-    void from_file(string filename, hid_t file_plist, hid_t read_plist);
+    /* Add simulation objects to the chunk from an HDF5 file. comm contains
+     * every process loading the network (and is MPI_COMM_NULL when loading
+     * without MPI); all of them must call from_file. See NetworkFile. */
+    void from_file(string filename, MPI_Comm comm);
+
+    /* The same, from a network held in memory by process 0 (see PackedNetwork).
+     * When components may be rebalanced, the chunk keeps ``network'' to
+     * rebuild itself from. */
+    void from_network(shared_ptr<const PackedNetwork> network, MPI_Comm comm);
 
     /* Run an integer number of steps. Called by a
      * worker process once it gets a signal from the master
      * process telling the worker to begin a simulation. */
     void run_n_steps(int steps, bool progress);
 
-    /* Reset the chunk. */
+    /* Run the operators for ``steps'' steps using the thread pool, following
+     * level_schedule. begin_step and end_step are called by the main thread
+     * before and after the operators are run on each step. */
+    void run_threaded(
+        int steps, function<void(unsigned)> begin_step, function<void()> end_step);
+
+    /* Reset the chunk. Trial k is reset with seed + k. */
     void reset(unsigned seed);
 
+    /* Write the state of the chunk to a checkpoint: the base signals that
+     * operators write to, the state of operators that is not stored in
+     * signals, and any update message that has been received but not yet
+     * unpacked. With more than one process, every chunk must call this
+     * between the same two steps, and the checkpoint is written collectively.
+     * Probe data is not part of the checkpoint; a simulation that writes a
+     * checkpoint should be logging its probe data to a file. */
+    void checkpoint(string filename);
+
+    /* Restore the chunk to the state saved in a checkpoint. Called in place of
+     * reset, once the chunk has been loaded from the network file the
+     * checkpoint was written for and finalized with the same number of
+     * processes. Later simulations carry on from the step of the checkpoint. */
+    void restore(string filename);
+
+    /* Decide whether to move components between processes before the next
+     * simulation, from the cost of each component measured during the last
+     * one (see SimulatorConfig::rebalance and rebalance_components). Every
+     * chunk in comm must call this, and gets the same answer. Returns whether
+     * any component moves, and if so, sets ``new_mapping'' to where the
+     * components go. */
+    bool plan_rebalance(ComponentMapping& new_mapping);
+
+    /* Take over the state of a simulation from ``old'', a chunk of the same
+     * network on the same processes that simulates different components,
+     * after they were moved between processes by plan_rebalance. Called in
+     * place of reset, once the chunk has been loaded and finalized. Every
+     * chunk in comm must call this. The state is what a checkpoint saves:
+     * the values of the signals that operators write (which each process
+     * sends to where the components that use them now are), the state of
+     * operators that is not stored in signals (the state of filters is moved
+     * per output, since they are merged differently on each process), and
+     * the update messages that are about to be unpacked, which are recreated
+     * from the values of the signals they carry. Probes carry on as after
+     * restoring a checkpoint. */
+    void migrate_from(MpiSimulatorChunk& old);
+
+    unsigned get_steps_since_reset() const{ return steps_since_reset; }
+
+    unsigned get_n_trials() const{ return n_trials; }
+
     // *** Signals ***
 
     /* Add data to the chunk, in the form of a Signal. All data in
@@ -95,6 +199,9 @@ public:
      * as the signal that it is a view of). */
     Signal get_signal(key_type key);
 
+    /* All of the functions above return views of the signals of the first
+     * trial, except while the chunk is adding the operators of a later trial. */
+
     // *** Operators ***
 
     /* Functions used to add operators to the chunk. These
@@ -120,8 +227,10 @@ public:
 
     /* Add MPI-related operators. These have to be added separately,
      * because we need to initialize them in a special way before the
-     * simulation begins. */
-    void add_mpi_send(float index, int dst, int tag, Signal content);
+     * simulation begins. Sends and receives are recorded here, and only turned
+     * into operators by build_mpi_groups. */
+    void add_mpi_send(
+        float index, int dst, int tag, Signal content, bool is_update, bool can_merge=true);
     void add_mpi_recv(float index, int src, int tag, Signal content, bool is_update);
 
     // *** Probes ***
@@ -134,16 +243,131 @@ public:
     void finalize_build();
     void finalize_build(MPI_Comm comm);
 
+    /* Merge the recorded sends into MPISend operators, one per group of sends
+     * to the same destination that can share a message, and tell each destination
+     * how its messages are composed so that it can build matching MPIRecv
+     * operators. A group consists of sends with the same destination and value
+     * of is_update between which there is no receive. The group is sent at the
+     * index of its last member and received at the index of its first, so no
+     * process waits for a message that in the ungrouped schedule it would have
+     * had to wait for anyway. Must be called by every process in comm. */
+    void build_mpi_groups(MPI_Comm comm);
+
+    /* Find the memory that holds the spikes of neurons (see
+     * Operator::spike_output), leaving out any that other operators also
+     * write to, so that signals lying in it can be sent as spikes. When the
+     * log stores spike events, also tells the simulation log which probes
+     * record nothing but spikes. Must be called by every process in comm,
+     * before build_mpi_groups. */
+    void find_spike_signals(MPI_Comm comm);
+
+    // Whether all of a signal lies in memory found by find_spike_signals.
+    bool is_spike_signal(const Signal& signal) const;
+
+    /* Called on the sorted operator list to speed up matrix-vector DotIncs
+     * whose matrix is not written by any operator. Those with mostly zero
+     * matrices become SparseDotIncs, and small ones that share an X and can be
+     * moved next to each other are merged into BatchedDotIncs. When several
+     * trials are simulated, the copies of each other DotInc in the trials are
+     * merged into a TrialDotInc. Of the rest, those with a dimension of at most
+     * MAX_SMALL_DOT_INC_DIM become SmallDotIncs. */
+    void optimize_dot_incs();
+
+    /* Called on the sorted operator list to merge each run of adjacent
+     * SlicedCopies into the same destination into the first of them, so
+     * that their compiled plans run as one operator. */
+    void merge_sliced_copies();
+
+    /* Called on the sorted operator list to merge each SimpleSynapse, Synapse
+     * and TriangleSynapse into the first earlier synapse with the same filter
+     * that it can be moved up to, within a window of operators, so that each
+     * group is updated in lockstep by one operator. */
+    void merge_synapses();
+
+    /* Called on the sorted operator list to make each learning rule add its
+     * delta to its target itself, in place of the ElementwiseInc (or scalar
+     * DotInc) that would, when the rule can be moved down to that operator's
+     * position. Also makes the rules update every learning_every steps. */
+    void optimize_learning_rules();
+
+    /* Called on the final operator list, if quiescence is positive, to make
+     * the operators that can skip their work while their inputs are zero do
+     * so (see SimulatorConfig::quiescence). */
+    void gate_quiescent_ops();
+
+    /* Called on the sorted operator list to overlap communication with
+     * computation. Each MPIRecv is moved as late as possible, to just before
+     * the first operator that uses any of the signals it receives, and each
+     * MPISend as early as possible, to just after the last operator that
+     * writes any of the signals it sends. Moving a receive later and a send
+     * earlier never makes a process wait for a message that it would not
+     * have waited for in index order, so this introduces no deadlocks. */
+    void schedule_mpi_ops();
+
+    /* Has the MPI operators that transfer messages between this process and
+     * others on the same node use a SharedMailbox instead of MPI. Each process
+     * allocates the mailboxes of its sends in a window of shared memory, and
+     * tells their receivers where they are. Collective over the communicator
+     * the chunk is finalized with. Does nothing unless built with MPI-3. */
+    void build_shared_transport();
+
+    /* Frees the shared memory of the mailboxes, after which the MPI operators
+     * can't be run. Collective over the processes on the node, so it is called
+     * when the simulator is closed rather than when the chunk is destroyed. */
+    void free_shared_transport();
+
+    /* Called on the sorted operator list when MPI transfers are made in place.
+     * Puts an MPIWait in front of the first operator that writes to the
+     * contents of each in-place MPISend, so the contents are not overwritten
+     * before the previous step's message has been sent. Sends whose contents
+     * are also written after the send go back to using a buffer. */
+    void place_mpi_waits();
+
+    /* Called on the sorted operator list with the cuda backend, once every
+     * operator is in place. Puts a DeviceSync in front of each operator run
+     * on the host that reads or writes a base signal that a device operator
+     * has used since the last DeviceSync, or that doesn't declare what it
+     * uses, and one at the end of the list, so that the host sees the results
+     * of the device operators and every step is done when it ends. */
+    void place_device_syncs();
+
+    /* Flatten the sorted operator list into op_schedule, and split it into
+     * batches of consecutive operators that share a BatchRunner. Execution
+     * order is exactly the order of operator_list. */
+    void build_schedule();
+
+    /* Assign each operator to the earliest OpLevel that comes after every
+     * operator it conflicts with, based on the signals that each operator
+     * declares that it reads and writes. An operator conflicts with an earlier
+     * one if it writes memory that the earlier one reads or writes, or reads
+     * memory that the earlier one writes. Operators that are not thread safe
+     * additionally keep their relative order. */
+    void build_parallel_schedule();
+
     void set_log_filename(string lf);
     bool is_logging();
     void close_simulation_log();
 
+    /* Hand the data collected by the probes to the simulation log. If the
+     * chunk has a log writer, the data is written in the background, and
+     * wait_for_probe_writes must be called before the log is used again. */
     void flush_probes();
+    void wait_for_probe_writes();
     size_t get_num_probes(){return probe_map.size();}
 
+    // Write the runtimes of the operators, measured over n_steps steps, and
+    // the step times recorded by the tracer to the ``_runtimes'' file.
     void process_timing_data(
         int n_steps, const map<string, double>& per_class_average_timings,
-        const double per_op_timings[], const vector<double>& step_times);
+        const double per_op_timings[]);
+
+    /* Write the cost profile of the last simulation to ``profile_file'': a
+     * CSV with a row for the seconds per step of each operator read from the
+     * network file, and one for the bytes per step of each message sent to
+     * another process, which can be traced back to the objects and
+     * connections of the network by their index and tag. Every process takes
+     * part, writing its own rows. */
+    void write_profile(int n_steps, const double per_op_timings[]);
 
     string to_string() const;
 
@@ -158,29 +382,249 @@ public:
     map<key_type, shared_ptr<Probe>> probe_map;
     vector<ProbeSpec> probe_info;
 
+    // Which process simulates each component, known once loaded from a file.
+    const ComponentMapping& get_mapping() const{ return mapping; }
+
+    /* Simulate the components that ``mapping'' gives this process, instead
+     * of those given by the network file and the mapping mode. Must be
+     * called before from_file. */
+    void set_mapping(const ComponentMapping& mapping){ this->mapping = mapping; }
+
+    // The network file the chunk was loaded from.
+    const string& get_filename() const{ return filename; }
+
+    // The network in memory that the chunk was loaded from, if it was kept.
+    shared_ptr<const PackedNetwork> get_network() const{ return network; }
+
+    // Bytes of the signals, their initial values and the buffers of the
+    // operators on this process, as counted by report_memory.
+    size_t memory_bytes() const{
+        return signal_bytes + init_value_bytes() + operator_buffer_bytes();
+    }
+
 private:
+    /* Add the signals, operators and probes of a component read from a network file.
+     *
+     * When several trials are simulated, every base signal that an operator
+     * (other than the TimeUpdate) writes to gets a copy for each trial, and the
+     * copies of all such signals are stored trial after trial in one array, so
+     * that the copies of a signal are a fixed distance apart. Other signals,
+     * such as constant weights, are shared by the trials. Each operator is then
+     * added once per trial, operating on that trial's copies, and each probe
+     * records every trial. The signals with a copy per trial must already be in
+     * trial_keys. */
+    void add_component(const NetworkComponent& component);
+
+    // Add the components that ``network_file'' gives this process.
+    void load(NetworkFile& network_file);
+
+    /* Add the keys of the base signals of a component that have a copy in
+     * each trial to ``keys'', by building the component in a separate chunk and
+     * looking at the signals that its operators write to. */
+    void find_trial_signals(const NetworkComponent& component, set<key_type>& keys);
+
+    /* Set up the backend named by the config, which the constructors have
+     * copied into ``backend''. */
+    void init_backend();
+
+    /* Memory for ``size'' values of base signals, aligned to SIGNAL_ALIGNMENT
+     * bytes. Managed memory with the cuda backend. */
+    shared_ptr<dtype> allocate_signals(unsigned size);
+
+    /* The base signal with the given key in current_trial. */
+    const Signal& base_signal(key_type key) const;
+
+    /* The trial whose signals an operator was added with. */
+    unsigned trial_of(const Operator* op) const;
+
+    /* Choose where in a component's arena each of its base signals will be
+     * stored. Signals are placed in the order in which operators first use
+     * them, going by operator index, so that signals used together are close
+     * to one another, and each starts on a SIGNAL_ALIGNMENT byte boundary.
+     * Fills ``offsets'' and returns the size of the arena. */
+    unsigned layout_base_signals(
+        const vector<OpSpec>& op_specs, const vector<pair<key_type, unsigned>>& signal_sizes,
+        map<key_type, unsigned>& offsets);
+
+    /* Choose where in a single array each signal that a component sends to
+     * or receives from another process will be stored, so that the signals
+     * transferred in the same direction with the same process are adjacent, in
+     * the order of their operators' indices. Used by layout_base_signals when
+     * MPI transfers are made in place. Fills ``offsets'' and returns the size
+     * of the array. */
+    unsigned layout_mpi_signals(
+        const vector<OpSpec>& op_specs, const map<key_type, unsigned>& signal_sizes,
+        map<key_type, unsigned>& offsets);
+
+    /* Divide the time per step that each operator took over the n_steps steps
+     * whose operators were timed between the components they came from,
+     * for plan_rebalance. */
+    void measure_component_costs(unsigned n_steps, const double per_op_timings[]);
+
+    /* The state that migrate_from moves out of this chunk, as a block for
+     * each process, going by where the components are in ``new_mapping''. */
+    vector<string> save_migrating_state(const ComponentMapping& new_mapping);
+
+    // The key and trial of each base signal, by its memory.
+    map<const dtype*, pair<key_type, unsigned>> base_signal_keys() const;
+
+    // The keys of the base signals that the operators, or the messages
+    // received from other processes, write to in any trial.
+    set<key_type> written_signal_keys() const;
+
+    /* Copy the values of the base signals in written_signal_keys into
+     * signal_init_value, before anything runs. Other signals, such as
+     * weights, are never changed, so reset leaves them as they are. */
+    void save_init_values();
+
+    size_t init_value_bytes() const;
+    size_t operator_buffer_bytes() const;
+
+    /* Print, on rank 0, how much memory the signals, their initial values and
+     * the buffers of the operators take on the busiest process and node. */
+    void report_memory();
+
+    /* Store a base signal under the given key, or check that it matches the
+     * one already stored there. Returns whether it was stored. Unlike
+     * add_base_signal, it doesn't count the signal in signal_bytes. */
+    bool store_base_signal(key_type key, Signal signal);
+
     int rank;
     int n_processors;
 
+    // The communicator the chunk was finalized with.
+    MPI_Comm comm;
+
+    // The processes of comm on the same node as this one, and the shared
+    // memory holding the mailboxes of their transfers, if any.
+    MPI_Comm node_comm;
+    MPI_Win shared_window;
+
+    // Seed of the last reset, and number of steps simulated since then.
+    unsigned seed;
+    unsigned steps_since_reset;
+
+    unsigned n_trials;
+
+    // The trial whose operators are being added.
+    unsigned current_trial;
+
+    // The component whose operators are being added.
+    int current_component;
+
+    // The network file that the chunk was loaded from.
+    string filename;
+    shared_ptr<const PackedNetwork> network;
+
+    // The component of each operator read from the network file, by index.
+    map<float, int> op_components;
+
+    // The components simulated by this process that contain each base
+    // signal, and those that any of them send it to, on any process.
+    map<key_type, set<int>> signal_components;
+    map<key_type, set<int>> send_components;
+
+    // Seconds per step that each component, and operators that belong to no
+    // component, took during the last simulation. Empty until measured.
+    vector<double> component_costs;
+    double process_cost;
+
+    // Bytes of the base signals, for report_memory: the whole arenas of the
+    // components, padding and every trial's copies included, and the signals
+    // given straight to add_base_signal.
+    size_t signal_bytes;
+
+    // Whether finalize_build calls report_memory.
+    bool print_memory;
+
     unique_ptr<SimulationLog> sim_log;
     string log_filename;
 
+    // Only exists during a simulation that writes probe data in the background.
+    // Declared after sim_log so that it is destroyed first.
+    unique_ptr<AsyncLogWriter> log_writer;
+
     map<key_type, Signal> signal_map;
+
+    // The values that reset restores, for the base signals that operators
+    // write to. Signals that start out the same share a copy.
     map<key_type, Signal> signal_init_value;
 
+    // Keys of the base signals that have a copy per trial, in any component.
+    // Components can share signals, so these are found for the whole network
+    // before any component is added.
+    set<key_type> trial_keys;
+
+    // Every trial's copy of the base signals that have one, starting with the
+    // copy in signal_map.
+    map<key_type, vector<Signal>> trial_signals;
+
+    // Trial of each operator that was added for a trial other than the first.
+    map<const Operator*, unsigned> op_trials;
+
+#ifdef NENGO_MPI_CUDA
+    // Only exists with the cuda backend. Outlives the device operators that use it.
+    unique_ptr<DeviceContext> device;
+#endif
+
     // Contains all operators - don't have to worry about deleting these, since we
     // have unique_ptr's for all these ops in the lists below.
     list<Operator*> operator_list;
 
+    // Flat copy of operator_list made by finalize_build once the ops are sorted,
+    // along with the runs of same-type ops that are dispatched together.
+    vector<Operator*> op_schedule;
+    vector<OpBatch> batch_schedule;
+
+    // Only used when running with more than one thread.
+    vector<OpLevel> level_schedule;
+    unique_ptr<atomic<unsigned>[]> level_counters;
+    unique_ptr<ThreadPool> thread_pool;
+
     // operate_store contains only non-mpi operators
     list<unique_ptr<Operator>> operator_store;
 
+    vector<MPIOpRecord> send_records;
+    vector<MPIOpRecord> recv_records;
+
     list<unique_ptr<MPISend>> mpi_sends;
     list<unique_ptr<MPIRecv>> mpi_recvs;
+    list<unique_ptr<MPIWait>> mpi_waits;
+
+    // First and last elements of each region of memory found by find_spike_signals.
+    vector<pair<const dtype*, const dtype*>> spike_regions;
 
     unique_ptr<TimeUpdate> time_update;
 
+    // Only exists while a simulation is timed or traced.
+    unique_ptr<Tracer> tracer;
+
     bool collect_timings;
+    string trace_file;
+    string profile_file;
+
+    // For operators made by merging others, the index of each operator merged
+    // and its share of the work, which the profile divides their cost by.
+    map<const Operator*, vector<pair<float, double>>> merged_shares;
+    unsigned n_threads;
+    string backend;
+    unsigned learning_every;
+    dtype quiescence;
+
+    // See SimulatorConfig::realtime.
+    double realtime;
+    bool zero_copy;
+    bool sparse_spikes;
+    bool shared_memory;
+    unsigned flush_every;
+    bool async_flush;
+    bool leader_load;
+    string mapping_mode;
+    ComponentMapping mapping;
+    double rebalance;
+    unsigned checkpoint_every;
+    string checkpoint_file;
+    LogOptions log_options;
 };
 
 template <class A, class B> inline bool compare_first_lt(const pair<A, B> &left, const pair<A, B> &right){
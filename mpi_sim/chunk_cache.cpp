@@ -0,0 +1,146 @@
+#include "chunk_cache.hpp"
+
+unique_ptr<MpiSimulatorChunk> ChunkCache::take(const string& key, MPI_Comm comm){
+    auto it = entries.begin();
+    while(it != entries.end() && it->key != key){
+        it++;
+    }
+
+    int found = !key.empty() && it != entries.end();
+    if(comm != MPI_COMM_NULL){
+        MPI_Allreduce(MPI_IN_PLACE, &found, 1, MPI_INT, MPI_MIN, comm);
+    }
+
+    // The entry is left where it is if another process doesn't have it.
+    if(!found){
+        return unique_ptr<MpiSimulatorChunk>();
+    }
+
+    unique_ptr<MpiSimulatorChunk> chunk = move(it->chunk);
+    total_bytes -= it->bytes;
+    entries.erase(it);
+
+    return chunk;
+}
+
+void ChunkCache::put(
+        const string& key, unique_ptr<MpiSimulatorChunk> chunk, size_t budget, MPI_Comm comm){
+
+    unsigned long long bytes = chunk->memory_bytes();
+    if(comm != MPI_COMM_NULL){
+        MPI_Allreduce(MPI_IN_PLACE, &bytes, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+    }
+
+    if(key.empty() || bytes > budget){
+        free_chunk(move(chunk));
+        return;
+    }
+
+    while(!entries.empty() && total_bytes + bytes > budget){
+        total_bytes -= entries.back().bytes;
+        free_chunk(move(entries.back().chunk));
+        entries.pop_back();
+    }
+
+    entries.push_front(Entry{key, move(chunk), bytes});
+    total_bytes += bytes;
+}
+
+void ChunkCache::clear(){
+    while(!entries.empty()){
+        free_chunk(move(entries.front().chunk));
+        entries.pop_front();
+    }
+
+    total_bytes = 0;
+}
+
+void ChunkCache::free_chunk(unique_ptr<MpiSimulatorChunk> chunk){
+    chunk->free_shared_transport();
+}
+
+ChunkCache& chunk_cache(){
+    static ChunkCache* cache = new ChunkCache();
+    return *cache;
+}
+
+// 64 bit FNV-1a hash of ``size'' bytes, continuing from ``hash''.
+static uint64_t hash_bytes(const char* bytes, size_t size, uint64_t hash){
+    for(size_t i = 0; i < size; i++){
+        hash = (hash ^ (unsigned char) bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+template<typename T>
+static uint64_t hash_vector(const vector<T>& values, uint64_t hash){
+    uint64_t size = values.size();
+    hash = hash_bytes((const char*) &size, sizeof(size), hash);
+    return hash_bytes((const char*) values.data(), size * sizeof(T), hash);
+}
+
+static const uint64_t hash_basis = 14695981039346656037ull;
+
+// The key of a network from where it came from and the hash of its contents.
+static string make_key(string source, uint64_t hash, SimulatorConfig config){
+    // The budget doesn't change how the chunks are built.
+    config.cache_memory = 0;
+
+    stringstream key;
+    key << source << "|" << hex << setw(16) << setfill('0') << hash << "|" << config.to_string();
+    return key.str();
+}
+
+string chunk_cache_key(string filename, const SimulatorConfig& config){
+    if(config.cache_memory == 0){
+        return "";
+    }
+
+    ifstream file(filename, ios::binary);
+    if(!file.good()){
+        stringstream msg;
+        msg << "Could not open network file " << filename << " to hash it." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    uint64_t hash = hash_basis;
+    vector<char> buffer(1 << 20);
+
+    while(file){
+        file.read(buffer.data(), buffer.size());
+        hash = hash_bytes(buffer.data(), file.gcount(), hash);
+    }
+
+    return make_key("file:" + filename, hash, config);
+}
+
+string chunk_cache_key(const PackedNetwork& network, const SimulatorConfig& config){
+    if(config.cache_memory == 0){
+        return "";
+    }
+
+    const NetworkHeader& header = network.header;
+
+    uint64_t hash = hash_basis;
+    hash = hash_bytes((const char*) &header.n_components, sizeof(header.n_components), hash);
+    hash = hash_bytes((const char*) &header.dt, sizeof(header.dt), hash);
+
+    for(const string& probe: header.probe_info){
+        hash = hash_bytes(probe.c_str(), probe.size() + 1, hash);
+    }
+
+    for(const auto& offsets: header.offsets){
+        hash = hash_vector(offsets, hash);
+    }
+
+    hash = hash_vector(header.row_sizes, hash);
+    hash = hash_vector(header.component_mapping, hash);
+    hash = hash_vector(header.component_graph, hash);
+
+    for(unsigned d = 0; d < network.datasets.size(); d++){
+        hash = hash_bytes(network.datasets[d], network.sizes[d], hash);
+    }
+
+    return make_key("memory", hash, config);
+}
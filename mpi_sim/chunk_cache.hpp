@@ -0,0 +1,76 @@
+#pragma once
+
+#include <list>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <exception>
+
+#include <mpi.h>
+
+#include "chunk.hpp"
+#include "config.hpp"
+#include "net_file.hpp"
+
+#include "typedef.hpp"
+#include "debug.hpp"
+
+using namespace std;
+
+/* Chunks kept by a process after their simulator is closed, so that a new
+ * simulator of the same network with the same options can start from one,
+ * having only to be reset, instead of loading and building the network again
+ * (see SimulatorConfig::cache_memory). A chunk is kept under a key given by
+ * where its network came from, a hash of the network's contents, and the
+ * options of the simulator.
+ *
+ * Every process of a simulation makes the same calls on its cache in the same
+ * order, with the same keys, and an entry is charged the memory of the chunk
+ * on the busiest process, so every process keeps and evicts the same chunks.
+ * When the kept chunks would take more than the budget, the least recently
+ * used are freed first. */
+class ChunkCache{
+public:
+    ChunkCache(): total_bytes(0){}
+
+    /* Take out the chunk kept under ``key'', if every process in ``comm''
+     * (which may be MPI_COMM_NULL) has one. Returns NULL otherwise. */
+    unique_ptr<MpiSimulatorChunk> take(const string& key, MPI_Comm comm);
+
+    /* Keep ``chunk'' under ``key'', within a budget of ``budget'' bytes on
+     * each process, or free it if it doesn't fit. Every process in ``comm''
+     * must call this. */
+    void put(const string& key, unique_ptr<MpiSimulatorChunk> chunk, size_t budget, MPI_Comm comm);
+
+    // Free every chunk. Every process that shares chunks must call this.
+    void clear();
+
+    unsigned size() const{ return entries.size(); }
+
+private:
+    struct Entry{
+        string key;
+        unique_ptr<MpiSimulatorChunk> chunk;
+        size_t bytes;
+    };
+
+    static void free_chunk(unique_ptr<MpiSimulatorChunk> chunk);
+
+    // Most recently used first.
+    list<Entry> entries;
+    size_t total_bytes;
+};
+
+/* The cache of this process, shared by every simulator it creates. It is never
+ * destroyed, since its chunks can't be freed once MPI is finalized; clear it
+ * before then (see mpi_kill_workers). */
+ChunkCache& chunk_cache();
+
+/* The key of a network file, or of a network in memory, simulated with
+ * ``config'', or the empty string if ``config'' keeps no chunks. Only needs
+ * to be made by the master, which reads the whole file to hash it. */
+string chunk_cache_key(string filename, const SimulatorConfig& config);
+string chunk_cache_key(const PackedNetwork& network, const SimulatorConfig& config);
@@ -0,0 +1,309 @@
+#include "config.hpp"
+
+SimulatorConfig::SimulatorConfig()
+:collect_timings(false), trace_file(""), profile_file(""), n_threads(1), learning_every(1), quiescence(0.0),
+zero_copy(false), sparse_spikes(true), shared_memory(true),
+flush_every(DEFAULT_FLUSH_EVERY), async_flush(true), async_pyfuncs(false),
+collective_io(false), io_ranks(0), compression("none"), compression_level(4), shuffle(true),
+spike_events(false), leader_load(false), mapping("default"), rebalance(0.0), n_trials(1), checkpoint_every(0), checkpoint_file(""), log_precision("double"), backend("cpu"), cache_memory(0), realtime(0.0), report_memory(false){
+
+}
+
+SimulatorConfig::SimulatorConfig(string options)
+:SimulatorConfig(){
+    set_from_string(options);
+}
+
+void SimulatorConfig::set(string name, string value){
+    try{
+        if(name.compare("timing") == 0){
+            collect_timings = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("trace_file") == 0){
+            if(value.find(',') != string::npos){
+                stringstream msg;
+                msg << "Trace file " << value << " has a comma in its name." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            trace_file = value;
+
+        }else if(name.compare("profile_file") == 0){
+            if(value.find(',') != string::npos){
+                stringstream msg;
+                msg << "Profile file " << value << " has a comma in its name." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            profile_file = value;
+
+        }else if(name.compare("threads") == 0){
+            n_threads = boost::lexical_cast<unsigned>(value);
+
+            if(n_threads == 0){
+                throw runtime_error("Number of threads must be at least 1.");
+            }
+
+        }else if(name.compare("learning_every") == 0){
+            learning_every = boost::lexical_cast<unsigned>(value);
+
+            if(learning_every == 0){
+                throw runtime_error("Learning rules must update at least every 1 step.");
+            }
+
+        }else if(name.compare("quiescence") == 0){
+            quiescence = boost::lexical_cast<double>(value);
+
+            if(quiescence < 0){
+                throw runtime_error("Quiescence tolerance must be non-negative.");
+            }
+
+        }else if(name.compare("realtime") == 0){
+            realtime = boost::lexical_cast<double>(value);
+
+            if(realtime < 0){
+                throw runtime_error("Real-time speed must be non-negative.");
+            }
+
+        }else if(name.compare("zero_copy") == 0){
+            zero_copy = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("sparse_spikes") == 0){
+            sparse_spikes = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("shared_memory") == 0){
+            shared_memory = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("flush_every") == 0){
+            flush_every = boost::lexical_cast<unsigned>(value);
+
+            if(flush_every == 0){
+                throw runtime_error("Probes must be flushed at least every 1 step.");
+            }
+
+        }else if(name.compare("async_flush") == 0){
+            async_flush = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("async_pyfuncs") == 0){
+            async_pyfuncs = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("collective_io") == 0){
+            collective_io = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("io_ranks") == 0){
+            io_ranks = boost::lexical_cast<unsigned>(value);
+
+        }else if(name.compare("compression") == 0){
+            if(value.compare("none") != 0 && value.compare("deflate") != 0 &&
+                    value.compare("lz4") != 0){
+                stringstream msg;
+                msg << "Unknown compression: " << value << ". "
+                    << "Expected one of none, deflate, lz4." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            compression = value;
+
+        }else if(name.compare("compression_level") == 0){
+            compression_level = boost::lexical_cast<unsigned>(value);
+
+            if(compression_level > 9){
+                throw runtime_error("Compression level must be between 0 and 9.");
+            }
+
+        }else if(name.compare("shuffle") == 0){
+            shuffle = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("spike_events") == 0){
+            spike_events = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("leader_load") == 0){
+            leader_load = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("report_memory") == 0){
+            report_memory = bool(boost::lexical_cast<int>(value));
+
+        }else if(name.compare("mapping") == 0){
+            if(value.compare("default") != 0 && value.compare("graph") != 0 &&
+                    value.compare("node") != 0){
+                stringstream msg;
+                msg << "Unknown component mapping: " << value << ". "
+                    << "Expected one of default, graph, node." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            mapping = value;
+
+        }else if(name.compare("rebalance") == 0){
+            rebalance = boost::lexical_cast<double>(value);
+
+            if(rebalance < 0.0){
+                throw runtime_error("Rebalancing tolerance must not be negative.");
+            }
+
+        }else if(name.compare("cache_memory") == 0){
+            cache_memory = boost::lexical_cast<unsigned>(value);
+
+        }else if(name.compare("trials") == 0){
+            n_trials = boost::lexical_cast<unsigned>(value);
+
+            if(n_trials == 0){
+                throw runtime_error("Number of trials must be at least 1.");
+            }
+
+        }else if(name.compare("checkpoint_every") == 0){
+            checkpoint_every = boost::lexical_cast<unsigned>(value);
+
+        }else if(name.compare("checkpoint_file") == 0){
+            if(value.find(',') != string::npos){
+                stringstream msg;
+                msg << "Checkpoint file " << value << " has a comma in its name." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            checkpoint_file = value;
+
+        }else if(name.compare("log_precision") == 0){
+            if(value.compare("single") != 0 && value.compare("double") != 0){
+                stringstream msg;
+                msg << "Unknown log precision: " << value << ". "
+                    << "Expected one of single, double." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            log_precision = value;
+
+        }else if(name.compare("precision") == 0){
+            check_precision(value);
+
+        }else if(name.compare("backend") == 0){
+            check_backend(value);
+            backend = value;
+
+        }else{
+            stringstream msg;
+            msg << "Unknown simulator option: " << name << "." << endl;
+            throw runtime_error(msg.str());
+        }
+    }catch(const boost::bad_lexical_cast& e){
+        stringstream msg;
+        msg << "Value " << value << " for simulator option "
+            << name << " could not be parsed." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+void SimulatorConfig::check_precision(string value){
+    string precision;
+
+    if(value.compare("single") == 0 || value.compare("float32") == 0){
+        precision = "single";
+    }else if(value.compare("double") == 0 || value.compare("float64") == 0){
+        precision = "double";
+    }else{
+        stringstream msg;
+        msg << "Unknown precision: " << value << ". "
+            << "Expected one of single, float32, double, float64." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    if(precision.compare(DTYPE_PRECISION) != 0){
+        stringstream msg;
+        msg << "Requested " << precision << " precision, but nengo_mpi was built "
+            << "for " << DTYPE_PRECISION << " precision. Rebuild "
+            << (precision.compare("single") == 0 ? "with" : "without")
+            << " NENGO_MPI_SINGLE_PRECISION defined." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+void SimulatorConfig::check_backend(string value){
+    if(value.compare("cpu") != 0 && value.compare("cuda") != 0){
+        stringstream msg;
+        msg << "Unknown backend: " << value << ". "
+            << "Expected one of cpu, cuda." << endl;
+        throw runtime_error(msg.str());
+    }
+
+#ifndef NENGO_MPI_CUDA
+    if(value.compare("cuda") == 0){
+        throw runtime_error(
+            "Requested the cuda backend, but nengo_mpi was built without it. "
+            "Rebuild with NENGO_MPI_CUDA defined (make cuda).");
+    }
+#endif
+}
+
+void SimulatorConfig::set_from_string(string options){
+    vector<string> tokens;
+    boost::split(tokens, options, boost::is_any_of(","));
+
+    for(string& token: tokens){
+        boost::trim(token);
+
+        if(token.length() == 0){
+            continue;
+        }
+
+        size_t eq = token.find('=');
+        if(eq == string::npos){
+            stringstream msg;
+            msg << "Simulator option " << token << " is not of the form name=value." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        set(boost::trim_copy(token.substr(0, eq)), boost::trim_copy(token.substr(eq + 1)));
+    }
+}
+
+string SimulatorConfig::to_string() const{
+    stringstream out;
+
+    out << "timing=" << int(collect_timings);
+    out << ",trace_file=" << trace_file;
+    out << ",profile_file=" << profile_file;
+    out << ",threads=" << n_threads;
+    out << ",learning_every=" << learning_every;
+    out << ",quiescence=" << quiescence;
+    out << ",realtime=" << realtime;
+    out << ",zero_copy=" << int(zero_copy);
+    out << ",sparse_spikes=" << int(sparse_spikes);
+    out << ",shared_memory=" << int(shared_memory);
+    out << ",flush_every=" << flush_every;
+    out << ",async_flush=" << int(async_flush);
+    out << ",async_pyfuncs=" << int(async_pyfuncs);
+    out << ",collective_io=" << int(collective_io);
+    out << ",io_ranks=" << io_ranks;
+    out << ",compression=" << compression;
+    out << ",compression_level=" << compression_level;
+    out << ",shuffle=" << int(shuffle);
+    out << ",spike_events=" << int(spike_events);
+    out << ",leader_load=" << int(leader_load);
+    out << ",mapping=" << mapping;
+    out << ",rebalance=" << rebalance;
+    out << ",trials=" << n_trials;
+    out << ",checkpoint_every=" << checkpoint_every;
+    out << ",checkpoint_file=" << checkpoint_file;
+    out << ",log_precision=" << log_precision;
+    out << ",backend=" << backend;
+    out << ",cache_memory=" << cache_memory;
+    out << ",report_memory=" << int(report_memory);
+
+    return out.str();
+}
+
+LogOptions SimulatorConfig::log_options() const{
+    LogOptions options;
+
+    options.flush_every = flush_every;
+    options.collective_io = collective_io;
+    options.io_ranks = io_ranks;
+    options.compression = compression;
+    options.compression_level = compression_level;
+    options.shuffle = shuffle;
+    options.single_precision = log_precision.compare("single") == 0;
+    options.n_trials = n_trials;
+    options.spike_events = spike_events;
+
+    return options;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <exception>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "typedef.hpp"
+
+using namespace std;
+
+// Default for how frequently to flush the probe buffers, in units of number of steps.
+const unsigned DEFAULT_FLUSH_EVERY = 1000;
+
+/* How probe data is stored in the simulation log. Built from a SimulatorConfig. */
+struct LogOptions{
+    LogOptions()
+    :flush_every(DEFAULT_FLUSH_EVERY), collective_io(false), io_ranks(0),
+    compression("none"), compression_level(4), shuffle(true), single_precision(false),
+    n_trials(1), spike_events(false){};
+
+    // Number of rows written to each dataset per flush, used as the chunk size.
+    unsigned flush_every;
+
+    // Whether processes write to a parallel log collectively.
+    bool collective_io;
+
+    // Number of processes that collective writes are aggregated to. 0 lets MPI-IO decide.
+    unsigned io_ranks;
+
+    // One of none, deflate or lz4.
+    string compression;
+    unsigned compression_level;
+
+    // Whether to apply the shuffle filter before compressing.
+    bool shuffle;
+
+    // Whether probe data is stored as 32 bit floats.
+    bool single_precision;
+
+    // Number of trials simulated at once. With more than one, each probe
+    // dataset has a trial axis after the time axis.
+    unsigned n_trials;
+
+    // Whether probes that record the spikes of neurons are stored as a list
+    // of spike events, rather than as a value for every neuron in every sample.
+    bool spike_events;
+};
+
+/* Run-time options for a simulator. These are parsed by the master process
+ * (from the command line, or from python), and broadcast to the workers when
+ * the simulator is created, so that every chunk is configured identically.
+ *
+ * Options can be given as a string of the form "name1=value1,name2=value2",
+ * which is also the form in which they are sent to the workers. */
+class SimulatorConfig{
+
+public:
+    SimulatorConfig();
+    SimulatorConfig(string options);
+
+    /* Set a single option from its name and a string value. Throws a
+     * runtime_error if the name is unknown or the value can't be parsed. */
+    void set(string name, string value);
+
+    /* Set any number of options from a string of the form
+     * "name1=value1,name2=value2". The empty string sets nothing. */
+    void set_from_string(string options);
+
+    /* Inverse of set_from_string. */
+    string to_string() const;
+
+    LogOptions log_options() const;
+
+    friend ostream& operator << (ostream &out, const SimulatorConfig &config){
+        out << config.to_string();
+        return out;
+    }
+
+    // Whether to collect per-operator timing information.
+    bool collect_timings;
+
+    // File that a Chrome trace of each simulation is written to, if not
+    // empty (see Tracer). Each simulation replaces the trace of the last.
+    string trace_file;
+
+    /* File that the measured cost of each operator in each simulation, and
+     * the size of each message, are written to as CSV, if not empty. Times
+     * the operators like collect_timings, and is read by the partitioners
+     * (see nengo_mpi/partition/profile.py). */
+    string profile_file;
+
+    // Number of threads used to run the operators on each process.
+    unsigned n_threads;
+
+    // Number of steps between updates of the learning rules, which are made
+    // with a learning rate scaled up by the same factor (see LearningRule).
+    unsigned learning_every;
+
+    // Values within this distance of zero count as zero for operators whose
+    // work can be skipped while their inputs are zero: increments (DotInc,
+    // ElementwiseInc) skip steps on which their input is zero, and synapses
+    // stop updating once their input and state have decayed to zero, until
+    // their input changes. 0 runs every operator on every step.
+    double quiescence;
+
+    // Whether MPI messages are sent and received directly from signal memory
+    // where possible, instead of being copied through a separate buffer.
+    bool zero_copy;
+
+    // Whether the spikes of neurons are sent to other processes as the
+    // indices of the neurons that spiked, when that makes messages smaller.
+    // Messages with spikes are never transferred in place.
+    bool sparse_spikes;
+
+    // Whether messages between processes on the same node are passed through
+    // shared memory instead of MPI, where the MPI library supports MPI-3.
+    bool shared_memory;
+
+    // Number of steps between flushes of the probe buffers to the simulation log.
+    unsigned flush_every;
+
+    // Whether probe data is written to the simulation log by a background
+    // thread while the simulation continues, rather than stopping the
+    // simulation for each flush. Parallel simulation logs fall back to
+    // blocking writes if MPI does not support MPI_THREAD_MULTIPLE.
+    bool async_flush;
+
+    // Whether the python functions of a network (see PyFunc in _mpi_sim.hpp)
+    // are called by a thread of their own, one step behind the simulation:
+    // each step, they are given their inputs and the simulation goes on with
+    // the outputs they computed from their inputs on the step before.
+    bool async_pyfuncs;
+
+    // See LogOptions. Compressing a parallel log requires collective writes,
+    // so compression turns on collective_io for simulations on more than one process.
+    bool collective_io;
+    unsigned io_ranks;
+    string compression;
+    unsigned compression_level;
+    bool shuffle;
+    bool spike_events;
+
+    // Whether one process per node reads the network file for every process
+    // on the node, and scatters the data to them. Only used for packed
+    // network files (see PACKED_COMPONENT_LAYOUT in net_file.hpp).
+    bool leader_load;
+
+    // How the processes that simulate the components of a network are
+    // rearranged to suit the machine: default, graph or node (see
+    // remap_components in mapping.hpp).
+    string mapping;
+
+    // If positive, the cost of each component is measured during each
+    // simulation, and components are moved between processes before the
+    // next one when the busiest process costs more than this fraction above
+    // the mean (see MpiSimulatorChunk::plan_rebalance). 0 never moves them.
+    double rebalance;
+
+    // Number of trials of the network simulated together (see
+    // MpiSimulatorChunk::add_component). Trial k is simulated as it would be
+    // by a separate simulator reset with seed + k.
+    unsigned n_trials;
+
+    // Number of steps between checkpoints written during a simulation (see
+    // MpiSimulatorChunk::checkpoint), counting from the last reset. 0 writes
+    // no checkpoints. Each checkpoint replaces the previous one in
+    // checkpoint_file, whose name can't contain commas.
+    unsigned checkpoint_every;
+    string checkpoint_file;
+
+    // Precision that probe data is stored in, either "single" or "double".
+    // Independent of the precision of the simulation.
+    string log_precision;
+
+    // Where operators are run: "cpu", or "cuda" to run the operators that
+    // support it on a GPU (see device.hpp), which requires nengo_mpi to be
+    // built with NENGO_MPI_CUDA defined.
+    string backend;
+
+    // Memory in MiB that each process may keep built chunks in after their
+    // simulator is closed, so that a new simulator of the same network with
+    // the same options starts from one without loading and building the
+    // network again (see ChunkCache). 0 keeps none.
+    unsigned cache_memory;
+
+    // If positive, each step of a simulation is paced to take dt / realtime
+    // seconds of wall-clock time, so 1 runs in real time, and a step that
+    // takes longer than that misses its deadline. The latency of the steps
+    // and the deadlines missed are reported after each simulation (see
+    // RealtimePacer). 0 runs the steps as fast as possible.
+    double realtime;
+
+    // Whether the master prints how much memory the signals, initial values
+    // and operator buffers of the built network take (see
+    // MpiSimulatorChunk::report_memory).
+    bool report_memory;
+
+private:
+    /* The precision of the simulation is fixed when nengo_mpi is compiled
+     * (see typedef.hpp), so the precision option only checks that the build
+     * matches the requested precision, and throws a runtime_error if not. */
+    static void check_precision(string value);
+
+    /* Likewise, the cuda backend is only available if nengo_mpi was built
+     * for it; throws a runtime_error if it wasn't. */
+    static void check_backend(string value);
+};
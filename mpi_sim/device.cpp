@@ -0,0 +1,261 @@
+#include "device.hpp"
+
+#ifdef NENGO_MPI_CUDA
+
+#include <cstdlib> // getenv
+
+void check_cuda(cudaError_t error, const char* what){
+    if(error != cudaSuccess){
+        stringstream msg;
+        msg << "CUDA error while " << what << ": " << cudaGetErrorString(error) << "." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+void check_cublas(cublasStatus_t status, const char* what){
+    if(status != CUBLAS_STATUS_SUCCESS){
+        stringstream msg;
+        msg << "cuBLAS error " << int(status) << " while " << what << "." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+shared_ptr<dtype> allocate_managed(unsigned size){
+    void* memory = NULL;
+    check_cuda(
+        cudaMallocManaged(&memory, max(size, 1u) * sizeof(dtype), cudaMemAttachGlobal),
+        "allocating signals");
+
+    return shared_ptr<dtype>(static_cast<dtype*>(memory), [](dtype* p){ cudaFree(p); });
+}
+
+// The rank of this process on its node, as set by common MPI launchers.
+static int local_rank(){
+    const char* variables[] = {
+        "OMPI_COMM_WORLD_LOCAL_RANK", "MV2_COMM_WORLD_LOCAL_RANK",
+        "MPI_LOCALRANKID", "SLURM_LOCALID"};
+
+    for(const char* variable: variables){
+        const char* value = getenv(variable);
+        if(value){
+            return atoi(value);
+        }
+    }
+
+    return 0;
+}
+
+DeviceContext::DeviceContext(){
+    int n_devices = 0;
+    check_cuda(cudaGetDeviceCount(&n_devices), "counting devices");
+
+    if(n_devices == 0){
+        throw runtime_error("The cuda backend was requested, but no CUDA device was found.");
+    }
+
+    device = local_rank() % n_devices;
+    check_cuda(cudaSetDevice(device), "selecting a device");
+
+    int concurrent = 0;
+    check_cuda(
+        cudaDeviceGetAttribute(&concurrent, cudaDevAttrConcurrentManagedAccess, device),
+        "querying the device");
+
+    if(!concurrent){
+        stringstream msg;
+        msg << "CUDA device " << device << " does not support concurrent access to "
+            << "managed memory, which the cuda backend requires." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    check_cuda(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), "creating a stream");
+    check_cublas(cublasCreate(&blas), "creating a handle");
+    check_cublas(cublasSetStream(blas, stream), "setting the stream of a handle");
+}
+
+DeviceContext::~DeviceContext(){
+    cudaStreamSynchronize(stream);
+    cublasDestroy(blas);
+    cudaStreamDestroy(stream);
+}
+
+void DeviceContext::synchronize(){
+    check_cuda(cudaStreamSynchronize(stream), "running operators on the device");
+}
+
+string DeviceContext::to_string() const{
+    cudaDeviceProp properties;
+    check_cuda(cudaGetDeviceProperties(&properties, device), "querying the device");
+
+    stringstream out;
+    out << "<DeviceContext device: " << device << " (" << properties.name << ")>";
+    return out.str();
+}
+
+// ********************************************************************************
+// Overloads of cuBLAS gemv for both precisions, like cblas_gemv in operator.hpp.
+inline cublasStatus_t cublas_gemv(
+        cublasHandle_t handle, cublasOperation_t trans, int m, int n,
+        const double* alpha, const double* A, int lda, const double* x, int incx,
+        const double* beta, double* y, int incy){
+    return cublasDgemv(handle, trans, m, n, alpha, A, lda, x, incx, beta, y, incy);
+}
+
+inline cublasStatus_t cublas_gemv(
+        cublasHandle_t handle, cublasOperation_t trans, int m, int n,
+        const float* alpha, const float* A, int lda, const float* x, int incx,
+        const float* beta, float* y, int incy){
+    return cublasSgemv(handle, trans, m, n, alpha, A, lda, x, incx, beta, y, incy);
+}
+
+bool DeviceDotInc::supports(const Signal& A, const Signal& X, const Signal& Y){
+    return A.shape2 == X.shape1 && A.shape1 == Y.shape1 &&
+        X.shape2 == 1 && Y.shape2 == 1 && A.is_contiguous;
+}
+
+DeviceDotInc::DeviceDotInc(DeviceContext& context, Signal A, Signal X, Signal Y)
+:context(context), A(A), X(X), Y(Y){
+
+    declare_read(A);
+    declare_read(X);
+    declare_write(Y);
+
+    if(!supports(A, X, Y)){
+        stringstream ss;
+        ss << "While creating DeviceDotInc, got shapes that are not a matrix-vector "
+           << "product with a contiguous matrix. "
+           << "Shapes are: A - " << shape_string(A)
+           << ", X - " << shape_string(X)
+           << ", Y - " << shape_string(Y) << "." << endl;
+
+        throw runtime_error(ss.str());
+    }
+
+    if(A.row_major){
+        transpose_A = CUBLAS_OP_T;
+        n_rows = A.shape2;
+        n_cols = A.shape1;
+        leading_dim_A = max(A.stride1, 1);
+    }else{
+        transpose_A = CUBLAS_OP_N;
+        n_rows = A.shape1;
+        n_cols = A.shape2;
+        leading_dim_A = max(A.stride2, 1);
+    }
+}
+
+void DeviceDotInc::operator() (){
+    const dtype one = 1.0;
+
+    check_cublas(
+        cublas_gemv(
+            context.get_blas(), transpose_A, n_rows, n_cols, &one,
+            A.raw_data, leading_dim_A, X.raw_data, X.stride1,
+            &one, Y.raw_data, Y.stride1),
+        "queueing DeviceDotInc");
+
+    run_dbg(*this);
+}
+
+string DeviceDotInc::to_string() const{
+
+    stringstream out;
+    out << Operator::to_string();
+
+    out << "A:" << endl;
+    out << signal_to_string(A) << endl;
+    out << "X:" << endl;
+    out << signal_to_string(X) << endl;
+    out << "Y:" << endl;
+    out << signal_to_string(Y) << endl;
+
+    return out.str();
+}
+
+// ********************************************************************************
+DeviceLIF::DeviceLIF(
+    DeviceContext& context, unsigned n_neurons, dtype tau_rc, dtype tau_ref,
+    dtype min_voltage, dtype dt, Signal J, Signal output, Signal voltage,
+    Signal ref_time)
+:context(context), n_neurons(n_neurons), dt(dt), dt_inv(1.0 / dt), tau_rc(tau_rc),
+tau_ref(tau_ref), min_voltage(min_voltage), scale(-expm1(-dt / tau_rc)), J(J),
+output(output), voltage(voltage), ref_time(ref_time){
+
+    declare_read(J);
+    declare_write(output);
+    declare_write(voltage);
+    declare_write(ref_time);
+}
+
+void DeviceLIF::operator() (){
+    check_cuda(
+        launch_lif(
+            context.get_stream(), n_neurons, dt, dt_inv, scale, tau_ref, min_voltage,
+            J.raw_data, J.stride1, output.raw_data, output.stride1,
+            voltage.raw_data, voltage.stride1, ref_time.raw_data, ref_time.stride1),
+        "queueing DeviceLIF");
+
+    run_dbg(*this);
+}
+
+string DeviceLIF::to_string() const{
+
+    stringstream out;
+
+    out << Operator::to_string();
+    out << "J:" << endl;
+    out << signal_to_string(J) << endl;
+    out << "output:" << endl;
+    out << signal_to_string(output) << endl;
+    out << "voltage:" << endl;
+    out << signal_to_string(voltage) << endl;
+    out << "refractory_time:" << endl;
+    out << signal_to_string(ref_time) << endl;
+    out << "n_neurons: " << n_neurons << endl;
+    out << "tau_rc: " << tau_rc << endl;
+    out << "tau_ref: " << tau_ref << endl;
+    out << "min_voltage: " << min_voltage << endl;
+
+    return out.str();
+}
+
+// ********************************************************************************
+DeviceSimpleSynapse::DeviceSimpleSynapse(
+    DeviceContext& context, Signal input, Signal output, dtype a, dtype b)
+:context(context), input(input), output(output), a(a), b(b){
+
+    declare_read(input);
+    declare_write(output);
+
+    if(input.shape1 != output.shape1 || input.shape2 != output.shape2){
+        throw runtime_error(
+            "While creating DeviceSimpleSynapse, input and output had incompatible dimensions.");
+    }
+}
+
+void DeviceSimpleSynapse::operator() (){
+    check_cuda(
+        launch_lowpass(
+            context.get_stream(), output.shape1, output.shape2, a, b,
+            input.raw_data, input.stride1, input.stride2,
+            output.raw_data, output.stride1, output.stride2),
+        "queueing DeviceSimpleSynapse");
+
+    run_dbg(*this);
+}
+
+string DeviceSimpleSynapse::to_string() const{
+
+    stringstream out;
+    out << Operator::to_string();
+    out << "input:" << endl;
+    out << signal_to_string(input) << endl;
+    out << "output:" << endl;
+    out << signal_to_string(output) << endl;
+    out << "a: " << a << endl;
+    out << "b: " << b << endl;
+
+    return out.str();
+}
+
+#endif
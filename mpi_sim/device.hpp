@@ -0,0 +1,178 @@
+#pragma once
+
+/* Support for simulating on GPUs, the cuda backend (see SimulatorConfig::backend).
+ * Only compiled when NENGO_MPI_CUDA is defined (see the ``cuda'' make target).
+ *
+ * With this backend, a chunk stores its base signals in CUDA managed memory,
+ * which the host and the device share. The operators that do most of the work
+ * in typical networks (matrix-vector DotIncs, LIF neurons and SimpleSynapses)
+ * are created as device operators instead, which queue their work on the
+ * stream of the chunk's DeviceContext and return immediately. Every other
+ * operator runs on the host, as it does without the backend; the chunk puts a
+ * DeviceSync in front of each one that touches a signal that device operators
+ * may still be working on, and at the end of each step (see
+ * MpiSimulatorChunk::place_device_syncs).
+ *
+ * Since the signals stay where they are, MPI operators that transfer them in
+ * place (see SimulatorConfig::zero_copy) hand it device memory, which a
+ * CUDA-aware MPI library sends without staging it through the host. Sharing
+ * memory with the host while a kernel runs requires a device that supports
+ * concurrent managed access (compute capability 6.0 or later, on Linux). */
+
+#ifdef NENGO_MPI_CUDA
+
+#include <string>
+#include <sstream>
+#include <memory>
+#include <exception>
+
+#include <cuda_runtime.h>
+#include <cublas_v2.h>
+
+#include "signal.hpp"
+#include "operator.hpp"
+#include "device_kernels.hpp"
+#include "typedef.hpp"
+
+using namespace std;
+
+// Throw a runtime_error saying what failed, unless the call succeeded.
+void check_cuda(cudaError_t error, const char* what);
+void check_cublas(cublasStatus_t status, const char* what);
+
+// Managed memory for ``size'' values, freed when the last pointer to it goes.
+shared_ptr<dtype> allocate_managed(unsigned size);
+
+/* The device that a process simulates on, with the stream and the cuBLAS
+ * handle that the device operators of its chunk queue their work on. Processes
+ * on the same node share out its devices by their rank on the node, as given
+ * by the MPI launcher, or take the first device if it doesn't say. */
+class DeviceContext{
+public:
+    DeviceContext();
+    ~DeviceContext();
+
+    DeviceContext(const DeviceContext&) = delete;
+    DeviceContext& operator= (const DeviceContext&) = delete;
+
+    // Wait for all work queued so far, and throw a runtime_error if it failed.
+    void synchronize();
+
+    int get_device() const{ return device; }
+    cudaStream_t get_stream() const{ return stream; }
+    cublasHandle_t get_blas() const{ return blas; }
+
+    string to_string() const;
+
+private:
+    int device;
+    cudaStream_t stream;
+    cublasHandle_t blas;
+};
+
+/* Waits for the device operators queued before it to finish. Placed by the
+ * chunk; the time that device operators take is spent here. */
+class DeviceSync: public Operator{
+public:
+    DeviceSync(DeviceContext& context): context(context){}
+    virtual string classname() const { return "DeviceSync"; }
+    virtual BatchRunner batch_runner() const { return run_batch<DeviceSync>; }
+
+    void operator()(){ context.synchronize(); }
+
+    virtual bool thread_safe() const{ return false; }
+
+protected:
+    DeviceContext& context;
+};
+
+/* DotInc on the device, with cuBLAS. Only for matrix-vector products with a
+ * contiguous A (see ``supports''); other DotIncs stay on the host. */
+class DeviceDotInc: public Operator{
+public:
+    DeviceDotInc(DeviceContext& context, Signal A, Signal X, Signal Y);
+    virtual string classname() const { return "DeviceDotInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<DeviceDotInc>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    virtual bool thread_safe() const{ return false; }
+
+    static bool supports(const Signal& A, const Signal& X, const Signal& Y);
+
+protected:
+    DeviceContext& context;
+
+    Signal A;
+    Signal X;
+    Signal Y;
+
+    // cuBLAS stores matrices by column, so a row-major A is its transpose.
+    cublasOperation_t transpose_A;
+    int n_rows;
+    int n_cols;
+    int leading_dim_A;
+};
+
+// LIF on the device, with the same update as LIF.
+class DeviceLIF: public Operator{
+public:
+    DeviceLIF(
+        DeviceContext& context, unsigned n_neurons, dtype tau_rc, dtype tau_ref,
+        dtype min_voltage, dtype dt, Signal J, Signal output, Signal voltage,
+        Signal ref_time);
+    virtual string classname() const { return "DeviceLIF"; }
+    virtual BatchRunner batch_runner() const { return run_batch<DeviceLIF>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    virtual bool thread_safe() const{ return false; }
+    virtual const Signal* spike_output() const{ return &output; }
+
+protected:
+    DeviceContext& context;
+
+    const unsigned n_neurons;
+
+    const dtype dt;
+    const dtype dt_inv;
+
+    const dtype tau_rc;
+    const dtype tau_ref;
+
+    const dtype min_voltage;
+
+    // -expm1(-dt / tau_rc), the fraction of the distance to J covered each step.
+    const dtype scale;
+
+    Signal J;
+    Signal output;
+    Signal voltage;
+    Signal ref_time;
+};
+
+// SimpleSynapse on the device. Not merged with other synapses, and never quiescent.
+class DeviceSimpleSynapse: public Operator{
+public:
+    DeviceSimpleSynapse(DeviceContext& context, Signal input, Signal output, dtype a, dtype b);
+    virtual string classname() const { return "DeviceSimpleSynapse"; }
+    virtual BatchRunner batch_runner() const { return run_batch<DeviceSimpleSynapse>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    virtual bool thread_safe() const{ return false; }
+
+protected:
+    DeviceContext& context;
+
+    Signal input;
+    Signal output;
+
+    const dtype a;
+    const dtype b;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "device_kernels.hpp"
+
+// Threads per block of every kernel.
+#define DEVICE_BLOCK_SIZE 256
+
+static unsigned n_blocks(unsigned n_threads){
+    return (n_threads + DEVICE_BLOCK_SIZE - 1) / DEVICE_BLOCK_SIZE;
+}
+
+__global__ void lif_kernel(
+        unsigned n_neurons, dtype dt, dtype dt_inv, dtype scale,
+        dtype tau_ref, dtype min_voltage,
+        const dtype* __restrict__ J, int J_stride,
+        dtype* __restrict__ output, int output_stride,
+        dtype* __restrict__ voltage, int voltage_stride,
+        dtype* __restrict__ ref_time, int ref_time_stride){
+
+    const unsigned i = blockIdx.x * blockDim.x + threadIdx.x;
+    if(i >= n_neurons){
+        return;
+    }
+
+    const dtype one = 1.0, zero = 0.0;
+
+    // dV = -expm1(-dt / tau_rc) * (J - voltage)
+    dtype v = voltage[i * voltage_stride];
+    const dtype dV = scale * (J[i * J_stride] - v);
+
+    // voltage = max(voltage + dV, min_voltage)
+    v += dV;
+    v = v < min_voltage ? min_voltage : v;
+
+    // mult = (1 - (ref_time - dt) / dt).clip(0, 1)
+    dtype ref = ref_time[i * ref_time_stride] - dt;
+    dtype mult = -dt_inv * ref + one;
+    mult = mult > one ? one : (mult < zero ? zero : mult);
+
+    v *= mult;
+
+    const bool spiked = v > one;
+    const dtype overshoot = (v - one) / dV;
+
+    output[i * output_stride] = spiked ? dt_inv : zero;
+    ref_time[i * ref_time_stride] = spiked ? tau_ref + dt * (one - overshoot) : ref;
+    voltage[i * voltage_stride] = spiked ? zero : v;
+}
+
+cudaError_t launch_lif(
+        cudaStream_t stream, unsigned n_neurons, dtype dt, dtype dt_inv, dtype scale,
+        dtype tau_ref, dtype min_voltage,
+        const dtype* J, int J_stride, dtype* output, int output_stride,
+        dtype* voltage, int voltage_stride, dtype* ref_time, int ref_time_stride){
+
+    if(n_neurons == 0){
+        return cudaSuccess;
+    }
+
+    lif_kernel<<<n_blocks(n_neurons), DEVICE_BLOCK_SIZE, 0, stream>>>(
+        n_neurons, dt, dt_inv, scale, tau_ref, min_voltage,
+        J, J_stride, output, output_stride, voltage, voltage_stride,
+        ref_time, ref_time_stride);
+
+    return cudaGetLastError();
+}
+
+__global__ void lowpass_kernel(
+        unsigned shape1, unsigned shape2, dtype a, dtype b,
+        const dtype* __restrict__ input, int input_stride1, int input_stride2,
+        dtype* __restrict__ output, int output_stride1, int output_stride2){
+
+    const unsigned k = blockIdx.x * blockDim.x + threadIdx.x;
+    if(k >= shape1 * shape2){
+        return;
+    }
+
+    const int i = k / shape2, j = k % shape2;
+
+    dtype& out = output[i * output_stride1 + j * output_stride2];
+    out = -a * out + b * input[i * input_stride1 + j * input_stride2];
+}
+
+cudaError_t launch_lowpass(
+        cudaStream_t stream, unsigned shape1, unsigned shape2, dtype a, dtype b,
+        const dtype* input, int input_stride1, int input_stride2,
+        dtype* output, int output_stride1, int output_stride2){
+
+    const unsigned n_elements = shape1 * shape2;
+    if(n_elements == 0){
+        return cudaSuccess;
+    }
+
+    lowpass_kernel<<<n_blocks(n_elements), DEVICE_BLOCK_SIZE, 0, stream>>>(
+        shape1, shape2, a, b, input, input_stride1, input_stride2,
+        output, output_stride1, output_stride2);
+
+    return cudaGetLastError();
+}
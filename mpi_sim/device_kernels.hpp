@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include <cuda_runtime.h>
+
+#include "typedef.hpp"
+
+/* Kernels of the device operators (see device.hpp), compiled by nvcc. Each
+ * launcher queues its kernel on ``stream'' and returns without waiting for
+ * it, giving the error of the launch, if any. Strides are in elements. */
+
+// The update of LIF in operator.cpp, one neuron per thread.
+cudaError_t launch_lif(
+    cudaStream_t stream, unsigned n_neurons, dtype dt, dtype dt_inv, dtype scale,
+    dtype tau_ref, dtype min_voltage,
+    const dtype* J, int J_stride, dtype* output, int output_stride,
+    dtype* voltage, int voltage_stride, dtype* ref_time, int ref_time_stride);
+
+// output = -a * output + b * input, for signals of shape ``shape1'' x ``shape2''.
+cudaError_t launch_lowpass(
+    cudaStream_t stream, unsigned shape1, unsigned shape2, dtype a, dtype b,
+    const dtype* input, int input_stride1, int input_stride2,
+    dtype* output, int output_stride1, int output_stride2);
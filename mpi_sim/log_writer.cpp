@@ -0,0 +1,84 @@
+#include "log_writer.hpp"
+
+AsyncLogWriter::AsyncLogWriter(SimulationLog* sim_log, Tracer* tracer)
+:sim_log(sim_log), tracer(tracer), write_name(0), busy(false), stopping(false){
+
+    if(tracer){
+        write_name = tracer->add_name("write log");
+    }
+
+    writer = thread(&AsyncLogWriter::writer_loop, this);
+}
+
+AsyncLogWriter::~AsyncLogWriter(){
+    {
+        unique_lock<mutex> lock(batch_mutex);
+        batch_done.wait(lock, [this]{ return !busy; });
+        stopping = true;
+    }
+
+    batch_ready.notify_one();
+    writer.join();
+}
+
+void AsyncLogWriter::submit(vector<ProbeWrite> writes){
+    wait();
+
+    {
+        lock_guard<mutex> lock(batch_mutex);
+        batch = move(writes);
+        busy = true;
+    }
+
+    batch_ready.notify_one();
+}
+
+void AsyncLogWriter::wait(){
+    exception_ptr e;
+
+    {
+        unique_lock<mutex> lock(batch_mutex);
+        batch_done.wait(lock, [this]{ return !busy; });
+
+        e = write_exception;
+        write_exception = nullptr;
+    }
+
+    if(e){
+        rethrow_exception(e);
+    }
+}
+
+void AsyncLogWriter::writer_loop(){
+    while(true){
+        {
+            unique_lock<mutex> lock(batch_mutex);
+            batch_ready.wait(lock, [this]{ return stopping || busy; });
+
+            if(stopping){
+                return;
+            }
+        }
+
+        // The batch is only modified by submit while we are not busy.
+        try{
+            double begin = wall_time();
+            sim_log->write_batch(batch);
+
+            if(tracer){
+                tracer->record(write_name, begin, wall_time(), Tracer::LOG_THREAD);
+            }
+        }catch(...){
+            lock_guard<mutex> lock(batch_mutex);
+            write_exception = current_exception();
+        }
+
+        {
+            lock_guard<mutex> lock(batch_mutex);
+            batch.clear();
+            busy = false;
+        }
+
+        batch_done.notify_all();
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "sim_log.hpp"
+#include "trace.hpp"
+
+#include "typedef.hpp"
+
+using namespace std;
+
+/* Writes probe data to a SimulationLog from a background thread, so that the
+ * simulation can keep running while the data is written to disk. Writes are
+ * handed over in batches, one batch per flush of the probes. Only one batch is
+ * in flight at a time; ``submit'' first waits for the previous batch to finish.
+ *
+ * While a batch is in flight, the submitted buffers must not be modified, and
+ * no other calls may be made on the log, since HDF5 is not assumed to be
+ * thread safe. Call ``wait'' before touching the log again. An exception thrown
+ * while writing a batch is rethrown by the next call to ``submit'' or ``wait''.
+ *
+ * If given a tracer, each write is recorded in it as ``write log'' on the
+ * tracer's log thread. */
+class AsyncLogWriter{
+
+public:
+    AsyncLogWriter(SimulationLog* sim_log, Tracer* tracer=NULL);
+    ~AsyncLogWriter();
+
+    AsyncLogWriter(const AsyncLogWriter&) = delete;
+    AsyncLogWriter& operator= (const AsyncLogWriter&) = delete;
+
+    void submit(vector<ProbeWrite> writes);
+
+    // Block until the batch in flight, if any, has been written.
+    void wait();
+
+private:
+    void writer_loop();
+
+    SimulationLog* sim_log;
+
+    Tracer* tracer;
+    unsigned write_name;
+
+    thread writer;
+
+    mutex batch_mutex;
+    condition_variable batch_ready;
+    condition_variable batch_done;
+
+    vector<ProbeWrite> batch;
+    bool busy;
+    bool stopping;
+
+    exception_ptr write_exception;
+};
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <climits>
+
+#include "mapping.hpp"
+
+ComponentMapping::ComponentMapping(int n_components, int n_processors, const vector<int>& assignment)
+:n_processors(n_processors), processes(n_components){
+
+    if(!assignment.empty() && assignment.size() != unsigned(n_components)){
+        stringstream msg;
+        msg << "Component mapping gives processes for " << assignment.size()
+            << " components, but the network has " << n_components << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    for(int c = 0; c < n_components; c++){
+        int process = assignment.empty() ? c : assignment[c];
+
+        if(process < 0){
+            stringstream msg;
+            msg << "Component mapping assigns component " << c
+                << " to process " << process << "." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        processes[c] = process % n_processors;
+    }
+
+    if(n_components > 0 && processes[0] != 0){
+        throw runtime_error("Component mapping must assign component 0 to process 0.");
+    }
+}
+
+vector<int> ComponentMapping::components_of(int process) const{
+    vector<int> components;
+
+    for(unsigned c = 0; c < processes.size(); c++){
+        if(processes[c] == process){
+            components.push_back(c);
+        }
+    }
+
+    return components;
+}
+
+void ComponentMapping::permute(const vector<int>& permutation){
+    if(permutation.size() != unsigned(n_processors)){
+        throw logic_error("Permutation of a component mapping has the wrong size.");
+    }
+
+    for(auto& process: processes){
+        process = permutation[process];
+    }
+}
+
+void ComponentMapping::assign(int component, int process){
+    if(component <= 0 || component >= (int) processes.size() ||
+            process < 0 || process >= n_processors){
+        stringstream msg;
+        msg << "Can't assign component " << component << " to process " << process << "." << endl;
+        throw logic_error(msg.str());
+    }
+
+    processes[component] = process;
+}
+
+string ComponentMapping::to_string() const{
+    stringstream out;
+
+    out << "<ComponentMapping" << endl;
+    out << "n_processors: " << n_processors << endl;
+    for(unsigned c = 0; c < processes.size(); c++){
+        out << "component " << c << ": process " << processes[c] << endl;
+    }
+    out << ">" << endl;
+
+    return out.str();
+}
+
+// Values sent per step between each pair of processes, in either direction.
+static vector<map<int, long long>> process_traffic(
+        const ComponentMapping& mapping, const vector<ComponentEdge>& graph){
+
+    vector<map<int, long long>> traffic(mapping.get_n_processors());
+
+    for(const ComponentEdge& edge: graph){
+        int p = mapping.process_of(edge.src), q = mapping.process_of(edge.dst);
+
+        if(p != q){
+            traffic[p][q] += edge.size;
+            traffic[q][p] += edge.size;
+        }
+    }
+
+    return traffic;
+}
+
+static vector<int> graph_permutation(const vector<map<int, long long>>& traffic, MPI_Comm comm){
+    int rank, n_processors;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_processors);
+
+    // MPI takes the weights as ints.
+    long long max_size = 1;
+    for(auto& neighbours: traffic){
+        for(auto& kv: neighbours){
+            max_size = max(max_size, kv.second);
+        }
+    }
+
+    double scale = max_size > INT_MAX ? double(INT_MAX) / max_size : 1.0;
+
+    vector<int> neighbours, weights;
+    for(auto& kv: traffic[rank]){
+        neighbours.push_back(kv.first);
+        weights.push_back(max(1, int(kv.second * scale)));
+    }
+
+    int degree = neighbours.size();
+    int* weight_data = weights.data();
+#ifdef MPI_WEIGHTS_EMPTY
+    if(degree == 0){
+        weight_data = MPI_WEIGHTS_EMPTY;
+    }
+#endif
+
+    MPI_Comm graph_comm;
+    MPI_Dist_graph_create_adjacent(
+        comm, degree, neighbours.data(), weight_data, degree, neighbours.data(), weight_data,
+        MPI_INFO_NULL, 1, &graph_comm);
+
+    int new_rank;
+    MPI_Comm_rank(graph_comm, &new_rank);
+    MPI_Comm_free(&graph_comm);
+
+    vector<int> new_ranks(n_processors);
+    MPI_Allgather(&new_rank, 1, MPI_INT, new_ranks.data(), 1, MPI_INT, comm);
+
+    // The process given rank v in the reordered communicator takes the place of process v.
+    vector<int> permutation(n_processors);
+    for(int p = 0; p < n_processors; p++){
+        permutation[new_ranks[p]] = p;
+    }
+
+    return permutation;
+}
+
+static vector<int> node_permutation(const vector<map<int, long long>>& traffic, MPI_Comm comm){
+    int rank, n_processors;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_processors);
+
+    // A node is known by the lowest rank on it.
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+
+    int leader = rank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    vector<int> leaders(n_processors);
+    MPI_Allgather(&leader, 1, MPI_INT, leaders.data(), 1, MPI_INT, comm);
+
+    map<int, vector<int>> nodes;
+    for(int p = 0; p < n_processors; p++){
+        nodes[leaders[p]].push_back(p);
+    }
+
+    // Each node is filled by repeatedly taking the process with the most
+    // traffic to those already on it, or failing that, the lowest one left.
+    // Nodes are filled in order of their lowest rank, so the first process
+    // taken, process 0, stays where it is.
+    vector<int> permutation(n_processors);
+    vector<bool> placed(n_processors, false);
+
+    for(auto& node: nodes){
+        vector<long long> affinity(n_processors, 0);
+
+        for(int slot: node.second){
+            int best = -1;
+            for(int p = 0; p < n_processors; p++){
+                if(!placed[p] && (best < 0 || affinity[p] > affinity[best])){
+                    best = p;
+                }
+            }
+
+            permutation[best] = slot;
+            placed[best] = true;
+
+            for(auto& kv: traffic[best]){
+                affinity[kv.first] += kv.second;
+            }
+        }
+    }
+
+    return permutation;
+}
+
+void remap_components(
+        ComponentMapping& mapping, const vector<ComponentEdge>& graph,
+        const string& mode, MPI_Comm comm){
+
+    if(mode.compare("default") != 0 && mode.compare("graph") != 0 && mode.compare("node") != 0){
+        stringstream msg;
+        msg << "Unknown component mapping " << mode << "; expected default, graph or node." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    // Without the traffic between components, there is nothing to go on.
+    if(mode.compare("default") == 0 || comm == MPI_COMM_NULL || graph.empty()){
+        return;
+    }
+
+    vector<map<int, long long>> traffic = process_traffic(mapping, graph);
+
+    vector<int> permutation = mode.compare("graph") == 0 ?
+        graph_permutation(traffic, comm) : node_permutation(traffic, comm);
+
+    // Component 0 is simulated by process 0 before the permutation.
+    if(permutation[0] != 0){
+        int other = find(permutation.begin(), permutation.end(), 0) - permutation.begin();
+        swap(permutation[0], permutation[other]);
+    }
+
+    mapping.permute(permutation);
+}
+
+bool rebalance_components(
+        ComponentMapping& mapping, const vector<double>& component_costs,
+        const vector<double>& process_costs, double tolerance){
+
+    const int n_components = mapping.get_n_components();
+    const int n_processors = mapping.get_n_processors();
+
+    if(component_costs.size() != unsigned(n_components) ||
+            process_costs.size() != unsigned(n_processors)){
+        throw logic_error("Costs given for rebalancing do not match the component mapping.");
+    }
+
+    vector<double> loads(process_costs);
+    vector<int> n_owned(n_processors, 0);
+    for(int c = 0; c < n_components; c++){
+        loads[mapping.process_of(c)] += component_costs[c];
+        n_owned[mapping.process_of(c)]++;
+    }
+
+    double mean = 0.0;
+    for(double load: loads){
+        mean += load / n_processors;
+    }
+
+    bool moved = false;
+
+    // Every move lowers the cost of the busiest process, so this ends; the
+    // bound only guards against rounding.
+    for(int n_moves = 0; n_moves < n_components; n_moves++){
+        int busiest = max_element(loads.begin(), loads.end()) - loads.begin();
+
+        if(loads[busiest] <= mean * (1.0 + tolerance) || n_owned[busiest] < 2){
+            break;
+        }
+
+        int best_component = -1, best_process = -1;
+        double best_peak = loads[busiest];
+
+        for(int c = 1; c < n_components; c++){
+            if(mapping.process_of(c) != busiest){
+                continue;
+            }
+
+            for(int p = 0; p < n_processors; p++){
+                if(p == busiest){
+                    continue;
+                }
+
+                double peak = max(loads[busiest] - component_costs[c], loads[p] + component_costs[c]);
+                if(peak < best_peak){
+                    best_peak = peak;
+                    best_component = c;
+                    best_process = p;
+                }
+            }
+        }
+
+        if(best_component < 0){
+            break;
+        }
+
+        mapping.assign(best_component, best_process);
+        loads[busiest] -= component_costs[best_component];
+        loads[best_process] += component_costs[best_component];
+        n_owned[busiest]--;
+        n_owned[best_process]++;
+        moved = true;
+    }
+
+    return moved;
+}
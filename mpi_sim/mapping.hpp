@@ -0,0 +1,94 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <exception>
+
+#include <mpi.h>
+
+using namespace std;
+
+/* Which process simulates each component of a network. By default, component
+ * c is simulated by process c % n_processors. A network file can instead store
+ * the process of each component (the ``component_mapping'' dataset), which is
+ * also taken modulo the number of processes, so that a file written for many
+ * processes can still be run on fewer. Whatever the mapping, component 0 is
+ * simulated by process 0, the master, which runs the python functions of a
+ * network. */
+class ComponentMapping{
+
+public:
+    ComponentMapping(): n_processors(1){}
+    ComponentMapping(int n_components, int n_processors, const vector<int>& assignment=vector<int>());
+
+    int process_of(int component) const{
+        if(component >= 0 && component < (int) processes.size()){
+            return processes[component];
+        }
+
+        return component % n_processors;
+    }
+
+    // The components simulated by ``process'', in increasing order.
+    vector<int> components_of(int process) const;
+
+    int get_n_components() const{ return processes.size(); }
+    int get_n_processors() const{ return n_processors; }
+
+    // Move every component simulated by process p to process permutation[p].
+    void permute(const vector<int>& permutation);
+
+    // Move a single component to ``process''.
+    void assign(int component, int process);
+
+    bool operator== (const ComponentMapping& other) const{
+        return n_processors == other.n_processors && processes == other.processes;
+    }
+
+    string to_string() const;
+
+private:
+    int n_processors;
+    vector<int> processes;
+};
+
+/* The number of values sent per step from component ``src'' to component
+ * ``dst'', as stored in the rows of the ``component_graph'' dataset. */
+struct ComponentEdge{
+    int src;
+    int dst;
+    long long size;
+};
+
+/* Rearrange the processes of ``mapping'' to suit the machine, by the traffic
+ * between them that ``graph'' implies. Collective over ``comm'', and gives the
+ * same mapping on every process. ``mode'' is one of:
+ *
+ *   default: leave the mapping as it is.
+ *   graph: hand the traffic to MPI as a distributed graph topology
+ *     (MPI_Dist_graph_create_adjacent), and let MPI reorder the processes
+ *     to fit the network of the machine. Whether it does depends on the MPI
+ *     library.
+ *   node: place processes that exchange the most on the same node (as given
+ *     by MPI_Comm_split_type), filling nodes one at a time greedily.
+ *
+ * Whichever process the mapping moves component 0 to trades places with
+ * process 0. */
+void remap_components(
+    ComponentMapping& mapping, const vector<ComponentEdge>& graph,
+    const string& mode, MPI_Comm comm);
+
+/* Move components of ``mapping'' from the busiest processes to the least busy
+ * ones, given the measured cost of each component (in seconds per step), and
+ * the cost of each process that does not belong to any component. Moves are
+ * made one component at a time, each to the process that leaves the larger of
+ * the two processes' costs smallest, for as long as the busiest process costs
+ * more than ``tolerance'' times the mean above the mean and a move helps.
+ * Component 0 is never moved, and neither is the last component of a process.
+ * Gives the same mapping on every process given the same costs. Returns
+ * whether any component was moved. */
+bool rebalance_components(
+    ComponentMapping& mapping, const vector<double>& component_costs,
+    const vector<double>& process_costs, double tolerance);
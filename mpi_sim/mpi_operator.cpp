@@ -1,31 +1,234 @@
 #include "mpi_operator.hpp"
 
-MPISend::MPISend(int dst, int tag, Signal content)
-:MPIOperator(tag), dst(dst), content(content){
+MPIOperator::MPIOperator(int tag, vector<Signal> contents, bool in_place, vector<bool> spikes)
+:first_call(true), tag(tag), comm(MPI_COMM_NULL), request(MPI_REQUEST_NULL),
+contents(contents), adjacent(!contents.empty()), in_place(false),
+spikes(spikes), n_spike_contents(0), mailbox(NULL), n_transferred(0), tracer(NULL), trace_name(0), size(0){
 
-    if(!content.is_contiguous){
-        throw runtime_error("MPISend got a non-contiguous signal.");
+    if(this->spikes.empty()){
+        this->spikes.assign(contents.size(), false);
     }
 
-    content_data = content.raw_data;
-    size = content.size;
-    buffer = unique_ptr<dtype>(new dtype[size]);
+    if(this->spikes.size() != contents.size()){
+        stringstream msg;
+        msg << "MPIOperator with tag " << tag << " has " << contents.size()
+            << " contents, but was told whether " << this->spikes.size()
+            << " of them are spikes.";
+        throw logic_error(msg.str());
+    }
+
+    for(unsigned i = 0; i < contents.size(); i++){
+        const Signal& content = contents[i];
+
+        if(!content.is_contiguous){
+            stringstream msg;
+            msg << "MPIOperator with tag " << tag << " got a non-contiguous signal.";
+            throw runtime_error(msg.str());
+        }
+
+        if(content.raw_data != contents.front().raw_data + size){
+            adjacent = false;
+        }
+
+        size += content.size;
+
+        // Spikes are sent with a header of at most one value more than their size.
+        if(this->spikes[i]){
+            n_spike_contents++;
+            size++;
+        }
+    }
+
+    set_in_place(in_place);
+}
+
+MPIOperator::~MPIOperator(){
+    int finalized;
+    MPI_Finalized(&finalized);
+
+    if(!finalized && request != MPI_REQUEST_NULL){
+        MPI_Request_free(&request);
+    }
+}
+
+void MPIOperator::set_in_place(bool in_place){
+    this->in_place = in_place && adjacent && n_spike_contents == 0;
+
+    if(this->in_place || mailbox){
+        buffer.reset();
+    }else if(!buffer){
+        buffer = unique_ptr<dtype[]>(new dtype[size]);
+    }
+}
+
+void MPIOperator::use_mailbox(SharedMailbox* mailbox){
+    this->mailbox = mailbox;
+
+    // Messages are packed into and unpacked out of the mailbox directly.
+    buffer.reset();
+}
+
+// Write the values of a signal holding spikes to b, returning the end of what was written.
+static dtype* pack_spikes(const Signal& content, dtype* b){
+    const dtype* values = content.raw_data;
+    const int n = content.size;
+
+    // The spikes are only worth sending as indices if there are at most n - 2 of them.
+    bool sparse = true;
+    int n_spikes = 0;
+    dtype amplitude = 0.0;
+
+    for(int i = 0; i < n && sparse; i++){
+        if(values[i] != 0.0){
+            if(n_spikes == 0){
+                amplitude = values[i];
+            }
+
+            if(values[i] != amplitude || n_spikes >= n - 2){
+                sparse = false;
+            }else{
+                b[2 + n_spikes++] = i;
+            }
+        }
+    }
+
+    if(!sparse){
+        b[0] = -1.0;
+        memcpy(b + 1, values, n * sizeof(dtype));
+        return b + 1 + n;
+    }
+
+    b[0] = n_spikes;
+    b[1] = amplitude;
+    return b + 2 + n_spikes;
+}
+
+static const dtype* unpack_spikes(const Signal& content, const dtype* b){
+    dtype* values = content.raw_data;
+
+    if(b[0] < 0.0){
+        memcpy(values, b + 1, content.size * sizeof(dtype));
+        return b + 1 + content.size;
+    }
+
+    unsigned n_spikes = unsigned(b[0]);
+    dtype amplitude = b[1];
+
+    fill(values, values + content.size, dtype(0.0));
+    for(unsigned i = 0; i < n_spikes; i++){
+        values[unsigned(b[2 + i])] = amplitude;
+    }
+
+    return b + 2 + n_spikes;
+}
+
+int MPIOperator::pack(){
+    if(in_place){
+        return size;
+    }
+
+    return pack(buffer.get());
+}
+
+int MPIOperator::pack(dtype* data){
+    dtype* b = data;
+    for(unsigned i = 0; i < contents.size(); i++){
+        const Signal& content = contents[i];
+
+        if(spikes[i]){
+            b = pack_spikes(content, b);
+        }else{
+            memcpy(b, content.raw_data, content.size * sizeof(dtype));
+            b += content.size;
+        }
+    }
+
+    return b - data;
+}
+
+void MPIOperator::unpack(){
+    if(in_place){
+        return;
+    }
+
+    unpack(buffer.get());
+}
+
+void MPIOperator::unpack(const dtype* data){
+    const dtype* b = data;
+    for(unsigned i = 0; i < contents.size(); i++){
+        const Signal& content = contents[i];
+
+        if(spikes[i]){
+            b = unpack_spikes(content, b);
+        }else{
+            memcpy(content.raw_data, b, content.size * sizeof(dtype));
+            b += content.size;
+        }
+    }
+}
+
+string MPIOperator::contents_to_string() const{
+    stringstream out;
+
+    out << "n_contents: " << contents.size() << endl;
+    for(unsigned i = 0; i < contents.size(); i++){
+        out << (spikes[i] ? "spike content:" : "content:") << endl;
+        out << signal_to_string(contents[i]) << endl;
+    }
+
+    return out.str();
+}
+
+MPISend::MPISend(int dst, int tag, vector<Signal> contents, bool in_place, vector<bool> spikes)
+:MPIOperator(tag, contents, in_place, spikes), dst(dst){
+
+    for(auto& content: contents){
+        declare_read(content);
+    }
+}
+
+void MPISend::init_request(){
+    // The size of messages with spikes is only known when they are sent.
+    if(!has_spikes() && !mailbox){
+        MPI_Send_init(message_data(), size, MPI_DTYPE, dst, tag, comm, &request);
+    }
 }
 
 void MPISend::operator() (){
-    if(first_call){
-        first_call = false;
-    }else{
-        MPI_Wait(&request, &status);
+    if(mailbox){
+        // Wait for the receiver to read the message last written where this one goes.
+        wait_for([this]{
+            return n_transferred - mailbox->n_read.load(memory_order_acquire) < SharedMailbox::depth;
+        });
+
+        pack(mailbox->message(n_transferred, size));
+        mailbox->n_written.store(++n_transferred, memory_order_release);
+
+        mpi_dbg(*this);
+        return;
     }
 
-    memcpy(buffer.get(), content_data, size * sizeof(dtype));
+    // Waiting on the inactive request before the first send returns immediately.
+    wait();
 
-    MPI_Isend(buffer.get(), size, MPI_DOUBLE, dst, tag, comm, &request);
+    int message_size = pack();
+
+    if(has_spikes()){
+        MPI_Isend(buffer.get(), message_size, MPI_DTYPE, dst, tag, comm, &request);
+    }else{
+        MPI_Start(&request);
+    }
 
     mpi_dbg(*this);
 }
 
+void MPISend::set_tracer(Tracer* tracer){
+    stringstream name;
+    name << "MPISend wait (dst " << dst << ", tag " << tag << ")";
+    trace_as(tracer, name.str());
+}
+
 string MPISend::to_string() const{
     stringstream out;
 
@@ -33,8 +236,8 @@ string MPISend::to_string() const{
     out << "tag: " << tag << endl;
     out << "dst: " << dst << endl;
     out << "size: " << size << endl;
-    out << "content:" << endl;
-    out << signal_to_string(content) << endl;
+    out << "in_place: " << in_place << endl;
+    out << contents_to_string();
 
     /*
     out << "buffer:" << endl;
@@ -46,39 +249,143 @@ string MPISend::to_string() const{
     return out.str();
 }
 
-MPIRecv::MPIRecv(int src, int tag, Signal content, bool is_update)
-:MPIOperator(tag), src(src), content(content), is_update(is_update){
+MPIRecv::MPIRecv(
+    int src, int tag, vector<Signal> contents, bool is_update, bool in_place,
+    vector<bool> spikes)
+:MPIOperator(tag, contents, in_place && !is_update, spikes), src(src), is_update(is_update){
 
-    if(!content.is_contiguous){
-        throw runtime_error("MPIRecv got a non-contiguous signal.");
+    for(auto& content: contents){
+        declare_write(content);
+    }
+}
+
+void MPIRecv::init_request(){
+    if(mailbox){
+        return;
     }
 
-    content_data = content.raw_data;
-    size = content.size;
-    buffer = unique_ptr<dtype>(new dtype[size]);
+    MPI_Recv_init(message_data(), size, MPI_DTYPE, src, tag, comm, &request);
 }
 
 void MPIRecv::operator() (){
     if(is_update && first_call){
         first_call = false;
+
+        if(!pending.empty()){
+            unpack(pending.data());
+            pending.clear();
+        }
+    }else if(mailbox){
+        unpack(peek());
+        consume();
+    }else if(in_place){
+        MPI_Start(&request);
+        wait();
     }else{
-        MPI_Wait(&request, &status);
-        memcpy(content_data, buffer.get(), size * sizeof(dtype));
-        MPI_Irecv(buffer.get(), size, MPI_DOUBLE, src, tag, comm, &request);
+        wait();
+        unpack();
+        MPI_Start(&request);
     }
 
     mpi_dbg(*this);
 }
 
+const dtype* MPIRecv::peek(){
+    wait_for([this]{
+        return mailbox->n_written.load(memory_order_acquire) > n_transferred;
+    });
+
+    return mailbox->message(n_transferred, size);
+}
+
+void MPIRecv::consume(){
+    mailbox->n_read.store(++n_transferred, memory_order_release);
+}
+
 void MPIRecv::init(){
-    MPI_Irecv(buffer.get(), size, MPI_DOUBLE, src, tag, comm, &request);
+    if(!in_place && !mailbox){
+        MPI_Start(&request);
+    }
 }
 
 void MPIRecv::complete(){
-    if(!is_update){
+    if(mailbox){
+        if(is_update){
+            const dtype* message = peek();
+            pending.assign(message, message + size);
+            consume();
+            first_call = true;
+        }
+
+        return;
+    }
+
+    // In-place receives are never left active between steps.
+    if(!is_update && !in_place){
         MPI_Cancel(&request);
     }
     MPI_Wait(&request, &status);
+
+    // The update sent on the last step belongs to the step after it, so it
+    // is kept for the next simulation, which starts by unpacking it.
+    if(is_update){
+        pending.assign(buffer.get(), buffer.get() + size);
+        first_call = true;
+    }
+}
+
+void MPIRecv::set_tracer(Tracer* tracer){
+    stringstream name;
+    name << "MPIRecv wait (src " << src << ", tag " << tag << ")";
+    trace_as(tracer, name.str());
+}
+
+void MPIRecv::reset(unsigned seed){
+    MPIOperator::reset(seed);
+    pending.clear();
+}
+
+void MPIRecv::save_state(ostream& out){
+    if(!is_update){
+        return;
+    }
+
+    if(first_call){
+        write_state(out, pending);
+    }else if(mailbox){
+        // The message is left in the mailbox for the next call to unpack.
+        const dtype* message = peek();
+        write_state(out, vector<dtype>(message, message + size));
+    }else{
+        // Between steps of a simulation, the message sent on the last
+        // step may still be on its way, and is waited for here. The
+        // request is then inactive, and the next call doesn't wait again.
+        MPI_Wait(&request, &status);
+        write_state(out, vector<dtype>(buffer.get(), buffer.get() + size));
+    }
+}
+
+void MPIRecv::load_state(istream& in){
+    if(!is_update){
+        return;
+    }
+
+    read_state(in, pending);
+    first_call = true;
+
+    if(!pending.empty() && pending.size() != unsigned(size)){
+        throw runtime_error("Checkpointed message does not match the size of its MPIRecv.");
+    }
+}
+
+void MPIRecv::hold_contents(){
+    if(!is_update){
+        return;
+    }
+
+    pending.assign(size, 0.0);
+    pack(pending.data());
+    first_call = true;
 }
 
 string MPIRecv::to_string() const{
@@ -88,9 +395,9 @@ string MPIRecv::to_string() const{
     out << "tag: " << tag << endl;
     out << "src: " << src << endl;
     out << "size: " << size << endl;
+    out << "in_place: " << in_place << endl;
     out << "is_update: " << is_update << endl;
-    out << "content:" << endl;
-    out << signal_to_string(content) << endl;
+    out << contents_to_string();
 
     /*
     out << "buffer:" << endl;
@@ -101,3 +408,20 @@ string MPIRecv::to_string() const{
 
     return out.str();
 }
+
+MPIWait::MPIWait(MPISend* send)
+:send(send){
+
+    for(auto& content: send->get_contents()){
+        declare_read(content);
+    }
+}
+
+string MPIWait::to_string() const{
+    stringstream out;
+
+    out << Operator::to_string();
+    out << "tag: " << send->get_tag() << endl;
+
+    return out.str();
+}
@@ -2,8 +2,13 @@
 
 #include <mpi.h>
 
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
 #include "signal.hpp"
 #include "operator.hpp"
+#include "trace.hpp"
 
 #include "typedef.hpp"
 #include "debug.hpp"
@@ -11,11 +16,70 @@
 
 using namespace std;
 
+// Tag used by the chunks to tell each other how their sends have been grouped.
+const int mpi_group_tag = 3;
+
+// Shared-memory transfers need MPI-3 shared windows, and atomics that work
+// between processes, which only lock-free ones are guaranteed to.
+#if MPI_VERSION >= 3 && ATOMIC_LLONG_LOCK_FREE == 2
+#define NENGO_MPI_SHARED_MEMORY
+#endif
+
+/* Where the messages of an MPISend to a process on the same node are written,
+ * in memory shared by the two processes, so that the MPIRecv can read them
+ * straight from there. The header counts the messages written and read; it is
+ * followed by room for ``mailbox_depth'' messages, which are used in turn. The
+ * counters are on separate cache lines, since each is written by one side of
+ * the transfer, and each side reads the other's counter to know when it may go
+ * on. Each side keeps its own count of the messages it has transferred. */
+struct SharedMailbox{
+    static const unsigned depth = 2;
+
+    alignas(64) atomic<unsigned long long> n_written;
+    alignas(64) atomic<unsigned long long> n_read;
+
+    SharedMailbox(): n_written(0), n_read(0){}
+
+    // Where message ``i'' of a transfer of at most ``size'' values goes.
+    dtype* message(unsigned long long i, int size){
+        return reinterpret_cast<dtype*>(this + 1) + (i % depth) * size;
+    }
+
+    // Bytes of shared memory used by a mailbox for messages of at most ``size''
+    // values, rounded up so that the next mailbox starts on a cache line.
+    static size_t bytes(int size){
+        size_t n = sizeof(SharedMailbox) + depth * size * sizeof(dtype);
+        return (n + 63) / 64 * 64;
+    }
+};
+
+/* Base class for operators that communicate with other processes. Each
+ * MPIOperator transfers a group of signals (its ``contents'') in a single
+ * message, packed one after another into a preallocated buffer. The message
+ * uses a persistent request, which is created by ``init_request'' once the
+ * communicator is known and then restarted every step.
+ *
+ * If the contents lie next to each other in memory, in order, the message can
+ * instead be transferred ``in place'', straight from the memory of the
+ * contents, with no buffer and no copying.
+ *
+ * Contents that hold the spikes of neurons, which are almost all zero, can be
+ * sent as spikes: as the number of spikes, their amplitude and the indices of
+ * the neurons that spiked, or as -1 followed by every value when that would be
+ * smaller, or the nonzero values differ. Messages with spikes vary in size, so
+ * they are sent without a persistent request, and never in place.
+ *
+ * Between processes on the same node, messages can instead be passed through
+ * a SharedMailbox, which the sender packs the contents into and the receiver
+ * unpacks them out of, with no MPI calls and a single copy on each side. */
 class MPIOperator: public Operator{
 
 public:
-    MPIOperator():first_call(true){}
-    MPIOperator(int tag):first_call(true), tag(tag){}
+    /* ``spikes'' says which contents are sent as spikes; if empty, none are. */
+    MPIOperator(
+        int tag, vector<Signal> contents, bool in_place=false,
+        vector<bool> spikes=vector<bool>());
+    virtual ~MPIOperator();
 
     string classname() const { return "MPIOperator"; }
 
@@ -24,10 +88,99 @@ public:
 
     virtual void reset(unsigned seed){first_call = true;}
 
-    virtual void complete(){ MPI_Wait(&request, &status); }
+    // MPI is only guaranteed to be callable from the thread that initialized it.
+    virtual bool thread_safe() const{ return false; }
+
+    virtual void complete(){ wait(); }
     void set_communicator(MPI_Comm comm){ this->comm = comm; }
 
+    // Record the time spent waiting for messages in ``tracer'', or stop
+    // recording it if NULL. The tracer must outlive the simulation.
+    virtual void set_tracer(Tracer* tracer) = 0;
+
+    // Seconds spent waiting for messages, recorded by the tracer.
+    double get_wait_time() const{ return tracer ? tracer->total(trace_name) : 0.0; }
+
+    // Create the persistent request. Must be called after set_communicator.
+    virtual void init_request() = 0;
+
+    virtual size_t buffer_bytes() const{ return buffer ? size * sizeof(dtype) : 0; }
+
+    int get_tag() const{ return tag; }
+    unsigned get_n_contents() const{ return contents.size(); }
+    const vector<Signal>& get_contents() const{ return contents; }
+
+    /* Whether the message is transferred in place. Requesting an in-place
+     * transfer has no effect if the contents are not adjacent. Must not be
+     * changed after init_request has been called. */
+    bool is_in_place() const{ return in_place; }
+    void set_in_place(bool in_place);
+
+    // Whether any of the contents are sent as spikes.
+    bool has_spikes() const{ return n_spike_contents > 0; }
+
+    /* Transfer messages through ``mailbox'' instead of MPI, from then on. Both
+     * sides of a transfer must use the same mailbox, and neither then needs a
+     * request. The mailbox must outlive the operator's use. */
+    void use_mailbox(SharedMailbox* mailbox);
+    bool uses_mailbox() const{ return mailbox != NULL; }
+
+    // The largest number of values in a message.
+    int get_size() const{ return size; }
+
 protected:
+    // Copy the contents into the buffer, or out of it. No-ops when in place.
+    // pack returns the number of values in the message.
+    int pack();
+    void unpack();
+
+    // Copy a message out of ``data'' into the contents.
+    void unpack(const dtype* data);
+
+    // Copy the contents into ``data'', in place or not, returning the number of values written.
+    int pack(dtype* data);
+
+    // Where the message is sent from or received into.
+    dtype* message_data(){ return in_place ? contents.front().raw_data : buffer.get(); }
+
+    string contents_to_string() const;
+
+    // Wait for the request to finish, recording the time spent if traced.
+    void wait(){
+        if(tracer){
+            double begin = wall_time();
+            MPI_Wait(&request, &status);
+            tracer->record_wait(trace_name, begin, wall_time());
+        }else{
+            MPI_Wait(&request, &status);
+        }
+    }
+
+    // Wait until the other side of a transfer through the mailbox makes
+    // ``ready'' true, recording the time spent if traced. The other
+    // process is likely to be running, so the wait spins, but yields the
+    // core on each try, in case there are more processes than cores.
+    template<typename Ready>
+    void wait_for(Ready ready){
+        if(ready()){
+            return;
+        }
+
+        double begin = tracer ? wall_time() : 0.0;
+        do{
+            this_thread::yield();
+        }while(!ready());
+
+        if(tracer){
+            tracer->record_wait(trace_name, begin, wall_time());
+        }
+    }
+
+    void trace_as(Tracer* tracer, string name){
+        this->tracer = tracer;
+        trace_name = tracer ? tracer->add_name(name) : 0;
+    }
+
     bool first_call;
 
     int tag;
@@ -35,39 +188,110 @@ protected:
     MPI_Request request;
     MPI_Status status;
 
-    unique_ptr<dtype> buffer;
+    vector<Signal> contents;
+    bool adjacent;
+    bool in_place;
+
+    vector<bool> spikes;
+    unsigned n_spike_contents;
+
+    unique_ptr<dtype[]> buffer;
+
+    SharedMailbox* mailbox;
+    unsigned long long n_transferred;
+
+    Tracer* tracer;
+    unsigned trace_name;
+
+    // The largest number of values in a message, which is the size of the buffer.
     int size;
 };
 
 class MPISend: public MPIOperator{
 
 public:
-    MPISend(int dst, int tag, Signal content);
+    MPISend(
+        int dst, int tag, vector<Signal> contents, bool in_place=false,
+        vector<bool> spikes=vector<bool>());
     string classname() const { return "MPISend"; }
+    virtual BatchRunner batch_runner() const { return run_batch<MPISend>; }
 
     virtual void operator()();
+    virtual void init_request();
+    virtual void set_tracer(Tracer* tracer);
     virtual string to_string() const;
 
+    int get_dst() const{ return dst; }
+
 private:
     int dst;
-    Signal content;
-    dtype* content_data;
 };
 
 class MPIRecv: public MPIOperator{
 
 public:
-    MPIRecv(int src, int tag, Signal content, bool is_update);
+    /* An in-place receive is only posted when the operator runs, so that MPI
+     * never writes to the contents while other operators use them. Updates
+     * are never received in place, since their message is sent a step before
+     * it is received, and the sender could block waiting for it to be posted. */
+    MPIRecv(
+        int src, int tag, vector<Signal> contents, bool is_update, bool in_place=false,
+        vector<bool> spikes=vector<bool>());
     string classname() const { return "MPIRecv"; }
+    virtual BatchRunner batch_runner() const { return run_batch<MPIRecv>; }
 
     virtual void operator()();
+    virtual void init_request();
     void init();
     virtual void complete();
+    virtual void set_tracer(Tracer* tracer);
     virtual string to_string() const;
 
+    virtual void reset(unsigned seed);
+
+    /* The state of an update receive is the message sent on the last step
+     * that has been simulated, which would be unpacked on the next step. */
+    virtual void save_state(ostream& out);
+    virtual void load_state(istream& in);
+
+    /* Make the current values of the contents of an update receive the
+     * message that is unpacked on the next step, as though they had just
+     * been sent. Used when the sender's values have been copied into the
+     * contents directly. */
+    void hold_contents();
+
+    int get_src() const{ return src; }
+
 private:
+    // The next message in the mailbox, waiting for it to be written.
+    const dtype* peek();
+
+    // Let the sender reuse the space of the message returned by peek.
+    void consume();
+
     int src;
-    Signal content;
-    dtype* content_data;
     bool is_update;
+
+    // For updates, a message received after the last step of a simulation,
+    // which is unpacked on the first step of the next one.
+    vector<dtype> pending;
+};
+
+/* Waits for an in-place MPISend to finish, so that the memory it sends from can
+ * be overwritten. The chunk places one of these in front of the first operator
+ * that writes to the contents of the send. */
+class MPIWait: public Operator{
+
+public:
+    MPIWait(MPISend* send);
+    string classname() const { return "MPIWait"; }
+    virtual BatchRunner batch_runner() const { return run_batch<MPIWait>; }
+
+    void operator()(){ send->complete(); }
+    virtual string to_string() const;
+
+    virtual bool thread_safe() const{ return false; }
+
+private:
+    MPISend* send;
 };
@@ -3,8 +3,8 @@
 int n_processors_available = 1;
 
 // This constructor assumes that MPI_Initialize has already been called.
-MpiSimulator::MpiSimulator(bool collect_timings)
-:Simulator(collect_timings), comm(MPI_COMM_WORLD){
+MpiSimulator::MpiSimulator(SimulatorConfig config)
+:Simulator(config), comm(MPI_COMM_WORLD){
     MPI_Comm_size(comm, &n_processors);
 
     int buflen = 512;
@@ -19,17 +19,17 @@ MpiSimulator::MpiSimulator(bool collect_timings)
     cout << "Master detected " << n_processors << " processor(s) in total." << endl;
 
     mpi_wake_workers();
-    bcast_send_int(collect_timings ? 1 : 0, comm);
+    bcast_send_string(config.to_string(), comm);
 
     chunk = unique_ptr<MpiSimulatorChunk>(
-        new MpiSimulatorChunk(0, n_processors, collect_timings));
+        new MpiSimulatorChunk(0, n_processors, config));
 }
 
 MpiSimulator::~MpiSimulator(){
 }
 
 void MpiSimulator::from_file(string filename){
-    clock_t begin = clock();
+    double begin = wall_time();
 
     label = filename;
     if(filename.length() == 0){
@@ -48,44 +48,64 @@ void MpiSimulator::from_file(string filename){
 
     in_file.close();
 
-    for(int i = 0; i < n_processors-1; i++){
-        send_string(filename, i+1, setup_tag, comm);
+    cache_key = chunk_cache_key(filename, config);
+
+    bcast_send_string(filename, comm);
+    bcast_send_string(cache_key, comm);
+
+    if(!take_cached_chunk(comm)){
+        chunk->from_file(filename, comm);
     }
 
-    // Use parallel property lists
-    hid_t file_plist = H5Pcreate(H5P_FILE_ACCESS);
-    H5Pset_fapl_mpio(file_plist, comm, MPI_INFO_NULL);
+    for(const ProbeSpec& pi : chunk->probe_info){
+        probe_data[pi.probe_key] = vector<ProbeBlock>();
+    }
 
-    hid_t read_plist = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(read_plist, H5FD_MPIO_INDEPENDENT);
+    // Master barrier 1
+    MPI_Barrier(comm);
 
-    chunk->from_file(filename, file_plist, read_plist);
+    double delta = wall_time() - begin;
+    cout << "Loading network from file took " << delta << " seconds." << endl;
 
-    probe_counts.resize(n_processors);
-    for(const ProbeSpec& pi : chunk->probe_info){
-        probe_data[pi.probe_key] = vector<Signal>();
-        probe_counts[pi.component % n_processors] += 1;
+    write_to_loadtimes_file(delta);
+}
+
+void MpiSimulator::from_network(shared_ptr<const PackedNetwork> network){
+    double begin = wall_time();
+
+    label = "network in memory";
+
+    cache_key = chunk_cache_key(*network, config);
+
+    // An empty filename tells the workers that the network is scattered from here.
+    bcast_send_string("", comm);
+    bcast_send_string(cache_key, comm);
+
+    if(!take_cached_chunk(comm)){
+        chunk->from_network(network, comm);
     }
 
-    H5Pclose(file_plist);
-    H5Pclose(read_plist);
+    for(const ProbeSpec& pi : chunk->probe_info){
+        probe_data[pi.probe_key] = vector<ProbeBlock>();
+    }
 
     // Master barrier 1
     MPI_Barrier(comm);
 
-    clock_t end = clock();
-    double delta = double(end - begin) / CLOCKS_PER_SEC;
-    cout << "Loading network from file took " << delta << " seconds." << endl;
+    double delta = wall_time() - begin;
+    cout << "Loading network from memory took " << delta << " seconds." << endl;
 
     write_to_loadtimes_file(delta);
 }
 
 void MpiSimulator::finalize_build(){
-    chunk->finalize_build(comm);
+    if(!chunk_from_cache){
+        chunk->finalize_build(comm);
+    }
 }
 
 void MpiSimulator::run_n_steps(int steps, bool progress, string log_filename){
-    clock_t begin = clock();
+    double begin = wall_time();
 
     if(steps <= 0){
         throw runtime_error("Number of steps must be > 0.");
@@ -110,13 +130,70 @@ void MpiSimulator::run_n_steps(int steps, bool progress, string log_filename){
     // Master barrier 3
     MPI_Barrier(comm);
 
-    clock_t end = clock();
-    double delta = double(end - begin) / CLOCKS_PER_SEC;
+    double delta = wall_time() - begin;
     cout << "Simulating " << steps << " steps took " << delta << " seconds." << endl;
 
     write_to_runtimes_file(delta);
 }
 
+/* Probe data is gathered from the workers after a simulation with two
+ * collectives over all processes: a header holding (key, n_rows, shape1,
+ * shape2) for each probe of a process, and the samples of all of its probes
+ * one after another. The master takes part with no probes of its own. When
+ * there are too many samples in total for the int counts and displacements of
+ * MPI_Gatherv, each worker instead sends its samples to the master in messages
+ * of at most max_probe_message values. */
+static const long long max_probe_message = 1 << 28;
+
+static void send_probe_data(MpiSimulatorChunk& chunk, MPI_Comm comm){
+    vector<unsigned long long> header;
+    vector<ProbeBlock> blocks;
+    long long n_values = 0;
+
+    for(auto& pair : chunk.probe_map){
+        shared_ptr<Probe>& probe = pair.second;
+
+        ProbeBlock block;
+        block.data = probe->harvest_block(block.n_rows);
+        block.shape1 = probe->sample_shape1();
+        block.shape2 = probe->sample_shape2();
+
+        header.push_back(pair.first);
+        header.push_back(block.n_rows);
+        header.push_back(block.shape1);
+        header.push_back(block.shape2);
+
+        n_values += (long long) block.n_rows * block.sample_size();
+        blocks.push_back(block);
+    }
+
+    vector<dtype> values;
+    values.reserve(n_values);
+    for(auto& block : blocks){
+        values.insert(values.end(), block.data.get(), block.data.get() + block.n_rows * block.sample_size());
+    }
+
+    long long counts[2] = {(long long) header.size(), n_values};
+    MPI_Gather(counts, 2, MPI_LONG_LONG, NULL, 2, MPI_LONG_LONG, 0, comm);
+
+    int streamed;
+    MPI_Bcast(&streamed, 1, MPI_INT, 0, comm);
+
+    MPI_Gatherv(
+        header.data(), header.size(), MPI_UNSIGNED_LONG_LONG,
+        NULL, NULL, NULL, MPI_UNSIGNED_LONG_LONG, 0, comm);
+
+    if(!streamed){
+        MPI_Gatherv(values.data(), n_values, MPI_DTYPE, NULL, NULL, NULL, MPI_DTYPE, 0, comm);
+    }else{
+        for(long long offset = 0; offset < n_values; offset += max_probe_message){
+            MPI_Send(
+                values.data() + offset, min(max_probe_message, n_values - offset),
+                MPI_DTYPE, 0, probe_tag, comm);
+        }
+    }
+}
+
 void MpiSimulator::gather_probe_data(){
 
     // Gather data on the master process
@@ -125,28 +202,77 @@ void MpiSimulator::gather_probe_data(){
     // Gather data on the worker processes
     cout << "Master gathering probe data from workers..." << endl;
 
-    for(int processor_idx = 1; processor_idx < n_processors; processor_idx++){
+    long long no_counts[2] = {0, 0};
+    vector<long long> counts(2 * n_processors);
+    MPI_Gather(no_counts, 2, MPI_LONG_LONG, counts.data(), 2, MPI_LONG_LONG, 0, comm);
 
-        int probe_count = probe_counts[processor_idx];
+    vector<int> header_counts(n_processors), header_displs(n_processors);
+    vector<int> value_counts(n_processors), value_displs(n_processors);
+    vector<long long> value_offsets(n_processors);
+    long long n_header = 0, n_values = 0;
 
-        for(unsigned i = 0; i < probe_count; i++){
-            key_type probe_key = recv_key(processor_idx, probe_tag, comm);
+    for(int p = 0; p < n_processors; p++){
+        header_counts[p] = counts[2 * p];
+        header_displs[p] = n_header;
+        n_header += counts[2 * p];
 
-            run_dbg("Master receiving probe data from chunk " << processor_idx << endl
-                    << "with key " << probe_key << "..." << endl);
+        value_offsets[p] = n_values;
+        n_values += counts[2 * p + 1];
+    }
 
-            int data_length = recv_int(processor_idx, probe_tag, comm);
+    int streamed = n_values > INT_MAX;
+    MPI_Bcast(&streamed, 1, MPI_INT, 0, comm);
 
-            auto& data = probe_data[probe_key];
-            data.reserve(data.size() + data_length);
+    vector<unsigned long long> header(n_header);
+    MPI_Gatherv(
+        NULL, 0, MPI_UNSIGNED_LONG_LONG,
+        header.data(), header_counts.data(), header_displs.data(), MPI_UNSIGNED_LONG_LONG, 0, comm);
 
-            for(int j = 0; j < data_length; j++){
-                Signal signal = recv_base_signal(processor_idx, probe_tag, comm);
-                data.push_back(signal);
+    shared_ptr<dtype> values(new dtype[max(n_values, 1LL)], default_delete<dtype[]>());
+
+    if(!streamed){
+        for(int p = 0; p < n_processors; p++){
+            value_counts[p] = counts[2 * p + 1];
+            value_displs[p] = value_offsets[p];
+        }
+
+        MPI_Gatherv(
+            NULL, 0, MPI_DTYPE,
+            values.get(), value_counts.data(), value_displs.data(), MPI_DTYPE, 0, comm);
+    }else{
+        for(int p = 1; p < n_processors; p++){
+            long long n = counts[2 * p + 1];
+
+            for(long long offset = 0; offset < n; offset += max_probe_message){
+                MPI_Status status;
+                MPI_Recv(
+                    values.get() + value_offsets[p] + offset, min(max_probe_message, n - offset),
+                    MPI_DTYPE, p, probe_tag, comm, &status);
             }
         }
     }
 
+    // The samples of each probe are a view of their part of the values.
+    for(int p = 1; p < n_processors; p++){
+        long long offset = value_offsets[p];
+
+        for(int i = header_displs[p]; i < header_displs[p] + header_counts[p]; i += 4){
+            key_type probe_key = header[i];
+
+            run_dbg("Master received probe data from chunk " << p << endl
+                    << "with key " << probe_key << "..." << endl);
+
+            ProbeBlock block;
+            block.n_rows = header[i + 1];
+            block.shape1 = header[i + 2];
+            block.shape2 = header[i + 3];
+            block.data = shared_ptr<dtype>(values, values.get() + offset);
+
+            probe_data[probe_key].push_back(block);
+            offset += (long long) block.n_rows * block.sample_size();
+        }
+    }
+
     cout << "Master done gathering probe data from workers." << endl;
 }
 
@@ -164,12 +290,111 @@ void MpiSimulator::reset(unsigned seed){
     MPI_Barrier(comm);
 }
 
+void MpiSimulator::checkpoint(string filename){
+    cout << "Master sending signal to write a checkpoint to " << n_processors - 1 << " workers." << endl;
+
+    int steps = checkpoint_signal;
+    MPI_Bcast(&steps, 1, MPI_INT, 0, comm);
+    bcast_send_string(filename, comm);
+
+    Simulator::checkpoint(filename);
+
+    // Master barrier 6
+    MPI_Barrier(comm);
+}
+
+void MpiSimulator::restore(string filename){
+    cout << "Master sending signal to restore a checkpoint to " << n_processors - 1 << " workers." << endl;
+
+    int steps = restore_signal;
+    MPI_Bcast(&steps, 1, MPI_INT, 0, comm);
+    bcast_send_string(filename, comm);
+
+    Simulator::restore(filename);
+
+    // Master barrier 6
+    MPI_Barrier(comm);
+}
+
+/* Rebuilds ``chunk'' for the components its process simulates after they are
+ * moved by plan_rebalance, if any are, and moves the state of the simulation
+ * into it. The new chunk is loaded from the network file, or from the network
+ * in the master's memory, while the old one still holds the state. ``add_ops'' adds the operators that don't come from
+ * the file to the new chunk. Every process in comm must call this. */
+static bool rebalance_chunk(
+        unique_ptr<MpiSimulatorChunk>& chunk, const SimulatorConfig& config, MPI_Comm comm,
+        function<void(MpiSimulatorChunk&)> add_ops){
+
+    ComponentMapping new_mapping;
+    if(!chunk->plan_rebalance(new_mapping)){
+        return false;
+    }
+
+    int rank, n_processors;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_processors);
+
+    unique_ptr<MpiSimulatorChunk> new_chunk(new MpiSimulatorChunk(rank, n_processors, config));
+    new_chunk->set_mapping(new_mapping);
+
+    if(chunk->get_network()){
+        new_chunk->from_network(chunk->get_network(), comm);
+    }else{
+        new_chunk->from_file(chunk->get_filename(), comm);
+    }
+
+    if(add_ops){
+        add_ops(*new_chunk);
+    }
+
+    new_chunk->finalize_build(comm);
+    new_chunk->migrate_from(*chunk);
+
+    chunk->close_simulation_log();
+    chunk->free_shared_transport();
+    chunk = move(new_chunk);
+
+    return true;
+}
+
+bool MpiSimulator::rebalance(){
+    cout << "Master sending signal to rebalance the simulation to " << n_processors - 1 << " workers." << endl;
+
+    int steps = rebalance_signal;
+    MPI_Bcast(&steps, 1, MPI_INT, 0, comm);
+
+    double begin = wall_time();
+
+    bool moved = rebalance_chunk(chunk, config, comm, [this](MpiSimulatorChunk& new_chunk){
+        for(auto& pyfunc: pyfuncs){
+            new_chunk.add_op(pyfunc.first, pyfunc.second(new_chunk));
+        }
+    });
+
+    if(moved){
+        cout << "Rebalancing took " << wall_time() - begin << " seconds." << endl;
+
+        // The new chunk simulates components on other processes than the
+        // network's mapping gives, so it isn't kept.
+        cache_key.clear();
+    }
+
+    // Master barrier 7
+    MPI_Barrier(comm);
+
+    return moved;
+}
+
 void MpiSimulator::close(){
     cout << "Master sending signal to close the simulator to " << n_processors - 1 << " workers." << endl;
     int steps = -1;
     MPI_Bcast(&steps, 1, MPI_INT, 0, comm);
 
-    chunk->close_simulation_log();
+    // Only the master knows whether the chunk has python functions.
+    int keep = can_keep_chunk();
+    MPI_Bcast(&keep, 1, MPI_INT, 0, comm);
+
+    release_chunk(keep, comm);
 
     // Master barrier 4
     MPI_Barrier(comm);
@@ -208,7 +433,11 @@ void mpi_init(){
     int argc = 0;
     char** argv;
 
-    MPI_Init(&argc, &argv);
+    // Operators are only ever run on multiple threads within a process if
+    // they don't make MPI calls, but probe data may be written to the parallel
+    // simulation log by a background thread while the main thread communicates.
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
 
     MPI_Comm_size(MPI_COMM_WORLD, &n_processors_available);
 }
@@ -235,6 +464,9 @@ void mpi_wake_workers(){
 void mpi_kill_workers(){
     int kill = 1;
     MPI_Bcast(&kill, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    // The workers free their kept chunks at the same time.
+    chunk_cache().clear();
 }
 
 void mpi_worker_start(){
@@ -264,37 +496,48 @@ void mpi_worker_start(MPI_Comm comm){
 
         if(kill){
             // Program is ending
+            chunk_cache().clear();
             break;
         }
 
         MPI_Status status;
 
-        dbg("Reading collect_timings...");
-        int collect_timings = bcast_recv_int(comm);
+        dbg("Reading simulator options...");
+        SimulatorConfig config(bcast_recv_string(comm));
 
         dbg("Reading filename...");
-        string filename = recv_string(0, setup_tag, comm);
-
-        dbg("Creating chunk...");
-        MpiSimulatorChunk chunk(rank, n_processors, bool(collect_timings));
-
-        // Use parallel property lists
-        hid_t file_plist = H5Pcreate(H5P_FILE_ACCESS);
-        H5Pset_fapl_mpio(file_plist, comm, MPI_INFO_NULL);
-
-        hid_t read_plist = H5Pcreate(H5P_DATASET_XFER);
-        H5Pset_dxpl_mpio(read_plist, H5FD_MPIO_INDEPENDENT);
-
-        dbg("Loading from file...");
-        chunk.from_file(filename, file_plist, read_plist);
-        chunk.finalize_build(comm);
-
-        H5Pclose(file_plist);
-        H5Pclose(read_plist);
+        string filename = bcast_recv_string(comm);
+        string cache_key = bcast_recv_string(comm);
+
+        // Matches the master's call in from_file or from_network.
+        unique_ptr<MpiSimulatorChunk> chunk = chunk_cache().take(cache_key, comm);
+        bool from_cache = bool(chunk);
+
+        if(from_cache){
+            dbg("Reusing a kept chunk...");
+        }else{
+            dbg("Creating chunk->..");
+            chunk.reset(new MpiSimulatorChunk(rank, n_processors, config));
+
+            if(filename.empty()){
+                dbg("Loading from the master's memory...");
+                chunk->from_network(make_shared<PackedNetwork>(), comm);
+            }else{
+                dbg("Loading from file...");
+                chunk->from_file(filename, comm);
+            }
+        }
 
         // Worker barrier 1
         MPI_Barrier(comm);
 
+        // Matches the master's call to finalize_build, which
+        // comes after master barrier 1. Chunks exchange
+        // information about their MPI messages while finalizing.
+        if(!from_cache){
+            chunk->finalize_build(comm);
+        }
+
         while(true){
             dbg("Worker " << rank << " waiting for signal to start simulation...");
             int steps;
@@ -307,7 +550,7 @@ void mpi_worker_start(MPI_Comm comm){
                 unsigned seed;
                 MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, comm);
 
-                chunk.reset(seed);
+                chunk->reset(seed);
 
                 // Worker barrier 5
                 MPI_Barrier(comm);
@@ -317,35 +560,53 @@ void mpi_worker_start(MPI_Comm comm){
                 dbg("Worker " << rank << " received the signal to run the simulation for "
                     << steps << " steps." << endl);
 
-                chunk.run_n_steps(steps, false);
+                chunk->run_n_steps(steps, false);
 
                 // Worker barrier 2
                 MPI_Barrier(comm);
 
-                if(!chunk.is_logging()){
+                if(!chunk->is_logging()){
                     // If we're not logging, send the probe data back to the master
-                    for(auto& pair : chunk.probe_map){
-                        key_type key = pair.first;
-                        shared_ptr<Probe>& probe = pair.second;
-
-                        send_key(key, 0, probe_tag, comm);
+                    send_probe_data(*chunk, comm);
+                }
 
-                        vector<Signal> probe_data = probe->harvest_data();
+                // Worker barrier 3
+                MPI_Barrier(comm);
+            }else if(steps == checkpoint_signal || steps == restore_signal){
+                string checkpoint_filename = bcast_recv_string(comm);
+
+                if(steps == checkpoint_signal){
+                    dbg("Worker " << rank << " received the signal to write a checkpoint." << endl);
+                    chunk->checkpoint(checkpoint_filename);
+                }else{
+                    dbg("Worker " << rank << " received the signal to restore a checkpoint." << endl);
+                    chunk->restore(checkpoint_filename);
+                }
 
-                        send_int(probe_data.size(), 0, probe_tag, comm);
+                // Worker barrier 6
+                MPI_Barrier(comm);
+            }else if(steps == rebalance_signal){
+                dbg("Worker " << rank << " received the signal to rebalance the simulation." << endl);
 
-                        for(auto& pd : probe_data){
-                            send_base_signal(move(pd), 0, probe_tag, comm);
-                        }
-                    }
+                if(rebalance_chunk(chunk, config, comm, nullptr)){
+                    cache_key.clear();
                 }
 
-                // Worker barrier 3
+                // Worker barrier 7
                 MPI_Barrier(comm);
             }else{
                 dbg("Worker " << rank << " received the signal to close the simulation." << endl);
 
-                chunk.close_simulation_log();
+                int keep;
+                MPI_Bcast(&keep, 1, MPI_INT, 0, comm);
+
+                chunk->close_simulation_log();
+                if(keep && !cache_key.empty()){
+                    chunk_cache().put(
+                        cache_key, move(chunk), size_t(config.cache_memory) << 20, comm);
+                }else{
+                    chunk->free_shared_transport();
+                }
 
                 // Worker barrier 4
                 MPI_Barrier(comm);
@@ -387,14 +648,14 @@ void send_string(string s, int dst, int tag, MPI_Comm comm){
 
 dtype recv_dtype(int src, int tag, MPI_Comm comm){
     MPI_Status status;
-    double d;
+    dtype d;
 
-    MPI_Recv(&d, 1, MPI_DOUBLE, src, tag, comm, &status);
+    MPI_Recv(&d, 1, MPI_DTYPE, src, tag, comm, &status);
     return d;
 }
 
 void send_dtype(dtype d, int dst, int tag, MPI_Comm comm){
-    MPI_Send(&d, 1, MPI_DOUBLE, dst, tag, comm);
+    MPI_Send(&d, 1, MPI_DTYPE, dst, tag, comm);
 }
 
 int recv_int(int src, int tag, MPI_Comm comm){
@@ -441,7 +702,7 @@ Signal recv_base_signal(int src, int tag, MPI_Comm comm){
     unsigned size2 = recv_unsigned(src, tag, comm);
 
     Signal signal = Signal(size1, size2);
-    MPI_Recv(signal.raw_data, signal.size, MPI_DOUBLE, src, tag, comm, &status);
+    MPI_Recv(signal.raw_data, signal.size, MPI_DTYPE, src, tag, comm, &status);
 
     return signal;
 }
@@ -451,7 +712,31 @@ void send_base_signal(Signal signal, int dst, int tag, MPI_Comm comm){
     send_unsigned(signal.shape1, dst, tag, comm);
     send_unsigned(signal.shape2, dst, tag, comm);
 
-    MPI_Send(signal.raw_data, signal.size, MPI_DOUBLE, dst, tag, comm);
+    MPI_Send(signal.raw_data, signal.size, MPI_DTYPE, dst, tag, comm);
+}
+
+string bcast_recv_string(MPI_Comm comm){
+    int src = 0;
+
+    // Convention: size does not include the c_str's terminating character
+    int size;
+    MPI_Bcast(&size, 1, MPI_INT, src, comm);
+
+    unique_ptr<char[]> buffer(new char[size+1]);
+    MPI_Bcast(buffer.get(), size+1, MPI_CHAR, src, comm);
+
+    return string(buffer.get());
+}
+
+void bcast_send_string(string s, MPI_Comm comm){
+    int src = 0;
+
+    int size = s.length();
+    MPI_Bcast(&size, 1, MPI_INT, src, comm);
+
+    unique_ptr<char[]> buffer(new char[size+1]);
+    strcpy(buffer.get(), s.c_str());
+    MPI_Bcast(buffer.get(), size+1, MPI_CHAR, src, comm);
 }
 
 int bcast_recv_int(MPI_Comm comm){
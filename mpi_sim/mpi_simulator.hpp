@@ -5,6 +5,7 @@
 #include <string>
 #include <memory>
 #include <exception>
+#include <climits>
 
 #include <mpi.h>
 
@@ -22,14 +23,21 @@ using namespace std;
 const int setup_tag = 1;
 const int probe_tag = 2;
 
+// Values broadcast by the master in place of a number of steps to run, telling
+// the workers what to do next. 0 resets the simulator, and -1 closes it.
+const int checkpoint_signal = -2;
+const int restore_signal = -3;
+const int rebalance_signal = -4;
+
 extern int n_processors_available;
 
 class MpiSimulator: public Simulator{
 public:
-    MpiSimulator(bool collect_timings);
+    MpiSimulator(SimulatorConfig config);
     ~MpiSimulator();
 
     void from_file(string filename) override;
+    void from_network(shared_ptr<const PackedNetwork> network) override;
     void finalize_build() override;
 
     void run_n_steps(int steps, bool progress, string log_filename) override;
@@ -39,6 +47,11 @@ public:
     void reset(unsigned seed) override;
     void close() override;
 
+    void checkpoint(string filename) override;
+    void restore(string filename) override;
+
+    bool rebalance() override;
+
     string to_string() const;
 
     friend ostream& operator << (ostream &out, const MpiSimulator &sim){
@@ -52,9 +65,6 @@ protected:
     int n_processors;
 
     MPI_Comm comm;
-
-    // Used to gather probe data from workers after simulation.
-    vector<int> probe_counts;
 };
 
 void mpi_init();
@@ -84,6 +94,9 @@ void send_key(key_type i, int dst, int tag, MPI_Comm comm);
 Signal recv_base_signal(int src, int tag, MPI_Comm comm);
 void send_base_signal(Signal signal, int dst, int tag, MPI_Comm comm);
 
+string bcast_recv_string(MPI_Comm comm);
+void bcast_send_string(string s, MPI_Comm comm);
+
 int bcast_recv_int(MPI_Comm comm);
 void bcast_send_int(int i, MPI_Comm comm);
 
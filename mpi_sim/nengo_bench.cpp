@@ -0,0 +1,734 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <random>
+#include <functional>
+
+#include <mpi.h>
+#include <boost/lexical_cast.hpp>
+
+#include "optionparser.h"
+
+#include "chunk.hpp"
+#include "operator.hpp"
+#include "mpi_operator.hpp"
+#include "trace.hpp"
+
+
+using namespace std;
+
+enum benchOptionIndex {UNKNOWN, HELP, KERNELS, SCALING, STEPS, MIN_TIME, THREADS, ENSEMBLES, ENSEMBLES_PER_RANK, NEURONS, DIMENSIONS, OUTPUT, LABEL, BASELINE};
+
+const option::Descriptor bench_usage[] =
+{
+ {UNKNOWN, 0, "" , "",          option::Arg::None, "USAGE: nengo_bench [options]\n\n"
+                                                   "Benchmarks the operators of nengo_mpi one at a time, and the\n"
+                                                   "scaling of a synthetic network over the processes it is run with.\n"
+                                                   "Without --kernels or --scaling, both are run.\n"
+                                                   "Options:" },
+ {HELP,     0, "" , "help",     option::Arg::None, "  --help  \tPrint usage and exit." },
+ {KERNELS,  0, "",  "kernels",  option::Arg::None, "  --kernels  \tSupply to time each kind of operator on its own, "
+                                                          "over a range of sizes, and MPI messages between the first "
+                                                          "two processes."},
+ {SCALING,  0, "",  "scaling",  option::Arg::None, "  --scaling  \tSupply to time the synthetic network on 1, 2, 4, ... "
+                                                          "processes, with a fixed total size (strong scaling) and a "
+                                                          "fixed size per process (weak scaling)."},
+ {STEPS,    0, "",  "steps",    option::Arg::Numeric, "  --steps  \tNumber of steps the synthetic network is run for. "
+                                                             "Defaults to 1000."},
+ {MIN_TIME, 0, "",  "min-time", option::Arg::NonEmpty, "  --min-time  \tSeconds that each operator is called repeatedly for. "
+                                                              "Defaults to 0.2."},
+ {THREADS,  0, "",  "threads",  option::Arg::Numeric, "  --threads  \tNumber of threads used to run the operators of the "
+                                                             "synthetic network on each process. Defaults to 1."},
+ {ENSEMBLES, 0, "", "ensembles", option::Arg::Numeric, "  --ensembles  \tTotal number of ensembles in the strong scaling "
+                                                              "network. Defaults to 64."},
+ {ENSEMBLES_PER_RANK, 0, "", "ensembles-per-rank", option::Arg::Numeric, "  --ensembles-per-rank  \tNumber of ensembles on each "
+                                                              "process in the weak scaling network. Defaults to 16."},
+ {NEURONS,  0, "",  "neurons",  option::Arg::Numeric, "  --neurons  \tNumber of neurons in each ensemble. Defaults to 200."},
+ {DIMENSIONS, 0, "", "dimensions", option::Arg::Numeric, "  --dimensions  \tDimensionality of each ensemble. Defaults to 4."},
+ {OUTPUT,   0, "",  "output",   option::Arg::NonEmpty, "  --output  \tName of a CSV file to append the results to, "
+                                                              "creating it if it doesn't exist."},
+ {LABEL,    0, "",  "label",    option::Arg::NonEmpty, "  --label  \tLabel stored with each result in the output file, "
+                                                              "such as the revision being benchmarked."},
+ {BASELINE, 0, "",  "baseline", option::Arg::NonEmpty, "  --baseline  \tName of a CSV file written by an earlier run. Each "
+                                                              "result is shown with its speedup over the last matching "
+                                                              "result in that file."},
+ {UNKNOWN,  0, "" , ""   ,      option::Arg::None, "\nExamples:\n"
+                                                   "  mpirun -np 1 nengo_bench --kernels --output bench.csv --label before\n"
+                                                   "  mpirun -np 8 nengo_bench --scaling --baseline bench.csv\n" },
+ {0,0,0,0,0,0}
+};
+
+const char* CSV_HEADER =
+    "label,precision,suite,name,size,n_procs,n_threads,seconds_per_step,steps_per_second,"
+    "bytes_per_step,gbytes_per_second,flops_per_step,gflops";
+
+const dtype BENCH_DT = 0.001;
+
+/* One measurement. For the kernel suite, a step is one call of the operator,
+ * and bytes are those of the signals it reads and writes, or for messages,
+ * those sent in both directions. For the scaling suites, a step is a step of
+ * the network, and bytes are those sent between processes. Flops are nominal
+ * counts of the arithmetic each step needs, and are negative where a kernel
+ * doesn't have one, such as the neuron models. */
+struct BenchResult{
+    string suite;
+    string name;
+    string size;
+    int n_procs;
+    unsigned n_threads;
+
+    double seconds_per_step;
+    double bytes_per_step;
+    double flops_per_step;
+
+    // Identifies the results from other runs that this one can be compared to.
+    string key() const{
+        stringstream out;
+        out << DTYPE_PRECISION << "," << suite << "," << name << "," << size << ","
+            << n_procs << "," << n_threads;
+        return out.str();
+    }
+
+    string to_csv(string label) const{
+        stringstream out;
+        out << setprecision(6) << label << "," << key() << "," << seconds_per_step << ","
+            << 1.0 / seconds_per_step << "," << bytes_per_step << ","
+            << bytes_per_step / seconds_per_step / 1e9 << ",";
+
+        if(flops_per_step >= 0.0){
+            out << flops_per_step << "," << flops_per_step / seconds_per_step / 1e9;
+        }else{
+            out << ",";
+        }
+
+        return out.str();
+    }
+};
+
+/* Seconds per call of ``call'', which is called in ever larger batches
+ * until at least min_time seconds have passed. Every process in comm must
+ * call this with the same min_time; they stop together, with the first one
+ * deciding when. */
+double time_calls(function<void()> call, double min_time, MPI_Comm comm){
+    // Warm up caches and, for messages, the connection.
+    call();
+
+    unsigned long long n_calls = 0, batch = 1;
+    double begin = wall_time(), elapsed = 0.0;
+
+    while(true){
+        for(unsigned long long i = 0; i < batch; i++){
+            call();
+        }
+
+        n_calls += batch;
+        batch *= 2;
+
+        elapsed = wall_time() - begin;
+        MPI_Bcast(&elapsed, 1, MPI_DOUBLE, 0, comm);
+
+        if(elapsed >= min_time){
+            break;
+        }
+    }
+
+    return elapsed / n_calls;
+}
+
+// Vectors when n is 1, as the builder makes them, otherwise matrices.
+Signal random_signal(unsigned m, unsigned n, mt19937& rng, dtype low=-1.0, dtype high=1.0){
+    Signal s = n == 1 ? Signal(m) : Signal(m, n);
+    uniform_real_distribution<double> dist(low, high);
+
+    for(unsigned i = 0; i < s.size; i++){
+        s.raw_data[i] = dist(rng);
+    }
+
+    return s;
+}
+
+string shape_string(unsigned m, unsigned n){
+    stringstream out;
+    out << m << "x" << n;
+    return out.str();
+}
+
+string size_string(unsigned n){
+    stringstream out;
+    out << n;
+    return out.str();
+}
+
+BenchResult time_kernel(
+        Operator& op, string name, string size, double bytes, double flops, double min_time){
+
+    BenchResult result;
+    result.suite = "kernel";
+    result.name = name;
+    result.size = size;
+    result.n_procs = 1;
+    result.n_threads = 1;
+    result.bytes_per_step = bytes;
+    result.flops_per_step = flops;
+    result.seconds_per_step = time_calls([&op](){ op(); }, min_time, MPI_COMM_SELF);
+
+    return result;
+}
+
+// Time each kind of operator on this process alone.
+void bench_kernels(double min_time, vector<BenchResult>& results){
+    mt19937 rng(1);
+    const double w = sizeof(dtype);
+
+    // Decoders are small and wide, encoders tall and narrow.
+    const unsigned mat_shapes[][2] = {{4, 200}, {16, 1000}, {200, 4}, {1000, 16}, {512, 512}};
+    for(auto& shape: mat_shapes){
+        unsigned m = shape[0], n = shape[1];
+        Signal A = random_signal(m, n, rng), X = random_signal(n, 1, rng), Y(m);
+
+        DotInc op(A, X, Y);
+        results.push_back(time_kernel(
+            op, "DotInc", shape_string(m, n), w * (m * n + n + 2 * m), 2.0 * m * n, min_time));
+    }
+
+    const unsigned vec_sizes[] = {50, 1000, 100000};
+    for(unsigned n: vec_sizes){
+        Signal A = random_signal(n, 1, rng), X = random_signal(n, 1, rng), Y(n);
+
+        ElementwiseInc op(A, X, Y);
+        results.push_back(time_kernel(
+            op, "ElementwiseInc", size_string(n), w * 4 * n, 2.0 * n, min_time));
+    }
+
+    for(unsigned n: vec_sizes){
+        // Currents around the firing threshold, so some neurons spike and some don't.
+        Signal J = random_signal(n, 1, rng, 0.0, 3.0), output(n), voltage(n), ref_time(n);
+
+        LIF op(n, 0.02, 0.002, 0.0, BENCH_DT, J, output, voltage, ref_time);
+        results.push_back(time_kernel(op, "LIF", size_string(n), w * 6 * n, -1.0, min_time));
+    }
+
+    const dtype decay = exp(-BENCH_DT / 0.005);
+    for(unsigned n: vec_sizes){
+        Signal input = random_signal(n, 1, rng), output(n);
+
+        SimpleSynapse op(input, output, decay, 1.0 - decay);
+        results.push_back(time_kernel(
+            op, "SimpleSynapse", size_string(n), w * 3 * n, 3.0 * n, min_time));
+    }
+
+    // A second order filter, as given by an Alpha synapse.
+    for(unsigned n: vec_sizes){
+        Signal input = random_signal(n, 1, rng), output(n);
+        Signal numer(2), denom(2);
+        numer(0) = 0.0; numer(1) = (1.0 - decay) * (1.0 - decay);
+        denom(0) = -2.0 * decay; denom(1) = decay * decay;
+
+        Synapse op(input, output, numer, denom);
+        results.push_back(time_kernel(
+            op, "Synapse", size_string(n), w * 6 * n, 8.0 * n, min_time));
+    }
+
+    // Strided copies, as made by slicing a signal in a connection.
+    for(unsigned n: vec_sizes){
+        Signal src = random_signal(2 * n, 1, rng), dst(n);
+
+        SlicedCopy op(src, dst, 0, 2 * n, 2, 0, n, 1, vector<int>(), vector<int>(), false);
+        results.push_back(time_kernel(op, "SlicedCopy", size_string(n), w * 2 * n, 0.0, min_time));
+    }
+
+    // post x pre, the shape of the weights that the rules learn.
+    const unsigned learn_shapes[][2] = {{50, 50}, {200, 200}, {1000, 1000}};
+    for(auto& shape: learn_shapes){
+        unsigned m = shape[0], n = shape[1];
+        Signal pre = random_signal(n, 1, rng), post = random_signal(m, 1, rng);
+        Signal theta = random_signal(m, 1, rng), weights = random_signal(m, n, rng);
+        Signal delta(m, n);
+
+        BCM bcm(pre, post, theta, delta, 1e-6, BENCH_DT);
+        results.push_back(time_kernel(
+            bcm, "BCM", shape_string(m, n), w * (2 * m * n + n + 2 * m), 2.0 * m * n, min_time));
+
+        Oja oja(pre, post, weights, delta, 1e-6, BENCH_DT, 1.0);
+        results.push_back(time_kernel(
+            oja, "Oja", shape_string(m, n), w * (3 * m * n + n + m), 4.0 * m * n, min_time));
+    }
+
+    // neurons x dimensions of the encoders that Voja learns.
+    for(auto& shape: mat_shapes){
+        unsigned m = shape[0], n = shape[1];
+        if(m < n){
+            continue;
+        }
+
+        Signal pre_decoded = random_signal(n, 1, rng), post = random_signal(m, 1, rng);
+        Signal encoders = random_signal(m, n, rng), delta(m, n);
+        Signal learning_signal(1, dtype(1.0)), scale = random_signal(m, 1, rng);
+
+        Voja op(pre_decoded, post, encoders, delta, learning_signal, scale, 1e-6, BENCH_DT);
+        results.push_back(time_kernel(
+            op, "Voja", shape_string(m, n), w * (2 * m * n + n + 2 * m), 5.0 * m * n, min_time));
+    }
+}
+
+/* Time a round trip between the first two processes: the first sends a
+ * message with an MPISend and receives it back with an MPIRecv, and the
+ * second does the opposite. Every process must call this. */
+void bench_ping_pong(double min_time, vector<BenchResult>& results){
+    int rank, n_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+
+    if(n_procs < 2){
+        return;
+    }
+
+    MPI_Comm pair;
+    MPI_Comm_split(MPI_COMM_WORLD, rank < 2 ? 0 : MPI_UNDEFINED, rank, &pair);
+
+    if(pair == MPI_COMM_NULL){
+        return;
+    }
+
+    const unsigned message_sizes[] = {1, 16, 256, 4096, 65536};
+    const int other = 1 - rank;
+
+    for(unsigned tag = 0; tag < sizeof(message_sizes) / sizeof(unsigned); tag++){
+        const unsigned n = message_sizes[tag];
+        Signal outgoing(n, dtype(1.0)), incoming(n);
+
+        MPISend send(other, tag, {outgoing});
+        MPIRecv recv(other, tag, {incoming}, false);
+
+        for(MPIOperator* op: vector<MPIOperator*>{&send, &recv}){
+            op->set_communicator(pair);
+            op->init_request();
+        }
+        recv.init();
+
+        function<void()> round_trip;
+        if(rank == 0){
+            round_trip = [&](){ send(); recv(); };
+        }else{
+            round_trip = [&](){ recv(); send(); };
+        }
+
+        BenchResult result;
+        result.suite = "kernel";
+        result.name = "MPISend/MPIRecv";
+        result.size = size_string(n);
+        result.n_procs = 2;
+        result.n_threads = 1;
+        result.bytes_per_step = 2.0 * n * sizeof(dtype);
+        result.flops_per_step = -1.0;
+        result.seconds_per_step = time_calls(round_trip, min_time, pair);
+
+        // The second process receives last, so the first has no message in flight.
+        send.complete();
+        recv.complete();
+        MPI_Barrier(pair);
+
+        if(rank == 0){
+            results.push_back(result);
+        }
+    }
+
+    MPI_Comm_free(&pair);
+}
+
+/* Keys of the signals of the synthetic network. Those of ensemble g start at
+ * N_SHARED_SIGS + g * N_ENSEMBLE_SIGS. */
+enum NetworkSignal {
+    STEP_SIG, TIME_SIG, N_SHARED_SIGS
+};
+
+enum EnsembleSignal {
+    INPUT_SIG, TRANSFORM_SIG, RECEIVED_SIG, BIAS_SIG, ENCODERS_SIG, CURRENT_SIG, SPIKES_SIG,
+    VOLTAGE_SIG, REF_TIME_SIG, FILTERED_SIG, DECODERS_SIG, DECODED_SIG, OUTPUT_SIG, N_ENSEMBLE_SIGS
+};
+
+/* Build and run a network of n_ensembles ensembles, each of n_neurons LIF neurons
+ * representing a value with dimensions dimensions, on the processes of comm.
+ * Like the stream network of the benchmarks in the docs, the ensembles form a
+ * ring: each one decodes its value, filters it, and passes it on to the next,
+ * whose input is a transform of it. Ensemble g is simulated by process
+ * g % n_procs, so with more than one process, every connection crosses between
+ * processes. Every process in comm must call this, and the result is only
+ * complete on the first one. */
+BenchResult bench_network(
+        MPI_Comm comm, string suite, unsigned n_ensembles, unsigned n_neurons,
+        unsigned dimensions, unsigned n_threads, int n_steps){
+
+    int rank, n_procs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_procs);
+
+    SimulatorConfig config;
+    config.n_threads = n_threads;
+
+    MpiSimulatorChunk chunk(rank, n_procs, config);
+    mt19937 rng(rank + 1);
+
+    const unsigned N = n_neurons, D = dimensions;
+    const dtype decay = exp(-BENCH_DT / 0.005);
+
+    chunk.add_base_signal(STEP_SIG, Signal(1));
+    chunk.add_base_signal(TIME_SIG, Signal(1));
+    chunk.add_time_update(-1.0, unique_ptr<TimeUpdate>(
+        new TimeUpdate(chunk.get_signal(STEP_SIG), chunk.get_signal(TIME_SIG), BENCH_DT)));
+
+    double bytes = 0.0, flops = 0.0;
+
+    for(unsigned g = rank, l = 0; g < n_ensembles; g += n_procs, l++){
+        const key_type base = N_SHARED_SIGS + key_type(g) * N_ENSEMBLE_SIGS;
+        const unsigned prev = (g + n_ensembles - 1) % n_ensembles;
+        const unsigned next = (g + 1) % n_ensembles;
+        const int prev_rank = prev % n_procs, next_rank = next % n_procs;
+
+        auto add = [&](EnsembleSignal which, Signal s) -> Signal{
+            chunk.add_base_signal(base + which, s);
+            return chunk.get_signal(base + which);
+        };
+
+        Signal input = add(INPUT_SIG, Signal(D));
+        Signal transform = add(TRANSFORM_SIG, random_signal(D, D, rng, -1.0 / D, 1.0 / D));
+        Signal bias = add(BIAS_SIG, random_signal(N, 1, rng, 0.5, 2.0));
+        Signal encoders = add(ENCODERS_SIG, random_signal(N, D, rng));
+        Signal current = add(CURRENT_SIG, Signal(N));
+        Signal spikes = add(SPIKES_SIG, Signal(N));
+        Signal voltage = add(VOLTAGE_SIG, Signal(N));
+        Signal ref_time = add(REF_TIME_SIG, Signal(N));
+        Signal filtered = add(FILTERED_SIG, Signal(N));
+        Signal decoders = add(DECODERS_SIG, random_signal(D, N, rng, -1e-3, 1e-3));
+        Signal decoded = add(DECODED_SIG, Signal(D));
+        Signal output = add(OUTPUT_SIG, Signal(D));
+
+        // The filtered output of the previous ensemble, from the last step.
+        Signal received;
+        if(prev_rank == rank){
+            const key_type prev_base = N_SHARED_SIGS + key_type(prev) * N_ENSEMBLE_SIGS;
+            if(prev < g){
+                received = chunk.get_signal(prev_base + OUTPUT_SIG);
+            }else{
+                // Created ahead of the ensemble it belongs to.
+                received = add(RECEIVED_SIG, Signal(D));
+            }
+        }else{
+            received = add(RECEIVED_SIG, Signal(D));
+            chunk.add_mpi_recv(10.0 * l, prev_rank, g, received, true);
+        }
+
+        float index = 10.0 * l;
+        chunk.add_op(index + 1, unique_ptr<Operator>(new Reset(input, 0.0)));
+        chunk.add_op(index + 2, unique_ptr<Operator>(new DotInc(transform, received, input)));
+        chunk.add_op(index + 3, unique_ptr<Operator>(new Copy(current, bias)));
+        chunk.add_op(index + 4, unique_ptr<Operator>(new DotInc(encoders, input, current)));
+        chunk.add_op(index + 5, unique_ptr<Operator>(
+            new LIF(N, 0.02, 0.002, 0.0, BENCH_DT, current, spikes, voltage, ref_time)));
+        chunk.add_op(index + 6, unique_ptr<Operator>(
+            new SimpleSynapse(spikes, filtered, decay, 1.0 - decay)));
+        chunk.add_op(index + 7, unique_ptr<Operator>(new Reset(decoded, 0.0)));
+        chunk.add_op(index + 8, unique_ptr<Operator>(new DotInc(decoders, filtered, decoded)));
+        chunk.add_op(index + 9, unique_ptr<Operator>(
+            new SimpleSynapse(decoded, output, decay, 1.0 - decay)));
+
+        if(next_rank != rank){
+            chunk.add_mpi_send(index + 9.5, next_rank, next, output, true);
+            bytes += D * sizeof(dtype);
+        }
+
+        flops += 2.0 * D * D + 4.0 * N * D + 3.0 * N + 3.0 * D;
+    }
+
+    // Local connections whose ensemble comes before the one it reads from
+    // read a copy, made at the end of each step.
+    for(unsigned g = rank, l = 0; g < n_ensembles; g += n_procs, l++){
+        const unsigned prev = (g + n_ensembles - 1) % n_ensembles;
+        if(prev % n_procs != unsigned(rank) || prev < g){
+            continue;
+        }
+
+        const key_type base = N_SHARED_SIGS + key_type(g) * N_ENSEMBLE_SIGS;
+        const key_type prev_base = N_SHARED_SIGS + key_type(prev) * N_ENSEMBLE_SIGS;
+        chunk.add_op(10.0 * n_ensembles, unique_ptr<Operator>(new Copy(
+            chunk.get_signal(base + RECEIVED_SIG), chunk.get_signal(prev_base + OUTPUT_SIG))));
+    }
+
+    chunk.finalize_build(comm);
+    chunk.set_log_filename("");
+    chunk.reset(1);
+
+    // run_n_steps reports its progress, which would get in the way of the results.
+    stringstream quiet;
+    streambuf* cout_buf = cout.rdbuf(quiet.rdbuf());
+
+    chunk.run_n_steps(min(n_steps, 10), false);
+
+    MPI_Barrier(comm);
+    double begin = wall_time();
+    chunk.run_n_steps(n_steps, false);
+    MPI_Barrier(comm);
+    double elapsed = wall_time() - begin;
+
+    cout.rdbuf(cout_buf);
+
+    double totals[2] = {bytes, flops}, sums[2];
+    MPI_Reduce(totals, sums, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Bcast(&elapsed, 1, MPI_DOUBLE, 0, comm);
+
+    stringstream size;
+    size << n_ensembles << "x" << N << "x" << D;
+
+    BenchResult result;
+    result.suite = suite;
+    result.name = "ring";
+    result.size = size.str();
+    result.n_procs = n_procs;
+    result.n_threads = n_threads;
+    result.seconds_per_step = elapsed / n_steps;
+    result.bytes_per_step = sums[0];
+    result.flops_per_step = sums[1];
+
+    return result;
+}
+
+/* Run the synthetic network on the first 1, 2, 4, ... processes, and on all of
+ * them. Every process must call this. */
+void bench_scaling(
+        unsigned n_ensembles, unsigned ensembles_per_rank, unsigned n_neurons,
+        unsigned dimensions, unsigned n_threads, int n_steps, vector<BenchResult>& results){
+
+    int rank, n_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+
+    vector<int> proc_counts;
+    for(int p = 1; p < n_procs; p *= 2){
+        proc_counts.push_back(p);
+    }
+    proc_counts.push_back(n_procs);
+
+    for(int p: proc_counts){
+        MPI_Comm comm;
+        MPI_Comm_split(MPI_COMM_WORLD, rank < p ? 0 : MPI_UNDEFINED, rank, &comm);
+
+        if(comm != MPI_COMM_NULL){
+            BenchResult strong = bench_network(
+                comm, "strong", n_ensembles, n_neurons, dimensions, n_threads, n_steps);
+            BenchResult weak = bench_network(
+                comm, "weak", ensembles_per_rank * p, n_neurons, dimensions, n_threads, n_steps);
+
+            if(rank == 0){
+                results.push_back(strong);
+                results.push_back(weak);
+            }
+
+            MPI_Comm_free(&comm);
+        }
+
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+}
+
+// Steps per second of the last result for each key in a file written with --output.
+map<string, double> read_baseline(string filename){
+    ifstream in(filename);
+
+    if(!in.good()){
+        stringstream msg;
+        msg << "Could not read baseline results from " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    map<string, double> baseline;
+    string line;
+
+    while(getline(in, line)){
+        vector<string> fields;
+        stringstream line_stream(line);
+        string field;
+        while(getline(line_stream, field, ',')){
+            fields.push_back(field);
+        }
+
+        // label, then the 6 fields of the key, then seconds and steps per second.
+        if(fields.size() < 9 || fields[0] == "label"){
+            continue;
+        }
+
+        string key = fields[1];
+        for(unsigned i = 2; i < 7; i++){
+            key += "," + fields[i];
+        }
+
+        baseline[key] = boost::lexical_cast<double>(fields[8]);
+    }
+
+    return baseline;
+}
+
+void print_results(const vector<BenchResult>& results, const map<string, double>& baseline){
+    cout << left << setw(8) << "suite" << setw(18) << "name" << setw(14) << "size"
+         << right << setw(6) << "procs" << setw(8) << "threads" << setw(14) << "steps/sec"
+         << setw(12) << "GB/s" << setw(10) << "GFLOP/s";
+    if(!baseline.empty()){
+        cout << setw(10) << "speedup";
+    }
+    cout << endl;
+
+    for(auto& r: results){
+        double steps_per_second = 1.0 / r.seconds_per_step;
+
+        cout << left << setw(8) << r.suite << setw(18) << r.name << setw(14) << r.size
+             << right << setw(6) << r.n_procs << setw(8) << r.n_threads
+             << setw(14) << setprecision(6) << steps_per_second
+             << setw(12) << setprecision(4) << r.bytes_per_step * steps_per_second / 1e9;
+
+        if(r.flops_per_step >= 0.0){
+            cout << setw(10) << r.flops_per_step * steps_per_second / 1e9;
+        }else{
+            cout << setw(10) << "-";
+        }
+
+        if(!baseline.empty()){
+            auto found = baseline.find(r.key());
+            if(found != baseline.end()){
+                cout << setw(9) << steps_per_second / found->second << "x";
+            }else{
+                cout << setw(10) << "-";
+            }
+        }
+
+        cout << endl;
+    }
+}
+
+void write_results(const vector<BenchResult>& results, string filename, string label){
+    bool exists = ifstream(filename).good();
+
+    ofstream out(filename, ios::app);
+    if(!exists){
+        out << CSV_HEADER << endl;
+    }
+
+    for(auto& r: results){
+        out << r.to_csv(label) << endl;
+    }
+
+    if(!out.good()){
+        stringstream msg;
+        msg << "Could not write results to " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+int run_benchmarks(int argc, char **argv){
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    argc -= (argc > 0); argv += (argc > 0); // skip program name argv[0] if present
+    option::Stats  stats(bench_usage, argc, argv);
+    option::Option options[stats.options_max], buffer[stats.buffer_max];
+    option::Parser parse(bench_usage, argc, argv, options, buffer);
+
+    if(parse.error()){
+        return 1;
+    }
+
+    if(options[HELP]){
+        if(rank == 0){
+            option::printUsage(std::cout, bench_usage);
+        }
+        return 0;
+    }
+
+    bool run_kernels = bool(options[KERNELS]), run_scaling = bool(options[SCALING]);
+    if(!run_kernels && !run_scaling){
+        run_kernels = run_scaling = true;
+    }
+
+    int n_steps = 1000;
+    if(options[STEPS]){
+        n_steps = boost::lexical_cast<int>(options[STEPS].arg);
+    }
+
+    double min_time = 0.2;
+    if(options[MIN_TIME]){
+        min_time = boost::lexical_cast<double>(options[MIN_TIME].arg);
+    }
+
+    unsigned n_threads = 1;
+    if(options[THREADS]){
+        n_threads = max(boost::lexical_cast<unsigned>(options[THREADS].arg), 1u);
+    }
+
+    unsigned n_ensembles = 64, ensembles_per_rank = 16, n_neurons = 200, dimensions = 4;
+    if(options[ENSEMBLES]){
+        n_ensembles = boost::lexical_cast<unsigned>(options[ENSEMBLES].arg);
+    }
+    if(options[ENSEMBLES_PER_RANK]){
+        ensembles_per_rank = boost::lexical_cast<unsigned>(options[ENSEMBLES_PER_RANK].arg);
+    }
+    if(options[NEURONS]){
+        n_neurons = boost::lexical_cast<unsigned>(options[NEURONS].arg);
+    }
+    if(options[DIMENSIONS]){
+        dimensions = boost::lexical_cast<unsigned>(options[DIMENSIONS].arg);
+    }
+
+    string label = options[LABEL] ? options[LABEL].arg : "";
+    if(label.find(',') != string::npos){
+        throw runtime_error("The label of the results cannot contain commas.");
+    }
+
+    map<string, double> baseline;
+    if(options[BASELINE] && rank == 0){
+        baseline = read_baseline(options[BASELINE].arg);
+    }
+
+    vector<BenchResult> results;
+
+    if(run_kernels){
+        if(rank == 0){
+            bench_kernels(min_time, results);
+        }
+        bench_ping_pong(min_time, results);
+    }
+
+    if(run_scaling){
+        bench_scaling(
+            n_ensembles, ensembles_per_rank, n_neurons, dimensions, n_threads, n_steps, results);
+    }
+
+    if(rank == 0){
+        cout << "Precision: " << DTYPE_PRECISION << endl << endl;
+        print_results(results, baseline);
+
+        if(options[OUTPUT]){
+            write_results(results, options[OUTPUT].arg, label);
+            cout << endl << "Appended results to " << options[OUTPUT].arg << "." << endl;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv){
+
+    // Chunks of the synthetic network start the thread that writes the
+    // simulation log, as they do in nengo_mpi.
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    int status = run_benchmarks(argc, argv);
+
+    MPI_Finalize();
+
+    return status;
+}
@@ -7,7 +7,7 @@
 #include "simulator.hpp"
 
 
-enum serialOptionIndex {UNKNOWN, HELP, NO_PROG, TIMING, LOG, SEED};
+enum serialOptionIndex {UNKNOWN, HELP, NO_PROG, TIMING, TRACE, PROFILE, LOG, SEED, THREADS, TRIALS, LEARNING_EVERY, QUIESCENCE, REALTIME, PRECISION, BACKEND, FLUSH_EVERY, SYNC_FLUSH, COMPRESSION, COMPRESSION_LEVEL, LOG_PRECISION, SPIKE_EVENTS, REPORT_MEMORY, CHECKPOINT, CHECKPOINT_EVERY, RESTORE};
 
 const option::Descriptor serial_usage[] =
 {
@@ -20,10 +20,61 @@ const option::Descriptor serial_usage[] =
  {HELP,     0, "" , "help",     option::Arg::None, "  --help  \tPrint usage and exit." },
  {NO_PROG,  0, "",  "noprog",   option::Arg::None, "  --noprog  \tSupply to omit the progress bar." },
  {TIMING,   0, "",  "timing",   option::Arg::None, "  --timing  \tSupply to collect timing info." },
+ {TRACE,    0, "",  "trace",    option::Arg::NonEmpty, "  --trace  \tName of file to write a Chrome trace of the simulation "
+                                                               "to, showing the time each process spends in each step, waiting "
+                                                               "for messages and writing probe data. With --timing, it also "
+                                                               "shows every operator call."},
+ {PROFILE,  0, "",  "profile",  option::Arg::NonEmpty, "  --profile  \tName of file to write the measured cost of each "
+                                                               "operator and the size of each message between processes to, "
+                                                               "which the partitioners can use to balance the next run "
+                                                               "of the network."},
  {LOG,      0, "",  "log",      option::Arg::NonEmpty, "  --log  \tName of file to log results to using HDF5. "
                                                                "If not specified, the log filename is the same as the "
                                                                "name of the network file, but with the .h5 extension."},
  {SEED,     0, "",  "seed",     option::Arg::Numeric, "  --seed  \tSeed for stochastic processes in the network."},
+ {THREADS,  0, "",  "threads",  option::Arg::Numeric, "  --threads  \tNumber of threads used to run the operators on each process. "
+                                                             "Defaults to 1."},
+ {TRIALS,   0, "",  "trials",   option::Arg::Numeric, "  --trials  \tNumber of trials of the network to simulate together, "
+                                                             "with seeds seed, seed + 1, and so on. Defaults to 1."},
+ {LEARNING_EVERY, 0, "", "learning-every", option::Arg::Numeric, "  --learning-every  \tNumber of steps between updates of the "
+                                                             "learning rules, which are made with a learning rate scaled up "
+                                                             "by the same factor. Defaults to 1."},
+ {QUIESCENCE, 0, "", "quiescence", option::Arg::NonEmpty, "  --quiescence  \tValues within this distance of zero count as "
+                                                             "zero, and operators whose inputs are all zero skip their work. "
+                                                             "Defaults to 0, which runs every operator on every step."},
+ {REALTIME, 0, "", "realtime", option::Arg::NonEmpty, "  --realtime  \tPace each step to take dt divided by this many "
+                                                             "seconds of wall-clock time, so 1 runs in real time, and report "
+                                                             "the latency of the steps and the deadlines they missed. "
+                                                             "Defaults to 0, which runs the steps as fast as possible."},
+ {PRECISION, 0, "", "precision", option::Arg::NonEmpty, "  --precision  \tPrecision the simulation is expected to run in, "
+                                                             "either single or double. The precision is fixed when nengo_mpi "
+                                                             "is compiled; supplying this makes sure the build matches."},
+ {BACKEND, 0, "", "backend", option::Arg::NonEmpty, "  --backend  \tWhere operators are run: cpu, or cuda to run those "
+                                                             "that support it on the GPUs of each node, which requires "
+                                                             "nengo_mpi to be compiled with CUDA. Defaults to cpu."},
+ {FLUSH_EVERY, 0, "", "flush-every", option::Arg::Numeric, "  --flush-every  \tNumber of steps between writes of probe data "
+                                                             "to the log file. Defaults to 1000."},
+ {SYNC_FLUSH, 0, "", "sync-flush", option::Arg::None, "  --sync-flush  \tSupply to stop the simulation while probe data is "
+                                                             "written, instead of writing it from a background thread."},
+ {COMPRESSION, 0, "", "compression", option::Arg::NonEmpty, "  --compression  \tCompression applied to probe data in the log file: "
+                                                             "none, deflate or lz4. Defaults to none."},
+ {COMPRESSION_LEVEL, 0, "", "compression-level", option::Arg::Numeric, "  --compression-level  \tLevel of deflate compression, "
+                                                             "from 0 to 9. Defaults to 4."},
+ {LOG_PRECISION, 0, "", "log-precision", option::Arg::NonEmpty, "  --log-precision  \tPrecision that probe data is stored in, "
+                                                             "either single or double. Defaults to double."},
+ {SPIKE_EVENTS, 0, "", "spike-events", option::Arg::None, "  --spike-events  \tSupply to store probes of the spikes of neurons "
+                                                             "in the log file as lists of spike events."},
+ {REPORT_MEMORY, 0, "", "report-memory", option::Arg::None, "  --report-memory  \tSupply to print how much memory the "
+                                                             "signals and operators of the network take once it is built."},
+ {CHECKPOINT, 0, "", "checkpoint", option::Arg::NonEmpty, "  --checkpoint  \tName of file to write a checkpoint of the "
+                                                             "simulation to when it ends, which --restore can continue from."},
+ {CHECKPOINT_EVERY, 0, "", "checkpoint-every", option::Arg::Numeric, "  --checkpoint-every  \tNumber of steps between checkpoints "
+                                                             "written during the simulation, each replacing the last. If "
+                                                             "--checkpoint is not supplied, they are written to the network "
+                                                             "file's name with the extension _checkpoint.h5."},
+ {RESTORE, 0, "", "restore", option::Arg::NonEmpty, "  --restore  \tName of a checkpoint of this network to continue "
+                                                             "from. The simulation ends at the same time as it would have "
+                                                             "without restoring; --seed is ignored."},
  {UNKNOWN,  0, "" , ""   ,      option::Arg::None, "\nExamples:\n"
                                                    "  nengo_cpp --progress basal_ganglia.net 1.0\n"
                                                    "  nengo_cpp --log ~/spaun_results.h5 spaun.net 7.5\n" },
@@ -73,14 +124,110 @@ int main(int argc, char **argv){
     bool show_progress = !bool(options[NO_PROG]);
     cout << "Show progress bar: " << show_progress << endl;
 
-    bool collect_timings = bool(options[TIMING]);
-    cout << "Collect timing info: " << collect_timings << endl;
+    SimulatorConfig config;
+
+    config.collect_timings = bool(options[TIMING]);
+    cout << "Collect timing info: " << config.collect_timings << endl;
+
+    if(options[TRACE]){
+        config.set("trace_file", options[TRACE].arg);
+        cout << "Will write a trace to: " << config.trace_file << endl;
+    }
+
+    if(options[PROFILE]){
+        config.set("profile_file", options[PROFILE].arg);
+        cout << "Will write a cost profile to: " << config.profile_file << endl;
+    }
+
+    if(options[THREADS]){
+        config.set("threads", options[THREADS].arg);
+    }
+    cout << "Threads per process: " << config.n_threads << endl;
+
+    if(options[TRIALS]){
+        config.set("trials", options[TRIALS].arg);
+    }
+    cout << "Trials: " << config.n_trials << endl;
+
+    if(options[LEARNING_EVERY]){
+        config.set("learning_every", options[LEARNING_EVERY].arg);
+    }
+    cout << "Learning rules update every: " << config.learning_every << " steps" << endl;
+
+    if(options[QUIESCENCE]){
+        config.set("quiescence", options[QUIESCENCE].arg);
+    }
+    cout << "Quiescence tolerance: " << config.quiescence << endl;
+
+    if(options[REALTIME]){
+        config.set("realtime", options[REALTIME].arg);
+    }
+    cout << "Real-time speed: " << config.realtime << endl;
+
+    if(options[PRECISION]){
+        config.set("precision", options[PRECISION].arg);
+    }
+    cout << "Precision: " << DTYPE_PRECISION << endl;
+
+    if(options[BACKEND]){
+        config.set("backend", options[BACKEND].arg);
+    }
+    cout << "Backend: " << config.backend << endl;
+
+    if(options[FLUSH_EVERY]){
+        config.set("flush_every", options[FLUSH_EVERY].arg);
+    }
+    cout << "Flush probes every: " << config.flush_every << " steps" << endl;
+
+    config.async_flush = !bool(options[SYNC_FLUSH]);
+    cout << "Write probe data in background: " << config.async_flush << endl;
+
+    if(options[COMPRESSION]){
+        config.set("compression", options[COMPRESSION].arg);
+    }
+    if(options[COMPRESSION_LEVEL]){
+        config.set("compression_level", options[COMPRESSION_LEVEL].arg);
+    }
+    if(options[LOG_PRECISION]){
+        config.set("log_precision", options[LOG_PRECISION].arg);
+    }
+    cout << "Probe data compression: " << config.compression << endl;
+    cout << "Probe data precision: " << config.log_precision << endl;
+
+    config.spike_events = bool(options[SPIKE_EVENTS]);
+    cout << "Store spikes as events: " << config.spike_events << endl;
+
+    config.report_memory = bool(options[REPORT_MEMORY]);
+
+    string net_base = net_filename.substr(0, net_filename.find_last_of("."));
+
+    string checkpoint_filename;
+    if(options[CHECKPOINT]){
+        checkpoint_filename = options[CHECKPOINT].arg;
+    }
+
+    if(options[CHECKPOINT_EVERY]){
+        config.set("checkpoint_every", options[CHECKPOINT_EVERY].arg);
+
+        if(checkpoint_filename.length() == 0){
+            checkpoint_filename = net_base + "_checkpoint.h5";
+        }
+    }
+
+    config.set("checkpoint_file", checkpoint_filename);
+    if(checkpoint_filename.length() > 0){
+        cout << "Will write checkpoints to: " << checkpoint_filename;
+        if(config.checkpoint_every > 0){
+            cout << ", every " << config.checkpoint_every << " steps";
+        }
+        cout << endl;
+    }
 
     string log_filename;
     if(options[LOG]){
         log_filename = options[LOG].arg;
     }else{
-        log_filename = net_filename.substr(0, net_filename.find_last_of(".")) + ".h5";
+        log_filename = net_base + ".h5";
     }
     cout << "Will write simulation results to: " << log_filename << endl;
 
@@ -93,20 +240,32 @@ int main(int argc, char **argv){
     cout << endl;
 
     cout << "Building network..." << endl;
-    auto sim = unique_ptr<Simulator>(new Simulator(collect_timings));
+    auto sim = unique_ptr<Simulator>(new Simulator(config));
     sim->from_file(net_filename);
     sim->finalize_build();
 
     cout << "Done building network." << endl;
     cout << endl;
 
-    sim->reset(seed);
+    if(options[RESTORE]){
+        sim->restore(options[RESTORE].arg);
+    }else{
+        sim->reset(seed);
+    }
     cout << endl;
 
-    int n_steps = int(round(sim_length / sim->dt()));
-    cout << "Running simulation for " << n_steps << " steps with dt = " << sim->dt() << "." << endl;
+    int n_steps = int(round(sim_length / sim->dt())) - int(sim->get_steps_since_reset());
 
-    sim->run_n_steps(n_steps, show_progress, log_filename);
+    if(n_steps > 0){
+        cout << "Running simulation for " << n_steps << " steps with dt = " << sim->dt() << "." << endl;
+        sim->run_n_steps(n_steps, show_progress, log_filename);
+    }else{
+        cout << "The checkpoint is already at the end of the simulation." << endl;
+    }
+
+    if(checkpoint_filename.length() > 0){
+        sim->checkpoint(checkpoint_filename);
+    }
     sim->close();
 
     return 0;
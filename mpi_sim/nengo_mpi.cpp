@@ -12,7 +12,7 @@
 
 using namespace std;
 
-enum serialOptionIndex {UNKNOWN, HELP, NO_PROG, TIMING, LOG, SEED};
+enum serialOptionIndex {UNKNOWN, HELP, NO_PROG, TIMING, TRACE, PROFILE, LOG, SEED, THREADS, TRIALS, LEARNING_EVERY, QUIESCENCE, REALTIME, ZERO_COPY, DENSE_SPIKES, NO_SHARED_MEMORY, PRECISION, BACKEND, FLUSH_EVERY, SYNC_FLUSH, COLLECTIVE_IO, IO_RANKS, COMPRESSION, COMPRESSION_LEVEL, LOG_PRECISION, SPIKE_EVENTS, REPORT_MEMORY, LEADER_LOAD, MAPPING, CHECKPOINT, CHECKPOINT_EVERY, RESTORE};
 
 const option::Descriptor serial_usage[] =
 {
@@ -25,10 +25,78 @@ const option::Descriptor serial_usage[] =
  {HELP,     0, "" , "help",     option::Arg::None, "  --help  \tPrint usage and exit." },
  {NO_PROG,  0, "",  "noprog",   option::Arg::None, "  --noprog  \tSupply to omit the progress bar." },
  {TIMING,   0, "",  "timing",   option::Arg::None, "  --timing  \tSupply to collect timing info." },
+ {TRACE,    0, "",  "trace",    option::Arg::NonEmpty, "  --trace  \tName of file to write a Chrome trace of the simulation "
+                                                               "to, showing the time each process spends in each step, waiting "
+                                                               "for messages and writing probe data. With --timing, it also "
+                                                               "shows every operator call."},
+ {PROFILE,  0, "",  "profile",  option::Arg::NonEmpty, "  --profile  \tName of file to write the measured cost of each "
+                                                               "operator and the size of each message between processes to, "
+                                                               "which the partitioners can use to balance the next run "
+                                                               "of the network."},
  {LOG,      0, "",  "log",      option::Arg::NonEmpty, "  --log  \tName of file to log results to using HDF5. "
                                                                "If not specified, the log filename is the same as the "
                                                                "name of the network file, but with the .h5 extension."},
  {SEED,     0, "",  "seed",     option::Arg::Numeric, "  --seed  \tSeed for stochastic processes in the network."},
+ {THREADS,  0, "",  "threads",  option::Arg::Numeric, "  --threads  \tNumber of threads used to run the operators on each process. "
+                                                             "Defaults to 1."},
+ {TRIALS,   0, "",  "trials",   option::Arg::Numeric, "  --trials  \tNumber of trials of the network to simulate together, "
+                                                             "with seeds seed, seed + 1, and so on. Defaults to 1."},
+ {LEARNING_EVERY, 0, "", "learning-every", option::Arg::Numeric, "  --learning-every  \tNumber of steps between updates of the "
+                                                             "learning rules, which are made with a learning rate scaled up "
+                                                             "by the same factor. Defaults to 1."},
+ {QUIESCENCE, 0, "", "quiescence", option::Arg::NonEmpty, "  --quiescence  \tValues within this distance of zero count as "
+                                                             "zero, and operators whose inputs are all zero skip their work. "
+                                                             "Defaults to 0, which runs every operator on every step."},
+ {REALTIME, 0, "", "realtime", option::Arg::NonEmpty, "  --realtime  \tPace each step to take dt divided by this many "
+                                                             "seconds of wall-clock time, so 1 runs in real time, and report "
+                                                             "the latency of the steps and the deadlines they missed. "
+                                                             "Defaults to 0, which runs the steps as fast as possible."},
+ {ZERO_COPY, 0, "", "zero-copy", option::Arg::None, "  --zero-copy  \tSupply to send and receive MPI messages directly from "
+                                                             "signal memory, rather than copying them through a buffer."},
+ {DENSE_SPIKES, 0, "", "dense-spikes", option::Arg::None, "  --dense-spikes  \tSupply to send the spikes of neurons to other "
+                                                             "processes as a value for every neuron, rather than as the "
+                                                             "indices of the neurons that spiked."},
+ {NO_SHARED_MEMORY, 0, "", "no-shared-memory", option::Arg::None, "  --no-shared-memory  \tSupply to send messages between processes "
+                                                             "on the same node through MPI, rather than through shared memory."},
+ {PRECISION, 0, "", "precision", option::Arg::NonEmpty, "  --precision  \tPrecision the simulation is expected to run in, "
+                                                             "either single or double. The precision is fixed when nengo_mpi "
+                                                             "is compiled; supplying this makes sure the build matches."},
+ {BACKEND, 0, "", "backend", option::Arg::NonEmpty, "  --backend  \tWhere operators are run: cpu, or cuda to run those "
+                                                             "that support it on the GPUs of each node, which requires "
+                                                             "nengo_mpi to be compiled with CUDA. Defaults to cpu."},
+ {FLUSH_EVERY, 0, "", "flush-every", option::Arg::Numeric, "  --flush-every  \tNumber of steps between writes of probe data "
+                                                             "to the log file. Defaults to 1000."},
+ {SYNC_FLUSH, 0, "", "sync-flush", option::Arg::None, "  --sync-flush  \tSupply to stop the simulation while probe data is "
+                                                             "written, instead of writing it from a background thread."},
+ {COLLECTIVE_IO, 0, "", "collective-io", option::Arg::None, "  --collective-io  \tSupply to have all processes write probe data "
+                                                             "collectively, instead of independently."},
+ {IO_RANKS, 0, "", "io-ranks", option::Arg::Numeric, "  --io-ranks  \tNumber of processes that collective writes are "
+                                                             "aggregated to. By default, MPI-IO decides."},
+ {COMPRESSION, 0, "", "compression", option::Arg::NonEmpty, "  --compression  \tCompression applied to probe data in the log file: "
+                                                             "none, deflate or lz4. Defaults to none."},
+ {COMPRESSION_LEVEL, 0, "", "compression-level", option::Arg::Numeric, "  --compression-level  \tLevel of deflate compression, "
+                                                             "from 0 to 9. Defaults to 4."},
+ {LOG_PRECISION, 0, "", "log-precision", option::Arg::NonEmpty, "  --log-precision  \tPrecision that probe data is stored in, "
+                                                             "either single or double. Defaults to double."},
+ {SPIKE_EVENTS, 0, "", "spike-events", option::Arg::None, "  --spike-events  \tSupply to store probes of the spikes of neurons "
+                                                             "in the log file as lists of spike events."},
+ {LEADER_LOAD, 0, "", "leader-load", option::Arg::None, "  --leader-load  \tSupply to have one process per node read the "
+                                                             "network file and scatter it to the others on the node."},
+ {MAPPING, 0, "", "mapping", option::Arg::NonEmpty, "  --mapping  \tHow components are placed on processes to keep "
+                                                             "the traffic between them local: default, graph (let MPI "
+                                                             "reorder processes by the traffic) or node (keep the most "
+                                                             "traffic within nodes). Defaults to default."},
+ {REPORT_MEMORY, 0, "", "report-memory", option::Arg::None, "  --report-memory  \tSupply to print how much memory the "
+                                                             "signals and operators of the network take once it is built."},
+ {CHECKPOINT, 0, "", "checkpoint", option::Arg::NonEmpty, "  --checkpoint  \tName of file to write a checkpoint of the "
+                                                             "simulation to when it ends, which --restore can continue from."},
+ {CHECKPOINT_EVERY, 0, "", "checkpoint-every", option::Arg::Numeric, "  --checkpoint-every  \tNumber of steps between checkpoints "
+                                                             "written during the simulation, each replacing the last. If "
+                                                             "--checkpoint is not supplied, they are written to the network "
+                                                             "file's name with the extension _checkpoint.h5."},
+ {RESTORE, 0, "", "restore", option::Arg::NonEmpty, "  --restore  \tName of a checkpoint of this network to continue "
+                                                             "from. The simulation ends at the same time as it would have "
+                                                             "without restoring; --seed is ignored."},
  {UNKNOWN,  0, "" , ""   ,      option::Arg::None, "\nExamples:\n"
                                                    "  nengo_mpi --noprog basal_ganglia.net 1.0\n"
                                                    "  nengo_mpi --log ~/spaun_results.h5 spaun.net 7.5\n" },
@@ -80,14 +148,133 @@ int mpi_master_start(int argc, char **argv){
     bool show_progress = !bool(options[NO_PROG]);
     cout << "Show progress bar: " << show_progress << endl;
 
-    bool collect_timings = bool(options[TIMING]);
-    cout << "Collect timing info: " << collect_timings << endl;
+    SimulatorConfig config;
+
+    config.collect_timings = bool(options[TIMING]);
+    cout << "Collect timing info: " << config.collect_timings << endl;
+
+    if(options[TRACE]){
+        config.set("trace_file", options[TRACE].arg);
+        cout << "Will write a trace to: " << config.trace_file << endl;
+    }
+
+    if(options[PROFILE]){
+        config.set("profile_file", options[PROFILE].arg);
+        cout << "Will write a cost profile to: " << config.profile_file << endl;
+    }
+
+    if(options[THREADS]){
+        config.set("threads", options[THREADS].arg);
+    }
+    cout << "Threads per process: " << config.n_threads << endl;
+
+    if(options[TRIALS]){
+        config.set("trials", options[TRIALS].arg);
+    }
+    cout << "Trials: " << config.n_trials << endl;
+
+    if(options[LEARNING_EVERY]){
+        config.set("learning_every", options[LEARNING_EVERY].arg);
+    }
+    cout << "Learning rules update every: " << config.learning_every << " steps" << endl;
+
+    if(options[QUIESCENCE]){
+        config.set("quiescence", options[QUIESCENCE].arg);
+    }
+    cout << "Quiescence tolerance: " << config.quiescence << endl;
+
+    if(options[REALTIME]){
+        config.set("realtime", options[REALTIME].arg);
+    }
+    cout << "Real-time speed: " << config.realtime << endl;
+
+    config.zero_copy = bool(options[ZERO_COPY]);
+    cout << "Zero-copy MPI transfers: " << config.zero_copy << endl;
+
+    config.sparse_spikes = !bool(options[DENSE_SPIKES]);
+    cout << "Send spikes as indices: " << config.sparse_spikes << endl;
+
+    config.shared_memory = !bool(options[NO_SHARED_MEMORY]);
+    cout << "Shared-memory transfers within nodes: " << config.shared_memory << endl;
+
+    if(options[PRECISION]){
+        config.set("precision", options[PRECISION].arg);
+    }
+    cout << "Precision: " << DTYPE_PRECISION << endl;
+
+    if(options[BACKEND]){
+        config.set("backend", options[BACKEND].arg);
+    }
+    cout << "Backend: " << config.backend << endl;
+
+    if(options[FLUSH_EVERY]){
+        config.set("flush_every", options[FLUSH_EVERY].arg);
+    }
+    cout << "Flush probes every: " << config.flush_every << " steps" << endl;
+
+    config.async_flush = !bool(options[SYNC_FLUSH]);
+    cout << "Write probe data in background: " << config.async_flush << endl;
+
+    config.collective_io = bool(options[COLLECTIVE_IO]);
+    if(options[IO_RANKS]){
+        config.set("io_ranks", options[IO_RANKS].arg);
+    }
+
+    if(options[COMPRESSION]){
+        config.set("compression", options[COMPRESSION].arg);
+    }
+    if(options[COMPRESSION_LEVEL]){
+        config.set("compression_level", options[COMPRESSION_LEVEL].arg);
+    }
+    if(options[LOG_PRECISION]){
+        config.set("log_precision", options[LOG_PRECISION].arg);
+    }
+    cout << "Collective writes: " << config.collective_io << endl;
+    cout << "Probe data compression: " << config.compression << endl;
+    cout << "Probe data precision: " << config.log_precision << endl;
+
+    config.spike_events = bool(options[SPIKE_EVENTS]);
+    cout << "Store spikes as events: " << config.spike_events << endl;
+
+    config.report_memory = bool(options[REPORT_MEMORY]);
+
+    config.leader_load = bool(options[LEADER_LOAD]);
+    cout << "Load network through node leaders: " << config.leader_load << endl;
+
+    if(options[MAPPING]){
+        config.set("mapping", options[MAPPING].arg);
+    }
+    cout << "Component mapping: " << config.mapping << endl;
+
+    string net_base = net_filename.substr(0, net_filename.find_last_of("."));
+
+    string checkpoint_filename;
+    if(options[CHECKPOINT]){
+        checkpoint_filename = options[CHECKPOINT].arg;
+    }
+
+    if(options[CHECKPOINT_EVERY]){
+        config.set("checkpoint_every", options[CHECKPOINT_EVERY].arg);
+
+        if(checkpoint_filename.length() == 0){
+            checkpoint_filename = net_base + "_checkpoint.h5";
+        }
+    }
+
+    config.set("checkpoint_file", checkpoint_filename);
+    if(checkpoint_filename.length() > 0){
+        cout << "Will write checkpoints to: " << checkpoint_filename;
+        if(config.checkpoint_every > 0){
+            cout << ", every " << config.checkpoint_every << " steps";
+        }
+        cout << endl;
+    }
 
     string log_filename;
     if(options[LOG]){
         log_filename = options[LOG].arg;
     }else{
-        log_filename = net_filename.substr(0, net_filename.find_last_of(".")) + ".h5";
+        log_filename = net_base + ".h5";
     }
     cout << "Will write simulation results to: " << log_filename << endl;
 
@@ -99,20 +286,32 @@ int mpi_master_start(int argc, char **argv){
     cout << endl;
 
     cout << "Building network..." << endl;
-    auto sim = unique_ptr<MpiSimulator>(new MpiSimulator(collect_timings));
+    auto sim = unique_ptr<MpiSimulator>(new MpiSimulator(config));
     sim->from_file(net_filename);
     sim->finalize_build();
 
     cout << "Done building network." << endl;
     cout << endl;
 
-    sim->reset(seed);
+    if(options[RESTORE]){
+        sim->restore(options[RESTORE].arg);
+    }else{
+        sim->reset(seed);
+    }
     cout << endl;
 
-    int n_steps = int(round(sim_length / sim->dt()));
-    cout << "Running simulation for " << n_steps << " steps with dt = " << sim->dt() << "." << endl;
+    int n_steps = int(round(sim_length / sim->dt())) - int(sim->get_steps_since_reset());
+
+    if(n_steps > 0){
+        cout << "Running simulation for " << n_steps << " steps with dt = " << sim->dt() << "." << endl;
+        sim->run_n_steps(n_steps, show_progress, log_filename);
+    }else{
+        cout << "The checkpoint is already at the end of the simulation." << endl;
+    }
 
-    sim->run_n_steps(n_steps, show_progress, log_filename);
+    if(checkpoint_filename.length() > 0){
+        sim->checkpoint(checkpoint_filename);
+    }
     sim->close();
 
     mpi_kill_workers();
@@ -122,7 +321,10 @@ int mpi_master_start(int argc, char **argv){
 
 int main(int argc, char **argv){
 
-    MPI_Init(&argc, &argv);
+    // Besides the main thread, the thread that writes probe data to
+    // the simulation log may make MPI calls (see AsyncLogWriter).
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
 
     int rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -0,0 +1,862 @@
+#include "net_file.hpp"
+
+static const char* packed_names[N_PACKED_DATASETS] = {
+    "signal_keys", "signal_shapes", "signal_strides", "signal_labels",
+    "signals", "op_types", "op_indices", "op_arg_starts",
+    "op_args", "op_signals", "op_reals", "op_index_data",
+    "op_strings", "probes"};
+
+// Columns of the ``op_signals'' dataset of binary network files.
+enum{
+    OP_SIGNAL_KEY, OP_SIGNAL_NDIM, OP_SIGNAL_SHAPE1, OP_SIGNAL_SHAPE2,
+    OP_SIGNAL_STRIDE1, OP_SIGNAL_STRIDE2, OP_SIGNAL_OFFSET, OP_SIGNAL_COLUMNS
+};
+
+// Memory type of OpArgRecord. Members are read by name, so the layout in the
+// file doesn't have to match.
+static hid_t op_arg_type(){
+    hid_t record_type = H5Tcreate(H5T_COMPOUND, sizeof(OpArgRecord));
+    H5Tinsert(record_type, "kind", HOFFSET(OpArgRecord, kind), H5T_NATIVE_INT);
+    H5Tinsert(record_type, "value", HOFFSET(OpArgRecord, value), H5T_NATIVE_LLONG);
+    H5Tinsert(record_type, "rows", HOFFSET(OpArgRecord, rows), H5T_NATIVE_LLONG);
+    H5Tinsert(record_type, "cols", HOFFSET(OpArgRecord, cols), H5T_NATIVE_LLONG);
+    H5Tinsert(record_type, "real", HOFFSET(OpArgRecord, real), H5T_NATIVE_DOUBLE);
+
+    return record_type;
+}
+
+static hid_t string_type(){
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_strpad(str_type, H5T_STR_NULLPAD);
+
+    return str_type;
+}
+
+// Memory type that each packed dataset is read as. Must be closed by the caller.
+static hid_t packed_mem_type(int d){
+    switch(d){
+        case PACKED_SIGNAL_KEYS:
+        case PACKED_OP_ARG_STARTS:
+        case PACKED_OP_SIGNALS:
+        case PACKED_OP_INDEX_DATA:
+            return H5Tcopy(H5T_NATIVE_LLONG);
+
+        case PACKED_SIGNAL_SHAPES:
+        case PACKED_SIGNAL_STRIDES:
+        case PACKED_OP_TYPES:
+            return H5Tcopy(H5T_NATIVE_INT);
+
+        case PACKED_SIGNALS:
+            return H5Tcopy(H5T_NATIVE_DTYPE);
+
+        case PACKED_OP_INDICES:
+        case PACKED_OP_REALS:
+            return H5Tcopy(H5T_NATIVE_DOUBLE);
+
+        case PACKED_OP_ARGS:
+            return op_arg_type();
+
+        default:
+            return string_type();
+    }
+}
+
+const char* packed_dataset_name(int d){
+    return packed_names[d];
+}
+
+size_t packed_element_size(int d){
+    hid_t mem_type = packed_mem_type(d);
+    size_t size = H5Tget_size(mem_type);
+    H5Tclose(mem_type);
+
+    return size;
+}
+
+static hid_t open_dataset(hid_t loc, const string& name){
+    hid_t dset = H5Dopen(loc, name.c_str(), H5P_DEFAULT);
+
+    if(dset < 0){
+        stringstream msg;
+        msg << "Network file is missing dataset " << name << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    return dset;
+}
+
+// Read a whole dataset into a vector. Returns the number of rows.
+template<typename T>
+static hsize_t read_dataset(
+        hid_t loc, const string& name, hid_t mem_type, hid_t read_plist, vector<T>& out){
+
+    hid_t dset = open_dataset(loc, name);
+
+    hid_t dspace = H5Dget_space(dset);
+    hssize_t n_elements = H5Sget_simple_extent_npoints(dspace);
+
+    hsize_t dset_shape[2] = {0, 0};
+    H5Sget_simple_extent_dims(dspace, dset_shape, NULL);
+    H5Sclose(dspace);
+
+    out.resize(n_elements);
+
+    if(n_elements > 0){
+        H5Dread(dset, mem_type, H5S_ALL, H5S_ALL, read_plist, out.data());
+    }
+
+    H5Dclose(dset);
+
+    return dset_shape[0];
+}
+
+// Split a buffer of null-terminated strings.
+static vector<string> split_strings(const char* data, size_t size){
+    vector<string> strings;
+
+    size_t start = 0;
+    for(size_t i = 0; i < size; i++){
+        if(data[i] == '\0'){
+            strings.push_back(string(data + start, i - start));
+            start = i + 1;
+        }
+    }
+
+    return strings;
+}
+
+// Read a list of strings stored by store_string_list in nengo_mpi/model.py.
+static vector<string> read_string_list(hid_t loc, const string& name, hid_t read_plist){
+    hid_t str_type = string_type();
+    vector<char> buffer;
+    read_dataset(loc, name, str_type, read_plist, buffer);
+    H5Tclose(str_type);
+
+    int n_strings;
+    hid_t dset = open_dataset(loc, name);
+    hid_t attr = H5Aopen(dset, "n_strings", H5P_DEFAULT);
+    H5Aread(attr, H5T_NATIVE_INT, &n_strings);
+    H5Aclose(attr);
+    H5Dclose(dset);
+
+    // The list is stored with a final null, except in files from old versions.
+    buffer.push_back('\0');
+
+    vector<string> strings = split_strings(buffer.data(), buffer.size());
+    strings.resize(n_strings);
+
+    return strings;
+}
+
+/* Build the OpSpecs of a component stored in the binary format (see
+ * BINARY_OP_FORMAT in spec.hpp). Every argument is already typed, so this involves
+ * no string parsing. */
+static vector<OpSpec> build_op_specs(
+        const vector<int>& op_types, const vector<double>& op_indices,
+        const vector<long long>& op_arg_starts, const vector<OpArgRecord>& op_args,
+        const vector<long long>& op_signals, vector<double>& op_reals,
+        vector<long long>& op_index_data, vector<string>& op_strings){
+
+    size_t n_ops = op_types.size();
+
+    if(op_indices.size() != n_ops || op_arg_starts.size() != n_ops + 1){
+        throw runtime_error("Operator datasets in network file have inconsistent sizes.");
+    }
+
+    if(op_signals.size() % OP_SIGNAL_COLUMNS != 0){
+        throw runtime_error("Dataset op_signals in network file has the wrong shape.");
+    }
+
+    auto data = make_shared<OpData>();
+
+    for(size_t i = 0; i < op_signals.size(); i += OP_SIGNAL_COLUMNS){
+        const long long* row = op_signals.data() + i;
+
+        SignalSpec ss;
+        ss.key = row[OP_SIGNAL_KEY];
+        ss.ndim = row[OP_SIGNAL_NDIM];
+        ss.shape1 = row[OP_SIGNAL_SHAPE1];
+        ss.shape2 = row[OP_SIGNAL_SHAPE2];
+        ss.stride1 = row[OP_SIGNAL_STRIDE1];
+        ss.stride2 = row[OP_SIGNAL_STRIDE2];
+        ss.offset = row[OP_SIGNAL_OFFSET];
+
+        data->signals.push_back(ss);
+    }
+
+    data->reals.swap(op_reals);
+    data->indices.swap(op_index_data);
+    data->strings.swap(op_strings);
+
+    vector<OpSpec> op_specs;
+    for(size_t i = 0; i < n_ops; i++){
+        long long start = op_arg_starts[i], end = op_arg_starts[i+1];
+
+        if(start < 0 || end < start || end > (long long)op_args.size()){
+            throw runtime_error("Dataset op_arg_starts in network file is invalid.");
+        }
+
+        op_specs.push_back(OpSpec(
+            op_indices[i], OpType(op_types[i]),
+            vector<OpArgRecord>(op_args.begin() + start, op_args.begin() + end), data));
+    }
+
+    return op_specs;
+}
+
+template<typename T>
+static void bcast_vector(vector<T>& v, MPI_Datatype type, MPI_Comm comm){
+    long long size = v.size();
+    MPI_Bcast(&size, 1, MPI_LONG_LONG, 0, comm);
+
+    v.resize(size);
+    if(size > 0){
+        MPI_Bcast(v.data(), size, type, 0, comm);
+    }
+}
+
+static void bcast_strings(vector<string>& strings, MPI_Comm comm){
+    vector<char> buffer;
+    for(const string& s: strings){
+        buffer.insert(buffer.end(), s.begin(), s.end());
+        buffer.push_back('\0');
+    }
+
+    bcast_vector(buffer, MPI_CHAR, comm);
+    strings = split_strings(buffer.data(), buffer.size());
+}
+
+NetworkFile::NetworkFile(
+    string filename, MPI_Comm comm, bool use_leaders, string mapping_mode,
+    const ComponentMapping& mapping)
+:filename(filename), comm(comm), rank(0), n_processors(1),
+use_leaders(use_leaders && comm != MPI_COMM_NULL),
+node_comm(MPI_COMM_NULL), file_comm(MPI_COMM_NULL), file(-1),
+read_plist(H5Pcreate(H5P_DATASET_XFER)){
+
+    if(comm == MPI_COMM_NULL){
+        read_header();
+        this->mapping = ComponentMapping(header.n_components, 1);
+        open_file(MPI_COMM_NULL);
+        return;
+    }
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_processors);
+
+    bcast_header();
+    init_mapping(mapping_mode, mapping);
+
+    // Only packed files can be read for other processes.
+    if(header.component_layout != PACKED_COMPONENT_LAYOUT){
+        this->use_leaders = false;
+    }
+
+    if(this->use_leaders){
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+
+        int node_rank, node_size;
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_size(node_comm, &node_size);
+
+        node_ranks.resize(node_size);
+        MPI_Allgather(&rank, 1, MPI_INT, node_ranks.data(), 1, MPI_INT, node_comm);
+
+        MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &file_comm);
+
+        if(node_rank == 0){
+            open_file(file_comm);
+        }
+    }else{
+        file_comm = comm;
+        open_file(comm);
+    }
+}
+
+NetworkFile::NetworkFile(
+    shared_ptr<const PackedNetwork> network, MPI_Comm comm, string mapping_mode,
+    const ComponentMapping& mapping)
+:filename("in memory"), network(network), comm(comm), rank(0), n_processors(1),
+use_leaders(comm != MPI_COMM_NULL), node_comm(MPI_COMM_NULL), file_comm(MPI_COMM_NULL),
+file(-1), read_plist(H5Pcreate(H5P_DATASET_XFER)){
+
+    if(comm == MPI_COMM_NULL){
+        take_header();
+        this->mapping = ComponentMapping(header.n_components, 1);
+        return;
+    }
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_processors);
+
+    bcast_header();
+    init_mapping(mapping_mode, mapping);
+
+    // Process 0, which holds the network, is the leader of every process.
+    MPI_Comm_dup(comm, &node_comm);
+
+    node_ranks.resize(n_processors);
+    for(int p = 0; p < n_processors; p++){
+        node_ranks[p] = p;
+    }
+}
+
+void NetworkFile::init_mapping(string mapping_mode, const ComponentMapping& mapping){
+    if(mapping.get_n_components() > 0){
+        if(mapping.get_n_components() != header.n_components ||
+                mapping.get_n_processors() != n_processors){
+            throw logic_error("Component mapping given to NetworkFile does not match the network.");
+        }
+
+        this->mapping = mapping;
+    }else{
+        this->mapping = ComponentMapping(
+            header.n_components, n_processors, header.component_mapping);
+
+        vector<ComponentEdge> graph;
+        for(size_t i = 0; i + 2 < header.component_graph.size(); i += 3){
+            const long long* row = header.component_graph.data() + i;
+            graph.push_back(ComponentEdge{int(row[0]), int(row[1]), row[2]});
+        }
+
+        remap_components(this->mapping, graph, mapping_mode, comm);
+    }
+}
+
+NetworkFile::~NetworkFile(){
+    if(file >= 0){
+        H5Fclose(file);
+    }
+
+    H5Pclose(read_plist);
+
+    if(node_comm != MPI_COMM_NULL){
+        MPI_Comm_free(&node_comm);
+    }
+
+    if(use_leaders && file_comm != MPI_COMM_NULL){
+        MPI_Comm_free(&file_comm);
+    }
+}
+
+void NetworkFile::read_header(){
+    hid_t f = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if(f < 0){
+        stringstream msg;
+        msg << "Could not open network file " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    hid_t attr = H5Aopen(f, "n_components", H5P_DEFAULT);
+    H5Aread(attr, H5T_NATIVE_INT, &header.n_components);
+    H5Aclose(attr);
+
+    attr = H5Aopen(f, "dt", H5P_DEFAULT);
+    H5Aread(attr, H5T_NATIVE_DTYPE, &header.dt);
+    H5Aclose(attr);
+
+    // Files written before operators were stored in binary have no op_format.
+    header.op_format = 0;
+    if(H5Aexists(f, "op_format") > 0){
+        attr = H5Aopen(f, "op_format", H5P_DEFAULT);
+        H5Aread(attr, H5T_NATIVE_INT, &header.op_format);
+        H5Aclose(attr);
+    }
+
+    if(header.op_format > BINARY_OP_FORMAT){
+        stringstream msg;
+        msg << "Network file " << filename << " stores operators in format "
+            << header.op_format << ", but this version of nengo_mpi only reads "
+            << "formats up to " << BINARY_OP_FORMAT << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    header.component_layout = 0;
+    if(H5Aexists(f, "component_layout") > 0){
+        attr = H5Aopen(f, "component_layout", H5P_DEFAULT);
+        H5Aread(attr, H5T_NATIVE_INT, &header.component_layout);
+        H5Aclose(attr);
+    }
+
+    if(header.component_layout > PACKED_COMPONENT_LAYOUT){
+        stringstream msg;
+        msg << "Network file " << filename << " stores components in layout "
+            << header.component_layout << ", but this version of nengo_mpi only "
+            << "reads layouts up to " << PACKED_COMPONENT_LAYOUT << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    if(header.component_layout == PACKED_COMPONENT_LAYOUT){
+        if(header.op_format != BINARY_OP_FORMAT){
+            throw runtime_error("Packed network files must store operators in binary.");
+        }
+
+        hid_t group = H5Gopen(f, "components", H5P_DEFAULT);
+
+        header.offsets.resize(N_PACKED_DATASETS);
+        header.row_sizes.resize(N_PACKED_DATASETS);
+
+        for(int d = 0; d < N_PACKED_DATASETS; d++){
+            string name = packed_names[d];
+
+            vector<long long>& offsets = header.offsets[d];
+            read_dataset(group, name + "_offsets", H5T_NATIVE_LLONG, H5P_DEFAULT, offsets);
+
+            hid_t dset = open_dataset(group, name);
+            hid_t dspace = H5Dget_space(dset);
+            int ndim = H5Sget_simple_extent_ndims(dspace);
+            vector<hsize_t> dims(max(ndim, 1), 0);
+            H5Sget_simple_extent_dims(dspace, dims.data(), NULL);
+            H5Sclose(dspace);
+            H5Dclose(dset);
+
+            header.row_sizes[d] = 1;
+            for(int i = 1; i < ndim; i++){
+                header.row_sizes[d] *= dims[i];
+            }
+
+            bool valid = offsets.size() == unsigned(header.n_components + 1) &&
+                offsets.front() == 0 && offsets.back() == (long long)dims[0];
+            for(int c = 0; valid && c < header.n_components; c++){
+                valid = offsets[c] <= offsets[c+1];
+            }
+
+            if(!valid){
+                stringstream msg;
+                msg << "Dataset " << name << "_offsets in network file "
+                    << filename << " is invalid." << endl;
+                throw runtime_error(msg.str());
+            }
+        }
+
+        H5Gclose(group);
+    }
+
+    header.probe_info = read_string_list(f, "probe_info", H5P_DEFAULT);
+
+    if(H5Lexists(f, "component_mapping", H5P_DEFAULT) > 0){
+        read_dataset(f, "component_mapping", H5T_NATIVE_INT, H5P_DEFAULT, header.component_mapping);
+    }
+
+    if(H5Lexists(f, "component_graph", H5P_DEFAULT) > 0){
+        read_dataset(f, "component_graph", H5T_NATIVE_LLONG, H5P_DEFAULT, header.component_graph);
+    }
+
+    H5Fclose(f);
+}
+
+void NetworkFile::take_header(){
+    header = network->header;
+
+    bool valid = header.component_layout == PACKED_COMPONENT_LAYOUT &&
+        header.op_format == BINARY_OP_FORMAT &&
+        network->datasets.size() == N_PACKED_DATASETS &&
+        network->sizes.size() == N_PACKED_DATASETS &&
+        header.offsets.size() == N_PACKED_DATASETS &&
+        header.row_sizes.size() == N_PACKED_DATASETS;
+
+    for(int d = 0; valid && d < N_PACKED_DATASETS; d++){
+        const vector<long long>& offsets = header.offsets[d];
+
+        valid = offsets.size() == unsigned(header.n_components + 1) && offsets.front() == 0;
+        for(int c = 0; valid && c < header.n_components; c++){
+            valid = offsets[c] <= offsets[c+1];
+        }
+
+        if(valid){
+            size_t row_bytes = header.row_sizes[d] * packed_element_size(d);
+            valid = offsets.back() * row_bytes == network->sizes[d];
+        }
+
+        if(!valid){
+            stringstream msg;
+            msg << "The packed dataset " << packed_names[d] << " of the network "
+                << "given in memory does not match its offsets." << endl;
+            throw runtime_error(msg.str());
+        }
+    }
+
+    if(!valid){
+        throw runtime_error("The network given in memory is not in the packed layout.");
+    }
+}
+
+void NetworkFile::bcast_header(){
+    // Errors reading the header are raised on every process.
+    string error;
+    if(rank == 0){
+        try{
+            if(network){
+                take_header();
+            }else{
+                read_header();
+            }
+        }catch(const exception& e){
+            error = e.what();
+        }
+    }
+
+    vector<char> error_buffer(error.begin(), error.end());
+    bcast_vector(error_buffer, MPI_CHAR, comm);
+
+    if(!error_buffer.empty()){
+        throw runtime_error(string(error_buffer.begin(), error_buffer.end()));
+    }
+
+    int values[3] = {header.n_components, header.op_format, header.component_layout};
+    MPI_Bcast(values, 3, MPI_INT, 0, comm);
+    header.n_components = values[0];
+    header.op_format = values[1];
+    header.component_layout = values[2];
+
+    MPI_Bcast(&header.dt, 1, MPI_DTYPE, 0, comm);
+
+    bcast_strings(header.probe_info, comm);
+    bcast_vector(header.row_sizes, MPI_LONG_LONG, comm);
+
+    header.offsets.resize(header.row_sizes.size());
+    for(auto& offsets: header.offsets){
+        bcast_vector(offsets, MPI_LONG_LONG, comm);
+    }
+
+    bcast_vector(header.component_mapping, MPI_INT, comm);
+    bcast_vector(header.component_graph, MPI_LONG_LONG, comm);
+}
+
+void NetworkFile::open_file(MPI_Comm file_comm){
+    bool packed = header.component_layout == PACKED_COMPONENT_LAYOUT;
+
+    hid_t file_plist = H5Pcreate(H5P_FILE_ACCESS);
+
+    if(file_comm != MPI_COMM_NULL){
+        H5Pset_fapl_mpio(file_plist, file_comm, MPI_INFO_NULL);
+
+        // Packed datasets are read with one collective read each. Components in
+        // their own groups are read independently, since processes own different
+        // numbers of them.
+        H5Pset_dxpl_mpio(read_plist, packed ? H5FD_MPIO_COLLECTIVE : H5FD_MPIO_INDEPENDENT);
+    }
+
+    file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, file_plist);
+    H5Pclose(file_plist);
+
+    if(file < 0){
+        stringstream msg;
+        msg << "Could not open network file " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+}
+
+vector<int> NetworkFile::my_components() const{
+    return mapping.components_of(rank);
+}
+
+size_t NetworkFile::n_elements(int d, int c) const{
+    return (header.offsets[d][c+1] - header.offsets[d][c]) * header.row_sizes[d];
+}
+
+vector<NetworkComponent> NetworkFile::read_components(){
+    vector<NetworkComponent> components;
+    vector<int> component_indices = my_components();
+
+    if(header.component_layout != PACKED_COMPONENT_LAYOUT){
+        for(int c: component_indices){
+            components.push_back(read_component_group(c));
+        }
+
+        return components;
+    }
+
+    packed_data = read_packed_datasets();
+    packed_positions.assign(N_PACKED_DATASETS, 0);
+
+    for(int c: component_indices){
+        vector<char> chars;
+
+        NetworkComponent component;
+        take(PACKED_SIGNAL_KEYS, c, component.signal_keys);
+        take(PACKED_SIGNAL_SHAPES, c, component.signal_shapes);
+        take(PACKED_SIGNAL_STRIDES, c, component.signal_strides);
+
+        take(PACKED_SIGNAL_LABELS, c, chars);
+        component.signal_labels = split_strings(chars.data(), chars.size());
+        component.signal_labels.resize(component.signal_keys.size());
+
+        take(PACKED_SIGNALS, c, component.signals);
+
+        vector<int> op_types;
+        vector<double> op_indices, op_reals;
+        vector<long long> op_arg_starts, op_signals, op_index_data;
+        vector<OpArgRecord> op_args;
+
+        take(PACKED_OP_TYPES, c, op_types);
+        take(PACKED_OP_INDICES, c, op_indices);
+        take(PACKED_OP_ARG_STARTS, c, op_arg_starts);
+        take(PACKED_OP_ARGS, c, op_args);
+        take(PACKED_OP_SIGNALS, c, op_signals);
+        take(PACKED_OP_REALS, c, op_reals);
+        take(PACKED_OP_INDEX_DATA, c, op_index_data);
+
+        take(PACKED_OP_STRINGS, c, chars);
+        vector<string> op_strings = split_strings(chars.data(), chars.size());
+
+        component.op_specs = build_op_specs(
+            op_types, op_indices, op_arg_starts, op_args,
+            op_signals, op_reals, op_index_data, op_strings);
+
+        take(PACKED_PROBES, c, chars);
+        component.probes = split_strings(chars.data(), chars.size());
+
+        components.push_back(move(component));
+    }
+
+    packed_data.clear();
+
+    return components;
+}
+
+NetworkComponent NetworkFile::read_component_group(int c){
+    stringstream ss;
+    ss << c;
+
+    hid_t group = H5Gopen(file, ss.str().c_str(), H5P_DEFAULT);
+    if(group < 0){
+        stringstream msg;
+        msg << "Network file " << filename << " has no group for component " << c << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    NetworkComponent component;
+
+    hsize_t n_signals = read_dataset(
+        group, "signal_keys", H5T_NATIVE_LLONG, read_plist, component.signal_keys);
+
+    read_dataset(group, "signal_shapes", H5T_NATIVE_INT, read_plist, component.signal_shapes);
+    read_dataset(group, "signal_strides", H5T_NATIVE_INT, read_plist, component.signal_strides);
+
+    if(component.signal_shapes.size() != 2 * n_signals ||
+            component.signal_strides.size() != 2 * n_signals){
+        throw runtime_error("Signal datasets in network file have inconsistent sizes.");
+    }
+
+    component.signal_labels = read_string_list(group, "signal_labels", read_plist);
+    component.signal_labels.resize(n_signals);
+
+    read_dataset(group, "signals", H5T_NATIVE_DTYPE, read_plist, component.signals);
+
+    if(header.op_format == BINARY_OP_FORMAT){
+        vector<int> op_types;
+        vector<double> op_indices, op_reals;
+        vector<long long> op_arg_starts, op_signals, op_index_data;
+        vector<OpArgRecord> op_args;
+
+        read_dataset(group, "op_types", H5T_NATIVE_INT, read_plist, op_types);
+        read_dataset(group, "op_indices", H5T_NATIVE_DOUBLE, read_plist, op_indices);
+        read_dataset(group, "op_arg_starts", H5T_NATIVE_LLONG, read_plist, op_arg_starts);
+
+        hid_t record_type = op_arg_type();
+        read_dataset(group, "op_args", record_type, read_plist, op_args);
+        H5Tclose(record_type);
+
+        read_dataset(group, "op_signals", H5T_NATIVE_LLONG, read_plist, op_signals);
+        read_dataset(group, "op_reals", H5T_NATIVE_DOUBLE, read_plist, op_reals);
+        read_dataset(group, "op_index_data", H5T_NATIVE_LLONG, read_plist, op_index_data);
+
+        vector<string> op_strings = read_string_list(group, "op_strings", read_plist);
+
+        component.op_specs = build_op_specs(
+            op_types, op_indices, op_arg_starts, op_args,
+            op_signals, op_reals, op_index_data, op_strings);
+
+    }else{
+        for(const string& op_string: read_string_list(group, "operators", read_plist)){
+            component.op_specs.push_back(OpSpec(op_string));
+        }
+    }
+
+    component.probes = read_string_list(group, "probes", read_plist);
+
+    H5Gclose(group);
+
+    return component;
+}
+
+vector<char> NetworkFile::read_packed_rows(int d, const vector<int>& components){
+    const vector<long long>& offsets = header.offsets[d];
+
+    // Rows to read, merging the ranges of adjacent components
+    vector<pair<hsize_t, hsize_t>> ranges;
+    hsize_t n_rows = 0;
+
+    for(int c: components){
+        hsize_t start = offsets[c], count = offsets[c+1] - offsets[c];
+
+        if(count == 0){
+            continue;
+        }
+
+        if(!ranges.empty() && ranges.back().first + ranges.back().second == start){
+            ranges.back().second += count;
+        }else{
+            ranges.push_back(make_pair(start, count));
+        }
+
+        n_rows += count;
+    }
+
+    if(network){
+        size_t row_bytes = header.row_sizes[d] * packed_element_size(d);
+        vector<char> buffer(n_rows * row_bytes);
+
+        char* dst = buffer.data();
+        for(auto& range: ranges){
+            memcpy(dst, network->datasets[d] + range.first * row_bytes, range.second * row_bytes);
+            dst += range.second * row_bytes;
+        }
+
+        return buffer;
+    }
+
+    hid_t mem_type = packed_mem_type(d);
+    size_t row_size = header.row_sizes[d];
+    vector<char> buffer(n_rows * row_size * H5Tget_size(mem_type));
+
+    hid_t group = H5Gopen(file, "components", H5P_DEFAULT);
+    hid_t dset = open_dataset(group, packed_names[d]);
+    hid_t file_space = H5Dget_space(dset);
+
+    int ndim = H5Sget_simple_extent_ndims(file_space);
+    vector<hsize_t> dims(max(ndim, 1), 0);
+    H5Sget_simple_extent_dims(file_space, dims.data(), NULL);
+
+    vector<hsize_t> start(dims.size(), 0), count(dims);
+
+    H5Sselect_none(file_space);
+    for(auto& range: ranges){
+        start[0] = range.first;
+        count[0] = range.second;
+        H5Sselect_hyperslab(file_space, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+    }
+
+    // Processes with nothing to read still take part in the collective read.
+    hsize_t n_elements = max(n_rows * row_size, hsize_t(1));
+    hid_t mem_space = H5Screate_simple(1, &n_elements, NULL);
+    if(n_rows == 0){
+        H5Sselect_none(mem_space);
+    }
+
+    char dummy[16];
+    herr_t err = H5Dread(
+        dset, mem_type, mem_space, file_space, read_plist,
+        n_rows > 0 ? buffer.data() : dummy);
+
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+    H5Dclose(dset);
+    H5Gclose(group);
+    H5Tclose(mem_type);
+
+    if(err < 0){
+        stringstream msg;
+        msg << "Failed to read dataset " << packed_names[d] << " from network file "
+            << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    return buffer;
+}
+
+vector<vector<char>> NetworkFile::read_packed_datasets(){
+    vector<vector<char>> data(N_PACKED_DATASETS);
+
+    if(!use_leaders){
+        vector<int> components = my_components();
+
+        for(int d = 0; d < N_PACKED_DATASETS; d++){
+            data[d] = read_packed_rows(d, components);
+        }
+
+        return data;
+    }
+
+    int node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+    int node_size = node_ranks.size();
+
+    // Components of each process on the node, and all of them in file order
+    vector<vector<int>> peer_components(node_size);
+    vector<int> node_components;
+
+    for(int p = 0; p < node_size; p++){
+        peer_components[p] = mapping.components_of(node_ranks[p]);
+        node_components.insert(
+            node_components.end(), peer_components[p].begin(), peer_components[p].end());
+    }
+
+    sort(node_components.begin(), node_components.end());
+
+    for(int d = 0; d < N_PACKED_DATASETS; d++){
+        const vector<long long>& offsets = header.offsets[d];
+        size_t row_bytes = header.row_sizes[d] * packed_element_size(d);
+
+        MPI_Datatype row_type;
+        MPI_Type_contiguous(row_bytes, MPI_BYTE, &row_type);
+        MPI_Type_commit(&row_type);
+
+        vector<int> counts(node_size, 0), displs(node_size, 0);
+        long long total_rows = 0;
+
+        for(int p = 0; p < node_size; p++){
+            long long rows = 0;
+            for(int c: peer_components[p]){
+                rows += offsets[c+1] - offsets[c];
+            }
+
+            if(total_rows + rows > INT_MAX){
+                stringstream msg;
+                msg << "Dataset " << packed_names[d] << " of network file is too "
+                    << "large to be scattered from a single process per node." << endl;
+                throw runtime_error(msg.str());
+            }
+
+            counts[p] = rows;
+            displs[p] = total_rows;
+            total_rows += rows;
+        }
+
+        data[d].resize(counts[node_rank] * row_bytes);
+
+        // The leader reads the rows of every process on the node, and orders
+        // them by process.
+        vector<char> send_buffer;
+        if(node_rank == 0){
+            vector<char> file_rows = read_packed_rows(d, node_components);
+
+            map<int, size_t> positions;
+            size_t position = 0;
+            for(int c: node_components){
+                positions[c] = position;
+                position += (offsets[c+1] - offsets[c]) * row_bytes;
+            }
+
+            send_buffer.resize(total_rows * row_bytes);
+
+            char* dst = send_buffer.data();
+            for(int p = 0; p < node_size; p++){
+                for(int c: peer_components[p]){
+                    size_t n_bytes = (offsets[c+1] - offsets[c]) * row_bytes;
+                    memcpy(dst, file_rows.data() + positions[c], n_bytes);
+                    dst += n_bytes;
+                }
+            }
+        }
+
+        MPI_Scatterv(
+            send_buffer.data(), counts.data(), displs.data(), row_type,
+            data[d].data(), counts[node_rank], row_type, 0, node_comm);
+
+        MPI_Type_free(&row_type);
+    }
+
+    return data;
+}
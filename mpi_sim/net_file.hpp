@@ -0,0 +1,210 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <mpi.h>
+#include <hdf5.h>
+
+#include "spec.hpp"
+#include "mapping.hpp"
+
+#include "typedef.hpp"
+#include "debug.hpp"
+
+using namespace std;
+
+/* Value of the ``component_layout'' attribute of network files in which the
+ * datasets of all components are concatenated into one dataset per kind of
+ * data, stored in the ``components'' group. Each dataset ``name'' comes with a
+ * dataset ``name_offsets'' of n_components + 1 entries, giving the first row
+ * of each component. Files without the attribute store each component in its
+ * own group. */
+const int PACKED_COMPONENT_LAYOUT = 1;
+
+// Kinds of data stored for each component. In a packed file, each is one dataset.
+enum PackedDataset{
+    PACKED_SIGNAL_KEYS, PACKED_SIGNAL_SHAPES, PACKED_SIGNAL_STRIDES, PACKED_SIGNAL_LABELS,
+    PACKED_SIGNALS, PACKED_OP_TYPES, PACKED_OP_INDICES, PACKED_OP_ARG_STARTS,
+    PACKED_OP_ARGS, PACKED_OP_SIGNALS, PACKED_OP_REALS, PACKED_OP_INDEX_DATA,
+    PACKED_OP_STRINGS, PACKED_PROBES, N_PACKED_DATASETS
+};
+
+// The name of each packed dataset in network files.
+const char* packed_dataset_name(int d);
+
+// The size in bytes of an element of a packed dataset, as it is held in memory.
+size_t packed_element_size(int d);
+
+/* Everything a network file stores about a single component. */
+struct NetworkComponent{
+    vector<key_type> signal_keys;
+
+    // Two entries per signal
+    vector<int> signal_shapes;
+    vector<int> signal_strides;
+
+    vector<string> signal_labels;
+
+    // Initial values of all signals, concatenated
+    vector<dtype> signals;
+
+    vector<OpSpec> op_specs;
+    vector<string> probes;
+};
+
+/* Information in a network file that every process needs. Read by one
+ * process, and broadcast to the others. */
+struct NetworkHeader{
+    int n_components;
+    dtype dt;
+    int op_format;
+    int component_layout;
+
+    vector<string> probe_info;
+
+    // For packed files, the first row of each component in each packed dataset.
+    vector<vector<long long>> offsets;
+
+    // For packed files, the number of elements in a row of each packed dataset.
+    vector<long long> row_sizes;
+
+    // The process of each component, if the file stores a mapping (see
+    // ComponentMapping), and the traffic between components, as rows of
+    // (src, dst, size). Empty if the file doesn't store them.
+    vector<int> component_mapping;
+    vector<long long> component_graph;
+};
+
+/* A network in the packed layout, held in memory by one process instead of
+ * stored in a file, such as one built by the python module. ``datasets'' has
+ * the rows of every component of each packed dataset, one after another, with
+ * the elements laid out as in memory (see packed_element_size), and
+ * ``header'' gives where each component's rows are, as read from a file.
+ * ``owner'' keeps the memory of the datasets alive. */
+struct PackedNetwork{
+    NetworkHeader header;
+
+    vector<const char*> datasets;
+
+    // Size of each dataset in bytes.
+    vector<size_t> sizes;
+
+    shared_ptr<void> owner;
+};
+
+/* Reads the components assigned to one process from a network file.
+ *
+ * When loading in parallel, the header of the file is read by one process and
+ * broadcast. With a packed file, each packed dataset is then read with a single
+ * collective read, selecting the rows of every component the reading process
+ * needs. If ``use_leaders'' is true, only one process per node (as given by
+ * MPI_Comm_split_type) opens the file; it reads the components of every
+ * process on its node and scatters them. Files in the per-group layout are read
+ * independently by every process.
+ *
+ * Which process reads each component is given by the mapping stored in the
+ * file, if any, rearranged according to ``mapping_mode'' (see remap_components),
+ * unless a mapping of the network's components is given as ``mapping''.
+ *
+ * A network held in memory by process 0 is read the same way as a packed
+ * file in leaders mode, with process 0 as the leader of every process: it
+ * scatters the rows of each dataset to the processes they belong to.
+ *
+ * comm is MPI_COMM_NULL when loading a network without MPI, in which case all
+ * components belong to the single process. */
+class NetworkFile{
+
+public:
+    NetworkFile(
+        string filename, MPI_Comm comm, bool use_leaders, string mapping_mode="default",
+        const ComponentMapping& mapping=ComponentMapping());
+
+    /* Read from ``network'', which only process 0 needs to hold; the others
+     * may pass an empty PackedNetwork. */
+    NetworkFile(
+        shared_ptr<const PackedNetwork> network, MPI_Comm comm, string mapping_mode="default",
+        const ComponentMapping& mapping=ComponentMapping());
+
+    ~NetworkFile();
+
+    const NetworkHeader& get_header() const { return header; }
+    const ComponentMapping& get_mapping() const { return mapping; }
+
+    // The components assigned to this process, in increasing order.
+    vector<int> my_components() const;
+
+    /* Read the components assigned to this process. Must be called by every
+     * process in comm. */
+    vector<NetworkComponent> read_components();
+
+private:
+    void read_header();
+
+    // The header of ``network'', checked against the size of its datasets.
+    void take_header();
+
+    void bcast_header();
+
+    // Choose the components of each process, once the header is known.
+    void init_mapping(string mapping_mode, const ComponentMapping& mapping);
+
+    void open_file(MPI_Comm file_comm);
+
+    NetworkComponent read_component_group(int component);
+
+    // Number of elements of packed dataset d that belong to component c.
+    size_t n_elements(int d, int c) const;
+
+    /* Copy the elements of packed dataset d that belong to component c out of
+     * packed_data. Components must be taken in increasing order. */
+    template<typename T>
+    void take(int d, int c, vector<T>& out){
+        size_t n_bytes = n_elements(d, c) * sizeof(T);
+
+        out.resize(n_elements(d, c));
+        memcpy(out.data(), packed_data[d].data() + packed_positions[d], n_bytes);
+        packed_positions[d] += n_bytes;
+    }
+
+    /* Read the rows of the given components (in increasing order) from the
+     * packed dataset ``d'', collectively over file_comm if it isn't null. */
+    vector<char> read_packed_rows(int d, const vector<int>& components);
+
+    /* Read this process's rows of every packed dataset, either directly or
+     * from the leader of its node. */
+    vector<vector<char>> read_packed_datasets();
+
+    string filename;
+
+    // Only for networks held in memory; empty on processes other than 0.
+    shared_ptr<const PackedNetwork> network;
+
+    MPI_Comm comm;
+    int rank;
+    int n_processors;
+
+    // Leaders mode only. node_comm contains the processes sharing a node, and
+    // file_comm the processes that open the file.
+    bool use_leaders;
+    MPI_Comm node_comm;
+    MPI_Comm file_comm;
+    vector<int> node_ranks;
+
+    hid_t file;
+    hid_t read_plist;
+
+    NetworkHeader header;
+    ComponentMapping mapping;
+
+    // This process's rows of each packed dataset, while they are being read.
+    vector<vector<char>> packed_data;
+    vector<size_t> packed_positions;
+};
@@ -1,9 +1,17 @@
 #include "operator.hpp"
 
+void run_virtual_batch(Operator* const* ops, unsigned n_ops){
+    for(unsigned i = 0; i < n_ops; i++){
+        (*ops[i])();
+    }
+}
+
 // ********************************************************************************
 TimeUpdate::TimeUpdate(Signal step, Signal time, dtype dt)
 :step(step), time(time), dt(dt){
 
+    declare_write(step);
+    declare_write(time);
 }
 
 void TimeUpdate::operator() (){
@@ -31,6 +39,7 @@ string TimeUpdate::to_string() const {
 Reset::Reset(Signal dst, dtype value)
 :dst(dst), value(value){
 
+    declare_write(dst);
 }
 
 void Reset::operator() (){
@@ -54,6 +63,8 @@ string Reset::to_string() const {
 Copy::Copy(Signal dst, Signal src)
 :dst(dst), src(src){
 
+    declare_read(src);
+    declare_write(dst);
 }
 
 void Copy::operator() (){
@@ -85,6 +96,9 @@ start_src(start_src), stop_src(stop_src), step_src(step_src),
 start_dst(start_dst), stop_dst(stop_dst), step_dst(step_dst),
 seq_src(seq_src), seq_dst(seq_dst){
 
+    declare_read(src);
+    declare_write(dst);
+
     if(seq_src.size() > 0 && (start_src != 0 || stop_src != 0 || step_src != 0)){
         throw runtime_error(
             "While creating SlicedCopy, seq_src was non-empty, "
@@ -128,78 +142,190 @@ seq_src(seq_src), seq_dst(seq_dst){
     }
 
     n_assignments = n_assignments_src;
+
+    sources.push_back(src);
+    compile_plan();
 }
 
-void SlicedCopy::operator() (){
-    unsigned idx_src, idx_dst;
-    if(seq_src.size() > 0 && seq_dst.size() > 0){
-        if(inc){
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = seq_src[i] % length_src;
-                idx_dst = seq_dst[i] % length_dst;
-
-                dst(idx_dst) += src(idx_src);
-            }
-        }else{
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = seq_src[i] % length_src;
-                idx_dst = seq_dst[i] % length_dst;
+// Shortest run of assignments with constant strides, other than unit
+// strides, that is copied as a strided block instead of being gathered.
+static const unsigned MIN_STRIDED_RUN = 4;
+
+void SlicedCopy::compile_plan(){
+    // Offsets of the elements of each assignment, in the order they are made.
+    vector<int> src_offsets(n_assignments);
+    vector<int> dst_offsets(n_assignments);
+
+    for(unsigned i = 0; i < n_assignments; i++){
+        unsigned idx_src = seq_src.size() > 0 ?
+            seq_src[i] % length_src : (start_src + i * step_src) % length_src;
+        unsigned idx_dst = seq_dst.size() > 0 ?
+            seq_dst[i] % length_dst : (start_dst + i * step_dst) % length_dst;
+
+        src_offsets[i] = int(idx_src) * src.stride1;
+        dst_offsets[i] = int(idx_dst) * dst.stride1;
+    }
+
+    unsigned i = 0;
+    while(i < n_assignments){
+        int src_stride = 0, dst_stride = 0;
+        unsigned length = 1;
 
-                dst(idx_dst) = src(idx_src);
+        if(i + 1 < n_assignments){
+            src_stride = src_offsets[i + 1] - src_offsets[i];
+            dst_stride = dst_offsets[i + 1] - dst_offsets[i];
+            length = 2;
+
+            while(i + length < n_assignments &&
+                    src_offsets[i + length] - src_offsets[i + length - 1] == src_stride &&
+                    dst_offsets[i + length] - dst_offsets[i + length - 1] == dst_stride){
+                length++;
             }
         }
 
-    }else if(seq_src.size() > 0){
-        if(inc){
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = seq_src[i] % length_src;
-                idx_dst = (start_dst + i * step_dst) % length_dst;
+        bool contiguous = length > 1 && src_stride == 1 && dst_stride == 1;
 
-                dst(idx_dst) += src(idx_src);
-            }
+        if(contiguous || length >= MIN_STRIDED_RUN){
+            add_block({
+                contiguous ? CONTIGUOUS : STRIDED, 0,
+                src_offsets[i], dst_offsets[i], src_stride, dst_stride, 0, length});
+            i += length;
         }else{
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = seq_src[i] % length_src;
-                idx_dst = (start_dst + i * step_dst) % length_dst;
+            gather_src.push_back(src_offsets[i]);
+            gather_dst.push_back(dst_offsets[i]);
+            add_block({GATHER, 0, 0, 0, 0, 0, unsigned(gather_src.size() - 1), 1});
+            i++;
+        }
+    }
+}
 
-                dst(idx_dst) = src(idx_src);
-            }
+void SlicedCopy::add_block(const Block& block){
+    if(!blocks.empty()){
+        Block& last = blocks.back();
+
+        bool same = last.kind == block.kind && last.source == block.source;
+
+        if(same && block.kind == GATHER &&
+                last.src_offset == block.src_offset &&
+                last.dst_offset == block.dst_offset &&
+                last.start + last.length == block.start){
+            last.length += block.length;
+            return;
         }
 
-    }else if(seq_dst.size() > 0){
-        if(inc){
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = (start_src + i * step_src) % length_src;
-                idx_dst = seq_dst[i] % length_dst;
+        if(same && block.kind != GATHER &&
+                last.src_stride == block.src_stride &&
+                last.dst_stride == block.dst_stride &&
+                block.src_offset == last.src_offset + int(last.length) * last.src_stride &&
+                block.dst_offset == last.dst_offset + int(last.length) * last.dst_stride){
+            last.length += block.length;
+            return;
+        }
+    }
 
-                dst(idx_dst) += src(idx_src);
-            }
-        }else{
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = (start_src + i * step_src) % length_src;
-                idx_dst = seq_dst[i] % length_dst;
+    blocks.push_back(block);
+}
 
-                dst(idx_dst) = src(idx_src);
-            }
+bool SlicedCopy::merge(const SlicedCopy& other){
+    if(other.inc != inc || other.dst.data.get() != dst.data.get()){
+        return false;
+    }
+
+    // The sources of other, as indices into our own.
+    vector<unsigned> source_ids;
+    for(const Signal& source: other.sources){
+        unsigned id = 0;
+        while(id < sources.size() && sources[id].raw_data != source.raw_data){
+            id++;
         }
 
-    }else{
-        if(inc){
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = (start_src + i * step_src) % length_src;
-                idx_dst = (start_dst + i * step_dst) % length_dst;
+        if(id == sources.size()){
+            sources.push_back(source);
+            declare_read(source);
+        }
+
+        source_ids.push_back(id);
+    }
+
+    // Signal's == compares values, so views are compared by where they lie.
+    bool same_dst = other.dst.raw_data == dst.raw_data &&
+        other.dst.shape1 == dst.shape1 && other.dst.stride1 == dst.stride1;
+
+    if(!same_dst){
+        declare_write(other.dst);
+    }
+
+    const int dst_shift = int(other.dst.raw_data - dst.raw_data);
+
+    for(Block block: other.blocks){
+        block.source = source_ids[block.source];
+        block.dst_offset += dst_shift;
+
+        if(block.kind == GATHER){
+            unsigned start = gather_src.size();
+            gather_src.insert(
+                gather_src.end(), other.gather_src.begin() + block.start,
+                other.gather_src.begin() + block.start + block.length);
+            gather_dst.insert(
+                gather_dst.end(), other.gather_dst.begin() + block.start,
+                other.gather_dst.begin() + block.start + block.length);
+            block.start = start;
+        }
+
+        add_block(block);
+    }
+
+    n_assignments += other.n_assignments;
+    return true;
+}
+
+void SlicedCopy::operator() (){
+    for(const Block& block: blocks){
+        const dtype* s = sources[block.source].raw_data + block.src_offset;
+        dtype* d = dst.raw_data + block.dst_offset;
+        const unsigned n = block.length;
+
+        if(block.kind == CONTIGUOUS){
+            if(inc){
+                for(unsigned i = 0; i < n; i++){
+                    d[i] += s[i];
+                }
+            }else if(d + n <= s || s + n <= d){
+                memcpy(d, s, n * sizeof(dtype));
+            }else{
+                for(unsigned i = 0; i < n; i++){
+                    d[i] = s[i];
+                }
+            }
 
-                dst(idx_dst) += src(idx_src);
+        }else if(block.kind == STRIDED){
+            const int src_stride = block.src_stride;
+            const int dst_stride = block.dst_stride;
+
+            if(inc){
+                for(unsigned i = 0; i < n; i++){
+                    d[int(i) * dst_stride] += s[int(i) * src_stride];
+                }
+            }else{
+                for(unsigned i = 0; i < n; i++){
+                    d[int(i) * dst_stride] = s[int(i) * src_stride];
+                }
             }
-        }else{
-            for(unsigned i = 0; i < n_assignments; i++){
-                idx_src = (start_src + i * step_src) % length_src;
-                idx_dst = (start_dst + i * step_dst) % length_dst;
 
-                dst(idx_dst) = src(idx_src);
+        }else{
+            const int* idx_src = gather_src.data() + block.start;
+            const int* idx_dst = gather_dst.data() + block.start;
+
+            if(inc){
+                for(unsigned i = 0; i < n; i++){
+                    d[idx_dst[i]] += s[idx_src[i]];
+                }
+            }else{
+                for(unsigned i = 0; i < n; i++){
+                    d[idx_dst[i]] = s[idx_src[i]];
+                }
             }
         }
-
     }
 
     run_dbg(*this);
@@ -236,12 +362,87 @@ string SlicedCopy::to_string() const{
     }
     out << endl;
 
+    const char* kinds[] = {"contiguous", "strided", "gather"};
+
+    out << "n_sources: " << sources.size() << endl;
+    out << "plan:" << endl;
+    for(const Block& block: blocks){
+        out << kinds[block.kind] << " (source " << block.source
+            << ", length " << block.length << ")" << endl;
+    }
+
     return out.str();
 }
 
 // ********************************************************************************
+// Whether the elements of a signal lie one after the other in memory, in row-major order.
+static bool is_dense(const Signal& signal){
+    return signal.is_contiguous &&
+        (signal.shape1 == 1 || signal.shape2 == 1 || signal.stride2 == 1);
+}
+
+// Whether every element of a signal is within ``tolerance'' of zero. Stops
+// at the first element that isn't, so is cheap for signals that are active.
+static bool is_quiet(const Signal& signal, dtype tolerance){
+    if(is_dense(signal)){
+        const dtype* values = signal.raw_data;
+
+        for(unsigned i = 0; i < signal.size; i++){
+            if(fabs(values[i]) > tolerance){
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    for(unsigned i = 0; i < signal.shape1; i++){
+        for(unsigned j = 0; j < signal.shape2; j++){
+            if(fabs(signal(i, j)) > tolerance){
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool is_quiet(const vector<Signal>& signals, dtype tolerance){
+    for(const Signal& signal: signals){
+        if(!is_quiet(signal, tolerance)){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool is_quiet(const dtype* values, unsigned n, dtype tolerance){
+    for(unsigned i = 0; i < n; i++){
+        if(fabs(values[i]) > tolerance){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void set_zero(const vector<Signal>& signals){
+    for(const Signal& signal: signals){
+        for(unsigned i = 0; i < signal.shape1; i++){
+            for(unsigned j = 0; j < signal.shape2; j++){
+                signal.raw_data[int(i) * signal.stride1 + int(j) * signal.stride2] = 0.0;
+            }
+        }
+    }
+}
+
 DotInc::DotInc(Signal A, Signal X, Signal Y)
-:scalar(A.shape2 != X.shape1), matrix_vector(X.shape2 == 1), A(A), X(X), Y(Y){
+:scalar(A.shape2 != X.shape1), matrix_vector(X.shape2 == 1), A(A), X(X), Y(Y), quiescence(0.0){
+
+    declare_read(A);
+    declare_read(X);
+    declare_write(Y);
 
     if(scalar){
         // Scalar multiplication
@@ -315,6 +516,10 @@ DotInc::DotInc(Signal A, Signal X, Signal Y)
 }
 
 void DotInc::operator() (){
+    if(quiescence > 0 && !scalar && is_quiet(X, quiescence)){
+        return;
+    }
+
     if(scalar){
         dtype a = A(0);
 
@@ -325,12 +530,12 @@ void DotInc::operator() (){
         }
 
     }else if(X.shape2 == 1){
-        cblas_dgemv(
+        cblas_gemv(
             CblasRowMajor, transpose_A, m, n, 1.0,
             A.raw_data, leading_dim_A, X.raw_data, X.stride1,
             1.0, Y.raw_data, Y.stride1);
     }else{
-        cblas_dgemm(
+        cblas_gemm(
             CblasRowMajor, transpose_A, transpose_X, m, n, k,
             1.0, A.raw_data, leading_dim_A, X.raw_data, leading_dim_X,
             1.0, Y.raw_data, leading_dim_Y);
@@ -339,6 +544,15 @@ void DotInc::operator() (){
     run_dbg(*this);
 }
 
+bool DotInc::set_quiescence(dtype tolerance){
+    if(scalar){
+        return false;
+    }
+
+    quiescence = tolerance;
+    return true;
+}
+
 string DotInc::to_string() const{
 
     stringstream out;
@@ -355,11 +569,415 @@ string DotInc::to_string() const{
     return out.str();
 }
 
+// ********************************************************************************
+SparseDotInc::SparseDotInc(Signal A, Signal X, Signal Y)
+:X(X), Y(Y), quiescence(0.0){
+
+    declare_read(A);
+    declare_read(X);
+    declare_write(Y);
+
+    if(A.shape1 != Y.shape1 || A.shape2 != X.shape1 || X.shape2 != 1 || Y.shape2 != 1){
+        stringstream ss;
+        ss << "While creating SparseDotInc, got mismatching shapes for A, X and Y. "
+           << "Shapes are: A - " << shape_string(A)
+           << ", X - " << shape_string(X)
+           << ", Y - " << shape_string(Y) << "." << endl;
+
+        throw runtime_error(ss.str());
+    }
+
+    row_starts.push_back(0);
+
+    for(unsigned i = 0; i < A.shape1; i++){
+        for(unsigned j = 0; j < A.shape2; j++){
+            dtype a = A(i, j);
+
+            if(a != 0.0){
+                columns.push_back(j * X.stride1);
+                values.push_back(a);
+            }
+        }
+
+        row_starts.push_back(values.size());
+    }
+}
+
+void SparseDotInc::operator() (){
+    if(quiescence > 0 && is_quiet(X, quiescence)){
+        return;
+    }
+
+    const dtype* const __restrict__ x = X.raw_data;
+    dtype* const __restrict__ y = Y.raw_data;
+
+    const unsigned* const cols = columns.data();
+    const dtype* const vals = values.data();
+
+    const unsigned n_rows = Y.shape1;
+    const int y_stride = Y.stride1;
+
+    for(unsigned i = 0; i < n_rows; i++){
+        dtype sum = 0.0;
+
+        for(unsigned k = row_starts[i]; k < row_starts[i+1]; k++){
+            sum += vals[k] * x[cols[k]];
+        }
+
+        y[i * y_stride] += sum;
+    }
+
+    run_dbg(*this);
+}
+
+string SparseDotInc::to_string() const{
+
+    stringstream out;
+    out << Operator::to_string();
+    out << "n_nonzero: " << values.size() << endl;
+
+    out << "X:" << endl;
+    out << signal_to_string(X) << endl;
+    out << "Y:" << endl;
+    out << signal_to_string(Y) << endl;
+
+    return out.str();
+}
+
+// ********************************************************************************
+BatchedDotInc::BatchedDotInc(vector<Signal> A, Signal X, vector<Signal> Y)
+:X(X), Y(Y), n_rows(0), n_cols(X.shape1), quiescence(0.0){
+
+    declare_read(X);
+
+    if(A.size() != Y.size() || X.shape2 != 1){
+        throw runtime_error(
+            "While creating BatchedDotInc, got mismatching numbers of A and Y, "
+            "or X was not a vector.");
+    }
+
+    for(unsigned i = 0; i < A.size(); i++){
+        if(A[i].shape1 != Y[i].shape1 || A[i].shape2 != n_cols || Y[i].shape2 != 1){
+            stringstream ss;
+            ss << "While creating BatchedDotInc, got mismatching shapes for A, X and Y. "
+               << "Shapes are: A - " << shape_string(A[i])
+               << ", X - " << shape_string(X)
+               << ", Y - " << shape_string(Y[i]) << "." << endl;
+
+            throw runtime_error(ss.str());
+        }
+
+        declare_read(A[i]);
+        declare_write(Y[i]);
+
+        n_rows += A[i].shape1;
+    }
+
+    stacked_A = unique_ptr<dtype[]>(new dtype[n_rows * n_cols]);
+    result = unique_ptr<dtype[]>(new dtype[n_rows]);
+
+    dtype* a = stacked_A.get();
+    for(auto& matrix: A){
+        for(unsigned i = 0; i < matrix.shape1; i++){
+            for(unsigned j = 0; j < n_cols; j++){
+                *(a++) = matrix(i, j);
+            }
+        }
+    }
+}
+
+void BatchedDotInc::operator() (){
+    if(quiescence > 0 && is_quiet(X, quiescence)){
+        return;
+    }
+
+    cblas_gemv(
+        CblasRowMajor, CblasNoTrans, n_rows, n_cols, 1.0,
+        stacked_A.get(), n_cols, X.raw_data, X.stride1,
+        0.0, result.get(), 1);
+
+    const dtype* r = result.get();
+    for(auto& y: Y){
+        dtype* const __restrict__ y_data = y.raw_data;
+        const int y_stride = y.stride1;
+
+        for(unsigned i = 0; i < y.shape1; i++){
+            y_data[i * y_stride] += r[i];
+        }
+
+        r += y.shape1;
+    }
+
+    run_dbg(*this);
+}
+
+string BatchedDotInc::to_string() const{
+
+    stringstream out;
+    out << Operator::to_string();
+    out << "n_rows: " << n_rows << endl;
+    out << "n_cols: " << n_cols << endl;
+
+    out << "X:" << endl;
+    out << signal_to_string(X) << endl;
+
+    for(auto& y: Y){
+        out << "Y:" << endl;
+        out << signal_to_string(y) << endl;
+    }
+
+    return out.str();
+}
+
+// ********************************************************************************
+TrialDotInc::TrialDotInc(Signal A, vector<Signal> X, vector<Signal> Y)
+:A(A), X(X.at(0)), Y(Y.at(0)), n_trials(X.size()){
+
+    declare_read(A);
+
+    bool bad_shapes = X.size() != Y.size() || !A.is_contiguous;
+
+    for(unsigned i = 0; i < X.size() && !bad_shapes; i++){
+        bad_shapes |= X[i].shape1 != A.shape2 || X[i].shape2 != 1;
+        bad_shapes |= Y[i].shape1 != A.shape1 || Y[i].shape2 != 1;
+
+        declare_read(X[i]);
+        declare_write(Y[i]);
+    }
+
+    if(bad_shapes){
+        stringstream ss;
+        ss << "While creating TrialDotInc, got mismatching shapes for A, X and Y, "
+           << "or a matrix A that is not contiguous. Shapes are: A - " << shape_string(A)
+           << ", X - " << shape_string(this->X)
+           << ", Y - " << shape_string(this->Y) << "." << endl;
+
+        throw runtime_error(ss.str());
+    }
+
+    if(!fixed_trial_stride(X, X_trial_stride) || !fixed_trial_stride(Y, Y_trial_stride)){
+        throw runtime_error(
+            "While creating TrialDotInc, got trials of X or Y that are not "
+            "stored at a fixed distance from one another.");
+    }
+
+    // Each trial's Y is a row of the result, dot(X, A^T).
+    transpose_A = A.row_major ? CblasTrans : CblasNoTrans;
+    leading_dim_A = A.row_major ? A.stride1 : A.stride2;
+}
+
+bool TrialDotInc::fixed_trial_stride(const vector<Signal>& signals, unsigned& trial_stride){
+    trial_stride = signals.front().size;
+
+    for(unsigned i = 0; i < signals.size(); i++){
+        if(signals[i].shape2 != 1 || (signals[i].shape1 > 1 && signals[i].stride1 != 1)){
+            return false;
+        }
+
+        if(i == 0){
+            continue;
+        }
+
+        ptrdiff_t stride = signals[i].raw_data - signals[i-1].raw_data;
+
+        if(i == 1){
+            if(stride < ptrdiff_t(signals[0].size)){
+                return false;
+            }
+
+            trial_stride = stride;
+        }else if(stride != ptrdiff_t(trial_stride)){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void TrialDotInc::operator() (){
+    cblas_gemm(
+        CblasRowMajor, CblasNoTrans, transpose_A, n_trials, A.shape1, A.shape2,
+        1.0, X.raw_data, X_trial_stride, A.raw_data, leading_dim_A,
+        1.0, Y.raw_data, Y_trial_stride);
+
+    run_dbg(*this);
+}
+
+string TrialDotInc::to_string() const{
+
+    stringstream out;
+    out << Operator::to_string();
+    out << "n_trials: " << n_trials << endl;
+    out << "X_trial_stride: " << X_trial_stride << endl;
+    out << "Y_trial_stride: " << Y_trial_stride << endl;
+
+    out << "A:" << endl;
+    out << signal_to_string(A) << endl;
+    out << "X:" << endl;
+    out << signal_to_string(X) << endl;
+    out << "Y:" << endl;
+    out << signal_to_string(Y) << endl;
+
+    return out.str();
+}
+
+// ********************************************************************************
+template<unsigned N_ROWS, unsigned N_COLS>
+SmallDotInc<N_ROWS, N_COLS>::SmallDotInc(Signal A, Signal X, Signal Y)
+:A(A), X(X), Y(Y), quiescence(0.0){
+
+    static_assert((N_ROWS == 0) != (N_COLS == 0),
+                  "Exactly one dimension of a SmallDotInc is fixed.");
+
+    declare_read(A);
+    declare_read(X);
+    declare_write(Y);
+
+    bool bad_shapes =
+        A.shape1 != Y.shape1 || A.shape2 != X.shape1 || X.shape2 != 1 || Y.shape2 != 1 ||
+        (N_ROWS > 0 && A.shape1 != N_ROWS) || (N_COLS > 0 && A.shape2 != N_COLS);
+
+    if(bad_shapes){
+        stringstream ss;
+        ss << "While creating SmallDotInc<" << N_ROWS << ", " << N_COLS << ">, "
+           << "got mismatching shapes for A, X and Y. "
+           << "Shapes are: A - " << shape_string(A)
+           << ", X - " << shape_string(X)
+           << ", Y - " << shape_string(Y) << "." << endl;
+
+        throw runtime_error(ss.str());
+    }
+
+    if(A.shape2 > 1 && A.stride2 != 1){
+        stringstream ss;
+        ss << "While creating SmallDotInc, got signal A whose rows are not contiguous. "
+           << "A: " << A << endl;
+
+        throw runtime_error(ss.str());
+    }
+}
+
+template<unsigned N_ROWS, unsigned N_COLS>
+void SmallDotInc<N_ROWS, N_COLS>::operator() (){
+    if(quiescence > 0 && is_quiet(X, quiescence)){
+        return;
+    }
+
+    const dtype* const a = A.raw_data;
+    const dtype* const x = X.raw_data;
+    dtype* const y = Y.raw_data;
+
+    const int a_stride = A.stride1;
+    const int x_stride = X.stride1;
+    const int y_stride = Y.stride1;
+
+    if(N_COLS > 0){
+        dtype x_local[N_COLS > 0 ? N_COLS : 1];
+        for(unsigned j = 0; j < N_COLS; j++){
+            x_local[j] = x[j * x_stride];
+        }
+
+        for(unsigned i = 0; i < A.shape1; i++){
+            const dtype* row = a + int(i) * a_stride;
+
+            dtype sum = 0.0;
+            for(unsigned j = 0; j < N_COLS; j++){
+                sum += row[j] * x_local[j];
+            }
+
+            y[i * y_stride] += sum;
+        }
+
+    }else{
+        dtype sums[N_ROWS > 0 ? N_ROWS : 1] = {};
+
+        for(unsigned j = 0; j < A.shape2; j++){
+            const dtype x_j = x[j * x_stride];
+
+            for(unsigned i = 0; i < N_ROWS; i++){
+                sums[i] += a[int(i) * a_stride + int(j)] * x_j;
+            }
+        }
+
+        for(unsigned i = 0; i < N_ROWS; i++){
+            y[i * y_stride] += sums[i];
+        }
+    }
+
+    run_dbg(*this);
+}
+
+template<unsigned N_ROWS, unsigned N_COLS>
+string SmallDotInc<N_ROWS, N_COLS>::to_string() const{
+
+    stringstream out;
+    out << Operator::to_string();
+    out << "N_ROWS: " << N_ROWS << endl;
+    out << "N_COLS: " << N_COLS << endl;
+
+    out << "A:" << endl;
+    out << signal_to_string(A) << endl;
+    out << "X:" << endl;
+    out << signal_to_string(X) << endl;
+    out << "Y:" << endl;
+    out << signal_to_string(Y) << endl;
+
+    return out.str();
+}
+
+// The SmallDotInc for ``dot_inc'' whose fixed dimension is ``dim'', found by
+// counting down from D, so that every dimension up to D is instantiated.
+template<unsigned D>
+static unique_ptr<Operator> new_small_dot_inc(const DotInc& dot_inc, unsigned dim, bool fixed_cols){
+    if(dim != D){
+        return new_small_dot_inc<D - 1>(dot_inc, dim, fixed_cols);
+    }
+
+    const Signal& A = dot_inc.get_A();
+    const Signal& X = dot_inc.get_X();
+    const Signal& Y = dot_inc.get_Y();
+
+    if(fixed_cols){
+        return unique_ptr<Operator>(new SmallDotInc<0, D>(A, X, Y));
+    }
+
+    return unique_ptr<Operator>(new SmallDotInc<D, 0>(A, X, Y));
+}
+
+template<>
+unique_ptr<Operator> new_small_dot_inc<0>(const DotInc& dot_inc, unsigned dim, bool fixed_cols){
+    return unique_ptr<Operator>();
+}
+
+unique_ptr<Operator> make_small_dot_inc(const DotInc& dot_inc){
+    const Signal& A = dot_inc.get_A();
+    const Signal& Y = dot_inc.get_Y();
+
+    if(!dot_inc.is_matrix_vector() || Y.shape2 != 1 || (A.shape2 > 1 && A.stride2 != 1)){
+        return unique_ptr<Operator>();
+    }
+
+    // The smaller dimension is fixed; for encoders that is the number of columns.
+    if(A.shape2 <= MAX_SMALL_DOT_INC_DIM && A.shape2 <= A.shape1){
+        return new_small_dot_inc<MAX_SMALL_DOT_INC_DIM>(dot_inc, A.shape2, true);
+    }
+
+    if(A.shape1 <= MAX_SMALL_DOT_INC_DIM){
+        return new_small_dot_inc<MAX_SMALL_DOT_INC_DIM>(dot_inc, A.shape1, false);
+    }
+
+    return unique_ptr<Operator>();
+}
+
 // ********************************************************************************
 ElementwiseInc::ElementwiseInc(Signal A, Signal X, Signal Y)
 :A(A), X(X), Y(Y),
 A_row_stride(A.shape1 > 1 ? 1 : 0), A_col_stride(A.shape2 > 1 ? 1 : 0),
-X_row_stride(X.shape1 > 1 ? 1 : 0), X_col_stride(X.shape2 > 1 ? 1 : 0){
+X_row_stride(X.shape1 > 1 ? 1 : 0), X_col_stride(X.shape2 > 1 ? 1 : 0), quiescence(0.0){
+
+    declare_read(A);
+    declare_read(X);
+    declare_write(Y);
 
     if(A.shape1 != Y.shape1 && A.shape1 != 1){
         throw runtime_error(
@@ -383,21 +1001,38 @@ X_row_stride(X.shape1 > 1 ? 1 : 0), X_col_stride(X.shape2 > 1 ? 1 : 0){
 }
 
 void ElementwiseInc::operator() (){
-    unsigned A_i = 0, A_j = 0, X_i = 0, X_j = 0;
+    if(quiescence > 0 && is_quiet(X, quiescence)){
+        return;
+    }
+
+    // The shapes were checked when the operator was created, so the elements
+    // are reached through raw pointers, with a stride of 0 along broadcast axes.
+    const int A_step1 = A_row_stride * A.stride1, A_step2 = A_col_stride * A.stride2;
+    const int X_step1 = X_row_stride * X.stride1, X_step2 = X_col_stride * X.stride2;
+
+    const dtype* a_row = A.raw_data;
+    const dtype* x_row = X.raw_data;
 
     for(unsigned Y_i = 0; Y_i < Y.shape1; Y_i++){
-        A_j = 0;
-        X_j = 0;
+        dtype* const y = Y.raw_data + int(Y_i) * Y.stride1;
+        const dtype* a = a_row;
+        const dtype* x = x_row;
 
-        for(unsigned Y_j = 0; Y_j < Y.shape2; Y_j++){
-            Y(Y_i, Y_j) += A(A_i, A_j) * X(X_i, X_j);
+        if(Y.stride2 == 1 && A_step2 == 1 && X_step2 == 1){
+            for(unsigned Y_j = 0; Y_j < Y.shape2; Y_j++){
+                y[Y_j] += a[Y_j] * x[Y_j];
+            }
+        }else{
+            for(unsigned Y_j = 0; Y_j < Y.shape2; Y_j++){
+                y[int(Y_j) * Y.stride2] += *a * *x;
 
-            A_j += A_col_stride;
-            X_j += X_col_stride;
+                a += A_step2;
+                x += X_step2;
+            }
         }
 
-        A_i += A_row_stride;
-        X_i += X_row_stride;
+        a_row += A_step1;
+        x_row += X_step1;
     }
 
     run_dbg(*this);
@@ -428,6 +1063,9 @@ NoDenSynapse::NoDenSynapse(
     Signal input, Signal output, dtype b)
 :input(input), output(output), b(b){
 
+    declare_read(input);
+    declare_write(output);
+
     if(input.shape1 != output.shape1 || input.shape2 != output.shape2){
         throw runtime_error(
             "While creating NoDenSynapse, input and output had incompatible shapes.");
@@ -454,37 +1092,242 @@ string NoDenSynapse::to_string() const{
     out << signal_to_string(output) << endl;
     out << "b: " << b << endl;
 
-    return out.str();
+    return out.str();
+}
+
+// ********************************************************************************
+// Copy the elements of signals, one after the other and each in row-major order, to buffer.
+static void gather_signals(const vector<Signal>& signals, dtype* buffer){
+    for(const Signal& signal: signals){
+        if(is_dense(signal)){
+            memcpy(buffer, signal.raw_data, signal.size * sizeof(dtype));
+            buffer += signal.size;
+            continue;
+        }
+
+        for(unsigned i = 0; i < signal.shape1; i++){
+            for(unsigned j = 0; j < signal.shape2; j++){
+                *(buffer++) = signal(i, j);
+            }
+        }
+    }
+}
+
+// The inverse of gather_signals.
+static void scatter_signals(const dtype* buffer, const vector<Signal>& signals){
+    for(const Signal& signal: signals){
+        if(is_dense(signal)){
+            memcpy(signal.raw_data, buffer, signal.size * sizeof(dtype));
+            buffer += signal.size;
+            continue;
+        }
+
+        for(unsigned i = 0; i < signal.shape1; i++){
+            for(unsigned j = 0; j < signal.shape2; j++){
+                signal.raw_data[int(i) * signal.stride1 + int(j) * signal.stride2] = *(buffer++);
+            }
+        }
+    }
+}
+
+static bool same_values(const Signal& a, const Signal& b){
+    if(a.raw_data == b.raw_data && a.shape1 == b.shape1 && a.shape2 == b.shape2 &&
+            a.stride1 == b.stride1 && a.stride2 == b.stride2){
+        return true;
+    }
+
+    if(a.shape1 != b.shape1 || a.shape2 != b.shape2){
+        return false;
+    }
+
+    for(unsigned i = 0; i < a.shape1; i++){
+        for(unsigned j = 0; j < a.shape2; j++){
+            if(a(i, j) != b(i, j)){
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Rows of an n_rows x n array, stored in a ring starting at row head, in order.
+static vector<dtype> unroll_ring(
+        const vector<dtype>& ring, unsigned head, unsigned n_rows, unsigned n){
+
+    vector<dtype> rows(n_rows * n);
+    for(unsigned k = 0; k < n_rows; k++){
+        auto row = ring.begin() + ((head + k) % n_rows) * n;
+        copy(row, row + n, rows.begin() + k * n);
+    }
+
+    return rows;
+}
+
+// Rows of a (n_a + n_b)-column array from the rows of an n_a- and an n_b-column array.
+static vector<dtype> join_rows(
+        const vector<dtype>& a, unsigned n_a, const vector<dtype>& b, unsigned n_b,
+        unsigned n_rows){
+
+    vector<dtype> rows;
+    rows.reserve(n_rows * (n_a + n_b));
+
+    for(unsigned k = 0; k < n_rows; k++){
+        rows.insert(rows.end(), a.begin() + k * n_a, a.begin() + (k + 1) * n_a);
+        rows.insert(rows.end(), b.begin() + k * n_b, b.begin() + (k + 1) * n_b);
+    }
+
+    return rows;
+}
+
+// Push a row into an n_rows x n ring, returning it.
+static dtype* push_row(vector<dtype>& ring, unsigned& head, unsigned n_rows, unsigned n){
+    head = (head + n_rows - 1) % n_rows;
+    return ring.data() + head * n;
+}
+
+static void read_ring_state(
+        istream& in, vector<dtype>& ring, unsigned& head, const string& name){
+
+    vector<dtype> rows;
+    read_state(in, rows);
+
+    if(rows.size() != ring.size()){
+        throw runtime_error(
+            "Checkpointed history does not match the size of its " + name + ".");
+    }
+
+    ring = rows;
+    head = 0;
+}
+
+// The columns [begin, begin + n_columns) of an n-column ring, row by row from its head.
+static vector<dtype> ring_columns(
+        const vector<dtype>& ring, unsigned head, unsigned n_rows, unsigned n,
+        unsigned begin, unsigned n_columns){
+
+    vector<dtype> columns(n_rows * n_columns);
+    for(unsigned k = 0; k < n_rows; k++){
+        auto row = ring.begin() + ((head + k) % n_rows) * n + begin;
+        copy(row, row + n_columns, columns.begin() + k * n_columns);
+    }
+
+    return columns;
+}
+
+// Inverse of ring_columns, reading the columns from saved state.
+static void read_ring_columns(
+        istream& in, vector<dtype>& ring, unsigned head, unsigned n_rows, unsigned n,
+        unsigned begin, unsigned n_columns, const string& name){
+
+    vector<dtype> columns;
+    read_state(in, columns);
+
+    if(columns.size() != n_rows * n_columns){
+        throw runtime_error(
+            "Saved history does not match the size of an output of its " + name + ".");
+    }
+
+    for(unsigned k = 0; k < n_rows; k++){
+        auto row = ring.begin() + ((head + k) % n_rows) * n + begin;
+        copy(columns.begin() + k * n_columns, columns.begin() + (k + 1) * n_columns, row);
+    }
+}
+
+// Index of the first element of outputs[output] among the elements of all outputs.
+static unsigned first_element(const vector<Signal>& outputs, unsigned output){
+    unsigned begin = 0;
+    for(unsigned p = 0; p < output; p++){
+        begin += outputs[p].size;
+    }
+
+    return begin;
+}
+
+// ********************************************************************************
+SimpleSynapse::SimpleSynapse(Signal input, Signal output, dtype a, dtype b)
+:inputs({input}), outputs({output}), n_elements(output.size), a(a), b(b),
+quiescence(0.0), quiet(false){
+    declare_read(input);
+    declare_write(output);
+
+    if(input.shape1 != output.shape1 || input.shape2 != output.shape2){
+        throw runtime_error(
+            "While creating SimpleSynapse, input and output had incompatible dimensions.");
+    }
+}
+
+void SimpleSynapse::operator() (){
+    if(quiescence > 0){
+        if(is_quiet(inputs, quiescence)){
+            if(quiet){
+                return;
+            }
+
+            // The outputs decay towards zero, so once they are all within
+            // the tolerance they are set to zero and left there.
+            if(is_quiet(outputs, quiescence)){
+                set_zero(outputs);
+                quiet = true;
+                return;
+            }
+        }
+
+        quiet = false;
+    }
+
+    for(unsigned p = 0; p < outputs.size(); p++){
+        const Signal& input = inputs[p];
+        Signal& output = outputs[p];
+
+        if(is_dense(input) && is_dense(output)){
+            const dtype* in = input.raw_data;
+            dtype* out = output.raw_data;
+
+            for(unsigned i = 0; i < output.size; i++){
+                out[i] *= -a;
+                out[i] += b * in[i];
+            }
+
+            continue;
+        }
+
+        for(unsigned i = 0; i < output.shape1; i++){
+            for(unsigned j = 0; j < output.shape2; j++){
+                output(i, j) *= -a;
+                output(i, j) += b * input(i, j);
+            }
+        }
+    }
+
+    run_dbg(*this);
 }
 
-// ********************************************************************************
-SimpleSynapse::SimpleSynapse(Signal input, Signal output, dtype a, dtype b)
-:input(input), output(output), a(a), b(b){
-    if(input.shape1 != output.shape1 || input.shape2 != output.shape2){
-        throw runtime_error(
-            "While creating SimpleSynapse, input and output had incompatible dimensions.");
-    }
+bool SimpleSynapse::can_merge(const SimpleSynapse& other) const{
+    return a == other.a && b == other.b;
 }
 
-void SimpleSynapse::operator() (){
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            output(i, j) *= -a;
-            output(i, j) += b * input(i, j);
-        }
+void SimpleSynapse::merge(const SimpleSynapse& other){
+    for(unsigned p = 0; p < other.outputs.size(); p++){
+        inputs.push_back(other.inputs[p]);
+        outputs.push_back(other.outputs[p]);
+        declare_read(other.inputs[p]);
+        declare_write(other.outputs[p]);
     }
 
-    run_dbg(*this);
+    n_elements += other.n_elements;
 }
 
 string SimpleSynapse::to_string() const{
 
     stringstream out;
     out << Operator::to_string();
-    out << "input:" << endl;
-    out << signal_to_string(input) << endl;
-    out << "output:" << endl;
-    out << signal_to_string(output) << endl;
+    for(unsigned p = 0; p < outputs.size(); p++){
+        out << "input:" << endl;
+        out << signal_to_string(inputs[p]) << endl;
+        out << "output:" << endl;
+        out << signal_to_string(outputs[p]) << endl;
+    }
     out << "a: " << a << endl;
     out << "b: " << b << endl;
 
@@ -494,188 +1337,298 @@ string SimpleSynapse::to_string() const{
 // ********************************************************************************
 Synapse::Synapse(
     Signal input, Signal output, Signal numer, Signal denom)
-:input(input), output(output), numer(numer), denom(denom){
+:inputs({input}), outputs({output}), n_elements(output.size), numer(numer), denom(denom),
+x(numer.shape1 * output.size, 0.0), y(denom.shape1 * output.size, 0.0),
+x_head(0), y_head(0), result(output.size), quiescence(0.0), quiet(false), quiet_steps(0){
+    declare_read(input);
+    declare_read(numer);
+    declare_read(denom);
+    declare_write(output);
+
     if(input.shape1 != output.shape1 || input.shape2 != output.shape2){
         throw runtime_error(
             "While creating Synapse, input and output had incompatible dimensions.");
     }
+}
 
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            x.push_back(boost::circular_buffer<dtype>(numer.shape1));
-            y.push_back(boost::circular_buffer<dtype>(denom.shape1));
+void Synapse::operator() (){
+    const unsigned n = n_elements;
+    const unsigned order_x = numer.shape1;
+    const unsigned order_y = denom.shape1;
+
+    bool quiet_input = false;
+    if(quiescence > 0){
+        quiet_input = is_quiet(inputs, quiescence);
+
+        if(quiet && quiet_input){
+            return;
         }
+
+        quiet = false;
     }
-}
 
-void Synapse::operator() (){
-    unsigned idx = 0;
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            x[idx].push_front(input(i, j));
+    if(order_x > 0){
+        gather_signals(inputs, push_row(x, x_head, order_x, n));
+    }
 
-            output(i, j) = 0.0;
+    dtype* out = result.data();
+    fill(out, out + n, dtype(0.0));
 
-            for(unsigned k = 0; k < x[idx].size(); k++){
-                output(i, j) += numer(k) * x[idx][k];
-            }
+    for(unsigned k = 0; k < order_x; k++){
+        const dtype coefficient = numer(k);
+        const dtype* row = x.data() + ((x_head + k) % order_x) * n;
 
-            for(unsigned k = 0; k < y[idx].size(); k++){
-                output(i, j) -= denom(k) * y[idx][k];
-            }
+        for(unsigned i = 0; i < n; i++){
+            out[i] += coefficient * row[i];
+        }
+    }
+
+    for(unsigned k = 0; k < order_y; k++){
+        const dtype coefficient = denom(k);
+        const dtype* row = y.data() + ((y_head + k) % order_y) * n;
+
+        for(unsigned i = 0; i < n; i++){
+            out[i] -= coefficient * row[i];
+        }
+    }
 
-            y[idx].push_front(output(i, j));
+    if(order_y > 0){
+        memcpy(push_row(y, y_head, order_y, n), out, n * sizeof(dtype));
+    }
 
-            idx++;
+    // Once the inputs and outputs have all been within the tolerance for as
+    // long as the filter remembers, its state is all within the tolerance too,
+    // and is set to zero along with the outputs.
+    if(quiescence > 0){
+        quiet_steps = quiet_input && is_quiet(out, n, quiescence) ? quiet_steps + 1 : 0;
+
+        if(quiet_steps >= max(max(order_x, order_y), 1u)){
+            fill(x.begin(), x.end(), dtype(0.0));
+            fill(y.begin(), y.end(), dtype(0.0));
+            fill(out, out + n, dtype(0.0));
+            quiet = true;
+            quiet_steps = 0;
         }
     }
 
+    scatter_signals(out, outputs);
+
     run_dbg(*this);
 }
 
+bool Synapse::can_merge(const Synapse& other) const{
+    return same_values(numer, other.numer) && same_values(denom, other.denom);
+}
+
+void Synapse::merge(const Synapse& other){
+    const unsigned order_x = numer.shape1;
+    const unsigned order_y = denom.shape1;
+
+    x = join_rows(
+        unroll_ring(x, x_head, order_x, n_elements), n_elements,
+        unroll_ring(other.x, other.x_head, order_x, other.n_elements), other.n_elements,
+        order_x);
+
+    y = join_rows(
+        unroll_ring(y, y_head, order_y, n_elements), n_elements,
+        unroll_ring(other.y, other.y_head, order_y, other.n_elements), other.n_elements,
+        order_y);
+
+    x_head = 0;
+    y_head = 0;
+
+    for(unsigned p = 0; p < other.outputs.size(); p++){
+        inputs.push_back(other.inputs[p]);
+        outputs.push_back(other.outputs[p]);
+        declare_read(other.inputs[p]);
+        declare_write(other.outputs[p]);
+    }
+
+    n_elements += other.n_elements;
+    result.resize(n_elements);
+}
+
 string Synapse::to_string() const{
 
     stringstream out;
     out << Operator::to_string();
-    out << "input:" << endl;
-    out << signal_to_string(input) << endl;
-    out << "output:" << endl;
-    out << signal_to_string(output) << endl;
+    for(unsigned p = 0; p < outputs.size(); p++){
+        out << "input:" << endl;
+        out << signal_to_string(inputs[p]) << endl;
+        out << "output:" << endl;
+        out << signal_to_string(outputs[p]) << endl;
+    }
     out << "numer:" << endl;
     out << numer << endl;
     out << "denom:" << endl;
     out << denom << endl;
 
-    /*
-    out << "x & y:" << endl;
-    for(unsigned i = 0; i < input.size(); i++){
-        out << "i: " << i << endl;
+    return out.str();
+}
 
-        out << "x.size " << x[i].size() << endl;
-        for(unsigned j = 0; j < x[i].size(); j++){
-            out << "x[ "<< j << "] = "<< x[i][j] << ", ";
-        }
-        out << endl;
+void Synapse::reset(unsigned seed){
+    fill(x.begin(), x.end(), dtype(0.0));
+    fill(y.begin(), y.end(), dtype(0.0));
+    x_head = 0;
+    y_head = 0;
+    quiet = false;
+    quiet_steps = 0;
+}
 
-        out << "y.size " << y[i].size() << endl;
-        for(unsigned j = 0; j < y[i].size(); j++){
-            out << "y[ "<< j << "] = "<< y[i][j] << ", ";
-        }
-        out << endl;
-    }
-    */
+void Synapse::save_state(ostream& out){
+    write_state(out, unroll_ring(x, x_head, numer.shape1, n_elements));
+    write_state(out, unroll_ring(y, y_head, denom.shape1, n_elements));
+}
 
-    return out.str();
+void Synapse::load_state(istream& in){
+    read_ring_state(in, x, x_head, "Synapse");
+    read_ring_state(in, y, y_head, "Synapse");
 }
 
-void Synapse::reset(unsigned seed){
-    unsigned idx = 0;
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            for(unsigned k = 0; k < x[idx].size(); k++){
-                x[idx][k] = 0.0;
-            }
+void Synapse::save_output_state(unsigned output, ostream& out){
+    unsigned begin = first_element(outputs, output), n = outputs[output].size;
+    write_state(out, ring_columns(x, x_head, numer.shape1, n_elements, begin, n));
+    write_state(out, ring_columns(y, y_head, denom.shape1, n_elements, begin, n));
+}
 
-            for(unsigned k = 0; k < y[idx].size(); k++){
-                y[idx][k] = 0.0;
-            }
-            idx++;
-        }
-    }
+void Synapse::load_output_state(unsigned output, istream& in){
+    unsigned begin = first_element(outputs, output), n = outputs[output].size;
+    read_ring_columns(in, x, x_head, numer.shape1, n_elements, begin, n, "Synapse");
+    read_ring_columns(in, y, y_head, denom.shape1, n_elements, begin, n, "Synapse");
 }
 
 // ********************************************************************************
 TriangleSynapse::TriangleSynapse(
     Signal input, Signal output, dtype n0, dtype ndiff, unsigned n_taps)
-:input(input), output(output), n0(n0), ndiff(ndiff), n_taps(n_taps){
+:inputs({input}), outputs({output}), n_elements(output.size),
+n0(n0), ndiff(ndiff), n_taps(n_taps), x(n_taps * output.size, 0.0), x_head(0),
+input_values(output.size), result(output.size){
+
+    declare_read(input);
+    declare_write(output);
 
     if(input.shape1 != output.shape1 || input.shape2 != output.shape2){
         throw runtime_error(
             "While creating TriangleSynapse, input and output had incompatible dimensions.");
     }
-
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            x.push_back(boost::circular_buffer<dtype>(n_taps));
-        }
-    }
 }
 
 void TriangleSynapse::operator() (){
-    unsigned idx = 0;
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            output(i, j) += n0 * input(i, j);
+    const unsigned n = n_elements;
+    const dtype* in = input_values.data();
+    dtype* out = result.data();
 
-            for(unsigned k = 0; k < x[idx].size(); k++){
-                output(i, j) -= x[idx][k];
-            }
+    gather_signals(inputs, input_values.data());
+    gather_signals(outputs, out);
+
+    for(unsigned i = 0; i < n; i++){
+        out[i] += n0 * in[i];
+    }
+
+    for(unsigned k = 0; k < n_taps; k++){
+        const dtype* row = x.data() + ((x_head + k) % n_taps) * n;
+
+        for(unsigned i = 0; i < n; i++){
+            out[i] -= row[i];
+        }
+    }
+
+    if(n_taps > 0){
+        dtype* row = push_row(x, x_head, n_taps, n);
 
-            x[idx].push_front(ndiff * input(i, j));
-            idx++;
+        for(unsigned i = 0; i < n; i++){
+            row[i] = ndiff * in[i];
         }
     }
 
+    scatter_signals(out, outputs);
+
     run_dbg(*this);
 }
 
+bool TriangleSynapse::can_merge(const TriangleSynapse& other) const{
+    return n0 == other.n0 && ndiff == other.ndiff && n_taps == other.n_taps;
+}
+
+void TriangleSynapse::merge(const TriangleSynapse& other){
+    x = join_rows(
+        unroll_ring(x, x_head, n_taps, n_elements), n_elements,
+        unroll_ring(other.x, other.x_head, n_taps, other.n_elements), other.n_elements,
+        n_taps);
+
+    x_head = 0;
+
+    for(unsigned p = 0; p < other.outputs.size(); p++){
+        inputs.push_back(other.inputs[p]);
+        outputs.push_back(other.outputs[p]);
+        declare_read(other.inputs[p]);
+        declare_write(other.outputs[p]);
+    }
+
+    n_elements += other.n_elements;
+    input_values.resize(n_elements);
+    result.resize(n_elements);
+}
+
 string TriangleSynapse::to_string() const{
 
     stringstream out;
     out << Operator::to_string();
-    out << "input:" << endl;
-    out << signal_to_string(input) << endl;
-    out << "output:" << endl;
-    out << signal_to_string(output) << endl;
+    for(unsigned p = 0; p < outputs.size(); p++){
+        out << "input:" << endl;
+        out << signal_to_string(inputs[p]) << endl;
+        out << "output:" << endl;
+        out << signal_to_string(outputs[p]) << endl;
+    }
     out << "n0:" << n0 << endl;
     out << "ndiff:" << ndiff << endl;
     out << "n_taps: " << n_taps << endl;
 
-    /*
-    out << "x :" << endl;
-    for(unsigned i = 0; i < input.size(); i++){
-        out << "i: " << i << endl;
-
-        out << "x.size " << x[i].size() << endl;
-        for(unsigned j = 0; j < x[i].size(); j++){
-            out << "x[ "<< j << "] = "<< x[i][j] << ", ";
-        }
-        out << endl;
-    }
-    */
-
     return out.str();
 }
 
 void TriangleSynapse::reset(unsigned seed){
-    unsigned idx = 0;
-    for(unsigned i = 0; i < output.shape1; i++){
-        for(unsigned j = 0; j < output.shape2; j++){
-            for(unsigned k = 0; k < x[idx].size(); k++){
-                x[idx][k] = 0.0;
-            }
+    fill(x.begin(), x.end(), dtype(0.0));
+    x_head = 0;
+}
 
-            idx++;
-        }
-    }
+void TriangleSynapse::save_state(ostream& out){
+    write_state(out, unroll_ring(x, x_head, n_taps, n_elements));
+}
+
+void TriangleSynapse::load_state(istream& in){
+    read_ring_state(in, x, x_head, "TriangleSynapse");
+}
+
+void TriangleSynapse::save_output_state(unsigned output, ostream& out){
+    unsigned begin = first_element(outputs, output), n = outputs[output].size;
+    write_state(out, ring_columns(x, x_head, n_taps, n_elements, begin, n));
+}
+
+void TriangleSynapse::load_output_state(unsigned output, istream& in){
+    unsigned begin = first_element(outputs, output), n = outputs[output].size;
+    read_ring_columns(in, x, x_head, n_taps, n_elements, begin, n, "TriangleSynapse");
 }
 
 // ********************************************************************************
 WhiteNoise::WhiteNoise(
     Signal output, dtype mean, dtype std, bool do_scale, bool inc, dtype dt)
-:output(output), mean(mean), std(std), dist(mean, std),
+:output(output), mean(mean), std(std), n_draws(0), samples(output.shape1),
 alpha(do_scale ? 1.0 / dt : 1.0), do_scale(do_scale), inc(inc), dt(dt){
 
+    declare_write(output);
 }
 
 void WhiteNoise::operator() (){
+    stream.normals(n_draws++, mean, std, samples.data(), samples.size());
+
     if(inc){
         for(unsigned i = 0; i < output.shape1; i++){
-            output(i) += alpha * dist(rng);
+            output(i) += alpha * samples[i];
         }
     }else{
         for(unsigned i = 0; i < output.shape1; i++){
-            output(i) = alpha * dist(rng);
+            output(i) = alpha * samples[i];
         }
     }
 
@@ -698,13 +1651,25 @@ string WhiteNoise::to_string() const{
 }
 
 void WhiteNoise::reset(unsigned seed){
-    rng.seed(seed);
+    stream = RandomStream(seed, get_stream_id());
+    n_draws = 0;
+}
+
+void WhiteNoise::save_state(ostream& out){
+    write_state(out, n_draws);
+}
+
+void WhiteNoise::load_state(istream& in){
+    read_state(in, n_draws);
 }
 
 // ********************************************************************************
 WhiteSignal::WhiteSignal(Signal coefs, Signal output, Signal time, dtype dt)
 :coefs(coefs), output(output), time(time), dt(dt){
 
+    declare_read(coefs);
+    declare_read(time);
+    declare_write(output);
 }
 
 void WhiteSignal::operator() (){
@@ -735,6 +1700,9 @@ string WhiteSignal::to_string() const{
 PresentInput::PresentInput(Signal input, Signal output, Signal time, dtype presentation_time, dtype dt)
 :input(input), output(output), time(time), presentation_time(presentation_time), dt(dt){
 
+    declare_read(input);
+    declare_read(time);
+    declare_write(output);
 }
 
 void PresentInput::operator() (){
@@ -764,64 +1732,124 @@ string PresentInput::to_string() const{
 
 
 // ********************************************************************************
-LIF::LIF(
-    unsigned n_neurons, dtype tau_rc, dtype tau_ref, dtype min_voltage,
-    dtype dt, Signal J, Signal output, Signal voltage,
-    Signal ref_time)
-:n_neurons(n_neurons), dt(dt), dt_inv(1.0 / dt), tau_rc(tau_rc), tau_ref(tau_ref),
-min_voltage(min_voltage), J(J), output(output), voltage(voltage), ref_time(ref_time),
-one(n_neurons, (dtype) 1.0), mult(n_neurons), dV(n_neurons){
+// Fused neuron kernels. Each neuron's state is loaded once, updated, and stored
+// once, rather than making a separate pass over memory for each step of the
+// update. The loops are branch-free (all branches are selects) so that the
+// compiler can vectorize them when the signals are contiguous, which is the
+// common case; the CONTIGUOUS template parameter lets it drop the strides.
+template<bool CONTIGUOUS, bool ADAPTIVE>
+static inline void lif_kernel(
+        unsigned n_neurons, dtype dt, dtype dt_inv, dtype scale,
+        dtype tau_ref, dtype min_voltage, dtype dt_over_tau_n, dtype inc_n,
+        const dtype* __restrict__ J, int J_stride,
+        dtype* __restrict__ output, int output_stride,
+        dtype* __restrict__ voltage, int voltage_stride,
+        dtype* __restrict__ ref_time, int ref_time_stride,
+        dtype* __restrict__ adaptation, int adaptation_stride){
 
-}
+    for(unsigned i = 0; i < n_neurons; ++i){
+        const unsigned i_J = CONTIGUOUS ? i : i * J_stride;
+        const unsigned i_out = CONTIGUOUS ? i : i * output_stride;
+        const unsigned i_v = CONTIGUOUS ? i : i * voltage_stride;
+        const unsigned i_ref = CONTIGUOUS ? i : i * ref_time_stride;
+        const unsigned i_a = CONTIGUOUS ? i : i * adaptation_stride;
+
+        dtype j = J[i_J];
+        if(ADAPTIVE){
+            j -= adaptation[i_a];
+        }
 
-void LIF::operator() (){
-    // dV = -expm1(-dt / tau_rc) * (J - voltage)
-    cblas_dcopy(n_neurons, J.raw_data, J.stride1, dV.raw_data, dV.stride1);
-    cblas_daxpy(n_neurons, -1.0, voltage.raw_data, voltage.stride1, dV.raw_data, dV.stride1);
-    dtype scale = -expm1(-dt / tau_rc);
-    cblas_dscal(n_neurons, scale, dV.raw_data, dV.stride1);
+        // dV = -expm1(-dt / tau_rc) * (J - voltage)
+        dtype v = voltage[i_v];
+        const dtype dV = scale * (j - v);
 
-    // voltage += dV
-    cblas_daxpy(n_neurons, 1.0, dV.raw_data, dV.stride1, voltage.raw_data, voltage.stride1);
+        // voltage = max(voltage + dV, min_voltage)
+        v += dV;
+        v = v < min_voltage ? min_voltage : v;
 
-    // voltage = max(voltage, 0)
-    dtype v;
-    for(unsigned i = 0; i < n_neurons; ++i){
-        v = voltage(i);
-        voltage(i) = v < min_voltage ? min_voltage : v;
-    }
+        // mult = (1 - (ref_time - dt) / dt).clip(0, 1)
+        dtype ref = ref_time[i_ref] - dt;
+        dtype mult = -dt_inv * ref + 1.0;
+        mult = mult > 1.0 ? 1.0 : (mult < 0.0 ? 0.0 : mult);
 
-    // ref_time -= dt_vec
-    cblas_daxpy(n_neurons, -dt, one.raw_data, one.stride1,
-                ref_time.raw_data, ref_time.stride1);
+        v *= mult;
 
-    // mult = -dt_inv * ref_time + 1
-    cblas_dcopy(n_neurons, ref_time.raw_data, ref_time.stride1, mult.raw_data, mult.stride1);
-    cblas_dscal(n_neurons, -dt_inv, mult.raw_data, mult.stride1);
-    cblas_daxpy(n_neurons, 1.0, one.raw_data, one.stride1, mult.raw_data, mult.stride1);
+        const bool spiked = v > 1.0;
+        const dtype overshoot = (v - 1.0) / dV;
+        const dtype out = spiked ? dt_inv : 0.0;
 
-    // mult = mult.clip(0, 1)
-    dtype m;
-    for(unsigned i = 0; i < n_neurons; ++i){
-        m = mult(i);
-        mult(i) = m > 1.0 ? 1.0 : (m < 0.0 ? 0.0 : m);
+        output[i_out] = out;
+        ref_time[i_ref] = spiked ? tau_ref + dt * (1.0 - overshoot) : ref;
+        voltage[i_v] = spiked ? 0.0 : v;
+
+        if(ADAPTIVE){
+            // adaptation += (dt / tau_n) * (inc_n * output - adaptation);
+            const dtype a = adaptation[i_a];
+            adaptation[i_a] = a + dt_over_tau_n * (inc_n * out - a);
+        }
     }
+}
+
+template<bool CONTIGUOUS, bool ADAPTIVE>
+static inline void lif_rate_kernel(
+        unsigned n_neurons, dtype tau_rc, dtype tau_ref,
+        dtype dt_over_tau_n, dtype inc_n,
+        const dtype* __restrict__ J, int J_stride,
+        dtype* __restrict__ output, int output_stride,
+        dtype* __restrict__ adaptation, int adaptation_stride){
 
-    dtype overshoot;
     for(unsigned i = 0; i < n_neurons; ++i){
-        voltage(i) *= mult(i);
-        v = voltage(i);
-        if(v > 1.0){
-            output(i) = dt_inv;
-            overshoot = (v - 1.0) / dV(i);
-            ref_time(i) = tau_ref + dt * (1.0 - overshoot);
-            voltage(i) = 0.0;
+        const unsigned i_J = CONTIGUOUS ? i : i * J_stride;
+        const unsigned i_out = CONTIGUOUS ? i : i * output_stride;
+        const unsigned i_a = CONTIGUOUS ? i : i * adaptation_stride;
+
+        dtype j = J[i_J];
+        if(ADAPTIVE){
+            j -= adaptation[i_a];
         }
-        else
-        {
-            output(i) = 0.0;
+
+        const dtype out = j > 1.0 ? 1.0 / (tau_ref + tau_rc * log1p(1.0 / (j - 1.0))) : 0.0;
+        output[i_out] = out;
+
+        if(ADAPTIVE){
+            const dtype a = adaptation[i_a];
+            adaptation[i_a] = a + dt_over_tau_n * (inc_n * out - a);
         }
     }
+}
+
+// ********************************************************************************
+LIF::LIF(
+    unsigned n_neurons, dtype tau_rc, dtype tau_ref, dtype min_voltage,
+    dtype dt, Signal J, Signal output, Signal voltage,
+    Signal ref_time)
+:n_neurons(n_neurons), dt(dt), dt_inv(1.0 / dt), tau_rc(tau_rc), tau_ref(tau_ref),
+min_voltage(min_voltage), scale(-expm1(-dt / tau_rc)), J(J), output(output),
+voltage(voltage), ref_time(ref_time){
+
+    declare_read(J);
+    declare_write(output);
+    declare_write(voltage);
+    declare_write(ref_time);
+
+    contiguous = (
+        J.stride1 == 1 && output.stride1 == 1 &&
+        voltage.stride1 == 1 && ref_time.stride1 == 1);
+}
+
+void LIF::operator() (){
+    if(contiguous){
+        lif_kernel<true, false>(
+            n_neurons, dt, dt_inv, scale, tau_ref, min_voltage, 0.0, 0.0,
+            J.raw_data, 1, output.raw_data, 1, voltage.raw_data, 1,
+            ref_time.raw_data, 1, NULL, 1);
+    }else{
+        lif_kernel<false, false>(
+            n_neurons, dt, dt_inv, scale, tau_ref, min_voltage, 0.0, 0.0,
+            J.raw_data, J.stride1, output.raw_data, output.stride1,
+            voltage.raw_data, voltage.stride1, ref_time.raw_data, ref_time.stride1,
+            NULL, 1);
+    }
 
     run_dbg(*this);
 
@@ -853,16 +1881,21 @@ LIFRate::LIFRate(
     unsigned n_neurons, dtype tau_rc, dtype tau_ref, Signal J, Signal output)
 :n_neurons(n_neurons), tau_rc(tau_rc), tau_ref(tau_ref), J(J), output(output){
 
+    declare_read(J);
+    declare_write(output);
+
+    contiguous = J.stride1 == 1 && output.stride1 == 1;
 }
 
 void LIFRate::operator() (){
-    for(unsigned i = 0; i < n_neurons; ++i){
-        dtype j = J(i);
-        if(j > 1.0){
-             output(i) = 1.0 / (tau_ref + tau_rc * log1p(1.0 / (j - 1.0)));
-        }else{
-            output(i) = 0.0;
-        }
+    if(contiguous){
+        lif_rate_kernel<true, false>(
+            n_neurons, tau_rc, tau_ref, 0.0, 0.0,
+            J.raw_data, 1, output.raw_data, 1, NULL, 1);
+    }else{
+        lif_rate_kernel<false, false>(
+            n_neurons, tau_rc, tau_ref, 0.0, 0.0,
+            J.raw_data, J.stride1, output.raw_data, output.stride1, NULL, 1);
     }
 
     run_dbg(*this);
@@ -889,30 +1922,26 @@ AdaptiveLIF::AdaptiveLIF(
     dtype min_voltage, dtype dt, Signal J, Signal output, Signal voltage,
     Signal ref_time, Signal adaptation)
 :LIF(n_neurons, tau_rc, tau_ref, min_voltage, dt, J, output, voltage, ref_time),
-tau_n(tau_n), inc_n(inc_n), adaptation(adaptation), temp_J(n_neurons), dAdapt(n_neurons){
+tau_n(tau_n), inc_n(inc_n), adaptation(adaptation){
 
+    declare_write(adaptation);
+
+    contiguous &= adaptation.stride1 == 1;
 }
 
 void AdaptiveLIF::operator() (){
-    // temp_J = J
-    cblas_dcopy(n_neurons, J.raw_data, J.stride1, temp_J.raw_data, temp_J.stride1);
-
-    // J -= adaptation
-    cblas_daxpy(n_neurons, -1.0, adaptation.raw_data, adaptation.stride1,
-                J.raw_data, J.stride1);
-
-    LIF::operator()();
-
-    // J = temp_J
-    cblas_dcopy(n_neurons, temp_J.raw_data, temp_J.stride1, J.raw_data, J.stride1);
-
-    // adaptation += (dt / tau_n) * (inc_n * output - adaptation);
-    cblas_dcopy(n_neurons, output.raw_data, output.stride1, dAdapt.raw_data, dAdapt.stride1);
-    cblas_dscal(n_neurons, inc_n, dAdapt.raw_data, dAdapt.stride1);
-    cblas_daxpy(n_neurons, -1.0, adaptation.raw_data, adaptation.stride1,
-                dAdapt.raw_data, dAdapt.stride1);
-    cblas_daxpy(n_neurons, dt/tau_n, dAdapt.raw_data, dAdapt.stride1,
-                adaptation.raw_data, adaptation.stride1);
+    if(contiguous){
+        lif_kernel<true, true>(
+            n_neurons, dt, dt_inv, scale, tau_ref, min_voltage, dt / tau_n, inc_n,
+            J.raw_data, 1, output.raw_data, 1, voltage.raw_data, 1,
+            ref_time.raw_data, 1, adaptation.raw_data, 1);
+    }else{
+        lif_kernel<false, true>(
+            n_neurons, dt, dt_inv, scale, tau_ref, min_voltage, dt / tau_n, inc_n,
+            J.raw_data, J.stride1, output.raw_data, output.stride1,
+            voltage.raw_data, voltage.stride1, ref_time.raw_data, ref_time.stride1,
+            adaptation.raw_data, adaptation.stride1);
+    }
 
     run_dbg(*this);
 }
@@ -934,31 +1963,24 @@ AdaptiveLIFRate::AdaptiveLIFRate(
     unsigned n_neurons, dtype tau_n, dtype inc_n, dtype tau_rc, dtype tau_ref, dtype dt,
     Signal J, Signal output, Signal adaptation)
 :LIFRate(n_neurons, tau_rc, tau_ref, J, output),
-tau_n(tau_n), inc_n(inc_n), dt(dt), adaptation(adaptation),
-temp_J(n_neurons), dAdapt(n_neurons){
+tau_n(tau_n), inc_n(inc_n), dt(dt), adaptation(adaptation){
+
+    declare_write(adaptation);
 
+    contiguous &= adaptation.stride1 == 1;
 }
 
 void AdaptiveLIFRate::operator() (){
-    // temp_J = J
-    cblas_dcopy(n_neurons, J.raw_data, J.stride1, temp_J.raw_data, temp_J.stride1);
-
-    // J -= adaptation
-    cblas_daxpy(n_neurons, -1.0, adaptation.raw_data, adaptation.stride1,
-                J.raw_data, J.stride1);
-
-    LIFRate::operator()();
-
-    // J = temp_J
-    cblas_dcopy(n_neurons, temp_J.raw_data, temp_J.stride1, J.raw_data, J.stride1);
-
-    // adaptation += (dt / tau_n) * (inc_n * output - adaptation);
-    cblas_dcopy(n_neurons, output.raw_data, output.stride1, dAdapt.raw_data, dAdapt.stride1);
-    cblas_dscal(n_neurons, inc_n, dAdapt.raw_data, dAdapt.stride1);
-    cblas_daxpy(n_neurons, -1.0, adaptation.raw_data, adaptation.stride1,
-                dAdapt.raw_data, dAdapt.stride1);
-    cblas_daxpy(n_neurons, dt/tau_n, dAdapt.raw_data, dAdapt.stride1,
-                adaptation.raw_data, adaptation.stride1);
+    if(contiguous){
+        lif_rate_kernel<true, true>(
+            n_neurons, tau_rc, tau_ref, dt / tau_n, inc_n,
+            J.raw_data, 1, output.raw_data, 1, adaptation.raw_data, 1);
+    }else{
+        lif_rate_kernel<false, true>(
+            n_neurons, tau_rc, tau_ref, dt / tau_n, inc_n,
+            J.raw_data, J.stride1, output.raw_data, output.stride1,
+            adaptation.raw_data, adaptation.stride1);
+    }
 
     run_dbg(*this);
 }
@@ -980,13 +2002,26 @@ string AdaptiveLIFRate::to_string() const{
 RectifiedLinear::RectifiedLinear(unsigned n_neurons, Signal J, Signal output)
 :n_neurons(n_neurons), J(J), output(output){
 
+    declare_read(J);
+    declare_write(output);
 }
 
 void RectifiedLinear::operator() (){
-    dtype j = 0;
-    for(unsigned i = 0; i < n_neurons; ++i){
-        j = J(i);
-        output(i) = j > 0.0 ? j : 0.0;
+    const dtype* __restrict__ J_data = J.raw_data;
+    dtype* __restrict__ output_data = output.raw_data;
+    const int J_stride = J.stride1;
+    const int output_stride = output.stride1;
+
+    if(J_stride == 1 && output_stride == 1){
+        for(unsigned i = 0; i < n_neurons; ++i){
+            const dtype j = J_data[i];
+            output_data[i] = j > 0.0 ? j : 0.0;
+        }
+    }else{
+        for(unsigned i = 0; i < n_neurons; ++i){
+            const dtype j = J_data[i * J_stride];
+            output_data[i * output_stride] = j > 0.0 ? j : 0.0;
+        }
     }
 
     run_dbg(*this);
@@ -1009,6 +2044,8 @@ string RectifiedLinear::to_string() const{
 Sigmoid::Sigmoid(unsigned n_neurons, dtype tau_ref, Signal J, Signal output)
 :n_neurons(n_neurons), tau_ref(tau_ref), tau_ref_inv(1.0 / tau_ref), J(J), output(output){
 
+    declare_read(J);
+    declare_write(output);
 }
 
 void Sigmoid::operator() (){
@@ -1033,25 +2070,141 @@ string Sigmoid::to_string() const{
     return out.str();
 }
 
+// ********************************************************************************
+// Columns of a learning rule's matrix that are updated together, row after
+// row, so that the part of the presynaptic vector they use stays in cache.
+static const unsigned LEARNING_BLOCK_SIZE = 512;
+
+// Whether the columns of each row of a matrix are next to each other in memory.
+static bool unit_column_stride(const Signal& matrix){
+    return matrix.shape2 == 1 || matrix.stride2 == 1;
+}
+
+static bool unit_stride(const Signal& vector){
+    return vector.shape1 == 1 || vector.stride1 == 1;
+}
+
+LearningRule::LearningRule(Signal delta, dtype alpha)
+:alpha(alpha), delta(delta), fused(false), interval(1){
+
+    declare_write(delta);
+}
+
+void LearningRule::apply_to(Signal target, Signal scale){
+    if(target.shape1 != delta.shape1 || target.shape2 != delta.shape2 || scale.size != 1){
+        stringstream msg;
+        msg << "Cannot apply the delta of " << classname() << " with shape "
+            << shape_string(delta) << " to a target with shape " << shape_string(target)
+            << ", scaled by a signal of size " << scale.size << ".";
+        throw logic_error(msg.str());
+    }
+
+    fused = true;
+    this->target = target;
+    target_scale = scale;
+
+    declare_read(scale);
+    declare_write(target);
+}
+
+void LearningRule::set_interval(unsigned interval, Signal step){
+    if(interval == 0){
+        throw logic_error("Learning rules must update at least every 1 step.");
+    }
+
+    this->interval = interval;
+    this->step = step;
+
+    if(interval > 1){
+        declare_read(step);
+    }
+}
+
+bool LearningRule::updates_this_step(){
+    if(interval == 1){
+        return true;
+    }
+
+    // The step signal counts from 1 on the first step after a reset.
+    unsigned phase = (unsigned(step(0)) - 1) % interval;
+
+    // Delta is cleared on the step after each update, and stays zero until
+    // the next, so that an operator adding it to the target adds nothing.
+    if(phase == 1){
+        delta.fill_with(0.0);
+    }
+
+    return phase == 0;
+}
+
 // ********************************************************************************
 BCM::BCM(
     Signal pre_filtered, Signal post_filtered, Signal theta,
     Signal delta, dtype learning_rate, dtype dt)
-:alpha(learning_rate * dt), pre_filtered(pre_filtered), post_filtered(post_filtered),
-theta(theta), delta(delta), squared_pf(post_filtered.size){
+:LearningRule(delta, learning_rate * dt), pre_filtered(pre_filtered),
+post_filtered(post_filtered), theta(theta), squared_pf(post_filtered.size){
 
+    declare_read(pre_filtered);
+    declare_read(post_filtered);
+    declare_read(theta);
 }
 
 void BCM::operator() (){
+    if(!updates_this_step()){
+        return;
+    }
+
+    const dtype a = rate();
     for(unsigned i = 0; i < post_filtered.shape1; i++){
-        squared_pf(i) = post_filtered(i) * (post_filtered(i) - theta(i));
+        squared_pf(i) = a * (post_filtered(i) * (post_filtered(i) - theta(i)));
+    }
+
+    const unsigned n_rows = delta.shape1;
+    const unsigned n_cols = delta.shape2;
+    const dtype scale = fused ? target_scale(0) : 0.0;
+
+    bool unit = unit_column_stride(delta) && unit_stride(pre_filtered) &&
+        (!fused || unit_column_stride(target));
+
+    if(!unit){
+        for(unsigned i = 0; i < n_rows; i++){
+            for(unsigned j = 0; j < n_cols; j++){
+                dtype d = squared_pf(i) * pre_filtered(j);
+                delta(i, j) = d;
+
+                if(fused){
+                    target(i, j) += scale * d;
+                }
+            }
+        }
+
+        run_dbg(*this);
+        return;
     }
 
-    delta.fill_with(0.0);
+    const dtype* pre = pre_filtered.raw_data;
+
+    for(unsigned start = 0; start < n_cols; start += LEARNING_BLOCK_SIZE){
+        unsigned end = min(start + LEARNING_BLOCK_SIZE, n_cols);
 
-    cblas_dger(
-        CblasRowMajor, delta.shape1, delta.shape2, alpha, squared_pf.raw_data, squared_pf.stride1,
-        pre_filtered.raw_data, pre_filtered.stride1, delta.raw_data, delta.stride1);
+        for(unsigned i = 0; i < n_rows; i++){
+            const dtype c = squared_pf(i);
+            dtype* d = delta.raw_data + int(i) * delta.stride1;
+
+            if(fused){
+                dtype* w = target.raw_data + int(i) * target.stride1;
+
+                for(unsigned j = start; j < end; j++){
+                    d[j] = c * pre[j];
+                    w[j] += scale * d[j];
+                }
+            }else{
+                for(unsigned j = start; j < end; j++){
+                    d[j] = c * pre[j];
+                }
+            }
+        }
+    }
 
     run_dbg(*this);
 }
@@ -1060,6 +2213,8 @@ string BCM::to_string() const{
     stringstream out;
     out << Operator::to_string();
     out << "alpha: " << alpha << endl;
+    out << "interval: " << interval << endl;
+    out << "fused: " << fused << endl;
 
     out << "pre_filtered:" << endl;
     out << signal_to_string(pre_filtered) << endl;
@@ -1077,24 +2232,74 @@ string BCM::to_string() const{
 Oja::Oja(
     Signal pre_filtered, Signal post_filtered, Signal weights,
     Signal delta, dtype learning_rate, dtype dt, dtype beta)
-:alpha(learning_rate * dt), beta(beta), pre_filtered(pre_filtered),
-post_filtered(post_filtered), weights(weights), delta(delta){
+:LearningRule(delta, learning_rate * dt), beta(beta), pre_filtered(pre_filtered),
+post_filtered(post_filtered), weights(weights){
 
+    declare_read(pre_filtered);
+    declare_read(post_filtered);
+    declare_read(weights);
 }
 
 void Oja::operator() (){
-    for(unsigned i = 0; i < weights.shape1; i++){
-        dtype post_squared = post_filtered(i);
-        post_squared *= alpha * post_squared;
+    if(!updates_this_step()){
+        return;
+    }
+
+    const dtype a = rate();
+    const unsigned n_rows = delta.shape1;
+    const unsigned n_cols = delta.shape2;
+    const dtype scale = fused ? target_scale(0) : 0.0;
+
+    bool unit = unit_column_stride(delta) && unit_column_stride(weights) &&
+        unit_stride(pre_filtered) && (!fused || unit_column_stride(target));
 
-        for(unsigned j = 0; j < weights.shape2; j++){
-            delta(i, j) = -beta * weights(i, j) * post_squared;
+    if(!unit){
+        for(unsigned i = 0; i < n_rows; i++){
+            const dtype post = post_filtered(i);
+            const dtype decay = -beta * (post * (a * post));
+            const dtype hebbian = a * post;
+
+            for(unsigned j = 0; j < n_cols; j++){
+                dtype d = decay * weights(i, j) + hebbian * pre_filtered(j);
+                delta(i, j) = d;
+
+                if(fused){
+                    target(i, j) += scale * d;
+                }
+            }
         }
+
+        run_dbg(*this);
+        return;
     }
 
-    cblas_dger(
-        CblasRowMajor, delta.shape1, delta.shape2, alpha, post_filtered.raw_data, post_filtered.stride1,
-        pre_filtered.raw_data, pre_filtered.stride1, delta.raw_data, delta.stride1);
+    const dtype* pre = pre_filtered.raw_data;
+
+    for(unsigned start = 0; start < n_cols; start += LEARNING_BLOCK_SIZE){
+        unsigned end = min(start + LEARNING_BLOCK_SIZE, n_cols);
+
+        for(unsigned i = 0; i < n_rows; i++){
+            const dtype post = post_filtered(i);
+            const dtype decay = -beta * (post * (a * post));
+            const dtype hebbian = a * post;
+
+            const dtype* w = weights.raw_data + int(i) * weights.stride1;
+            dtype* d = delta.raw_data + int(i) * delta.stride1;
+
+            if(fused){
+                dtype* t = target.raw_data + int(i) * target.stride1;
+
+                for(unsigned j = start; j < end; j++){
+                    d[j] = decay * w[j] + hebbian * pre[j];
+                    t[j] += scale * d[j];
+                }
+            }else{
+                for(unsigned j = start; j < end; j++){
+                    d[j] = decay * w[j] + hebbian * pre[j];
+                }
+            }
+        }
+    }
 
     run_dbg(*this);
 }
@@ -1104,6 +2309,8 @@ string Oja::to_string() const{
     out << Operator::to_string();
     out << "alpha: " << alpha << endl;
     out << "beta: " << beta << endl;
+    out << "interval: " << interval << endl;
+    out << "fused: " << fused << endl;
 
     out << "pre_filtered:" << endl;
     out << signal_to_string(pre_filtered) << endl;
@@ -1122,23 +2329,75 @@ Voja::Voja(
     Signal pre_decoded, Signal post_filtered, Signal scaled_encoders,
     Signal delta, Signal learning_signal, Signal scale,
     dtype learning_rate, dtype dt)
-:alpha(learning_rate * dt), pre_decoded(pre_decoded), post_filtered(post_filtered),
-scaled_encoders(scaled_encoders), delta(delta), learning_signal(learning_signal), scale(scale){
+:LearningRule(delta, learning_rate * dt), pre_decoded(pre_decoded),
+post_filtered(post_filtered), scaled_encoders(scaled_encoders),
+learning_signal(learning_signal), scale(scale){
 
+    declare_read(pre_decoded);
+    declare_read(post_filtered);
+    declare_read(scaled_encoders);
+    declare_read(learning_signal);
+    declare_read(scale);
 }
 
 void Voja::operator() (){
+    if(!updates_this_step()){
+        return;
+    }
+
     // For now, learning_signal is required to have size 1.
-    dtype coef = alpha * learning_signal(0);
+    dtype coef = rate() * learning_signal(0);
+
+    const unsigned n_rows = delta.shape1;
+    const unsigned n_cols = delta.shape2;
+    const dtype t_scale = fused ? target_scale(0) : 0.0;
+
+    bool unit = unit_column_stride(delta) && unit_column_stride(scaled_encoders) &&
+        unit_stride(pre_decoded) && (!fused || unit_column_stride(target));
+
+    if(!unit){
+        for(unsigned i = 0; i < n_rows; i++){
+            const dtype pf = post_filtered(i);
+            const dtype s_pf = scale(i) * pf;
+
+            for(unsigned j = 0; j < n_cols; j++){
+                dtype d = coef * (s_pf * pre_decoded(j) - pf * scaled_encoders(i, j));
+                delta(i, j) = d;
+
+                if(fused){
+                    target(i, j) += t_scale * d;
+                }
+            }
+        }
+
+        run_dbg(*this);
+        return;
+    }
+
+    const dtype* pre = pre_decoded.raw_data;
 
-    for(unsigned i = 0; i < scaled_encoders.shape1; i++){
-        dtype s = scale(i);
-        dtype pf = post_filtered(i);
+    for(unsigned start = 0; start < n_cols; start += LEARNING_BLOCK_SIZE){
+        unsigned end = min(start + LEARNING_BLOCK_SIZE, n_cols);
 
-        for(unsigned j = 0; j < scaled_encoders.shape2; j++){
-            delta(i, j) =
-                coef * (s * post_filtered(i) * pre_decoded(j)
-                - pf * scaled_encoders(i, j));
+        for(unsigned i = 0; i < n_rows; i++){
+            const dtype pf = post_filtered(i);
+            const dtype s_pf = scale(i) * pf;
+
+            const dtype* e = scaled_encoders.raw_data + int(i) * scaled_encoders.stride1;
+            dtype* d = delta.raw_data + int(i) * delta.stride1;
+
+            if(fused){
+                dtype* t = target.raw_data + int(i) * target.stride1;
+
+                for(unsigned j = start; j < end; j++){
+                    d[j] = coef * (s_pf * pre[j] - pf * e[j]);
+                    t[j] += t_scale * d[j];
+                }
+            }else{
+                for(unsigned j = start; j < end; j++){
+                    d[j] = coef * (s_pf * pre[j] - pf * e[j]);
+                }
+            }
         }
     }
 
@@ -1149,6 +2408,8 @@ string Voja::to_string() const{
     stringstream out;
     out << Operator::to_string();
     out << "alpha: " << alpha << endl;
+    out << "interval: " << interval << endl;
+    out << "fused: " << fused << endl;
 
     out << "pre_decoded:" << endl;
     out << signal_to_string(pre_decoded) << endl;
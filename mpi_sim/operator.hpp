@@ -23,7 +23,55 @@ extern "C"
 }
 #endif
 
+// Overloads of the BLAS routines used by the operators, so that they can be
+// called the same way whichever type dtype is.
+inline void cblas_gemv(
+        const CBLAS_ORDER order, const CBLAS_TRANSPOSE trans, const int m, const int n,
+        const double alpha, const double* A, const int lda, const double* x, const int incx,
+        const double beta, double* y, const int incy){
+    cblas_dgemv(order, trans, m, n, alpha, A, lda, x, incx, beta, y, incy);
+}
+
+inline void cblas_gemv(
+        const CBLAS_ORDER order, const CBLAS_TRANSPOSE trans, const int m, const int n,
+        const float alpha, const float* A, const int lda, const float* x, const int incx,
+        const float beta, float* y, const int incy){
+    cblas_sgemv(order, trans, m, n, alpha, A, lda, x, incx, beta, y, incy);
+}
+
+inline void cblas_gemm(
+        const CBLAS_ORDER order, const CBLAS_TRANSPOSE trans_A, const CBLAS_TRANSPOSE trans_B,
+        const int m, const int n, const int k, const double alpha, const double* A,
+        const int lda, const double* B, const int ldb, const double beta, double* C,
+        const int ldc){
+    cblas_dgemm(order, trans_A, trans_B, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+inline void cblas_gemm(
+        const CBLAS_ORDER order, const CBLAS_TRANSPOSE trans_A, const CBLAS_TRANSPOSE trans_B,
+        const int m, const int n, const int k, const float alpha, const float* A,
+        const int lda, const float* B, const int ldb, const float beta, float* C,
+        const int ldc){
+    cblas_sgemm(order, trans_A, trans_B, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+inline void cblas_ger(
+        const CBLAS_ORDER order, const int m, const int n, const double alpha,
+        const double* x, const int incx, const double* y, const int incy,
+        double* A, const int lda){
+    cblas_dger(order, m, n, alpha, x, incx, y, incy, A, lda);
+}
+
+inline void cblas_ger(
+        const CBLAS_ORDER order, const int m, const int n, const float alpha,
+        const float* x, const int incx, const float* y, const int incy,
+        float* A, const int lda){
+    cblas_sger(order, m, n, alpha, x, incx, y, incy, A, lda);
+}
+
 #include "signal.hpp"
+#include "rng.hpp"
+#include "checkpoint.hpp"
 #include "typedef.hpp"
 #include "debug.hpp"
 
@@ -35,12 +83,39 @@ using namespace std;
 // them sequentially each time step. The order they are called in is determined
 // by the order they are given to us from python.
 //
-// Note that the () operator is a virtual function, which comes with some overhead.
-// Future optimizations should look at another scheme, either function pointers
-// or, ideally, finding some way to make these functions non-pointers and non-virtual.
+// The () operator is a virtual function, which comes with some overhead. To avoid
+// paying it for every operator on every step, once the operators have been sorted
+// the chunk groups consecutive operators of the same concrete type into batches.
+// Each batch is executed by a BatchRunner (obtained from the operator's
+// ``batch_runner'' function), which calls the () operator of each op in the batch
+// through a statically resolved (non-virtual) call.
+//
+// Each operator also records the signals that it reads and writes on every call
+// to the () operator. When a chunk is run with more than one thread, these are used
+// to find operators that do not conflict with each other, which may then be run
+// concurrently (see ``build_parallel_schedule'' in chunk.cpp). An operator that
+// increments a signal should declare it as written; a write conflicts with any
+// other access, a read only conflicts with writes.
 //
 // Note that in general reset must be called before the () operator can be called.
 
+class Operator;
+
+// Executes ``n_ops'' operators, which must all have the same concrete type.
+typedef void (*BatchRunner)(Operator* const* ops, unsigned n_ops);
+
+// BatchRunner for a concrete operator type. The qualified call to T::operator()
+// bypasses the vtable, so T must be the most-derived type of every op in the batch.
+template<class T>
+void run_batch(Operator* const* ops, unsigned n_ops){
+    for(unsigned i = 0; i < n_ops; i++){
+        static_cast<T*>(ops[i])->T::operator()();
+    }
+}
+
+// BatchRunner for operators that don't provide their own; uses virtual calls.
+void run_virtual_batch(Operator* const* ops, unsigned n_ops);
+
 class Operator{
 
 public:
@@ -56,6 +131,10 @@ public:
     virtual string classname() const { return "Operator"; }
 
     virtual void operator() () = 0;
+
+    // Subclasses that can be batched override this to return run_batch<Subclass>.
+    virtual BatchRunner batch_runner() const { return run_virtual_batch; }
+
     virtual string to_string() const{
         stringstream ss;
         ss << classname() << endl;
@@ -65,9 +144,25 @@ public:
 
     // Here we only need to reset aspects of operator's state that are *not* stored as signals
     // because resetting signals is handled by the chunk. Consequently, most operators won't
-    // need to override this.
+    // need to override this. The seed is the same for every operator of a trial; operators
+    // that are random draw from a RandomStream keyed by it and by their get_stream_id().
     virtual void reset(unsigned seed){}
 
+    // Save the same aspects of the operator's state to a checkpoint, and load
+    // them back, using the helpers in checkpoint.hpp. load_state is called
+    // after the operator has been reset with the seed of the checkpoint.
+    virtual void save_state(ostream& out){}
+    virtual void load_state(istream& in){}
+
+    // Operators that filter each of their outputs on its own, and may have
+    // been merged from several operators, can also save and load the state
+    // of one output at a time, so that it can be moved to an operator that
+    // was merged differently (see MpiSimulatorChunk::migrate_from). Those
+    // operators return the outputs whose state they save this way.
+    virtual vector<Signal> get_state_outputs() const{ return vector<Signal>(); }
+    virtual void save_output_state(unsigned output, ostream& out){}
+    virtual void load_output_state(unsigned output, istream& in){}
+
     friend ostream& operator << (ostream &out, const Operator &op){
         out << "<" << op.to_string() << ">" << endl;
         return out;
@@ -76,10 +171,39 @@ public:
     void set_index(float i){ index = i;}
     float get_index() const{ return index; }
 
-    virtual unsigned get_seed_modifier() const{ return unsigned(index); }
+    virtual uint32_t get_stream_id() const{ return stream_id(index); }
+
+    const vector<Signal>& get_reads() const{ return reads; }
+    const vector<Signal>& get_writes() const{ return writes; }
+
+    // Whether the operator may be called from a thread other than the one that
+    // runs the simulation. Operators that talk to MPI or python, or that touch
+    // state shared between operators, return false.
+    virtual bool thread_safe() const{ return true; }
+
+    // The signal that the operator writes spikes to, if it simulates spiking
+    // neurons: every value it writes there is either 0 or a single spike
+    // amplitude. NULL for other operators.
+    virtual const Signal* spike_output() const{ return NULL; }
+
+    // Operators whose work can be skipped while their inputs stay within
+    // ``tolerance'' of zero override this to start doing so, and return true
+    // (see SimulatorConfig::quiescence). Called once, before the simulation.
+    virtual bool set_quiescence(dtype tolerance){ return false; }
+
+    // Bytes of memory that the operator holds besides the signals it operates
+    // on, such as copies of them and message buffers.
+    virtual size_t buffer_bytes() const{ return 0; }
 
 protected:
+    // Called by subclass constructors to record the signals they operate on.
+    void declare_read(const Signal& signal){ reads.push_back(signal); }
+    void declare_write(const Signal& signal){ writes.push_back(signal); }
+
     float index;
+
+    vector<Signal> reads;
+    vector<Signal> writes;
 };
 
 class TimeUpdate: public Operator{
@@ -87,10 +211,13 @@ class TimeUpdate: public Operator{
 public:
     TimeUpdate(Signal step, Signal time, dtype t);
     virtual string classname() const { return "TimeUpdate"; }
+    virtual BatchRunner batch_runner() const { return run_batch<TimeUpdate>; }
 
     void operator()();
     virtual string to_string() const;
 
+    const Signal& get_step() const{ return step; }
+
 protected:
     Signal step;
     Signal time;
@@ -103,6 +230,7 @@ class Reset: public Operator{
 public:
     Reset(Signal dst, dtype value);
     virtual string classname() const { return "Reset"; }
+    virtual BatchRunner batch_runner() const { return run_batch<Reset>; }
 
     void operator()();
     virtual string to_string() const;
@@ -116,6 +244,7 @@ class Copy: public Operator{
 public:
     Copy(Signal dst, Signal src);
     virtual string classname() const { return "Copy"; }
+    virtual BatchRunner batch_runner() const { return run_batch<Copy>; }
 
     void operator()();
     virtual string to_string() const;
@@ -125,6 +254,14 @@ protected:
     Signal src;
 };
 
+/* Copies (or adds) a slice of src to a slice of dst, each given by either
+ * start/stop/step or a sequence of indices. The constructor compiles the
+ * element-by-element assignments into a plan of blocks: runs that are
+ * contiguous in both signals, runs with constant strides, and whatever is
+ * left as gathers through a compact index. The blocks are executed in the
+ * order of the assignments they cover, so the result is the same as making
+ * the assignments one by one. The plan stores offsets into the signals, so
+ * the operator is only correct as long as its signals are not moved. */
 class SlicedCopy: public Operator{
 public:
     SlicedCopy(
@@ -133,11 +270,45 @@ public:
         int start_dst, int stop_dst, int step_dst,
         vector<int> seq_src, vector<int> seq_dst, bool inc);
     virtual string classname() const { return "SlicedCopy"; }
+    virtual BatchRunner batch_runner() const { return run_batch<SlicedCopy>; }
 
     void operator()();
     virtual string to_string() const;
 
+    /* Append the plan of ``other'', which must run right after this one, to
+     * this copy's plan, so that this copy does the work of both. Only copies
+     * to the same destination with the same ``inc'' can be merged; returns
+     * whether ``other'' was merged. */
+    bool merge(const SlicedCopy& other);
+
+    unsigned get_n_assignments() const{ return n_assignments; }
+
 protected:
+    enum BlockKind { CONTIGUOUS, STRIDED, GATHER };
+
+    struct Block{
+        BlockKind kind;
+
+        // Index into sources.
+        unsigned source;
+
+        // Offsets from the start of the source and of dst, and strides, in
+        // elements. Gathers instead use gather_src and gather_dst from
+        // ``start''.
+        int src_offset;
+        int dst_offset;
+        int src_stride;
+        int dst_stride;
+
+        unsigned start;
+        unsigned length;
+    };
+
+    void compile_plan();
+
+    // Add a block to the plan, joining it to the last block where possible.
+    void add_block(const Block& block);
+
     Signal src;
     Signal dst;
 
@@ -157,6 +328,13 @@ protected:
 
     const bool inc;
     unsigned n_assignments;
+
+    // src, followed by the sources of any copies merged into this one.
+    vector<Signal> sources;
+
+    vector<Block> blocks;
+    vector<int> gather_src;
+    vector<int> gather_dst;
 };
 
 
@@ -165,10 +343,20 @@ class DotInc: public Operator{
 public:
     DotInc(Signal A, Signal X, Signal Y);
     virtual string classname() const { return "DotInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<DotInc>; }
 
     void operator()();
     virtual string to_string() const;
 
+    // Skips steps on which X is zero, unless A is a scalar.
+    virtual bool set_quiescence(dtype tolerance);
+
+    bool is_matrix_vector() const{ return !scalar && matrix_vector; }
+    bool is_scalar() const{ return scalar; }
+    const Signal& get_A() const{ return A; }
+    const Signal& get_X() const{ return X; }
+    const Signal& get_Y() const{ return Y; }
+
 protected:
     const bool scalar;
     bool matrix_vector;
@@ -187,17 +375,156 @@ protected:
     unsigned m;
     unsigned n;
     unsigned k;
+
+    dtype quiescence;
+};
+
+/* Matrix-vector DotInc for a constant matrix A that is mostly zeros. The
+ * nonzero entries of A are copied into compressed sparse row format when the
+ * operator is created, so the operator is only correct as long as A does not
+ * change. Created by the chunk in place of such DotIncs. */
+class SparseDotInc: public Operator{
+public:
+    SparseDotInc(Signal A, Signal X, Signal Y);
+    virtual string classname() const { return "SparseDotInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<SparseDotInc>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    // Skips steps on which X is zero.
+    virtual bool set_quiescence(dtype tolerance){ quiescence = tolerance; return true; }
+
+protected:
+    Signal X;
+    Signal Y;
+
+    vector<unsigned> row_starts;
+    vector<unsigned> columns;
+    vector<dtype> values;
+
+    dtype quiescence;
 };
 
+/* Several matrix-vector DotIncs with constant matrices that share the same X,
+ * computed with a single gemv. The matrices are stacked into one when the
+ * operator is created, so the operator is only correct as long as they do not
+ * change. The result for each Y is added to it in the order the DotIncs were
+ * given. Created by the chunk in place of groups of small DotIncs. */
+class BatchedDotInc: public Operator{
+public:
+    BatchedDotInc(vector<Signal> A, Signal X, vector<Signal> Y);
+    virtual string classname() const { return "BatchedDotInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<BatchedDotInc>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    // Skips steps on which X is zero.
+    virtual bool set_quiescence(dtype tolerance){ quiescence = tolerance; return true; }
+
+    virtual size_t buffer_bytes() const{ return (size_t(n_rows) * n_cols + n_rows) * sizeof(dtype); }
+
+protected:
+    Signal X;
+    vector<Signal> Y;
+
+    unsigned n_rows;
+    unsigned n_cols;
+
+    unique_ptr<dtype[]> stacked_A;
+    unique_ptr<dtype[]> result;
+
+    dtype quiescence;
+};
+
+/* The matrix-vector DotIncs of every trial of a network, which share a
+ * constant matrix A, computed with a single gemm. Trial i's X and Y are
+ * vectors with unit stride, each stored a fixed distance after trial i - 1's.
+ * Created by the chunk in place of the DotIncs of the individual trials. */
+class TrialDotInc: public Operator{
+public:
+    TrialDotInc(Signal A, vector<Signal> X, vector<Signal> Y);
+    virtual string classname() const { return "TrialDotInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<TrialDotInc>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    /* Whether ``signals'' are vectors with unit stride, each of which starts
+     * ``trial_stride'' elements after the previous one, without overlapping it. */
+    static bool fixed_trial_stride(const vector<Signal>& signals, unsigned& trial_stride);
+
+protected:
+    Signal A;
+    Signal X;
+    Signal Y;
+
+    unsigned n_trials;
+
+    CBLAS_TRANSPOSE transpose_A;
+    unsigned leading_dim_A;
+
+    unsigned X_trial_stride;
+    unsigned Y_trial_stride;
+};
+
+// Largest small dimension for which SmallDotInc is instantiated.
+#define MAX_SMALL_DOT_INC_DIM 16
+
+/* Matrix-vector DotInc in which one dimension of A is known at compile time,
+ * with fully unrolled inner loops. Either N_ROWS or N_COLS is nonzero, and the
+ * other dimension is given at run time:
+ *
+ *   SmallDotInc<0, D>: A maps a D-dimensional X to many values (encoders). X is
+ *     held in registers, and each row of A is applied in one unrolled pass.
+ *   SmallDotInc<D, 0>: A maps many values to a D-dimensional Y (decoders). The
+ *     D sums are accumulated in registers in a single pass over X.
+ *
+ * The rows of A must have unit stride. Unlike the other replacements of
+ * DotInc, A is read on every step, so it may change. Created by the chunk in
+ * place of such DotIncs. */
+template<unsigned N_ROWS, unsigned N_COLS>
+class SmallDotInc: public Operator{
+public:
+    SmallDotInc(Signal A, Signal X, Signal Y);
+    virtual string classname() const { return "SmallDotInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<SmallDotInc<N_ROWS, N_COLS>>; }
+
+    void operator()();
+    virtual string to_string() const;
+
+    // Skips steps on which X is zero.
+    virtual bool set_quiescence(dtype tolerance){ quiescence = tolerance; return true; }
+
+protected:
+    Signal A;
+    Signal X;
+    Signal Y;
+
+    dtype quiescence;
+};
+
+/* A SmallDotInc that computes ``dot_inc'', or NULL if none is instantiated
+ * for its shapes. */
+unique_ptr<Operator> make_small_dot_inc(const DotInc& dot_inc);
 
 class ElementwiseInc: public Operator{
 public:
     ElementwiseInc(Signal A, Signal X, Signal Y);
     virtual string classname() const { return "ElementwiseInc"; }
+    virtual BatchRunner batch_runner() const { return run_batch<ElementwiseInc>; }
 
     void operator()();
     virtual string to_string() const;
 
+    // Skips steps on which X is zero.
+    virtual bool set_quiescence(dtype tolerance){ quiescence = tolerance; return true; }
+
+    const Signal& get_A() const{ return A; }
+    const Signal& get_X() const{ return X; }
+    const Signal& get_Y() const{ return Y; }
+
 protected:
     Signal A;
     Signal X;
@@ -209,6 +536,8 @@ protected:
 
     const unsigned X_row_stride;
     const unsigned X_col_stride;
+
+    dtype quiescence;
 };
 
 class NoDenSynapse: public Operator{
@@ -217,6 +546,7 @@ public:
     NoDenSynapse(Signal input, Signal output, dtype b);
 
     virtual string classname() const { return "NoDenSynapse"; }
+    virtual BatchRunner batch_runner() const { return run_batch<NoDenSynapse>; }
 
     void operator()();
     virtual string to_string() const;
@@ -228,22 +558,50 @@ protected:
     const dtype b;
 };
 
+/* SimpleSynapse, Synapse and TriangleSynapse filter each element of their
+ * input into the same element of their output. A synapse can absorb others
+ * with the same filter (see merge), which the chunk uses to update each group
+ * of synapses with the same filter as one operator, in lockstep over all of
+ * their elements. The state of every element is stored in dense arrays with a
+ * row per step of history, so the updates run over contiguous memory. */
 class SimpleSynapse: public Operator{
 
 public:
     SimpleSynapse(Signal input, Signal output, dtype a, dtype b);
 
     virtual string classname() const { return "SimpleSynapse"; }
+    virtual BatchRunner batch_runner() const { return run_batch<SimpleSynapse>; }
 
     void operator()();
     virtual string to_string() const;
 
+    virtual void reset(unsigned seed){ quiet = false; }
+
+    // Stops updating once every input and output is zero, and sets the
+    // outputs to exactly zero, until an input changes.
+    virtual bool set_quiescence(dtype tolerance){ quiescence = tolerance; return true; }
+
+    // Whether other has the same filter, so that it can be merged into this synapse.
+    bool can_merge(const SimpleSynapse& other) const;
+
+    // Filter the elements of other as well, after those of this synapse.
+    void merge(const SimpleSynapse& other);
+
+    const vector<Signal>& get_inputs() const{ return inputs; }
+    unsigned get_n_elements() const{ return n_elements; }
+
 protected:
-    Signal input;
-    Signal output;
+    vector<Signal> inputs;
+    vector<Signal> outputs;
+    unsigned n_elements;
 
     const dtype a;
     const dtype b;
+
+    dtype quiescence;
+
+    // Whether the outputs were set to zero while every input was zero.
+    bool quiet;
 };
 
 class Synapse: public Operator{
@@ -254,21 +612,55 @@ public:
         Signal numer, Signal denom);
 
     virtual string classname() const { return "Synapse"; }
+    virtual BatchRunner batch_runner() const { return run_batch<Synapse>; }
 
     void operator()();
     virtual string to_string() const;
 
     virtual void reset(unsigned seed);
+    virtual void save_state(ostream& out);
+    virtual void load_state(istream& in);
+
+    virtual vector<Signal> get_state_outputs() const{ return outputs; }
+    virtual void save_output_state(unsigned output, ostream& out);
+    virtual void load_output_state(unsigned output, istream& in);
+
+    // Stops updating once every input and output has been zero for as many
+    // steps as the filter remembers, and sets the outputs and the state to
+    // exactly zero, until an input changes.
+    virtual bool set_quiescence(dtype tolerance){ quiescence = tolerance; return true; }
+
+    bool can_merge(const Synapse& other) const;
+    void merge(const Synapse& other);
+
+    const vector<Signal>& get_inputs() const{ return inputs; }
+    unsigned get_n_elements() const{ return n_elements; }
 
 protected:
-    Signal input;
-    Signal output;
+    vector<Signal> inputs;
+    vector<Signal> outputs;
+    unsigned n_elements;
 
     const Signal numer;
     const Signal denom;
 
-    vector< boost::circular_buffer<dtype> > x;
-    vector< boost::circular_buffer<dtype> > y;
+    // Row k of x holds the input of every element from k steps ago, counting
+    // the current step, and row k of y the output from k + 1 steps ago. The
+    // rows of each are kept in a ring that starts at x_head and y_head.
+    vector<dtype> x;
+    vector<dtype> y;
+    unsigned x_head;
+    unsigned y_head;
+
+    vector<dtype> result;
+
+    dtype quiescence;
+
+    // Whether the outputs and state were set to zero while every input was
+    // zero, and the number of steps in a row that every input and output has
+    // been zero for before that.
+    bool quiet;
+    unsigned quiet_steps;
 };
 
 class TriangleSynapse: public Operator{
@@ -277,21 +669,41 @@ public:
     TriangleSynapse(Signal input, Signal output, dtype n0, dtype ndiff, unsigned n_taps);
 
     virtual string classname() const { return "TriangleSynapse"; }
+    virtual BatchRunner batch_runner() const { return run_batch<TriangleSynapse>; }
 
     void operator()();
     virtual string to_string() const;
 
     virtual void reset(unsigned seed);
+    virtual void save_state(ostream& out);
+    virtual void load_state(istream& in);
+
+    virtual vector<Signal> get_state_outputs() const{ return outputs; }
+    virtual void save_output_state(unsigned output, ostream& out);
+    virtual void load_output_state(unsigned output, istream& in);
+
+    bool can_merge(const TriangleSynapse& other) const;
+    void merge(const TriangleSynapse& other);
+
+    const vector<Signal>& get_inputs() const{ return inputs; }
+    unsigned get_n_elements() const{ return n_elements; }
 
 protected:
-    Signal input;
-    Signal output;
+    vector<Signal> inputs;
+    vector<Signal> outputs;
+    unsigned n_elements;
 
     const dtype n0;
     const dtype ndiff;
     const unsigned n_taps;
 
-    vector< boost::circular_buffer<dtype> > x;
+    // Row k holds ndiff times the input of every element from k + 1 steps
+    // ago, in a ring that starts at x_head.
+    vector<dtype> x;
+    unsigned x_head;
+
+    vector<dtype> input_values;
+    vector<dtype> result;
 };
 
 
@@ -303,11 +715,14 @@ public:
         bool do_scale, bool inc, dtype dt);
 
     virtual string classname() const { return "WhiteNoise"; }
+    virtual BatchRunner batch_runner() const { return run_batch<WhiteNoise>; }
 
     void operator()();
     virtual string to_string() const;
 
     virtual void reset(unsigned seed);
+    virtual void save_state(ostream& out);
+    virtual void load_state(istream& in);
 
 protected:
     Signal output;
@@ -315,8 +730,10 @@ protected:
     const dtype mean;
     const dtype std;
 
-    default_random_engine rng;
-    normal_distribution<dtype> dist;
+    // Step n draws the n-th values of the stream.
+    RandomStream stream;
+    uint64_t n_draws;
+    vector<dtype> samples;
 
     const dtype alpha;
 
@@ -332,6 +749,7 @@ public:
     WhiteSignal(Signal coefs, Signal output, Signal time, dtype dt);
 
     virtual string classname() const { return "WhiteSignal"; }
+    virtual BatchRunner batch_runner() const { return run_batch<WhiteSignal>; }
 
     void operator()();
     virtual string to_string() const;
@@ -351,6 +769,7 @@ public:
         dtype presentation_time, dtype dt);
 
     virtual string classname() const { return "PresentInput"; }
+    virtual BatchRunner batch_runner() const { return run_batch<PresentInput>; }
 
     void operator()();
     virtual string to_string() const;
@@ -373,10 +792,13 @@ public:
         dtype dt, Signal J, Signal output, Signal voltage,
         Signal ref_time);
     virtual string classname() const { return "LIF"; }
+    virtual BatchRunner batch_runner() const { return run_batch<LIF>; }
 
     void operator()();
     virtual string to_string() const;
 
+    virtual const Signal* spike_output() const{ return &output; }
+
 protected:
     const unsigned n_neurons;
 
@@ -388,20 +810,23 @@ protected:
 
     const dtype min_voltage;
 
+    // -expm1(-dt / tau_rc), the fraction of the distance to J covered each step.
+    const dtype scale;
+
     Signal J;
     Signal output;
     Signal voltage;
     Signal ref_time;
 
-    const Signal one;
-    Signal mult;
-    Signal dV;
+    // Whether all state signals have unit stride, enabling the vectorized kernel.
+    bool contiguous;
 };
 
 class LIFRate: public Operator{
 public:
     LIFRate(unsigned n_neurons, dtype tau_rc, dtype tau_ref, Signal J, Signal output);
     virtual string classname() const { return "LIFRate"; }
+    virtual BatchRunner batch_runner() const { return run_batch<LIFRate>; }
 
     void operator()();
     virtual string to_string() const;
@@ -414,6 +839,8 @@ protected:
 
     Signal J;
     Signal output;
+
+    bool contiguous;
 };
 
 class AdaptiveLIF: public LIF{
@@ -423,6 +850,7 @@ public:
         dtype min_voltage, dtype dt, Signal J, Signal output, Signal voltage,
         Signal ref_time, Signal adaptation);
     virtual string classname() const { return "AdaptiveLIF"; }
+    virtual BatchRunner batch_runner() const { return run_batch<AdaptiveLIF>; }
 
     void operator()();
     virtual string to_string() const;
@@ -432,8 +860,6 @@ protected:
     const dtype inc_n;
 
     Signal adaptation;
-    Signal temp_J;
-    Signal dAdapt;
 };
 
 class AdaptiveLIFRate: public LIFRate{
@@ -443,6 +869,7 @@ public:
         unsigned n_neurons, dtype tau_n, dtype inc_n, dtype tau_rc, dtype tau_ref,
         dtype dt, Signal J, Signal output, Signal adaptation);
     virtual string classname() const { return "AdaptiveLIFRate"; }
+    virtual BatchRunner batch_runner() const { return run_batch<AdaptiveLIFRate>; }
 
     void operator()();
     virtual string to_string() const;
@@ -453,14 +880,13 @@ protected:
     const dtype inc_n;
 
     Signal adaptation;
-    Signal temp_J;
-    Signal dAdapt;
 };
 
 class RectifiedLinear: public Operator{
 public:
     RectifiedLinear(unsigned n_neurons, Signal J, Signal output);
     virtual string classname() const { return "RectifiedLinear"; }
+    virtual BatchRunner batch_runner() const { return run_batch<RectifiedLinear>; }
 
     void operator()();
     virtual string to_string() const;
@@ -476,6 +902,7 @@ class Sigmoid: public Operator{
 public:
     Sigmoid(unsigned n_neurons, dtype tau_ref, Signal J, Signal output);
     virtual string classname() const { return "Sigmoid"; }
+    virtual BatchRunner batch_runner() const { return run_batch<Sigmoid>; }
 
     void operator()();
     virtual string to_string() const;
@@ -490,65 +917,100 @@ protected:
     Signal output;
 };
 
-class BCM: public Operator{
+/* Base of the learning rules, which compute delta, the change to make to
+ * the weights (or encoders) of a connection on each step, with learning rate
+ * alpha. Normally another operator then adds delta to its target. The chunk
+ * can instead make a rule apply delta to the target itself (see apply_to),
+ * in the same pass over memory that computes it, and can make a rule update
+ * only every few steps (see set_interval). */
+class LearningRule: public Operator{
+public:
+    LearningRule(Signal delta, dtype alpha);
+
+    /* Add ``scale'' (a single value) times delta to ``target'' whenever delta
+     * is computed, in place of the operator that did so. */
+    void apply_to(Signal target, Signal scale);
+
+    /* Compute delta only on the first of every ``interval'' steps, counted by
+     * ``step'' (the step signal of the TimeUpdate), with the learning rate
+     * multiplied by ``interval''. On the other steps, delta is zero. */
+    void set_interval(unsigned interval, Signal step);
+
+    const Signal& get_delta() const{ return delta; }
+
+protected:
+    // Whether delta is computed on this step. Zeroes delta when it is not.
+    bool updates_this_step();
+
+    // Learning rate for each update, scaled by the interval.
+    dtype rate() const{ return alpha * interval; }
+
+    const dtype alpha;
+
+    Signal delta;
+
+    bool fused;
+    Signal target;
+    Signal target_scale;
+
+    unsigned interval;
+    Signal step;
+};
+
+class BCM: public LearningRule{
 public:
     BCM(
         Signal pre_filtered, Signal post_filtered, Signal weights,
         Signal delta, dtype learning_rate, dtype dt);
     virtual string classname() const { return "BCM"; }
+    virtual BatchRunner batch_runner() const { return run_batch<BCM>; }
 
     void operator()();
     virtual string to_string() const;
 
 protected:
-    const dtype alpha;
-
     Signal pre_filtered;
     Signal post_filtered;
     Signal theta;
-    Signal delta;
 
     Signal squared_pf;
 };
 
-class Oja: public Operator{
+class Oja: public LearningRule{
 public:
     Oja(
         Signal pre_filtered, Signal post_filtered, Signal theta,
         Signal delta, dtype learning_rate, dtype dt, dtype beta);
     virtual string classname() const { return "Oja"; }
+    virtual BatchRunner batch_runner() const { return run_batch<Oja>; }
 
     void operator()();
     virtual string to_string() const;
 
 protected:
-    const dtype alpha;
     const dtype beta;
 
     Signal pre_filtered;
     Signal post_filtered;
     Signal weights;
-    Signal delta;
 };
 
-class Voja: public Operator{
+class Voja: public LearningRule{
 public:
     Voja(
         Signal pre_decoded, Signal post_filtered, Signal scaled_encoders,
         Signal delta, Signal learning_signal, Signal scale,
         dtype learning_rate, dtype dt);
     virtual string classname() const { return "Voja"; }
+    virtual BatchRunner batch_runner() const { return run_batch<Voja>; }
 
     void operator()();
     virtual string to_string() const;
 
 protected:
-    const dtype alpha;
-
     Signal pre_decoded;
     Signal post_filtered;
     Signal scaled_encoders;
-    Signal delta;
     Signal learning_signal;
 
     Signal scale;
@@ -1,13 +1,82 @@
 #include "probe.hpp"
 
 Probe::Probe(Signal signal, dtype period)
-:signal(signal), period(period), data_index(0), time_index(0){
+:Probe(vector<Signal>{signal}, period){
 
 }
 
-void Probe::init_for_simulation(unsigned n_steps, unsigned flush_every_){
+ProbeReduction::ProbeReduction(string reduction_string)
+:ProbeReduction(){
+    vector<string> tokens;
+    boost::split(tokens, reduction_string, boost::is_any_of(":"));
 
-    if(!data.empty()){
+    if(tokens.size() != 3){
+        stringstream msg;
+        msg << "Probe reduction string " << reduction_string
+            << " does not have the form tau:window:across." << endl;
+        throw logic_error(msg.str());
+    }
+
+    try{
+        tau = boost::lexical_cast<dtype>(tokens[0]);
+    }catch(const boost::bad_lexical_cast& e){
+        stringstream msg;
+        msg << "Caught bad lexical cast while extracting the time constant of "
+            << "probe reduction " << reduction_string << " with error: " << e.what() << endl;
+        throw logic_error(msg.str());
+    }
+
+    const string windows[] = {"sample", "mean", "min", "max", "count"};
+    const string acrosses[] = {"none", "mean", "sum"};
+
+    auto index_of = [&](const string* names, int n_names, const string& name){
+        int index = find(names, names + n_names, name) - names;
+
+        if(index == n_names){
+            stringstream msg;
+            msg << "Probe reduction " << reduction_string
+                << " has an unknown reduction " << name << "." << endl;
+            throw logic_error(msg.str());
+        }
+
+        return index;
+    };
+
+    window = Window(index_of(windows, 5, tokens[1]));
+    across = Across(index_of(acrosses, 3, tokens[2]));
+}
+
+string ProbeReduction::to_string() const{
+    const char* windows[] = {"sample", "mean", "min", "max", "count"};
+    const char* acrosses[] = {"none", "mean", "sum"};
+
+    stringstream out;
+    out << tau << ":" << windows[window] << ":" << acrosses[across];
+    return out.str();
+}
+
+Probe::Probe(vector<Signal> trial_signals, dtype period)
+:Probe(trial_signals, period, ProbeReduction(), 1.0){
+
+}
+
+Probe::Probe(vector<Signal> trial_signals, dtype period, ProbeReduction reduction, dtype dt)
+:signal(trial_signals.at(0)), trial_signals(trial_signals), period(period),
+data_index(0), capacity(0), time_index(0), last_step(0), next_sample(0),
+flush_every(0), buffer_index(0), reduction(reduction),
+decay(reduction.tau > 0.0 ? exp(-dt / reduction.tau) : 0.0), window_steps(0){
+
+    if(!reduction.is_identity()){
+        unsigned n_values = signal.size * trial_signals.size();
+        current.resize(n_values, 0.0);
+        filtered.resize(reduction.tau > 0.0 ? n_values : 0, 0.0);
+        window_values.resize(n_values, 0.0);
+    }
+}
+
+void Probe::init_for_simulation(unsigned n_steps, unsigned flush_every_, unsigned n_buffers){
+
+    if(!buffers.empty()){
         stringstream error;
         error << "Probe must be empty before it can be initialized. "
               << "Call Probe.clear first";
@@ -15,35 +84,189 @@ void Probe::init_for_simulation(unsigned n_steps, unsigned flush_every_){
         throw logic_error(error.str());
     }
 
-    time_index = data_index;
+    // Samples continue to be taken at the same steps as if the
+    // previous simulations had not stopped.
+    time_index = last_step;
     data_index = 0;
+    next_sample = next_sample_after(time_index);
 
-    buffer.reset();
+    buffer_index = 0;
 
     flush_every = flush_every_;
-    if(flush_every > 0){
-        buffer = shared_ptr<dtype>(new dtype[signal.size * flush_every]);
-    }else{
-        buffer = shared_ptr<dtype>(NULL);
+    if(flush_every == 0){
+        n_buffers = 1;
     }
 
-    unsigned n_samples = (unsigned) floor(n_steps / period);
+    // The simulation may start part way through a period, so count the
+    // samples that are actually taken. A buffer is flushed at least
+    // every flush_every steps, so never holds more than flush_every samples.
+    unsigned n_samples = 0;
+    for(unsigned s = next_sample; s <= time_index + n_steps; s = next_sample_after(s)){
+        if(flush_every > 0 && n_samples == flush_every){
+            break;
+        }
 
-    if(flush_every > 0){
-        n_samples = min(n_samples, flush_every);
+        n_samples++;
     }
 
-    data.reserve(n_samples);
-    for(unsigned i = 0; i < n_samples; i++){
-        data.push_back(signal.deep_copy());
+    capacity = n_samples;
+    for(unsigned i = 0; i < n_buffers; i++){
+        buffers.push_back(shared_ptr<dtype>(
+            new dtype[max(sample_size() * capacity, 1u)], default_delete<dtype[]>()));
     }
 }
 
+unsigned Probe::next_sample_after(unsigned step) const{
+    if(period <= 1){
+        return step + 1;
+    }
+
+    // Candidate from the first multiple of the period past ``step'', then
+    // corrected so that rounding agrees with the definition using fmod.
+    unsigned k = (unsigned) floor(step / period) + 1;
+    unsigned next = max((unsigned) ceil(k * period), step + 1);
+
+    while(next > step + 1 && fmod(next - 1, period) < 1){
+        next--;
+    }
+
+    while(fmod(next, period) >= 1){
+        next++;
+    }
+
+    return next;
+}
+
 void Probe::gather(unsigned step){
-    if(fmod(step + time_index, period) < 1){
-        data[data_index].fill_with(signal);
+    last_step = step + time_index;
+
+    bool reduced = !reduction.is_identity();
+    if(reduced){
+        accumulate();
+    }
+
+    if(step + time_index >= next_sample){
+        if(data_index >= capacity){
+            throw logic_error("Probe is full. Flush it before gathering more data.");
+        }
+
+        dtype* sample = buffers[buffer_index].get() + data_index * sample_size();
+        if(reduced){
+            reduce_window(sample);
+        }else{
+            for(unsigned i = 0; i < trial_signals.size(); i++){
+                trial_signals[i].copy_to_buffer(sample + i * signal.size);
+            }
+        }
+
         data_index++;
+
+        next_sample = next_sample_after(step + time_index);
+    }
+}
+
+void Probe::read_values(){
+    for(unsigned i = 0; i < trial_signals.size(); i++){
+        trial_signals[i].copy_to_buffer(current.data() + i * signal.size);
+    }
+}
+
+void Probe::accumulate(){
+    // Only the values on the step of the sample are needed.
+    if(filtered.empty() && reduction.window == ProbeReduction::WINDOW_SAMPLE){
+        window_steps++;
+        return;
+    }
+
+    read_values();
+
+    const unsigned n_values = current.size();
+    const dtype* values = current.data();
+
+    if(!filtered.empty()){
+        for(unsigned j = 0; j < n_values; j++){
+            filtered[j] = decay * filtered[j] + (1.0 - decay) * current[j];
+        }
+
+        values = filtered.data();
+    }
+
+    switch(reduction.window){
+        case ProbeReduction::WINDOW_SAMPLE:
+            break;
+
+        case ProbeReduction::WINDOW_MEAN:
+            for(unsigned j = 0; j < n_values; j++){
+                window_values[j] += values[j];
+            }
+            break;
+
+        case ProbeReduction::WINDOW_MIN:
+            for(unsigned j = 0; j < n_values; j++){
+                window_values[j] = window_steps == 0 ? values[j] : min(window_values[j], values[j]);
+            }
+            break;
+
+        case ProbeReduction::WINDOW_MAX:
+            for(unsigned j = 0; j < n_values; j++){
+                window_values[j] = window_steps == 0 ? values[j] : max(window_values[j], values[j]);
+            }
+            break;
+
+        case ProbeReduction::WINDOW_COUNT:
+            for(unsigned j = 0; j < n_values; j++){
+                window_values[j] += values[j] != 0.0;
+            }
+            break;
     }
+
+    window_steps++;
+}
+
+void Probe::reduce_window(dtype* sample){
+    const unsigned n_values = window_values.size();
+
+    // The values of the window, in place of window_values where they are
+    // just those of the last step.
+    const dtype* values = window_values.data();
+
+    switch(reduction.window){
+        case ProbeReduction::WINDOW_SAMPLE:
+            if(filtered.empty()){
+                read_values();
+            }
+
+            values = filtered.empty() ? current.data() : filtered.data();
+            break;
+
+        case ProbeReduction::WINDOW_MEAN:
+            for(unsigned j = 0; j < n_values; j++){
+                window_values[j] /= max(window_steps, 1u);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    for(unsigned i = 0; i < trial_signals.size(); i++){
+        const dtype* trial_values = values + i * signal.size;
+
+        if(reduction.across == ProbeReduction::ACROSS_NONE){
+            copy(trial_values, trial_values + signal.size, sample + i * signal.size);
+            continue;
+        }
+
+        dtype sum = 0.0;
+        for(unsigned j = 0; j < signal.size; j++){
+            sum += trial_values[j];
+        }
+
+        sample[i] = reduction.across == ProbeReduction::ACROSS_MEAN ? sum / max(signal.size, 1u) : sum;
+    }
+
+    fill(window_values.begin(), window_values.end(), 0.0);
+    window_steps = 0;
 }
 
 shared_ptr<dtype> Probe::flush_to_buffer(unsigned &n_rows){
@@ -52,11 +275,8 @@ shared_ptr<dtype> Probe::flush_to_buffer(unsigned &n_rows){
             "Calling flush_to_buffer, but Probe has flush_every <= 0.");
     }
 
-    unsigned offset = 0;
-    for(unsigned i = 0; i < data_index; i++){
-        data[i].copy_to_buffer(buffer.get()+offset);
-        offset += data[i].size;
-    }
+    shared_ptr<dtype> buffer = buffers[buffer_index];
+    buffer_index = (buffer_index + 1) % buffers.size();
 
     n_rows = data_index;
     data_index = 0;
@@ -65,36 +285,60 @@ shared_ptr<dtype> Probe::flush_to_buffer(unsigned &n_rows){
 }
 
 vector<Signal> Probe::harvest_data(){
-    auto d = move(data);
-    clear();
+    unsigned n_rows;
+    shared_ptr<dtype> block = harvest_block(n_rows);
+
+    vector<Signal> d;
+    d.reserve(n_rows);
+
+    for(unsigned i = 0; i < n_rows; i++){
+        // Aliases the block, which lives as long as any of the rows.
+        shared_ptr<dtype> row(block, block.get() + i * sample_size());
+        d.push_back(Signal(sample_shape1(), sample_shape2(), row));
+    }
+
     return d;
 }
 
+shared_ptr<dtype> Probe::harvest_block(unsigned &n_rows){
+    shared_ptr<dtype> block;
+    if(!buffers.empty()){
+        block = buffers[buffer_index];
+    }
+
+    n_rows = data_index;
+    clear();
+
+    return block;
+}
+
 void Probe::clear(){
     data_index = 0;
-    data.clear();
+    buffers.clear();
 }
 
-void Probe::reset(){
+void Probe::reset(unsigned step){
     clear();
-    time_index = 0;
+    time_index = step;
+    last_step = step;
+
+    fill(filtered.begin(), filtered.end(), 0.0);
+    fill(window_values.begin(), window_values.end(), 0.0);
+    window_steps = 0;
 }
 
 string Probe::to_string() const{
     stringstream out;
     out << "Probe:" << endl;
     out << "period: " << period << endl;
-    out << "size: " << data.size() << endl;
+    out << "capacity: " << capacity << endl;
     out << "signal: " << signal << endl;
+    out << "n_trials: " << trial_signals.size() << endl;
+    out << "reduction: " << reduction.to_string() << endl;
     out << "data_index: " << data_index << endl;
     out << "time_index: " << time_index << endl;
-
-    /*
-    out << "data: " << endl;
-    for(unsigned i = 0; i < data.size(); i++){
-         out << "index: " << i << ", signal: " << data[i] << endl;
-    }
-    */
+    out << "last_step: " << last_step << endl;
+    out << "next_sample: " << next_sample << endl;
 
     return out.str();
 }
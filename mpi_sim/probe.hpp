@@ -3,6 +3,11 @@
 #include <vector>
 #include <memory>
 #include <cmath>
+#include <string>
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "signal.hpp"
 
@@ -12,24 +17,111 @@
 
 using namespace std;
 
+/* Samples of a probe taken out of the simulation: n_rows consecutive samples,
+ * each of shape1 x shape2 values, in row-major order. */
+struct ProbeBlock{
+    shared_ptr<dtype> data;
+    unsigned n_rows;
+    unsigned shape1;
+    unsigned shape2;
+
+    unsigned sample_size() const{ return shape1 * shape2; }
+};
+
+/* What a probe stores instead of the raw values of its signal, so that less
+ * data leaves the simulation. Each step, the values are filtered by a lowpass
+ * synapse with time constant ``tau'' (if positive), and then combined over
+ * the ``window'' of steps since the last sample: the value on the step of the
+ * sample, or the mean, min or max of the window, or the number of steps in
+ * it on which each value was non-zero (the spike count of a neuron). Each
+ * sample can then be combined ``across'' the values into their mean or sum,
+ * such as the mean activity of a population.
+ *
+ * Read from strings of the form "tau:window:across", such as "0.01:mean:none". */
+struct ProbeReduction{
+    enum Window{ WINDOW_SAMPLE, WINDOW_MEAN, WINDOW_MIN, WINDOW_MAX, WINDOW_COUNT };
+    enum Across{ ACROSS_NONE, ACROSS_MEAN, ACROSS_SUM };
+
+    ProbeReduction(): tau(0.0), window(WINDOW_SAMPLE), across(ACROSS_NONE){}
+    ProbeReduction(string reduction_string);
+
+    // Whether samples are the raw values of the signal.
+    bool is_identity() const{
+        return tau <= 0.0 && window == WINDOW_SAMPLE && across == ACROSS_NONE;
+    }
+
+    string to_string() const;
+
+    dtype tau;
+    Window window;
+    Across across;
+};
+
+/* Records the value of a signal at regular intervals. Samples are stored as
+ * consecutive rows of a single preallocated block, in row-major order, so
+ * the block can be written out or sent as it is. When several trials are
+ * simulated at once, the probe records the signal of every trial, and each
+ * sample holds the values of the trials one after another.
+ *
+ * With a reduction, the probe looks at its signal every step, and each
+ * sample holds the reduced values (see ProbeReduction). The state of the
+ * filter and of the current window starts over when the probe is reset. */
 class Probe {
 public:
     Probe(Signal signal, dtype period);
-    void init_for_simulation(unsigned n_steps, unsigned flush_every_);
+
+    // Record the same signal in each of several trials, given in trial order.
+    Probe(vector<Signal> trial_signals, dtype period);
+
+    // Record reduced values of the signals, in a simulation with time step dt.
+    Probe(vector<Signal> trial_signals, dtype period, ProbeReduction reduction, dtype dt);
+
+    /* Prepare for a simulation of n_steps steps. If flush_every_ is non-zero,
+     * the probe holds at most that many samples before it must be flushed,
+     * and flushes into one of n_buffers blocks, taking them in turn. With
+     * n_buffers > 1, a block returned by flush_to_buffer is not overwritten
+     * until the next n_buffers - 1 flushes have been made, so it can be
+     * written out while the simulation continues. */
+    void init_for_simulation(unsigned n_steps, unsigned flush_every_, unsigned n_buffers=1);
 
     void gather(unsigned n_steps);
 
+    // Returns the block holding the samples collected since the last flush,
+    // and starts filling the next block. n_rows is set to the number of samples.
     shared_ptr<dtype> flush_to_buffer(unsigned &n_rows);
 
-    // Gives up data currently stored in probe.
+    // Gives up data currently stored in probe, as views into its block.
     // After this call, the probe will be empty.
     vector<Signal> harvest_data();
 
+    // Same as harvest_data, but gives up the block itself, holding n_rows samples.
+    shared_ptr<dtype> harvest_block(unsigned &n_rows);
+
     /* Makes sure the probe's buffer is empty. May be called multiple times in a single simulation. */
     void clear();
 
-    /* Reset the probe. Only called between simulations. */
-    void reset();
+    /* Reset the probe, to the state it would be in after ``step'' steps of
+     * simulation from the last reset of the simulator (which is only non-zero
+     * when restoring a checkpoint). Only called between simulations. */
+    void reset(unsigned step=0);
+
+    Signal get_signal() const{ return signal; }
+    const vector<Signal>& get_trial_signals() const{ return trial_signals; }
+
+    // Shape of each sample: the shape of the signal, or with more than one
+    // trial, (number of trials, size of the signal).
+    // A reduction across the values leaves one value per trial.
+    unsigned sample_shape1() const{
+        return trial_signals.size() > 1 ? trial_signals.size() : (reduces_across() ? 1 : signal.shape1);
+    }
+
+    unsigned sample_shape2() const{
+        return trial_signals.size() > 1 ? trial_size() : (reduces_across() ? 1 : signal.shape2);
+    }
+
+    unsigned sample_size() const{ return trial_size() * trial_signals.size(); }
+
+    const ProbeReduction& get_reduction() const{ return reduction; }
 
     string to_string() const;
 
@@ -39,23 +131,63 @@ public:
     }
 
 protected:
-    // The data we've collected so far
-    vector<Signal> data;
+    // The first step after ``step'' on which a sample is taken. A sample is
+    // taken on step t if fmod(t, period) < 1.
+    unsigned next_sample_after(unsigned step) const;
+
+    bool reduces_across() const{ return reduction.across != ProbeReduction::ACROSS_NONE; }
+
+    // Number of values that each trial contributes to a sample.
+    unsigned trial_size() const{ return reduces_across() ? 1 : signal.size; }
+
+    // Copy the values of every trial on this step into ``current''.
+    void read_values();
+
+    // Add the values of this step to the window, filtering them first.
+    void accumulate();
 
-    // The signal to record
+    // Write the reduced values of the window to ``sample'', and start a new window.
+    void reduce_window(dtype* sample);
+
+    // The signal to record, and the same signal in every trial (starting with
+    // ``signal'' itself).
     Signal signal;
-    bool signal_contiguous;
+    vector<Signal> trial_signals;
 
     // How frequently to sample the recorded signal
     dtype period;
 
-    // The index of the next location to write to in the data vector.
+    // The index of the next row to write to in the current block.
     unsigned data_index;
 
-    // The current time index in the simulation.
+    // Number of rows in each block.
+    unsigned capacity;
+
+    // The number of steps simulated before the current simulation,
+    // since the last reset.
     unsigned time_index;
 
+    // The last step, counting from the last reset, that has been simulated.
+    unsigned last_step;
+
+    // The step, offset by time_index, on which the next sample is taken.
+    unsigned next_sample;
+
     unsigned flush_every;
 
-    shared_ptr<dtype> buffer;
+    vector<shared_ptr<dtype>> buffers;
+    unsigned buffer_index;
+
+    ProbeReduction reduction;
+
+    // Fraction of the filter's state kept each step, exp(-dt / tau).
+    dtype decay;
+
+    // For reductions, the values of every trial on this step, the state of
+    // the filter, and the combined values of the current window.
+    vector<dtype> current;
+    vector<dtype> filtered;
+    vector<dtype> window_values;
+
+    unsigned window_steps;
 };
@@ -0,0 +1,52 @@
+#include "progress.hpp"
+
+ProgressReporter::ProgressReporter(unsigned n_steps, bool bar)
+:n_steps(n_steps), bar(bar), eta(n_steps), n_reported(0), next_line(0), n_done(0),
+stopping(false){
+
+    if(bar){
+        eta.start();
+    }
+
+    reporter = thread(&ProgressReporter::reporter_loop, this);
+}
+
+ProgressReporter::~ProgressReporter(){
+    {
+        lock_guard<mutex> lock(stop_mutex);
+        stopping = true;
+    }
+
+    stop_requested.notify_one();
+    reporter.join();
+
+    report(n_done.load());
+}
+
+void ProgressReporter::reporter_loop(){
+    unique_lock<mutex> lock(stop_mutex);
+
+    while(!stopping){
+        report(n_done.load(memory_order_relaxed));
+
+        stop_requested.wait_for(
+            lock, chrono::duration<double>(PROGRESS_INTERVAL), [this]{ return stopping; });
+    }
+}
+
+void ProgressReporter::report(unsigned done){
+    if(bar){
+        if(done > n_reported){
+            eta.cur = done;
+            eta.setPct(float(done) / n_steps);
+        }
+    }else{
+        // The step after the last one done has begun, if there is one.
+        while(next_line <= done && next_line < n_steps){
+            cout << "Master beginning step: " << next_line << endl;
+            next_line += PROGRESS_LINE_EVERY;
+        }
+    }
+
+    n_reported = done;
+}
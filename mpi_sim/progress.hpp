@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+
+#include "ezProgressBar-2.1.1/ezETAProgressBar.hpp"
+
+using namespace std;
+
+// Steps between the lines that say which step the master is beginning.
+const unsigned PROGRESS_LINE_EVERY = 100;
+
+// Seconds between reports of the progress of a simulation.
+const double PROGRESS_INTERVAL = 0.1;
+
+/* Reports the progress of a simulation on the master from a background
+ * thread, so that writing to the terminal never holds up a step; the steps
+ * only count themselves, with ``step_done''. The progress is either shown as
+ * a progress bar, or as a line for each PROGRESS_LINE_EVERY'th step, saying
+ * that the master is beginning that step.
+ *
+ * The thread wakes every PROGRESS_INTERVAL seconds, and reports every step
+ * that was done since it last woke, so the output is the same as if it was
+ * written by the steps themselves, only later. The steps done are reported
+ * one last time when the reporter is destroyed. */
+class ProgressReporter{
+
+public:
+    ProgressReporter(unsigned n_steps, bool bar);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator= (const ProgressReporter&) = delete;
+
+    // Only called from one thread at a time.
+    void step_done(){
+        n_done.store(n_done.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+private:
+    void reporter_loop();
+
+    // Report the steps done since the last report.
+    void report(unsigned done);
+
+    unsigned n_steps;
+    bool bar;
+
+    ez::ezETAProgressBar eta;
+    unsigned n_reported;
+    unsigned next_line;
+
+    atomic<unsigned> n_done;
+
+    thread reporter;
+    mutex stop_mutex;
+    condition_variable stop_requested;
+    bool stopping;
+};
@@ -1,8 +1,30 @@
 #include "psim_log.hpp"
 
 ParallelSimulationLog::ParallelSimulationLog(
-    unsigned n_processors, unsigned processor, vector<ProbeSpec> probe_info, dtype dt, MPI_Comm comm)
-:SimulationLog(probe_info, dt), n_processors(n_processors), processor(processor), comm(comm){}
+    ComponentMapping mapping, unsigned processor, vector<ProbeSpec> probe_info, dtype dt, MPI_Comm comm,
+    LogOptions options)
+:SimulationLog(probe_info, dt, options), mapping(mapping), processor(processor),
+comm(comm), spike_comm(MPI_COMM_NULL){
+
+    // Parallel HDF5 can only apply filters to datasets that are written collectively.
+    collective = options.collective_io || options.compression.compare("none") != 0;
+
+#if !H5_VERSION_GE(1, 10, 2)
+    if(options.compression.compare("none") != 0){
+        throw runtime_error(
+            "Compressing a parallel simulation log requires HDF5 1.10.2 or later.");
+    }
+#endif
+}
+
+ParallelSimulationLog::~ParallelSimulationLog(){
+    int finalized;
+    MPI_Finalized(&finalized);
+
+    if(!finalized && spike_comm != MPI_COMM_NULL){
+        MPI_Comm_free(&spike_comm);
+    }
+}
 
 // Master version
 void ParallelSimulationLog::prep_for_simulation(string fn, unsigned n_steps){
@@ -57,55 +79,154 @@ void ParallelSimulationLog::prep_for_simulation(){
 }
 
 void ParallelSimulationLog::setup_hdf5(unsigned n_steps){
-    hid_t dset_id, dataspace_id, plist_id, att_id, att_dataspace_id;
+    hid_t dset_id, dataspace_id, plist_id;
+
+    // Hints to MPI-IO. Collective writes are aggregated by io_ranks processes.
+    MPI_Info info;
+    MPI_Info_create(&info);
+
+    if(collective){
+        MPI_Info_set(info, (char*)"romio_cb_write", (char*)"enable");
+    }
+
+    if(options.io_ranks > 0){
+        string cb_nodes = to_string(options.io_ranks);
+        MPI_Info_set(info, (char*)"cb_nodes", (char*)cb_nodes.c_str());
+    }
 
     // Set up file access property list with parallel I/O access
     plist_id = H5Pcreate(H5P_FILE_ACCESS);
-    H5Pset_fapl_mpio(plist_id, comm, MPI_INFO_NULL);
+    H5Pset_fapl_mpio(plist_id, comm, info);
 
     // Create a new file collectively and release property list identifier.
     file_id = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, plist_id);
     H5Pclose(plist_id);
-
-    hid_t str_type = H5Tcopy(H5T_C_S1);
-    H5Tset_size(str_type, MAX_PROBE_NAME_LENGTH);
-    H5Tset_strpad(str_type, H5T_STR_NULLTERM);
+    MPI_Info_free(&info);
 
     for(ProbeSpec ps : probe_info){
-        hsize_t dset_dims[] = {n_steps, ps.signal_spec.shape1};
+        dset_id = create_probe_dataset(ps, n_steps, dataspace_id);
 
-        // Create the dataspace for the dataset.
-        dataspace_id = H5Screate_simple(2, dset_dims, NULL);
+        // Create property list for dataset writes.
+        plist_id = H5Pcreate(H5P_DATASET_XFER);
+        H5Pset_dxpl_mpio(plist_id, collective ? H5FD_MPIO_COLLECTIVE : H5FD_MPIO_INDEPENDENT);
 
-        string dspace_key = to_string(ps.probe_key);
+        HDF5Dataset d(ps.name, ps.n_cols(), dset_id, dataspace_id, plist_id);
 
-        // Create the dataset with default properties
-        dset_id = H5Dcreate(
-            file_id, dspace_key.c_str(), H5T_NATIVE_DOUBLE, dataspace_id,
-            H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if(unsigned(mapping.process_of(ps.component)) == processor){
+            dset_map[ps.probe_key] = d;
+        }
 
-        // Set the ``name'' attribute of the dataset so we know which probe the data came from
-        att_dataspace_id  = H5Screate(H5S_SCALAR);
-        att_id = H5Acreate2(dset_id, "name", str_type, att_dataspace_id, H5P_DEFAULT, H5P_DEFAULT);
-        H5Awrite(att_id, str_type, ps.name.substr(0, MAX_PROBE_NAME_LENGTH).c_str());
+        datasets.push_back(d);
+    }
 
-        H5Sclose(att_dataspace_id);
-        H5Aclose(att_id);
+    closed = false;
+}
 
-        // Create property list for independent dataset write.
-        plist_id = H5Pcreate(H5P_DATASET_XFER);
-        H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
+void ParallelSimulationLog::set_spike_probes(const set<key_type>& keys){
+    SimulationLog::set_spike_probes(keys);
 
-        HDF5Dataset d(ps.name, ps.signal_spec.shape1, dset_id, dataspace_id, plist_id);
+    // The writes may be made from a background thread (see AsyncLogWriter).
+    if(!spike_probes.empty() && spike_comm == MPI_COMM_NULL){
+        MPI_Comm_dup(comm, &spike_comm);
+    }
+}
 
-        if(ps.component % n_processors == processor){
-            dset_map[ps.probe_key] = d;
+void ParallelSimulationLog::write_batch(const vector<ProbeWrite>& writes){
+    map<key_type, const ProbeWrite*> write_map;
+    for(auto& w: writes){
+        if(dset_map.find(w.probe_key) == dset_map.end()){
+            stringstream msg;
+            msg << "Invalid probe key: " << w.probe_key << "." << endl;
+            throw out_of_range(msg.str());
         }
 
-        datasets.push_back(d);
+        write_map[w.probe_key] = &w;
     }
 
-    closed = false;
+    if(!spike_probes.empty()){
+        write_spike_events(write_map);
+    }
+
+    if(!collective){
+        for(auto& w: writes){
+            if(!spike_probes.count(w.probe_key)){
+                write(w.probe_key, w.buffer, w.n_rows);
+            }
+        }
+
+        return;
+    }
+
+    // All processors visit the datasets in the same order. Those that
+    // do not own a dataset take part in its write with an empty selection.
+    for(unsigned i = 0; i < probe_info.size(); i++){
+        key_type probe_key = probe_info[i].probe_key;
+
+        if(spike_probes.count(probe_key)){
+            continue;
+        }
+
+        auto w = write_map.find(probe_key);
+        if(w != write_map.end()){
+            write(probe_key, w->second->buffer, w->second->n_rows);
+        }else{
+            HDF5Dataset& d = datasets[i];
+
+            hsize_t dims[3];
+            int n_dims = probe_dims(1, max(d.n_cols, 1u), dims);
+            hid_t memspace_id = H5Screate_simple(n_dims, dims, NULL);
+            H5Sselect_none(memspace_id);
+            H5Sselect_none(d.dataspace_id);
+
+            dtype dummy[1];
+            H5Dwrite(
+                d.dset_id, H5T_NATIVE_DTYPE, memspace_id, d.dataspace_id,
+                d.plist_id, dummy);
+
+            H5Sclose(memspace_id);
+        }
+    }
+}
+
+void ParallelSimulationLog::write_spike_events(
+        const map<key_type, const ProbeWrite*>& write_map){
+
+    // The dataset of every spike probe is extended by every processor,
+    // so they all need to know how many events each one gets.
+    vector<vector<unsigned>> events(probe_info.size());
+    vector<unsigned long long> n_events(probe_info.size(), 0);
+
+    for(unsigned i = 0; i < probe_info.size(); i++){
+        key_type probe_key = probe_info[i].probe_key;
+        auto w = write_map.find(probe_key);
+
+        if(spike_probes.count(probe_key) && w != write_map.end()){
+            find_spike_events(
+                dset_map.at(probe_key), w->second->buffer.get(), w->second->n_rows, events[i]);
+            n_events[i] = events[i].size() / spike_event_size();
+        }
+    }
+
+    MPI_Allreduce(
+        MPI_IN_PLACE, n_events.data(), n_events.size(),
+        MPI_UNSIGNED_LONG_LONG, MPI_SUM, spike_comm);
+
+    for(unsigned i = 0; i < probe_info.size(); i++){
+        key_type probe_key = probe_info[i].probe_key;
+
+        if(!spike_probes.count(probe_key)){
+            continue;
+        }
+
+        auto w = write_map.find(probe_key);
+        if(w != write_map.end()){
+            HDF5Dataset& d = dset_map.at(probe_key);
+            append_spike_events(d, events[i], n_events[i], collective);
+            d.row_offset += w->second->n_rows;
+        }else{
+            append_spike_events(datasets[i], events[i], n_events[i], collective);
+        }
+    }
 }
 
 void ParallelSimulationLog::write_file(
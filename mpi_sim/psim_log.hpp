@@ -11,6 +11,7 @@
 
 #include "sim_log.hpp"
 #include "spec.hpp"
+#include "mapping.hpp"
 
 #include "typedef.hpp"
 #include "debug.hpp"
@@ -18,14 +19,23 @@
 
 // A parallel version of SimulationLog. Represents an HDF5 file to which we
 // write data collected throughout the simulation. All processors have access
-// to the same file, and all processors can write to it independently.
+// to the same file, and write to it either independently, or collectively if
+// the log options ask for collective I/O or compression. In the collective
+// case every processor takes part in the write of every dataset, so all
+// processors must call write_batch the same number of times. The same goes
+// for logs with spike probes, whose datasets every processor extends.
 class ParallelSimulationLog: public SimulationLog{
 public:
-    ParallelSimulationLog(){};
+    ParallelSimulationLog(): spike_comm(MPI_COMM_NULL){};
 
     ParallelSimulationLog(
-        unsigned n_processors, unsigned processor,
-        vector<ProbeSpec> probe_info, dtype dt, MPI_Comm comm);
+        ComponentMapping mapping, unsigned processor,
+        vector<ProbeSpec> probe_info, dtype dt, MPI_Comm comm,
+        LogOptions options=LogOptions());
+
+    ~ParallelSimulationLog();
+
+    void set_spike_probes(const set<key_type>& keys) override;
 
     // Called by master
     void prep_for_simulation(string fn, unsigned n_steps);
@@ -38,13 +48,25 @@ public:
     // processors can write simulation results to.
     void setup_hdf5(unsigned n_steps);
 
+    void write_batch(const vector<ProbeWrite>& writes) override;
+
     virtual void write_file(string filename_suffix, unsigned rank, unsigned max_buffer_size, string data);
 
 protected:
-    unsigned n_processors;
+    // Write the events of the spike probes in a batch, which every
+    // processor takes part in. Called by write_batch.
+    void write_spike_events(const map<key_type, const ProbeWrite*>& write_map);
+
+    bool collective;
+
+    ComponentMapping mapping;
     unsigned processor;
     MPI_Comm comm;
 
+    // Duplicate of comm used to agree on the number of spike events, so that
+    // it doesn't interfere with communication made by the simulation.
+    MPI_Comm spike_comm;
+
     unsigned mpi_rank;
     unsigned mpi_size;
 };
@@ -0,0 +1,188 @@
+#include "realtime.hpp"
+
+// Laid out as MPI_DOUBLE_INT expects.
+struct BusyProcess{
+    double busy;
+    int rank;
+};
+
+RealtimePacer::RealtimePacer(double period)
+:period(period), due(0.0), next_due(0.0){
+
+}
+
+unsigned RealtimePacer::add_class(string name, bool blamed){
+    auto found = class_ids.find(name);
+    if(found != class_ids.end()){
+        return found->second;
+    }
+
+    unsigned id = class_names.size();
+    class_names.push_back(name);
+    class_blamed.push_back(blamed);
+    class_ids[name] = id;
+    class_seconds.push_back(0.0);
+
+    return id;
+}
+
+void RealtimePacer::begin_run(MPI_Comm comm){
+    if(comm != MPI_COMM_NULL){
+        MPI_Barrier(comm);
+    }
+
+    next_due = wall_time();
+
+    latencies.clear();
+    busy.clear();
+    busiest_class.clear();
+}
+
+void RealtimePacer::begin_step(){
+    double now = wall_time();
+
+    if(now < next_due - REALTIME_SPIN){
+        chrono::duration<double> wake(next_due - REALTIME_SPIN);
+        this_thread::sleep_until(chrono::steady_clock::time_point(
+            chrono::duration_cast<chrono::steady_clock::duration>(wake)));
+    }
+
+    while(now < next_due){
+        now = wall_time();
+    }
+
+    due = max(next_due, now);
+    next_due = due + period;
+
+    fill(class_seconds.begin(), class_seconds.end(), 0.0);
+}
+
+void RealtimePacer::end_step(double wait){
+    double latency = wall_time() - due;
+
+    latencies.push_back(latency);
+    busy.push_back(latency - wait);
+
+    int busiest = -1;
+    for(unsigned c = 0; c < class_seconds.size(); c++){
+        if(class_blamed[c] && class_seconds[c] > 0.0 &&
+                (busiest < 0 || class_seconds[c] > class_seconds[busiest])){
+            busiest = c;
+        }
+    }
+
+    busiest_class.push_back(busiest);
+}
+
+// Gather ``data'' from every process in comm on process 0, in order of rank.
+static vector<string> gather_strings(const string& data, MPI_Comm comm){
+    if(comm == MPI_COMM_NULL){
+        return vector<string>(1, data);
+    }
+
+    int rank, n_processors;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_processors);
+
+    int size = data.size();
+    vector<int> sizes(n_processors), offsets(n_processors + 1, 0);
+    MPI_Gather(&size, 1, MPI_INT, sizes.data(), 1, MPI_INT, 0, comm);
+
+    for(int p = 0; p < n_processors; p++){
+        offsets[p+1] = offsets[p] + sizes[p];
+    }
+
+    vector<char> gathered(max(offsets.back(), 1));
+    MPI_Gatherv(
+        data.data(), size, MPI_CHAR,
+        gathered.data(), sizes.data(), offsets.data(), MPI_CHAR, 0, comm);
+
+    vector<string> strings;
+    if(rank == 0){
+        for(int p = 0; p < n_processors; p++){
+            strings.push_back(string(gathered.data() + offsets[p], sizes[p]));
+        }
+    }
+
+    return strings;
+}
+
+// The smallest latency that at least ``fraction'' of the steps are within.
+static double percentile(const vector<double>& sorted, double fraction){
+    unsigned rank = unsigned(ceil(fraction * sorted.size()));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+string RealtimePacer::report(MPI_Comm comm) const{
+    int rank = 0;
+    if(comm != MPI_COMM_NULL){
+        MPI_Comm_rank(comm, &rank);
+    }
+
+    const unsigned n_steps = latencies.size();
+    vector<double> slowest(latencies);
+    vector<BusyProcess> local(n_steps), busiest(n_steps);
+
+    for(unsigned i = 0; i < n_steps; i++){
+        local[i].busy = busy[i];
+        local[i].rank = rank;
+        busiest[i] = local[i];
+    }
+
+    // Every process needs to know which steps missed, and who is to blame.
+    if(comm != MPI_COMM_NULL && n_steps > 0){
+        MPI_Allreduce(latencies.data(), slowest.data(), n_steps, MPI_DOUBLE, MPI_MAX, comm);
+        MPI_Allreduce(local.data(), busiest.data(), n_steps, MPI_DOUBLE_INT, MPI_MAXLOC, comm);
+    }
+
+    // The misses pinned on this process, by class of operator.
+    map<string, unsigned> class_misses;
+    unsigned n_misses = 0;
+
+    for(unsigned i = 0; i < n_steps; i++){
+        if(slowest[i] <= period){
+            continue;
+        }
+
+        n_misses++;
+
+        if(busiest[i].rank == rank){
+            int c = busiest_class[i];
+            class_misses[c < 0 ? "untimed operators" : class_names[c]]++;
+        }
+    }
+
+    stringstream misses;
+    for(auto& kv: class_misses){
+        misses << "  Rank " << rank << ", " << kv.first << ": " << kv.second << endl;
+    }
+
+    vector<string> all_misses = gather_strings(misses.str(), comm);
+
+    if(rank != 0 || n_steps == 0){
+        return "";
+    }
+
+    vector<double> sorted(slowest);
+    sort(sorted.begin(), sorted.end());
+
+    stringstream out;
+    out << setprecision(4);
+    out << "Real-time steps of " << period * 1e3 << " ms, latency p50: "
+        << percentile(sorted, 0.5) * 1e3 << " ms, p99: "
+        << percentile(sorted, 0.99) * 1e3 << " ms, max: "
+        << sorted.back() * 1e3 << " ms." << endl;
+    out << "Deadlines missed: " << n_misses << " of " << n_steps << " steps ("
+        << 100.0 * n_misses / n_steps << "%)." << endl;
+
+    if(n_misses > 0){
+        out << "Deadlines missed by the busiest process in the step, "
+            "and the operators it spent the most time in:" << endl;
+
+        for(const string& s: all_misses){
+            out << s;
+        }
+    }
+
+    return out.str();
+}
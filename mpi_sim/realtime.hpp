@@ -0,0 +1,78 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+#include <mpi.h>
+
+#include "trace.hpp"
+
+using namespace std;
+
+/* Seconds before a step is due that the pacer stops sleeping, and spins
+ * until the step is due instead, since the thread can wake up late by about
+ * this much. */
+const double REALTIME_SPIN = 100e-6;
+
+/* Paces the steps of a simulation to wall-clock time (see
+ * SimulatorConfig::realtime), and measures how well they keep to it. Each
+ * step is due ``period'' seconds after the one before it, and begins once it
+ * is due; a step that begins late moves the ones after it back, so they don't
+ * run early to catch up. The latency of a step is the time from when it was
+ * due until it ended, and the step misses its deadline if its latency, on the
+ * slowest process, is longer than the period.
+ *
+ * The time that a step spends in each class of operator can be charged to it.
+ * A missed deadline is then pinned on the process that was busiest in the
+ * step, not counting its MPI waits, and on the class of operator that process
+ * spent the most time in, or on "untimed operators" if none was charged. */
+class RealtimePacer{
+
+public:
+    RealtimePacer(double period);
+
+    /* Returns the id of an operator class, registering it if it is new. Time
+     * charged to a class that isn't ``blamed'', such as MPI operators that
+     * mostly wait for other processes, never makes it the class of a miss. */
+    unsigned add_class(string name, bool blamed=true);
+
+    /* Start pacing from now. If comm is not null, every process in it must
+     * call this, and they all start at the same moment. */
+    void begin_run(MPI_Comm comm);
+
+    // Wait until the next step is due.
+    void begin_step();
+
+    void charge(unsigned op_class, double seconds){ class_seconds[op_class] += seconds; }
+
+    // End the step, which spent ``wait'' seconds waiting for MPI messages.
+    void end_step(double wait);
+
+    /* The latency of the steps since begin_run, over every process in comm,
+     * and the deadlines that were missed. Every process in comm must call
+     * this, with as many steps; only process 0 gets the report. */
+    string report(MPI_Comm comm) const;
+
+private:
+    double period;
+    double due;
+    double next_due;
+
+    vector<string> class_names;
+    vector<bool> class_blamed;
+    map<string, unsigned> class_ids;
+    vector<double> class_seconds;
+
+    vector<double> latencies;
+    vector<double> busy;
+
+    // The blamed class that each step spent the most time in, or -1 if none.
+    vector<int> busiest_class;
+};
@@ -0,0 +1,46 @@
+#include <cmath>
+
+#include "rng.hpp"
+
+// A double in (0, 1) from 53 of the bits of two words.
+static inline double open_uniform(uint32_t hi, uint32_t lo){
+    uint64_t bits = ((uint64_t(hi) << 32) | lo) >> 11;
+    return (double(bits) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Each block of four words gives a pair of normals by the Box-Muller
+// transform. The loop has no branches or state carried between blocks, so
+// the blocks are independent and the compiler is free to vectorize it.
+void RandomStream::normals(uint64_t draw, dtype mean, dtype std, dtype* out, unsigned n) const{
+    const double two_pi = 6.283185307179586;
+    const unsigned n_pairs = n / 2;
+
+    for(unsigned i = 0; i < n_pairs; i++){
+        uint32_t words[4];
+        block(draw, 0, i, words);
+
+        double r = sqrt(-2.0 * log(open_uniform(words[0], words[1])));
+        double theta = two_pi * open_uniform(words[2], words[3]);
+
+        out[2 * i] = mean + std * dtype(r * cos(theta));
+        out[2 * i + 1] = mean + std * dtype(r * sin(theta));
+    }
+
+    if(n % 2){
+        uint32_t words[4];
+        block(draw, 0, n_pairs, words);
+
+        double r = sqrt(-2.0 * log(open_uniform(words[0], words[1])));
+        double theta = two_pi * open_uniform(words[2], words[3]);
+
+        out[n - 1] = mean + std * dtype(r * cos(theta));
+    }
+}
+
+unsigned RandomStream::uniform_int(uint64_t draw, uint32_t element, unsigned n) const{
+    uint32_t words[4];
+    block(draw, 1, element, words);
+
+    unsigned i = unsigned(open_uniform(words[0], words[1]) * n);
+    return i < n ? i : n - 1;
+}
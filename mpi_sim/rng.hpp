@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "typedef.hpp"
+
+using namespace std;
+
+/* The Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+ * numbers: as easy as 1, 2, 3", 2011). Each (counter, key) pair maps to four
+ * random words on its own, so any value of a stream can be computed without
+ * generating the ones before it, and nothing is shared between callers. */
+inline void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]){
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for(int round = 0; round < 10; round++){
+        uint64_t p0 = uint64_t(0xD2511F53) * c0;
+        uint64_t p1 = uint64_t(0xCD9E8D57) * c2;
+
+        uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+
+        c0 = n0;
+        c1 = uint32_t(p1);
+        c2 = n2;
+        c3 = uint32_t(p0);
+
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/* A stream of random numbers keyed by a seed and the identity of what draws
+ * from it, such as the index of an operator. Values are addressed by a draw
+ * (typically the step they are used on) and their position within the draw,
+ * so they don't depend on how many processes or threads a network is
+ * simulated with, on the order operators are called in, or on which other
+ * operators share a process. Drawing doesn't change the stream, so it can be
+ * shared freely between threads. */
+class RandomStream{
+public:
+    RandomStream(): key{0, 0}{}
+    RandomStream(uint32_t seed, uint32_t stream): key{seed, stream}{}
+
+    // Normally distributed values out[0], ..., out[n - 1], the first n values of ``draw''.
+    void normals(uint64_t draw, dtype mean, dtype std, dtype* out, unsigned n) const;
+
+    // A uniformly distributed integer in [0, n), the value at ``element'' of ``draw''.
+    unsigned uniform_int(uint64_t draw, uint32_t element, unsigned n) const;
+
+protected:
+    // The four words of a block of a draw. Normals and integers are
+    // taken from separate lanes, so they never reuse each other's words.
+    void block(uint64_t draw, uint32_t lane, uint32_t index, uint32_t out[4]) const{
+        uint32_t counter[4] = {index, lane, uint32_t(draw), uint32_t(draw >> 32)};
+        philox4x32(counter, key, out);
+    }
+
+    uint32_t key[2];
+};
+
+// Identifies an operator by its index in the streams it draws from.
+inline uint32_t stream_id(float index){
+    uint32_t id;
+    memcpy(&id, &index, sizeof(id));
+    return id;
+}
@@ -1,8 +1,8 @@
 #include "sim_log.hpp"
 
 
-SimulationLog::SimulationLog(vector<ProbeSpec> probe_info, dtype dt)
-:probe_info(probe_info), dt(dt), ready_for_simulation(false), closed(true){
+SimulationLog::SimulationLog(vector<ProbeSpec> probe_info, dtype dt, LogOptions options)
+:probe_info(probe_info), dt(dt), options(options), ready_for_simulation(false), closed(true){
 }
 
 SimulationLog::SimulationLog(dtype dt)
@@ -27,65 +27,136 @@ void SimulationLog::prep_for_simulation(){
         "Calling prep_for_simulation with no arguments on non-parallel simulation log.");
 }
 
+void SimulationLog::set_spike_probes(const set<key_type>& keys){
+    if(options.spike_events){
+        spike_probes = keys;
+    }
+}
+
 void SimulationLog::setup_hdf5(unsigned n_steps){
-    hid_t dset_id, dataspace_id, plist_id, att_id, att_dataspace_id;
+    hid_t dset_id, dataspace_id;
 
     // Create a new file collectively and release property list identifier.
     file_id = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
 
-    hid_t str_type = H5Tcopy(H5T_C_S1);
-    H5Tset_size(str_type, MAX_PROBE_NAME_LENGTH);
-    H5Tset_strpad(str_type, H5T_STR_NULLTERM);
-
     for(ProbeSpec ps : probe_info){
-        hsize_t dset_dims[] = {n_steps, ps.signal_spec.shape1};
+        dset_id = create_probe_dataset(ps, n_steps, dataspace_id);
 
-        // Create the dataspace for the dataset.
-        dataspace_id = H5Screate_simple(2, dset_dims, NULL);
+        HDF5Dataset d(ps.name, ps.n_cols(), dset_id, dataspace_id);
+
+        dset_map[ps.probe_key] = d;
+        datasets.push_back(d);
+    }
+}
 
-        string dspace_key = to_string(ps.probe_key);
+template<typename T>
+static void write_scalar_attribute(hid_t dset_id, string name, hid_t type, const T& value){
+    hid_t att_dataspace_id = H5Screate(H5S_SCALAR);
+    hid_t att_id = H5Acreate2(
+        dset_id, name.c_str(), type, att_dataspace_id, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(att_id, type, &value);
 
-        // Create the dataset with default properties
-        dset_id = H5Dcreate2(
-            file_id, dspace_key.c_str(), H5T_NATIVE_DOUBLE, dataspace_id,
-            H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Sclose(att_dataspace_id);
+    H5Aclose(att_id);
+}
 
-        // Set the ``name'' attribute of the dataset so we know which probe the data came from
-        att_dataspace_id  = H5Screate(H5S_SCALAR);
-        att_id = H5Acreate2(dset_id, "name", str_type, att_dataspace_id, H5P_DEFAULT, H5P_DEFAULT);
-        H5Awrite(att_id, str_type, ps.name.substr(0, MAX_PROBE_NAME_LENGTH).c_str());
+hid_t SimulationLog::create_probe_dataset(
+        const ProbeSpec& ps, unsigned n_steps, hid_t& dataspace_id) const{
 
-        H5Sclose(att_dataspace_id);
-        H5Aclose(att_id);
+    hid_t dset_id, create_plist_id;
 
-        HDF5Dataset d(ps.name, ps.signal_spec.shape1, dset_id, dataspace_id);
+    string dspace_key = to_string(ps.probe_key);
+    unsigned n_cols = ps.n_cols();
+    bool events = spike_probes.count(ps.probe_key) > 0;
 
-        dset_map[ps.probe_key] = d;
-        datasets.push_back(d);
+    if(events){
+        // The number of spikes isn't known in advance, so the dataset grows as they are written.
+        hsize_t dset_dims[] = {0, spike_event_size()};
+        hsize_t max_dims[] = {H5S_UNLIMITED, spike_event_size()};
+        dataspace_id = H5Screate_simple(2, dset_dims, max_dims);
+
+        create_plist_id = H5Pcreate(H5P_DATASET_CREATE);
+        hsize_t chunk_dims[] = {SPIKE_EVENT_CHUNK_SIZE, spike_event_size()};
+        H5Pset_chunk(create_plist_id, 2, chunk_dims);
+        set_filters(create_plist_id);
+
+        dset_id = H5Dcreate2(
+            file_id, dspace_key.c_str(), H5T_STD_U32LE, dataspace_id,
+            H5P_DEFAULT, create_plist_id, H5P_DEFAULT);
+    }else{
+        hsize_t dset_dims[3];
+        int n_dims = probe_dims(n_steps, n_cols, dset_dims);
+
+        // Create the dataspace for the dataset.
+        dataspace_id = H5Screate_simple(n_dims, dset_dims, NULL);
+
+        // Create the dataset, chunked and filtered according to the log options
+        create_plist_id = dataset_create_plist(n_steps, n_cols);
+        dset_id = H5Dcreate2(
+            file_id, dspace_key.c_str(), file_dtype(), dataspace_id,
+            H5P_DEFAULT, create_plist_id, H5P_DEFAULT);
     }
 
+    H5Pclose(create_plist_id);
+
+    // Set the ``name'' attribute of the dataset so we know which probe the data came from
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, MAX_PROBE_NAME_LENGTH);
+    H5Tset_strpad(str_type, H5T_STR_NULLTERM);
+
+    hid_t att_dataspace_id = H5Screate(H5S_SCALAR);
+    hid_t att_id = H5Acreate2(dset_id, "name", str_type, att_dataspace_id, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(att_id, str_type, ps.name.substr(0, MAX_PROBE_NAME_LENGTH).c_str());
+
+    H5Sclose(att_dataspace_id);
+    H5Aclose(att_id);
     H5Tclose(str_type);
+
+    // What is needed to turn the events back into dense data. Spikes have an amplitude of 1 / dt.
+    if(events){
+        write_scalar_attribute(dset_id, "n_neurons", H5T_NATIVE_UINT, n_cols);
+        write_scalar_attribute(dset_id, "amplitude", H5T_NATIVE_DOUBLE, 1.0 / double(dt));
+    }
+
+    return dset_id;
 }
 
 void SimulationLog::write(key_type probe_key, shared_ptr<dtype> buffer, unsigned n_rows){
     herr_t status;
 
-    HDF5Dataset& d = dset_map.at(probe_key);
+    auto it = dset_map.find(probe_key);
+    if(it == dset_map.end()){
+        stringstream msg;
+        msg << "Invalid probe key: " << probe_key << "." << endl;
+        throw out_of_range(msg.str());
+    }
+
+    HDF5Dataset& d = it->second;
+
+    if(spike_probes.count(probe_key)){
+        vector<unsigned> events;
+        find_spike_events(d, buffer.get(), n_rows, events);
+        append_spike_events(d, events, events.size() / spike_event_size(), false);
+
+        d.row_offset += n_rows;
+        return;
+    }
 
     unsigned n_cols = d.n_cols;
 
-    hsize_t     count[] = {n_rows, n_cols};
-    hsize_t     offset[] = {d.row_offset, 0};
-    hsize_t     stride[] = {1, 1};
-    hsize_t     block[] = {1, 1};
+    hsize_t     count[3];
+    hsize_t     offset[] = {d.row_offset, 0, 0};
+    hsize_t     stride[] = {1, 1, 1};
+    hsize_t     block[] = {1, 1, 1};
 
-    hid_t memspace_id = H5Screate_simple(2, count, NULL);
+    int n_dims = probe_dims(n_rows, n_cols, count);
+    hid_t memspace_id = H5Screate_simple(n_dims, count, NULL);
 
     status = H5Sselect_hyperslab(
         d.dataspace_id, H5S_SELECT_SET, offset, stride, count, block);
 
     status = H5Dwrite(
-        d.dset_id, H5T_NATIVE_DOUBLE, memspace_id, d.dataspace_id,
+        d.dset_id, H5T_NATIVE_DTYPE, memspace_id, d.dataspace_id,
         d.plist_id, buffer.get());
 
     H5Sclose(memspace_id);
@@ -93,6 +164,144 @@ void SimulationLog::write(key_type probe_key, shared_ptr<dtype> buffer, unsigned
     d.row_offset += n_rows;
 }
 
+void SimulationLog::write_batch(const vector<ProbeWrite>& writes){
+    for(auto& w: writes){
+        write(w.probe_key, w.buffer, w.n_rows);
+    }
+}
+
+hid_t SimulationLog::dataset_create_plist(unsigned n_steps, unsigned n_cols) const{
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+
+    // Each flush then writes whole chunks. Chunks are limited to 4GB by HDF5.
+    hsize_t row_size = max(n_cols, 1u) * options.n_trials * sizeof(dtype);
+    hsize_t max_rows = max(hsize_t(1), (hsize_t(1) << 31) / row_size);
+    hsize_t chunk_rows = min(hsize_t(max(min(options.flush_every, n_steps), 1u)), max_rows);
+    hsize_t chunk_dims[3];
+    int n_dims = probe_dims(chunk_rows, max(n_cols, 1u), chunk_dims);
+    H5Pset_chunk(plist_id, n_dims, chunk_dims);
+
+    set_filters(plist_id);
+
+    return plist_id;
+}
+
+void SimulationLog::set_filters(hid_t plist_id) const{
+    if(options.compression.compare("none") == 0){
+        return;
+    }
+
+    H5Z_filter_t filter = H5Z_FILTER_DEFLATE;
+    if(options.compression.compare("lz4") == 0){
+        filter = H5Z_FILTER_LZ4;
+    }
+
+    if(H5Zfilter_avail(filter) <= 0){
+        H5Pclose(plist_id);
+
+        stringstream msg;
+        msg << "Compression filter " << options.compression << " is not available "
+            << "in this HDF5 installation." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    if(options.shuffle){
+        H5Pset_shuffle(plist_id);
+    }
+
+    if(filter == H5Z_FILTER_DEFLATE){
+        H5Pset_deflate(plist_id, options.compression_level);
+    }else{
+        H5Pset_filter(plist_id, filter, H5Z_FLAG_MANDATORY, 0, NULL);
+    }
+}
+
+void SimulationLog::find_spike_events(
+        const HDF5Dataset& d, const dtype* block, unsigned n_rows,
+        vector<unsigned>& events) const{
+
+    const unsigned n_cols = d.n_cols;
+
+    for(unsigned row = 0; row < n_rows; row++){
+        for(unsigned trial = 0; trial < options.n_trials; trial++){
+            const dtype* values = block + (row * options.n_trials + trial) * n_cols;
+
+            for(unsigned i = 0; i < n_cols; i++){
+                if(values[i] != 0.0){
+                    events.push_back(i);
+                    events.push_back(d.row_offset + row);
+
+                    if(options.n_trials > 1){
+                        events.push_back(trial);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void SimulationLog::append_spike_events(
+        const HDF5Dataset& d, const vector<unsigned>& events, hsize_t n_total,
+        bool collective_write){
+
+    if(n_total == 0){
+        return;
+    }
+
+    const hsize_t event_size = spike_event_size();
+
+    hid_t dataspace_id = H5Dget_space(d.dset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(dataspace_id, dims, NULL);
+    H5Sclose(dataspace_id);
+
+    hsize_t offset[] = {dims[0], 0};
+    dims[0] += n_total;
+    H5Dset_extent(d.dset_id, dims);
+
+    hsize_t count[] = {events.size() / event_size, event_size};
+    if(count[0] == 0 && !collective_write){
+        return;
+    }
+
+    dataspace_id = H5Dget_space(d.dset_id);
+
+    hsize_t mem_dims[] = {max(count[0], hsize_t(1)), event_size};
+    hid_t memspace_id = H5Screate_simple(2, mem_dims, NULL);
+
+    if(count[0] > 0){
+        H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+    }else{
+        H5Sselect_none(dataspace_id);
+        H5Sselect_none(memspace_id);
+    }
+
+    unsigned dummy[1];
+    H5Dwrite(
+        d.dset_id, H5T_NATIVE_UINT, memspace_id, dataspace_id,
+        d.plist_id, count[0] > 0 ? events.data() : dummy);
+
+    H5Sclose(memspace_id);
+    H5Sclose(dataspace_id);
+}
+
+int SimulationLog::probe_dims(hsize_t n_rows, unsigned n_cols, hsize_t* dims) const{
+    dims[0] = n_rows;
+
+    if(options.n_trials > 1){
+        dims[1] = options.n_trials;
+        dims[2] = n_cols;
+        return 3;
+    }
+
+    dims[1] = n_cols;
+    return 2;
+}
+
+hid_t SimulationLog::file_dtype() const{
+    return options.single_precision ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+}
+
 void SimulationLog::write_file(string filename_suffix, unsigned rank, unsigned max_buffer_size, string data){
     string fn = filename.substr(0, filename.find_last_of('.')) + filename_suffix;
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <vector>
 #include <string>
 #include <memory>
@@ -9,6 +10,7 @@
 #include <hdf5.h>
 
 #include "spec.hpp"
+#include "config.hpp"
 
 #include "typedef.hpp"
 #include "debug.hpp"
@@ -52,20 +54,47 @@ struct HDF5Dataset{
 
 const unsigned MAX_PROBE_NAME_LENGTH = 512;
 
+// Identifier of the LZ4 filter registered with the HDF Group. Requires the filter plugin.
+const H5Z_filter_t H5Z_FILTER_LZ4 = 32004;
+
+// Number of events in each chunk of the dataset of a probe stored as spike events.
+const hsize_t SPIKE_EVENT_CHUNK_SIZE = 4096;
+
+// A block of rows recorded by a probe, waiting to be written to the simulation log.
+struct ProbeWrite{
+    ProbeWrite(key_type probe_key, shared_ptr<dtype> buffer, unsigned n_rows)
+    :probe_key(probe_key), buffer(buffer), n_rows(n_rows){};
+
+    key_type probe_key;
+    shared_ptr<dtype> buffer;
+    unsigned n_rows;
+};
+
 // Represents an HDF5 file to which we write data collected throughout the simulation.
 // If filename given to prep_for_simulation is the empty string, no logging is done.
 class SimulationLog{
 public:
     SimulationLog(){};
 
-    SimulationLog(vector<ProbeSpec> probe_info, dtype dt);
+    SimulationLog(vector<ProbeSpec> probe_info, dtype dt, LogOptions options=LogOptions());
     SimulationLog(dtype dt);
 
+    virtual ~SimulationLog(){};
+
     virtual void prep_for_simulation(string fn, unsigned n_steps);
     virtual void prep_for_simulation();
 
     bool is_ready(){return ready_for_simulation;};
 
+    /* Store the probes with the given keys as spike events, if the log options
+     * ask for it. The dataset of such a probe has a row (index, sample) for
+     * each spike, where index is the neuron that spiked and sample is the row
+     * the spike would have in the dense dataset, or with more than one trial,
+     * a row (index, sample, trial). The probes must record nothing but spikes,
+     * whose amplitude is stored in the dataset's ``amplitude'' attribute. Must
+     * be called with the same keys on every process, before prep_for_simulation. */
+    virtual void set_spike_probes(const set<key_type>& keys);
+
     // Use the `probe_info` (which is read from the HDF5 file that specifies the
     // network), to construct an HDF5 which simulation results are written to.
     // Called at the beginning of a simulation.
@@ -76,6 +105,10 @@ public:
     // (by calling the method `setup_hdf5`).
     void write(key_type probe_key, shared_ptr<dtype> buffer, unsigned n_rows);
 
+    // Write the data from one flush of the probes. Every probe in the
+    // batch must have a dataset in this log.
+    virtual void write_batch(const vector<ProbeWrite>& writes);
+
     virtual void write_file(string filename_suffix, unsigned rank, unsigned max_buffer_size, string data);
 
     // Close the HDF5 file.
@@ -84,6 +117,46 @@ public:
     bool is_closed(){return closed;};
 
 protected:
+    // Create the dataset of a probe, named by its key, for a simulation of
+    // n_steps steps. Sets ``dataspace_id'' to the dataset's dataspace.
+    hid_t create_probe_dataset(const ProbeSpec& ps, unsigned n_steps, hid_t& dataspace_id) const;
+
+    // Property list for creating the dataset of a probe with n_cols columns.
+    // Datasets are chunked by the number of rows written per flush, and
+    // filtered as given by the log options. Caller must close the list.
+    hid_t dataset_create_plist(unsigned n_steps, unsigned n_cols) const;
+
+    // Apply the filters asked for by the log options to a dataset creation
+    // property list. Throws a runtime_error, closing the list, if they are
+    // not available.
+    void set_filters(hid_t plist_id) const;
+
+    // Number of values in each spike event.
+    unsigned spike_event_size() const{ return options.n_trials > 1 ? 3 : 2; }
+
+    // Append the events for the spikes in a block of n_rows samples of a
+    // spike probe, whose first sample is row d.row_offset, to ``events''.
+    void find_spike_events(
+        const HDF5Dataset& d, const dtype* block, unsigned n_rows,
+        vector<unsigned>& events) const;
+
+    // Extend the dataset of a spike probe by n_total events, and write
+    // ``events'' to its end. In parallel, every process calls this with the
+    // same n_total, and those without events take part in collective writes.
+    void append_spike_events(
+        const HDF5Dataset& d, const vector<unsigned>& events, hsize_t n_total,
+        bool collective_write);
+
+    // Dimensions of a block of n_rows samples from a probe with n_cols columns:
+    // (n_rows, n_cols), or with more than one trial, (n_rows, n_trials, n_cols).
+    // Fills ``dims'', which must have room for 3, and returns the number of dimensions.
+    int probe_dims(hsize_t n_rows, unsigned n_cols, hsize_t* dims) const;
+
+    // Type that probe data is stored as in the file.
+    hid_t file_dtype() const;
+
+    LogOptions options;
+
     bool ready_for_simulation;
 
     dtype dt;
@@ -93,6 +166,9 @@ protected:
 
     vector<ProbeSpec> probe_info;
 
+    // Probes stored as spike events.
+    set<key_type> spike_probes;
+
     map<key_type, HDF5Dataset> dset_map;
     vector<HDF5Dataset> datasets;
     bool closed;
@@ -1,12 +1,12 @@
 #include "simulator.hpp"
 
-Simulator::Simulator(bool collect_timings)
-:collect_timings(collect_timings){
-    chunk = unique_ptr<MpiSimulatorChunk>(new MpiSimulatorChunk(collect_timings));
+Simulator::Simulator(SimulatorConfig config)
+:config(config), chunk_from_cache(false){
+    chunk = unique_ptr<MpiSimulatorChunk>(new MpiSimulatorChunk(config));
 }
 
 void Simulator::from_file(string filename){
-    clock_t begin = clock();
+    double begin = wall_time();
 
     label = filename;
     if(filename.length() == 0){
@@ -25,28 +25,79 @@ void Simulator::from_file(string filename){
 
     in_file.close();
 
-    // Use non-parallel property lists.
-    hid_t file_plist = H5Pcreate(H5P_FILE_ACCESS);
-    hid_t read_plist = H5Pcreate(H5P_DATASET_XFER);
-
-    chunk->from_file(filename, file_plist, read_plist);
+    cache_key = chunk_cache_key(filename, config);
+    if(!take_cached_chunk(MPI_COMM_NULL)){
+        chunk->from_file(filename, MPI_COMM_NULL);
+    }
 
     for(const ProbeSpec& pi : chunk->probe_info){
-        probe_data[pi.probe_key] = vector<Signal>();
+        probe_data[pi.probe_key] = vector<ProbeBlock>();
     }
 
-    H5Pclose(file_plist);
-    H5Pclose(read_plist);
-
-    clock_t end = clock();
-    double delta = double(end - begin) / CLOCKS_PER_SEC;
+    double delta = wall_time() - begin;
     cout << "Loading network from file took " << delta << " seconds." << endl;
 
     write_to_loadtimes_file(delta);
 }
 
+void Simulator::from_network(shared_ptr<const PackedNetwork> network){
+    double begin = wall_time();
+
+    label = "network in memory";
+
+    cache_key = chunk_cache_key(*network, config);
+    if(!take_cached_chunk(MPI_COMM_NULL)){
+        chunk->from_network(network, MPI_COMM_NULL);
+    }
+
+    for(const ProbeSpec& pi : chunk->probe_info){
+        probe_data[pi.probe_key] = vector<ProbeBlock>();
+    }
+
+    double delta = wall_time() - begin;
+    cout << "Loading network from memory took " << delta << " seconds." << endl;
+
+    write_to_loadtimes_file(delta);
+}
+
 void Simulator::finalize_build(){
-    chunk->finalize_build();
+    if(!chunk_from_cache){
+        chunk->finalize_build();
+    }
+}
+
+bool Simulator::take_cached_chunk(MPI_Comm comm){
+    unique_ptr<MpiSimulatorChunk> cached = chunk_cache().take(cache_key, comm);
+    chunk_from_cache = bool(cached);
+
+    if(chunk_from_cache){
+        chunk = move(cached);
+        cout << "Reusing the chunk built for " << label << " by a previous simulator." << endl;
+    }
+
+    return chunk_from_cache;
+}
+
+void Simulator::release_chunk(bool keep, MPI_Comm comm){
+    chunk->close_simulation_log();
+
+    if(!keep){
+        chunk->free_shared_transport();
+        return;
+    }
+
+    unique_ptr<MpiSimulatorChunk> empty;
+    if(comm == MPI_COMM_NULL){
+        empty.reset(new MpiSimulatorChunk(config));
+    }else{
+        int rank, n_processors;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &n_processors);
+        empty.reset(new MpiSimulatorChunk(rank, n_processors, config));
+    }
+
+    chunk_cache().put(cache_key, move(chunk), size_t(config.cache_memory) << 20, comm);
+    chunk = move(empty);
 }
 
 Signal Simulator::get_signal_view(string signal_string){
@@ -57,13 +108,26 @@ Signal Simulator::get_signal(key_type key){
     return chunk->get_signal(key);
 }
 
-void Simulator::add_pyfunc(float index, unique_ptr<Operator> pyfunc){
-    chunk->add_op(index, move(pyfunc));
+void Simulator::add_pyfunc(float index, OpFactory make_pyfunc){
+    // Chunks with python functions are never kept, so this network had none.
+    if(chunk_from_cache){
+        throw logic_error(
+            "Adding a python function to a network whose chunk was kept without any.");
+    }
+
+    // A python function only sees the signals of the first trial.
+    if(chunk->get_n_trials() > 1){
+        throw runtime_error(
+            "Networks with python functions can only be simulated one trial at a time.");
+    }
+
+    chunk->add_op(index, make_pyfunc(*chunk));
+    pyfuncs.push_back(make_pair(index, make_pyfunc));
 }
 
 void Simulator::run_n_steps(int steps, bool progress, string log_filename){
 
-    clock_t begin = clock();
+    double begin = wall_time();
 
     chunk->set_log_filename(log_filename);
     chunk->run_n_steps(steps, progress);
@@ -74,8 +138,7 @@ void Simulator::run_n_steps(int steps, bool progress, string log_filename){
 
     chunk->close_simulation_log();
 
-    clock_t end = clock();
-    double delta = double(end - begin) / CLOCKS_PER_SEC;
+    double delta = wall_time() - begin;
     cout << "Simulating " << steps << " steps took " << delta << " seconds." << endl;
 
     write_to_runtimes_file(delta);
@@ -84,25 +147,68 @@ void Simulator::run_n_steps(int steps, bool progress, string log_filename){
 void Simulator::gather_probe_data(){
     // Gather probe data from the chunk
     for(auto& kv: chunk->probe_map){
-        auto& data = probe_data.at(kv.first);
-        auto new_data = (kv.second)->harvest_data();
+        shared_ptr<Probe>& probe = kv.second;
 
-        data.reserve(data.size() + new_data.size());
+        ProbeBlock block;
+        block.data = probe->harvest_block(block.n_rows);
+        block.shape1 = probe->sample_shape1();
+        block.shape2 = probe->sample_shape2();
 
-        for(auto& nd : new_data){
-            data.push_back(move(nd));
-        }
+        probe_data.at(kv.first).push_back(block);
     }
 }
 
-vector<Signal> Simulator::get_probe_data(key_type probe_key){
+ProbeBlock Simulator::get_probe_block(key_type probe_key){
     if(chunk->is_logging()){
         throw logic_error(
             "Calling get_probe_data, but probe data has been written to file.");
     }
 
     // Using move here because we're giving up ownership.
-    return move(probe_data.at(probe_key));
+    vector<ProbeBlock> blocks = move(probe_data.at(probe_key));
+    probe_data.at(probe_key).clear();
+
+    ProbeBlock result;
+    result.n_rows = 0;
+    result.shape1 = blocks.empty() ? 0 : blocks[0].shape1;
+    result.shape2 = blocks.empty() ? 0 : blocks[0].shape2;
+
+    for(auto& block: blocks){
+        result.n_rows += block.n_rows;
+    }
+
+    // Data is fetched after every simulation, so there is usually one block;
+    // otherwise the blocks are joined.
+    if(blocks.size() == 1){
+        result.data = blocks[0].data;
+    }else if(result.n_rows > 0){
+        unsigned sample_size = result.sample_size();
+        result.data = shared_ptr<dtype>(
+            new dtype[result.n_rows * sample_size], default_delete<dtype[]>());
+
+        dtype* dst = result.data.get();
+        for(auto& block: blocks){
+            copy(block.data.get(), block.data.get() + block.n_rows * sample_size, dst);
+            dst += block.n_rows * sample_size;
+        }
+    }
+
+    return result;
+}
+
+vector<Signal> Simulator::get_probe_data(key_type probe_key){
+    ProbeBlock block = get_probe_block(probe_key);
+
+    vector<Signal> data;
+    data.reserve(block.n_rows);
+
+    for(unsigned i = 0; i < block.n_rows; i++){
+        // Each sample is a view of its row of the block.
+        shared_ptr<dtype> row(block.data, block.data.get() + i * block.sample_size());
+        data.push_back(Signal(block.shape1, block.shape2, row));
+    }
+
+    return data;
 }
 
 void Simulator::reset(unsigned seed){
@@ -111,17 +217,32 @@ void Simulator::reset(unsigned seed){
     // probe_data should already be clear, since it is
     // gathered after every simulation.
     for(auto& kv: chunk->probe_map){
-        auto& data = probe_data.at(kv.first);
-        if(data.size() != 0){
+        unsigned n_rows = 0;
+        for(auto& block: probe_data.at(kv.first)){
+            n_rows += block.n_rows;
+        }
+
+        if(n_rows != 0){
             stringstream msg;
             msg << "When resetting chunk, probe with key " << kv.first
-                << " had non-empty data array with length " << data.size() << ".";
+                << " had non-empty data array with length " << n_rows << ".";
             throw runtime_error(msg.str());
         }
     }
 }
 
 void Simulator::close(){
+    if(can_keep_chunk()){
+        release_chunk(true, MPI_COMM_NULL);
+    }
+}
+
+void Simulator::checkpoint(string filename){
+    chunk->checkpoint(filename);
+}
+
+void Simulator::restore(string filename){
+    chunk->restore(filename);
 }
 
 string Simulator::to_string() const{
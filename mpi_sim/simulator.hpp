@@ -9,39 +9,75 @@
 #include <sstream>
 #include <exception>
 #include <ctime>
+#include <functional>
+#include <algorithm>
 
 #include "signal.hpp"
 #include "operator.hpp"
 #include "chunk.hpp"
+#include "chunk_cache.hpp"
 #include "spec.hpp"
+#include "config.hpp"
 
 #include "typedef.hpp"
 #include "debug.hpp"
 
 using namespace std;
 
+/* Makes an operator that is added to a chunk from outside of the network file,
+ * such as a PyFunc, from the signals of the chunk. */
+typedef function<unique_ptr<Operator>(MpiSimulatorChunk& chunk)> OpFactory;
+
 class Simulator{
 
 public:
-    Simulator(bool collect_timings);
+    Simulator(SimulatorConfig config);
 
     virtual ~Simulator(){};
 
     virtual void from_file(string filename);
+
+    // Load a network held in memory (see PackedNetwork), instead of from a file.
+    virtual void from_network(shared_ptr<const PackedNetwork> network);
     virtual void finalize_build();
 
     virtual Signal get_signal_view(string signal_string);
     virtual Signal get_signal(key_type key);
-    virtual void add_pyfunc(float index, unique_ptr<Operator> pyfunc);
+
+    /* Add the operator of a python function, made by ``make_pyfunc''. The
+     * factory is kept, so that the operator can be made again if the chunk
+     * is rebuilt (see rebalance). */
+    virtual void add_pyfunc(float index, OpFactory make_pyfunc);
 
     virtual void run_n_steps(int steps, bool progress, string log_filename);
 
     virtual void gather_probe_data();
+
+    /* Give up the samples gathered from a probe since it was last asked for
+     * them, as a single block. get_probe_data gives the same samples as
+     * views into the block. */
+    ProbeBlock get_probe_block(key_type probe_key);
     vector<Signal> get_probe_data(key_type probe_key);
 
     virtual void reset(unsigned seed);
     virtual void close();
 
+    /* Write the state of the simulation to a checkpoint between simulations,
+     * and restore it (in place of a reset) in a new simulator built from the
+     * same network. See MpiSimulatorChunk::checkpoint. */
+    virtual void checkpoint(string filename);
+    virtual void restore(string filename);
+
+    /* Move components between processes to even out the cost of the
+     * processes measured during the last simulation, if it is uneven
+     * enough (see SimulatorConfig::rebalance). The simulation then
+     * continues where it was. Returns whether any component was moved.
+     * A simulator on one process has nothing to balance. */
+    virtual bool rebalance(){ return false; }
+
+    /* Number of steps simulated since the last reset or restored checkpoint. */
+    unsigned get_steps_since_reset() const{ return chunk->get_steps_since_reset(); }
+
     virtual string to_string() const;
 
     friend ostream& operator << (ostream &out, const Simulator &sim){
@@ -53,6 +89,8 @@ public:
         return chunk->dt;
     }
 
+    const SimulatorConfig& get_config() const{ return config; }
+
     virtual void write_to_time_file(char* filename, double delta);
 
     void write_to_loadtimes_file(double delta){
@@ -66,13 +104,34 @@ public:
     }
 
 protected:
+    /* Take the chunk kept in the chunk cache under cache_key, if there is
+     * one, in place of ``chunk''. Returns whether it did. */
+    bool take_cached_chunk(MPI_Comm comm);
+
+    /* Once the simulator is closed, keep ``chunk'' in the chunk cache if
+     * ``keep'', leaving an empty chunk in its place, or free it. */
+    void release_chunk(bool keep, MPI_Comm comm);
+
+    // Whether ``chunk'' can be kept once the simulator is closed. Chunks
+    // with python functions, or rearranged by rebalancing, are not kept.
+    bool can_keep_chunk() const{ return !cache_key.empty() && pyfuncs.empty(); }
+
     unique_ptr<MpiSimulatorChunk> chunk;
-    bool collect_timings;
+    SimulatorConfig config;
     string label;
 
+    // The key of the network in the chunk cache, if chunks are kept.
+    string cache_key;
+
+    // Whether ``chunk'' came from the chunk cache, and so is already built.
+    bool chunk_from_cache;
+
     // Place to store probe data retrieved from worker
-    // processes after simulation has finished.
-    map<key_type, vector<Signal>> probe_data;
+    // processes after simulation has finished, a block per simulation.
+    map<key_type, vector<ProbeBlock>> probe_data;
+
+    // The python functions added to the chunk, by index.
+    vector<pair<float, OpFactory>> pyfuncs;
 
     // Store the probe info so that we can scatter it to all
     // the other processes, which will allow all processes to
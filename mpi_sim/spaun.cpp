@@ -9,6 +9,9 @@ SpaunStimulus::SpaunStimulus(
 stim_sequence(stim_sequence), present_interval(present_interval),
 present_blanks(present_blanks), identifier(identifier){
 
+    declare_read(t);
+    declare_write(output);
+
     if(stim_sequence.empty()){
         throw runtime_error("Cannot create SpaunStimulus with empty stimulus sequence.");
     }
@@ -27,6 +30,8 @@ present_blanks(present_blanks), identifier(identifier){
         image_store = static_cast<unique_ptr<ImageStore>>(new ImageStore(vision_data_dir));
     }
 
+    image_store->prefetch(stim_sequence);
+
     image_size = output.shape1;
 }
 
@@ -82,24 +87,20 @@ string SpaunStimulus::to_string() const{
 }
 
 void SpaunStimulus::reset(unsigned seed){
-    default_random_engine rng(seed);
-
-    // We shouldn't need to do this, but in practice I've found the first number is
-    // consistently 0. Not sure why.
-    rng.discard(1);
+    RandomStream stream(seed, get_stream_id());
 
     images.clear();
 
     int stim_count = 0;
     for(string label: stim_sequence){
-        cout << "Loading image for stimulus " << stim_count << " with label " << label << endl;
+        build_dbg("Loading image for stimulus " << stim_count << " with label " << label);
 
         Signal image;
         if(label == "None" || label == "NULL"){
             dtype init_value = 0.0;
             image = Signal(image_size, init_value);
         }else{
-            image = image_store->get_image_with_label(label, image_size, rng);
+            image = image_store->get_image_with_label(label, image_size, stream, stim_count);
         }
 
         images.push_back(image);
@@ -110,9 +111,23 @@ void SpaunStimulus::reset(unsigned seed){
     previous_index = -1;
 }
 
+void SpaunStimulus::save_state(ostream& out){
+    write_state(out, previous_index);
+}
+
+void SpaunStimulus::load_state(istream& in){
+    read_state(in, previous_index);
+}
+
 ImageStore::ImageStore(string dir_name)
-:dir_name(dir_name), loaded_img_size(-1){
-    load_image_counts(dir_name + "/counts");
+:dir_name(dir_name), loaded_img_size(-1), packed_size(0){
+    string packed_filename = dir_name + "/" + PACKED_IMAGES_FILENAME;
+
+    if(ifstream(packed_filename).good()){
+        map_packed_file(packed_filename);
+    }else{
+        load_image_counts(dir_name + "/counts");
+    }
 }
 
 void ImageStore::load_image_counts(string filename){
@@ -134,8 +149,90 @@ void ImageStore::load_image_counts(string filename){
     ifs.close();
 }
 
+void ImageStore::map_packed_file(string filename){
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    struct stat file_stat;
+    if(fd < 0 || fstat(fd, &file_stat) != 0){
+        if(fd >= 0){
+            close(fd);
+        }
+
+        stringstream msg;
+        msg << "Could not open packed image file " << filename << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    packed_size = file_stat.st_size;
+    void* data = packed_size ? mmap(NULL, packed_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if(data == MAP_FAILED){
+        stringstream msg;
+        msg << "Could not map packed image file " << filename << " into memory." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    size_t size = packed_size;
+    packed = shared_ptr<char>((char*)data, [size](char* p){ munmap(p, size); });
+
+    const size_t header_size = sizeof(PACKED_IMAGES_MAGIC) + 2 * sizeof(uint64_t);
+    uint64_t image_size = 0, n_labels = 0;
+
+    if(packed_size >= header_size){
+        memcpy(&image_size, packed.get() + sizeof(PACKED_IMAGES_MAGIC), sizeof(uint64_t));
+        memcpy(&n_labels, packed.get() + sizeof(PACKED_IMAGES_MAGIC) + sizeof(uint64_t), sizeof(uint64_t));
+    }
+
+    if(packed_size < header_size ||
+            memcmp(packed.get(), PACKED_IMAGES_MAGIC, sizeof(PACKED_IMAGES_MAGIC)) != 0 ||
+            packed_size < header_size + n_labels * sizeof(PackedLabel)){
+        stringstream msg;
+        msg << "File " << filename << " is not a packed image file." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    loaded_img_size = image_size;
+
+    for(uint64_t i = 0; i < n_labels; i++){
+        PackedLabel label;
+        memcpy(&label, packed.get() + header_size + i * sizeof(PackedLabel), sizeof(PackedLabel));
+        label.name[sizeof(label.name) - 1] = '\0';
+
+        if(label.offset % sizeof(double) != 0 ||
+                label.offset + label.n_images * image_size * sizeof(double) > packed_size){
+            stringstream msg;
+            msg << "The images with label " << label.name << " lie outside of packed image file "
+                << filename << "." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        packed_labels[label.name] = label;
+        image_counts[label.name] = label.n_images;
+    }
+}
+
+void ImageStore::prefetch(const vector<string>& labels){
+    if(!packed){
+        return;
+    }
+
+    const size_t page = sysconf(_SC_PAGESIZE);
+
+    for(auto& name: labels){
+        auto found = packed_labels.find(name);
+        if(found == packed_labels.end()){
+            continue;
+        }
+
+        size_t begin = found->second.offset / page * page;
+        size_t end = found->second.offset + found->second.n_images * loaded_img_size * sizeof(double);
+        madvise(packed.get() + begin, end - begin, MADV_WILLNEED);
+    }
+}
+
 Signal ImageStore::get_image_with_label(
-        string label, unsigned desired_img_size, default_random_engine rng){
+        string label, unsigned desired_img_size, const RandomStream& stream, uint64_t draw){
 
     if(image_counts.find(label) == image_counts.end()){
         stringstream ss;
@@ -143,13 +240,56 @@ Signal ImageStore::get_image_with_label(
         throw runtime_error(ss.str());
     }
 
-    cout << "Image count for label " << label << ": "<< image_counts[label] << endl;
-    uniform_int_distribution<int> dist(0, image_counts[label]-1);
-    int index = dist(rng);
+    int index = stream.uniform_int(draw, 0, image_counts[label]);
+    Signal image = load_image(label, index);
+
+    if(desired_img_size < loaded_img_size){
+        image = do_down_sample(image, desired_img_size, stream, draw);
+    }else if(desired_img_size > loaded_img_size){
+        throw runtime_error("SpaunStimulus: loaded images too small.");
+    }
+
+    return image;
+}
+
+Signal ImageStore::load_image(string label, int index){
+    auto key = make_pair(label, index);
+
+    auto loaded = loaded_images.find(key);
+    if(loaded != loaded_images.end()){
+        return loaded->second;
+    }
+
+    Signal image;
+    auto found = packed_labels.find(label);
+
+    if(found == packed_labels.end()){
+        image = load_image_file(label, index);
+    }else{
+        const char* data = packed.get() + found->second.offset + index * loaded_img_size * sizeof(double);
+
+        if(sizeof(dtype) == sizeof(double)){
+            // Shares ownership of the mapping, which is never written.
+            shared_ptr<dtype> view(packed, (dtype*)(data));
+            image = Signal(loaded_img_size, view);
+        }else{
+            image = Signal(loaded_img_size);
+            for(int i = 0; i < loaded_img_size; i++){
+                double value;
+                memcpy(&value, data + i * sizeof(double), sizeof(double));
+                image(i) = value;
+            }
+        }
+    }
+
+    loaded_images[key] = image;
+    return image;
+}
 
+Signal ImageStore::load_image_file(string label, int index){
     stringstream image_file;
     image_file << dir_name << "/" << label << "/" << index;
-    cout << "Loading image from file: " << image_file.str() << endl;
+    build_dbg("Loading image from file: " << image_file.str());
 
     ifstream ifs(image_file.str());
 
@@ -170,26 +310,19 @@ Signal ImageStore::get_image_with_label(
         loaded_img_size = image.shape1;
     }
 
-    if(desired_img_size < loaded_img_size){
-        image = do_down_sample(image, desired_img_size);
-    }else if(desired_img_size > loaded_img_size){
-        throw runtime_error("SpaunStimulus: loaded images too small.");
-    }
-
     return image;
 }
 
-Signal do_down_sample(Signal image, unsigned new_size){
+Signal do_down_sample(Signal image, unsigned new_size, const RandomStream& stream, uint64_t draw){
     dtype init_value = 0.0;
     Signal new_image(new_size, init_value);
 
     // For now, just randomly choose the pixels for the new image from the old image
-    srand (time(NULL));
-
     vector<unsigned> chosen_indices;
 
+    uint32_t element = 1;
     while(chosen_indices.size() < new_size){
-        unsigned index = rand() % image.shape1;
+        unsigned index = stream.uniform_int(draw, element++, image.shape1);
 
         auto iter = find(chosen_indices.begin(), chosen_indices.end(), index);
         if(iter == chosen_indices.end()){
@@ -9,9 +9,17 @@
 #include <memory>
 #include <cmath>
 #include <time.h>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "signal.hpp"
 #include "operator.hpp"
+#include "rng.hpp"
 #include "utils.hpp"
 
 #include "typedef.hpp"
@@ -29,13 +37,20 @@ public:
         dtype present_interval, dtype present_blanks, int identifier);
 
     string classname() const {return "SpaunStimulus"; }
+    virtual BatchRunner batch_runner() const { return run_batch<SpaunStimulus>; }
 
     void operator() ();
     virtual string to_string() const;
 
     virtual void reset(unsigned seed);
+    virtual void save_state(ostream& out);
+    virtual void load_state(istream& in);
+
+    // Copies of the stimulus share its identifier, and so choose the same images.
+    virtual uint32_t get_stream_id() const{ return uint32_t(identifier); }
 
-    virtual unsigned get_seed_modifier() const{ return unsigned(identifier); }
+    // Images are loaded lazily through the shared image store.
+    virtual bool thread_safe() const{ return false; }
 
 protected:
     int n_stimuli;
@@ -55,28 +70,67 @@ protected:
     static unique_ptr<ImageStore> image_store;
 };
 
+/* Layout of a packed image file (see nengo_mpi.spaun_mpi.pack_spaun_images):
+ * the magic string, the size of every image and the number of labels as
+ * uint64s, a PackedLabel for each label, and then the images of each label as
+ * rows of doubles, starting at the offset (in bytes, from the start of the
+ * file) of the label. */
+const char PACKED_IMAGES_MAGIC[8] = {'S', 'P', 'A', 'U', 'N', 'I', 'M', '1'};
+const char PACKED_IMAGES_FILENAME[] = "images.bin";
+
+struct PackedLabel{
+    char name[48];
+    uint64_t n_images;
+    uint64_t offset;
+};
+
+/* Reads the images of the Spaun vision dataset in ``dir_name''. If the
+ * directory holds a packed image file, it is mapped into memory instead of
+ * read, so the processes on a node share a single copy of it through the page
+ * cache, and images are served as views of the mapping. Otherwise each image
+ * is read from a text file of its own the first time it is needed, and kept
+ * for later resets. */
 class ImageStore{
 public:
     ImageStore(string dir_name);
 
     void load_image_counts(string filename);
 
-    // Get a random image with the given label
+    // Ask for the images with the given labels to be read ahead of their
+    // first use. Only affects packed image files.
+    void prefetch(const vector<string>& labels);
+
+    // Get a random image with the given label, chosen by draw ``draw'' of the stream.
     Signal get_image_with_label(
-        string label, unsigned desired_img_size, default_random_engine rng);
+        string label, unsigned desired_img_size, const RandomStream& stream, uint64_t draw);
 
 protected:
+    void map_packed_file(string filename);
+
+    // Loaded images are shared with the caller, and must not be modified.
+    Signal load_image(string label, int index);
+    Signal load_image_file(string label, int index);
+
     string dir_name;
     map<string, int> image_counts;
 
     // -1 initially; set properly when we load the first image
     int loaded_img_size;
+
+    map<pair<string, int>, Signal> loaded_images;
+
+    // The mapping of the packed image file, if there is one, whose
+    // images are shared by reference with every Signal made from it.
+    shared_ptr<char> packed;
+    size_t packed_size;
+    map<string, PackedLabel> packed_labels;
 };
 
 /*
  * Down-sample the given image, returning an image whose size is new_size.
  * new_size should be < the size of the given image. Currently downsamples
- * by randomly choosing indices without replacement and then sorting. */
-Signal do_down_sample(Signal image, unsigned new_size);
+ * by randomly choosing indices without replacement and then sorting. The
+ * indices are chosen by draw ``draw'' of the stream, after its first value. */
+Signal do_down_sample(Signal image, unsigned new_size, const RandomStream& stream, uint64_t draw);
 
 void print_image(Signal image);
@@ -1,4 +1,45 @@
 #include "spec.hpp"
+#include "utils.hpp"
+
+static const char* op_type_names[] = {
+    "", "TimeUpdate", "Reset", "Copy", "SlicedCopy", "DotInc", "ElementwiseInc",
+    "LIF", "LIFRate", "AdaptiveLIF", "AdaptiveLIFRate", "RectifiedLinear", "Sigmoid",
+    "NoDenSynapse", "SimpleSynapse", "Synapse", "TriangleSynapse", "WhiteNoise",
+    "WhiteSignal", "PresentInput", "BCM", "Oja", "Voja", "MpiSend", "MpiRecv",
+    "SpaunStimulus"};
+
+static const unsigned n_op_types = sizeof(op_type_names) / sizeof(op_type_names[0]);
+
+OpType op_type_from_string(const string& name){
+    for(unsigned i = 1; i < n_op_types; i++){
+        if(name.compare(op_type_names[i]) == 0){
+            return OpType(i);
+        }
+    }
+
+    return OP_UNKNOWN;
+}
+
+string op_type_to_string(OpType type){
+    if(type <= OP_UNKNOWN || type >= n_op_types){
+        return "Unknown";
+    }
+
+    return op_type_names[type];
+}
+
+// Arguments of op strings that refer to signals start with a signal key,
+// followed by SIGNAL_DELIM or nothing.
+static bool get_signal_key(const string& arg, key_type& key){
+    string key_string = arg.substr(0, arg.find(SIGNAL_DELIM));
+
+    if(key_string.empty() || key_string.find_first_not_of("0123456789") != string::npos){
+        return false;
+    }
+
+    key = boost::lexical_cast<key_type>(key_string);
+    return true;
+}
 
 OpSpec::OpSpec(string op_string){
     try{
@@ -9,6 +50,7 @@ OpSpec::OpSpec(string op_string){
         tokens.erase(tokens.begin());
 
         type_string = tokens[0];
+        type = op_type_from_string(type_string);
         tokens.erase(tokens.begin());
 
         arguments = tokens;
@@ -22,6 +64,157 @@ OpSpec::OpSpec(string op_string){
     }
 }
 
+OpSpec::OpSpec(float index, OpType type, vector<OpArgRecord> records, shared_ptr<const OpData> data)
+:type(type), type_string(op_type_to_string(type)), index(index), records(records), data(data){
+
+}
+
+unsigned OpSpec::n_arguments() const{
+    return data ? records.size() : arguments.size();
+}
+
+const OpArgRecord& OpSpec::record(unsigned i) const{
+    if(i >= records.size()){
+        stringstream msg;
+        msg << "Operator of type " << type_string << " has " << records.size()
+            << " arguments, requested argument " << i << "." << endl;
+        throw out_of_range(msg.str());
+    }
+
+    return records[i];
+}
+
+SignalSpec OpSpec::signal(unsigned i) const{
+    if(!data){
+        return SignalSpec(arguments.at(i));
+    }
+
+    const OpArgRecord& r = record(i);
+    if(r.kind != ARG_SIGNAL){
+        stringstream msg;
+        msg << "Argument " << i << " of operator of type " << type_string
+            << " is not a signal." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    return data->signals.at(r.value);
+}
+
+int OpSpec::integer(unsigned i) const{
+    if(!data){
+        return boost::lexical_cast<int>(arguments.at(i));
+    }
+
+    const OpArgRecord& r = record(i);
+    return r.kind == ARG_REAL ? int(r.real) : int(r.value);
+}
+
+key_type OpSpec::key(unsigned i) const{
+    if(!data){
+        return boost::lexical_cast<key_type>(arguments.at(i));
+    }
+
+    return key_type(record(i).value);
+}
+
+dtype OpSpec::real(unsigned i) const{
+    if(!data){
+        return boost::lexical_cast<dtype>(arguments.at(i));
+    }
+
+    const OpArgRecord& r = record(i);
+    return r.kind == ARG_INTEGER ? dtype(r.value) : dtype(r.real);
+}
+
+Signal OpSpec::values(unsigned i) const{
+    if(!data){
+        return python_list_to_signal(arguments.at(i), false);
+    }
+
+    const OpArgRecord& r = record(i);
+    Signal result(unsigned(r.rows), 1u);
+    for(unsigned j = 0; j < r.rows; j++){
+        result(j) = data->reals.at(r.value + j);
+    }
+
+    return result;
+}
+
+Signal OpSpec::matrix(unsigned i) const{
+    if(!data){
+        return python_list_to_signal(arguments.at(i), true);
+    }
+
+    const OpArgRecord& r = record(i);
+    Signal result(unsigned(r.rows), unsigned(r.cols));
+    for(unsigned j = 0; j < r.rows; j++){
+        for(unsigned k = 0; k < r.cols; k++){
+            result(j, k) = data->reals.at(r.value + j * r.cols + k);
+        }
+    }
+
+    return result;
+}
+
+vector<int> OpSpec::indices(unsigned i) const{
+    if(!data){
+        return python_list_to_index_vector(arguments.at(i));
+    }
+
+    const OpArgRecord& r = record(i);
+    vector<int> result;
+    for(unsigned j = 0; j < r.rows; j++){
+        result.push_back(data->indices.at(r.value + j));
+    }
+
+    return result;
+}
+
+vector<string> OpSpec::strings(unsigned i) const{
+    vector<string> result;
+
+    if(!data){
+        string s = arguments.at(i);
+        boost::trim_if(s, boost::is_any_of("[]"));
+        boost::replace_all(s, "\"", "");
+        boost::replace_all(s, "\'", "");
+
+        boost::split(result, s, boost::is_any_of(","));
+        return result;
+    }
+
+    const OpArgRecord& r = record(i);
+    for(unsigned j = 0; j < r.rows; j++){
+        result.push_back(data->strings.at(r.value + j));
+    }
+
+    return result;
+}
+
+void OpSpec::signal_keys(vector<key_type>& keys) const{
+    if(!data){
+        key_type key;
+        for(const string& arg: arguments){
+            if(get_signal_key(arg, key)){
+                keys.push_back(key);
+            }
+        }
+
+        return;
+    }
+
+    for(const OpArgRecord& r: records){
+        if(r.kind == ARG_SIGNAL){
+            keys.push_back(data->signals.at(r.value).key);
+        }
+    }
+
+    // MPI operators refer to the signal they transfer by its key
+    if((type == OP_MPI_SEND || type == OP_MPI_RECV) && records.size() > 2){
+        keys.push_back(key(2));
+    }
+}
+
 string OpSpec::to_string() const{
     stringstream out;
 
@@ -29,8 +222,16 @@ string OpSpec::to_string() const{
     out << "Type: " << type_string << endl;
     out << "Index: " << index << endl;
     out << "Arguments:" << endl;
-    for(auto& s : arguments){
-        out << s << endl;
+
+    if(!data){
+        for(auto& s : arguments){
+            out << s << endl;
+        }
+    }else{
+        for(auto& r : records){
+            out << "kind: " << r.kind << ", value: " << r.value << ", rows: " << r.rows
+                << ", cols: " << r.cols << ", real: " << r.real << endl;
+        }
     }
 
     return out.str();
@@ -94,6 +295,10 @@ ProbeSpec::ProbeSpec(string probe_string){
         name = tokens[4];
         signal_spec = SignalSpec(signal_string);
 
+        if(tokens.size() > 5){
+            reduction = ProbeReduction(tokens[5]);
+        }
+
     }catch(const boost::bad_lexical_cast& e){
         stringstream msg;
         msg << "Caught bad lexical cast while extracting ProbeSpec from string "
@@ -112,6 +317,7 @@ string ProbeSpec::to_string() const{
     out << "signal: " << signal_spec << endl;
     out << "period: " << period << endl;
     out << "name: " << name << endl;
+    out << "reduction: " << reduction.to_string() << endl;
 
     return out.str();
 }
@@ -2,11 +2,15 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <sstream>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "signal.hpp"
+#include "probe.hpp"
+
 #include "typedef.hpp"
 #include "debug.hpp"
 
@@ -26,17 +30,6 @@ struct Spec{
     }
 };
 
-struct OpSpec: public Spec {
-    OpSpec(){};
-    OpSpec(string op_string);
-
-    string type_string;
-    vector<string> arguments;
-    float index;
-
-    string to_string() const override;
-};
-
 /* Expected format of signal_string:
 *     key:label:ndim:(shape1, shape2):(stride1, stride2):offset */
 struct SignalSpec: public Spec {
@@ -59,6 +52,123 @@ struct SignalSpec: public Spec {
     string to_string() const override;
 };
 
+/* Version of the binary encoding of operators written by nengo_mpi/model.py,
+ * stored as the ``op_format'' attribute of the network file. Files without the
+ * attribute encode each operator as a string. */
+const int BINARY_OP_FORMAT = 1;
+
+/* Types of operators. The values are part of the binary network file format,
+ * and must match OP_TYPES in nengo_mpi/model.py. */
+enum OpType{
+    OP_UNKNOWN = 0,
+    OP_TIME_UPDATE = 1,
+    OP_RESET = 2,
+    OP_COPY = 3,
+    OP_SLICED_COPY = 4,
+    OP_DOT_INC = 5,
+    OP_ELEMENTWISE_INC = 6,
+    OP_LIF = 7,
+    OP_LIF_RATE = 8,
+    OP_ADAPTIVE_LIF = 9,
+    OP_ADAPTIVE_LIF_RATE = 10,
+    OP_RECTIFIED_LINEAR = 11,
+    OP_SIGMOID = 12,
+    OP_NO_DEN_SYNAPSE = 13,
+    OP_SIMPLE_SYNAPSE = 14,
+    OP_SYNAPSE = 15,
+    OP_TRIANGLE_SYNAPSE = 16,
+    OP_WHITE_NOISE = 17,
+    OP_WHITE_SIGNAL = 18,
+    OP_PRESENT_INPUT = 19,
+    OP_BCM = 20,
+    OP_OJA = 21,
+    OP_VOJA = 22,
+    OP_MPI_SEND = 23,
+    OP_MPI_RECV = 24,
+    OP_SPAUN_STIMULUS = 25
+};
+
+// Returns OP_UNKNOWN if the name is not recognized.
+OpType op_type_from_string(const string& name);
+string op_type_to_string(OpType type);
+
+/* Kinds of operator arguments. The values are part of the binary network file format. */
+enum OpArgKind{
+    ARG_SIGNAL = 0,
+    ARG_INTEGER = 1,
+    ARG_REAL = 2,
+    ARG_VALUES = 3,
+    ARG_MATRIX = 4,
+    ARG_INDICES = 5,
+    ARG_STRINGS = 6
+};
+
+/* One operator argument in a binary network file, as stored in the ``op_args''
+ * dataset. For ARG_SIGNAL, ``value'' is a row of the component's signal table.
+ * For the array kinds, ``value'' is the offset of the first element in the
+ * component's array of the corresponding type, and ``rows'' (and ``cols'', for
+ * ARG_MATRIX) give the number of elements. */
+struct OpArgRecord{
+    int kind;
+    long long value;
+    long long rows;
+    long long cols;
+    double real;
+};
+
+/* The arrays that the operator arguments of a component refer to. */
+struct OpData{
+    vector<SignalSpec> signals;
+    vector<double> reals;
+    vector<long long> indices;
+    vector<string> strings;
+};
+
+/* Specifies an operator to add to a chunk, either parsed from a string of the
+ * form index;type;arg_0;arg_1;..., or built from the records of a binary network
+ * file. The accessors give the value of an argument however it was stored, and
+ * throw if the argument can't be interpreted as requested. */
+struct OpSpec: public Spec {
+    OpSpec(){};
+    OpSpec(string op_string);
+    OpSpec(float index, OpType type, vector<OpArgRecord> records, shared_ptr<const OpData> data);
+
+    unsigned n_arguments() const;
+
+    SignalSpec signal(unsigned i) const;
+    int integer(unsigned i) const;
+    key_type key(unsigned i) const;
+    dtype real(unsigned i) const;
+
+    // A list of values, as a signal with shape (n, 1).
+    Signal values(unsigned i) const;
+
+    // A list of values that is encoded along with its shape.
+    Signal matrix(unsigned i) const;
+
+    vector<int> indices(unsigned i) const;
+    vector<string> strings(unsigned i) const;
+
+    // Append the keys of the base signals of all signal arguments.
+    void signal_keys(vector<key_type>& keys) const;
+
+    string to_string() const override;
+
+    OpType type;
+    string type_string;
+    float index;
+
+    // Arguments of an operator read from a string
+    vector<string> arguments;
+
+    // Arguments of an operator read from a binary file
+    vector<OpArgRecord> records;
+    shared_ptr<const OpData> data;
+
+private:
+    const OpArgRecord& record(unsigned i) const;
+};
+
 struct ProbeSpec: public Spec {
     ProbeSpec(){};
     ProbeSpec(string probe_string);
@@ -70,5 +180,13 @@ struct ProbeSpec: public Spec {
     dtype period;
     string name;
 
+    // Given by an optional sixth field of the probe string.
+    ProbeReduction reduction;
+
+    // Number of values in each sample of one trial, once reduced.
+    unsigned n_cols() const{
+        return reduction.across != ProbeReduction::ACROSS_NONE ? 1 : signal_spec.shape1;
+    }
+
     string to_string() const override;
 };
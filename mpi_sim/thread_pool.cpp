@@ -0,0 +1,112 @@
+#include "thread_pool.hpp"
+
+// Number of times a waiting thread polls before it starts yielding.
+const unsigned SPIN_BEFORE_YIELD = 4096;
+
+SpinBarrier::SpinBarrier(unsigned n_threads)
+:n_threads(n_threads), n_waiting(0), generation(0){
+
+}
+
+void SpinBarrier::wait(){
+    unsigned gen = generation.load(memory_order_acquire);
+
+    if(n_waiting.fetch_add(1, memory_order_acq_rel) == n_threads - 1){
+        // Last thread to arrive releases the others.
+        n_waiting.store(0, memory_order_relaxed);
+        generation.fetch_add(1, memory_order_release);
+    }else{
+        unsigned spins = 0;
+        while(generation.load(memory_order_acquire) == gen){
+            if(++spins > SPIN_BEFORE_YIELD){
+                this_thread::yield();
+            }
+        }
+    }
+}
+
+ThreadPool::ThreadPool(unsigned n_threads)
+:n_threads(n_threads), job_generation(0), n_running(0), stopping(false),
+spin_barrier(n_threads){
+
+    for(unsigned i = 1; i < n_threads; i++){
+        workers.push_back(thread(&ThreadPool::worker_loop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        lock_guard<mutex> lock(job_mutex);
+        stopping = true;
+    }
+
+    job_ready.notify_all();
+
+    for(auto& w: workers){
+        w.join();
+    }
+}
+
+void ThreadPool::run(function<void(unsigned)> j){
+    {
+        lock_guard<mutex> lock(job_mutex);
+        job = j;
+        job_exception = nullptr;
+        n_running = n_threads - 1;
+        job_generation++;
+    }
+
+    job_ready.notify_all();
+
+    run_job(0);
+
+    {
+        unique_lock<mutex> lock(job_mutex);
+        job_done.wait(lock, [this]{ return n_running == 0; });
+    }
+
+    if(job_exception){
+        rethrow_exception(job_exception);
+    }
+}
+
+void ThreadPool::worker_loop(unsigned thread_id){
+    unsigned seen_generation = 0;
+
+    while(true){
+        {
+            unique_lock<mutex> lock(job_mutex);
+            job_ready.wait(
+                lock, [&]{ return stopping || job_generation != seen_generation; });
+
+            if(stopping){
+                return;
+            }
+
+            seen_generation = job_generation;
+        }
+
+        run_job(thread_id);
+
+        bool last;
+        {
+            lock_guard<mutex> lock(job_mutex);
+            last = --n_running == 0;
+        }
+
+        if(last){
+            job_done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_job(unsigned thread_id){
+    try{
+        job(thread_id);
+    }catch(...){
+        lock_guard<mutex> lock(job_mutex);
+        if(!job_exception){
+            job_exception = current_exception();
+        }
+    }
+}
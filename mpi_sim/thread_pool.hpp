@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+/* A barrier for a fixed number of threads that waits by spinning rather than
+ * by sleeping. The threads of a ThreadPool meet at a barrier many times per
+ * simulation step, and waking a sleeping thread costs far more than a typical
+ * operator takes to run. Threads yield after spinning for a while, so that an
+ * oversubscribed node still makes progress. */
+class SpinBarrier{
+
+public:
+    SpinBarrier(unsigned n_threads);
+
+    void wait();
+
+private:
+    const unsigned n_threads;
+    atomic<unsigned> n_waiting;
+    atomic<unsigned> generation;
+};
+
+/* A fixed set of worker threads that can repeatedly be given a job to run.
+ * A job is a function of the thread's id; the thread that calls ``run''
+ * takes part as thread 0, so a pool with n_threads threads creates only
+ * n_threads - 1 new ones. The threads are created with the pool and reused
+ * for every job until the pool is destroyed.
+ *
+ * If the job throws on any thread, the first exception is rethrown from
+ * ``run'' once all threads have finished the job. */
+class ThreadPool{
+
+public:
+    ThreadPool(unsigned n_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    /* Run job(thread_id) on every thread in the pool, with thread_id in
+     * [0, n_threads). Returns when all threads have returned from the job. */
+    void run(function<void(unsigned)> job);
+
+    /* Used from inside a job to make all threads wait until every
+     * thread has reached the same point. */
+    void barrier(){ spin_barrier.wait(); }
+
+    unsigned get_n_threads() const{ return n_threads; }
+
+private:
+    void worker_loop(unsigned thread_id);
+    void run_job(unsigned thread_id);
+
+    const unsigned n_threads;
+    vector<thread> workers;
+
+    mutex job_mutex;
+    condition_variable job_ready;
+    condition_variable job_done;
+
+    function<void(unsigned)> job;
+    unsigned job_generation;
+    unsigned n_running;
+    bool stopping;
+
+    exception_ptr job_exception;
+
+    SpinBarrier spin_barrier;
+};
@@ -0,0 +1,226 @@
+#include "trace.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+static const char* thread_names[] = {"main", "log writer"};
+
+// Laid out as MPI_DOUBLE_INT expects.
+struct BusyRank{
+    double busy;
+    int rank;
+};
+
+Tracer::Tracer(unsigned max_events)
+:max_events(max_events), origin(0.0), step_begin(0.0), step_wait(0.0){
+    for(unsigned t = 0; t < N_TRACE_THREADS; t++){
+        n_dropped[t] = 0;
+    }
+
+    step_name = add_name("step");
+}
+
+unsigned Tracer::add_name(string name){
+    auto found = name_ids.find(name);
+    if(found != name_ids.end()){
+        return found->second;
+    }
+
+    unsigned id = names.size();
+    names.push_back(name);
+    name_ids[name] = id;
+    totals.push_back(0.0);
+
+    return id;
+}
+
+void Tracer::begin_run(MPI_Comm comm){
+    if(comm != MPI_COMM_NULL){
+        MPI_Barrier(comm);
+    }
+
+    origin = wall_time();
+}
+
+void Tracer::begin_step(){
+    step_begin = wall_time();
+    step_wait = 0.0;
+}
+
+void Tracer::end_step(){
+    double end = wall_time();
+    record(step_name, step_begin, end);
+
+    step_begins.push_back(step_begin);
+    step_times.push_back(end - step_begin);
+    step_waits.push_back(step_wait);
+}
+
+// Microseconds since the origin, as Chrome traces measure time.
+static string trace_time(double t, double origin){
+    stringstream out;
+    out << fixed << setprecision(3) << (t - origin) * 1e6;
+    return out.str();
+}
+
+static string json_string(const string& s){
+    string out = "\"";
+    for(char c: s){
+        if(c == '"' || c == '\\'){
+            out += '\\';
+        }
+
+        out += (c == '\n' ? ' ' : c);
+    }
+    out += "\"";
+
+    return out;
+}
+
+string Tracer::events_to_json(int rank) const{
+    stringstream out;
+
+    unsigned long long dropped = 0;
+    for(unsigned t = 0; t < N_TRACE_THREADS; t++){
+        dropped += n_dropped[t];
+    }
+
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank
+        << ",\"args\":{\"name\":\"rank " << rank << "\",\"dropped spans\":" << dropped << "}},\n";
+    out << "{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":" << rank
+        << ",\"args\":{\"sort_index\":" << rank << "}}";
+
+    for(unsigned t = 0; t < N_TRACE_THREADS; t++){
+        if(thread_spans[t].empty()){
+            continue;
+        }
+
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << rank << ",\"tid\":" << t
+            << ",\"args\":{\"name\":\"" << thread_names[t] << "\"}}";
+
+        for(const Span& span: thread_spans[t]){
+            out << ",\n{\"name\":" << json_string(names[span.name]) << ",\"ph\":\"X\",\"pid\":"
+                << rank << ",\"tid\":" << t << ",\"ts\":" << trace_time(span.begin, origin)
+                << ",\"dur\":" << trace_time(span.end, span.begin) << "}";
+        }
+    }
+
+    return out.str();
+}
+
+string Tracer::imbalance_to_json(
+        int n_ranks, const vector<double>& slowest, const vector<int>& slowest_rank,
+        const vector<double>& mean) const{
+
+    stringstream out;
+
+    out << ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << n_ranks
+        << ",\"args\":{\"name\":\"imbalance\"}}";
+    out << ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":" << n_ranks
+        << ",\"args\":{\"sort_index\":-1}}";
+
+    for(unsigned i = 0; i < slowest.size(); i++){
+        string ts = trace_time(step_begins[i], origin);
+
+        out << ",\n{\"name\":\"busy seconds\",\"ph\":\"C\",\"pid\":" << n_ranks
+            << ",\"ts\":" << ts << ",\"args\":{\"slowest\":" << slowest[i]
+            << ",\"mean\":" << mean[i] << "}}";
+        out << ",\n{\"name\":\"slowest rank\",\"ph\":\"C\",\"pid\":" << n_ranks
+            << ",\"ts\":" << ts << ",\"args\":{\"rank\":" << slowest_rank[i] << "}}";
+    }
+
+    return out.str();
+}
+
+void Tracer::write(string filename, MPI_Comm comm) const{
+    int rank = 0, n_ranks = 1;
+    if(comm != MPI_COMM_NULL){
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &n_ranks);
+    }
+
+    // Time each rank spent in a step outside of MPI waits.
+    const unsigned n_steps = step_times.size();
+    vector<BusyRank> local(n_steps), slowest(n_steps);
+    vector<double> busy(n_steps), busy_sum(n_steps);
+
+    for(unsigned i = 0; i < n_steps; i++){
+        busy[i] = step_times[i] - step_waits[i];
+        local[i].busy = busy[i];
+        local[i].rank = rank;
+        slowest[i] = local[i];
+    }
+
+    busy_sum = busy;
+
+    if(comm != MPI_COMM_NULL && n_steps > 0){
+        MPI_Reduce(local.data(), slowest.data(), n_steps, MPI_DOUBLE_INT, MPI_MAXLOC, 0, comm);
+        MPI_Reduce(busy.data(), busy_sum.data(), n_steps, MPI_DOUBLE, MPI_SUM, 0, comm);
+    }
+
+    string data;
+
+    if(rank == 0){
+        vector<double> slowest_busy(n_steps), mean(n_steps);
+        vector<int> slowest_rank(n_steps);
+
+        for(unsigned i = 0; i < n_steps; i++){
+            slowest_busy[i] = slowest[i].busy;
+            slowest_rank[i] = slowest[i].rank;
+            mean[i] = busy_sum[i] / n_ranks;
+        }
+
+        data = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" + events_to_json(rank) +
+            imbalance_to_json(n_ranks, slowest_busy, slowest_rank, mean);
+    }else{
+        data = ",\n" + events_to_json(rank);
+    }
+
+    if(rank == n_ranks - 1){
+        data += "\n]}\n";
+    }
+
+    write_in_rank_order(filename, data, comm, "trace");
+}
+
+void write_in_rank_order(string filename, const string& data, MPI_Comm comm, string what){
+    if(comm == MPI_COMM_NULL){
+        ofstream out(filename);
+        out << data;
+
+        if(!out.good()){
+            stringstream msg;
+            msg << "Could not write " << what << " to " << filename << "." << endl;
+            throw runtime_error(msg.str());
+        }
+
+        return;
+    }
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // The parts are written one after another, in order of rank.
+    long long length = data.length(), offset = 0;
+    MPI_Exscan(&length, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if(rank == 0){
+        offset = 0;
+    }
+
+    MPI_File fh;
+    int error = MPI_File_open(
+        comm, (char*)filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+
+    if(error != MPI_SUCCESS){
+        stringstream msg;
+        msg << "Could not open " << filename << " to write the " << what << "." << endl;
+        throw runtime_error(msg.str());
+    }
+
+    MPI_File_set_size(fh, 0);
+    MPI_File_write_at_all(
+        fh, offset, (char*)data.c_str(), int(length), MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+}
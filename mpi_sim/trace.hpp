@@ -0,0 +1,124 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <mpi.h>
+
+
+using namespace std;
+
+// Most spans each thread of a Tracer keeps; later ones are counted, but dropped.
+const unsigned DEFAULT_MAX_TRACE_EVENTS = 1000000;
+
+// Wall-clock time in seconds, from a monotonic clock. Unlike clock(), this
+// includes time spent blocked, such as waiting for MPI messages or the disk.
+inline double wall_time(){
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Write ``data'' from every process in comm to ``filename'', one after another
+ * in order of rank, replacing the file. If comm is null, this process is the
+ * only one. ``what'' names the data in errors. */
+void write_in_rank_order(string filename, const string& data, MPI_Comm comm, string what);
+
+/* Records what a process spends its time on during a simulation, as named
+ * spans of wall-clock time: each step, each time an MPI operator waits for its
+ * message, each flush of the probes, each write to the simulation log, and,
+ * if operators are timed, each operator call. Names are registered once, and
+ * the total time spent under each name is kept alongside the spans.
+ *
+ * Spans are recorded by the main thread and by the thread that writes the
+ * simulation log, into separate buffers, so recording takes no locks. A name
+ * must only be recorded from one of the two threads.
+ *
+ * The trace of every process can be written to a single Chrome trace (the JSON
+ * format read by chrome://tracing and Perfetto), with a process per rank. It
+ * also holds, for every step, how long the busiest rank spent outside of MPI
+ * waits compared to the mean, and which rank that was, which shows where the
+ * stragglers are. */
+class Tracer{
+
+public:
+    enum Thread {MAIN_THREAD, LOG_THREAD, N_TRACE_THREADS};
+
+    Tracer(unsigned max_events=DEFAULT_MAX_TRACE_EVENTS);
+
+    // Returns the id of the name, registering it if it is new. Names must
+    // all be registered before the log thread starts recording.
+    unsigned add_name(string name);
+
+    /* Start measuring. Times in the trace are counted from here. If comm is
+     * not null, every process in it must call this, and they all start at the
+     * same moment, so that their traces line up. */
+    void begin_run(MPI_Comm comm);
+
+    void record(unsigned name, double begin, double end, Thread thread=MAIN_THREAD){
+        totals[name] += end - begin;
+
+        vector<Span>& spans = thread_spans[thread];
+        if(spans.size() < max_events){
+            spans.push_back({begin, end, name});
+        }else{
+            n_dropped[thread]++;
+        }
+    }
+
+    // Record time spent waiting for an MPI message, which is left out of the
+    // busy time of the step. Only called from the main thread.
+    void record_wait(unsigned name, double begin, double end){
+        record(name, begin, end);
+        step_wait += end - begin;
+    }
+
+    void begin_step();
+    void end_step();
+
+    // Total seconds recorded under a name.
+    double total(unsigned name) const{ return totals[name]; }
+
+    // Seconds that each step took, and how many of them were spent in MPI waits.
+    const vector<double>& get_step_times() const{ return step_times; }
+    const vector<double>& get_step_waits() const{ return step_waits; }
+
+    /* Write the trace of every process in comm to ``filename'', each process
+     * writing its own part of the file. If comm is null, this process is the
+     * only one. Every process in comm must have simulated the same steps. */
+    void write(string filename, MPI_Comm comm) const;
+
+private:
+    struct Span{
+        double begin;
+        double end;
+        unsigned name;
+    };
+
+    // The spans of this process as trace events, separated by commas.
+    string events_to_json(int rank) const;
+
+    // Counters for the busy time of the slowest rank and the mean busy time
+    // in each step, shown as a process of their own.
+    string imbalance_to_json(
+        int n_ranks, const vector<double>& slowest, const vector<int>& slowest_rank,
+        const vector<double>& mean) const;
+
+    unsigned max_events;
+    unsigned long long n_dropped[N_TRACE_THREADS];
+
+    vector<string> names;
+    map<string, unsigned> name_ids;
+    vector<double> totals;
+
+    vector<Span> thread_spans[N_TRACE_THREADS];
+
+    double origin;
+    unsigned step_name;
+
+    double step_begin;
+    double step_wait;
+    vector<double> step_begins;
+    vector<double> step_times;
+    vector<double> step_waits;
+};
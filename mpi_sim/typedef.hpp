@@ -2,6 +2,28 @@
  * addresses of python objects, so we need to use long long ints (64 bits). */
 typedef uintmax_t key_type;
 
-/* Type for data used throughout the simulation. */
+/* Type for data used throughout the simulation. Simulations run in single
+ * precision if NENGO_MPI_SINGLE_PRECISION is defined at compile time (see the
+ * ``single'' make target), and in double precision otherwise. Network files
+ * always store doubles, which HDF5 converts to dtype as they are read.
+ *
+ * The macros give the matching MPI, HDF5 and numpy types. They are only
+ * expanded where the corresponding library has been included. */
+#ifdef NENGO_MPI_SINGLE_PRECISION
+
+typedef float dtype;
+#define MPI_DTYPE MPI_FLOAT
+#define H5T_NATIVE_DTYPE H5T_NATIVE_FLOAT
+#define NPY_DTYPE NPY_FLOAT
+#define DTYPE_PRECISION "single"
+
+#else
+
 typedef double dtype;
+#define MPI_DTYPE MPI_DOUBLE
+#define H5T_NATIVE_DTYPE H5T_NATIVE_DOUBLE
+#define NPY_DTYPE NPY_DOUBLE
+#define DTYPE_PRECISION "double"
+
+#endif
 
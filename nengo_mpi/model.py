@@ -13,7 +13,7 @@ from collections import defaultdict, OrderedDict
 import warnings
 from itertools import chain
 import os
-import tempfile
+import multiprocessing
 import sys
 import logging
 import six
@@ -34,7 +34,6 @@ from nengo.neurons import AdaptiveLIF, AdaptiveLIFRate, Izhikevich
 from nengo.synapses import LinearFilter, Triangle
 from nengo.processes import (
     WhiteNoise, FilteredNoise, BrownNoise, WhiteSignal, PresentInput)
-from nengo.utils.graphs import toposort
 from nengo.utils.simulator import operator_depencency_graph
 from nengo.cache import NoDecoderCache
 from nengo.network import Network
@@ -45,10 +44,14 @@ from nengo.exceptions import BuildError
 
 from nengo_mpi import PartitionError
 from nengo_mpi.utils import (
-    OP_DELIM, PROBE_DELIM, make_key,
-    pad, ndarray_to_string, get_closures)
+    OP_DELIM, PROBE_DELIM, SIGNAL_KEY_ATTR, make_key, pad, get_closures,
+    BINARY_OP_FORMAT, PACKED_COMPONENT_LAYOUT, OP_TYPES, OP_ARG_DTYPE,
+    NATIVE_OP_ARG_DTYPE, ARG_SIGNAL, ARG_INTEGER,
+    ARG_REAL, ARG_VALUES, ARG_MATRIX, ARG_INDICES, ARG_STRINGS,
+    OpValues, OpMatrix, OpIndices, OpStrings)
 from nengo_mpi.utils import signal_to_string as _signal_to_string
 from nengo_mpi.native import NativeSimulator, native_sim_available
+from nengo_mpi.partition.profile import object_ids
 from nengo_mpi.spaun_mpi import SpaunStimulus, build_spaun_stimulus
 from nengo_mpi.spaun_mpi import SpaunStimulusOperator
 
@@ -114,9 +117,12 @@ class MpiSend(Operator):
     that it will be sent to. No `makestep` is defined, as it will
     never be called (this operator is never used in python simulations).
 
+    ``is_update`` must match the corresponding MpiRecv; the C++ code uses it
+    to decide which sends can be merged into a single message.
+
     """
 
-    def __init__(self, dst, tag, signal):
+    def __init__(self, dst, tag, signal, is_update):
         self.sets = []
         self.incs = []
         self.reads = []
@@ -125,6 +131,7 @@ class MpiSend(Operator):
         self.dst = dst
         self.tag = tag
         self.signal = signal
+        self.is_update = is_update
 
 
 class MpiRecv(Operator):
@@ -208,6 +215,62 @@ def split_connection(conn_ops, signal, is_update):
     return pre_ops, post_ops
 
 
+def gathering_toposort(edges, gathered):
+    """ Topologically sort a graph, keeping chosen nodes together.
+
+    Like ``nengo.utils.graphs.toposort``, but any node for which
+    ``gathered(node)`` is true is only taken once no other node is ready,
+    and then together with every other such node that is ready. Used to
+    order the SimPyFunc operators so that as many as possible are
+    consecutive, since the native simulator calls python once for each run
+    of consecutive python functions.
+
+    Parameters
+    ----------
+    edges: dict
+        A mapping from each node to the set of nodes that depend on it.
+    gathered: function
+        Whether a node is one of those to keep together.
+
+    Returns
+    -------
+    order: list
+        The nodes, each coming after every node it depends on.
+
+    """
+    nodes = list(edges)
+    nodes.extend(
+        n for n in set(chain(*edges.values())) if n not in edges)
+
+    n_deps = defaultdict(int)
+    for node in nodes:
+        for succ in edges.get(node, ()):
+            n_deps[succ] += 1
+
+    ready = [n for n in nodes if n_deps[n] == 0 and not gathered(n)]
+    ready_gathered = [n for n in nodes if n_deps[n] == 0 and gathered(n)]
+
+    order = []
+    while ready or ready_gathered:
+        if ready:
+            taken = [ready.pop()]
+        else:
+            taken, ready_gathered = ready_gathered, []
+
+        for node in taken:
+            order.append(node)
+
+            for succ in edges.get(node, ()):
+                n_deps[succ] -= 1
+                if n_deps[succ] == 0:
+                    (ready_gathered if gathered(succ) else ready).append(succ)
+
+    if len(order) != len(nodes):
+        raise ValueError("Graph is not acyclic.")
+
+    return order
+
+
 def store_string_list(
         h5_file, dset_name, strings, final_null=True, compression='gzip'):
     """ Store a list of strings as a dataset in an hdf5 file or group.
@@ -231,6 +294,138 @@ def store_string_list(
     dset.attrs['n_strings'] = len(strings)
 
 
+PROBE_WINDOWS = ('sample', 'mean', 'min', 'max', 'count')
+PROBE_ACROSS = (None, 'mean', 'sum')
+
+
+def reduction_string(reduction):
+    """ Encode a probe reduction, a dict with the optional keys ``synapse``,
+    ``window`` and ``across`` (see ``Simulator``), for the simulator. """
+
+    unknown = set(reduction) - set(['synapse', 'window', 'across'])
+    if unknown:
+        raise ValueError(
+            "Unknown keys in probe reduction: %s." % ", ".join(sorted(unknown)))
+
+    synapse = reduction.get('synapse', None)
+    window = reduction.get('window', 'sample')
+    across = reduction.get('across', None)
+
+    if window not in PROBE_WINDOWS:
+        raise ValueError(
+            "Probe reduction window must be one of %s, got %r." % (
+                ", ".join(PROBE_WINDOWS), window))
+
+    if across not in PROBE_ACROSS:
+        raise ValueError(
+            "Probe reduction across must be None, 'mean' or 'sum', "
+            "got %r." % (across,))
+
+    if synapse is not None and synapse <= 0:
+        raise ValueError("Probe reduction synapse must be positive.")
+
+    return ":".join([
+        repr(float(synapse or 0.0)), window, across or 'none'])
+
+
+def pack_strings(strings):
+    """ Encode a list of strings as an array of characters in which each
+    string is terminated by a null character. """
+    big_string = ''.join(s + '\0' for s in strings)
+
+    if isinstance(big_string, six.text_type):
+        big_string = big_string.encode('ascii')
+
+    return np.frombuffer(big_string, dtype='S1')
+
+
+class OpEncoder(object):
+    """ Stores the operators of one component in the binary encoding.
+
+    Each operator is a type, an index and a range of rows in a table of
+    typed arguments. Signal arguments refer to rows of a table of signal
+    views, and list arguments refer to ranges of flat arrays of reals,
+    indices and strings, so that the C++ code can build the operators
+    without parsing any strings. See build_op_specs in
+    mpi_sim/net_file.cpp for the reader.
+
+    """
+    def __init__(self):
+        self.types = []
+        self.indices = []
+        self.arg_starts = [0]
+        self.args = []
+        self.signals = []
+        self.reals = []
+        self.index_data = []
+        self.strings = []
+
+    def add(self, index, op_args):
+        self.types.append(OP_TYPES.get(op_args[0], 0))
+        self.indices.append(index)
+        self.args.extend(self._encode(arg) for arg in op_args[1:])
+        self.arg_starts.append(len(self.args))
+
+    def _encode(self, arg):
+        if isinstance(arg, Signal):
+            shape = pad(arg.shape)
+            stride = pad(arg.elemstrides)
+
+            self.signals.append((
+                make_key(arg.base), arg.ndim, shape[0], shape[1],
+                stride[0], stride[1], arg.elemoffset))
+            return (ARG_SIGNAL, len(self.signals) - 1, 0, 0, 0.0)
+
+        elif isinstance(arg, (OpValues, OpMatrix)):
+            values = np.atleast_2d(np.asarray(arg.values, dtype=np.float64))
+            if isinstance(arg, OpValues):
+                kind, (rows, cols) = ARG_VALUES, (values.size, 1)
+            else:
+                kind, (rows, cols) = ARG_MATRIX, values.shape
+
+            start = len(self.reals)
+            self.reals.extend(values.flatten())
+            return (kind, start, rows, cols, 0.0)
+
+        elif isinstance(arg, OpIndices):
+            start = len(self.index_data)
+            self.index_data.extend(int(i) for i in arg.values)
+            return (ARG_INDICES, start, len(arg.values), 1, 0.0)
+
+        elif isinstance(arg, OpStrings):
+            start = len(self.strings)
+            self.strings.extend(str(s) for s in arg.values)
+            return (ARG_STRINGS, start, len(arg.values), 1, 0.0)
+
+        elif isinstance(arg, (bool, int, long, np.integer)):
+            return (ARG_INTEGER, int(arg), 0, 0, 0.0)
+
+        else:
+            return (ARG_REAL, 0, 0, 0, float(arg))
+
+    def arrays(self):
+        """ The datasets storing the operators, as (name, array) pairs. """
+        return [
+            ('op_types', np.array(self.types, dtype='int32')),
+            ('op_indices', np.array(self.indices, dtype='float64')),
+            ('op_arg_starts', np.array(self.arg_starts, dtype='int64')),
+            ('op_args', np.array(self.args, dtype=OP_ARG_DTYPE)),
+            ('op_signals',
+             np.array(self.signals, dtype='int64').reshape(-1, 7)),
+            ('op_reals', np.array(self.reals, dtype='float64')),
+            ('op_index_data', np.array(self.index_data, dtype='int64')),
+            ('op_strings', pack_strings(self.strings))]
+
+
+# The model whose components are being exported by the worker processes of
+# MpiModel.finalize_build, which the workers inherit when they are forked.
+_exporting_model = None
+
+
+def _export_component(component):
+    return component, _exporting_model._export_component(component)
+
+
 class MpiModel(Model):
     """Output of the MpiBuilder, used by nengo_mpi.Simulator.
 
@@ -261,11 +456,29 @@ class MpiModel(Model):
     debug: bool
         Whether to run in debug mode. In debug mode, labels of operators and
         strings are passed to C++.
+    sim_options: dict
+        Options for the native simulator, mapping from option names (the same
+        as the long command line options of bin/nengo_mpi, e.g. ``threads``)
+        to values. Ignored if ``save_file`` is non-empty.
+    component_mapping: sequence of int
+        The process that simulates each component, stored in the network
+        file. Taken modulo the number of processes the network is run on.
+        Component 0 must be mapped to process 0. If None, component ``c``
+        is simulated by process ``c % n_processes``.
+    export_workers: int
+        Number of processes, forked from this one, that encode the components
+        of the network for the network file in parallel. With 1, the
+        components are encoded by this process.
+    probe_reductions: dict
+        Maps probes to how their data is reduced by the simulator before it
+        is stored. See ``Simulator``.
 
     """
     def __init__(
             self, n_components, assignments, dt=0.001, label=None,
-            decoder_cache=NoDecoderCache(), save_file="", debug=False):
+            decoder_cache=NoDecoderCache(), save_file="", debug=False,
+            sim_options=None, component_mapping=None, export_workers=1,
+            probe_reductions=None):
 
         self.dt = dt
         self.label = label
@@ -291,6 +504,21 @@ class MpiModel(Model):
         self.n_components = n_components
         self.assignments = assignments
 
+        if component_mapping is not None:
+            component_mapping = list(component_mapping)
+
+            if len(component_mapping) != n_components:
+                raise ValueError(
+                    "component_mapping has %d entries, but there are %d "
+                    "components." % (len(component_mapping), n_components))
+
+            if n_components > 0 and component_mapping[0] != 0:
+                raise ValueError(
+                    "component_mapping must map component 0 to process 0.")
+
+        self.component_mapping = component_mapping
+        self.export_workers = export_workers
+
         # for each component, stores the keys of the signals that have
         # to be sent and received, respectively
         self.send_signals = defaultdict(list)
@@ -298,6 +526,7 @@ class MpiModel(Model):
 
         self.base_signals = defaultdict(OrderedDict)
         self.total_base_signal_size = defaultdict(int)
+        self.n_signal_keys = 0
 
         self.sig = defaultdict(dict)
         self.sig['common'][0] = Signal(0., readonly=True, name='ZERO')
@@ -319,16 +548,24 @@ class MpiModel(Model):
                 "network files (cannot run simulations). However, save_file "
                 "argument was empty.")
 
+        # Trials of the network simulated together (see ``Simulator``).
+        self.n_trials = int((sim_options or {}).get('trials', 1))
+
         # Only create a working simulator if necessary.
-        self.native_sim = NativeSimulator(self.sig) if not save_file else None
+        self.native_sim = (
+            NativeSimulator(self.sig, sim_options) if not save_file else None)
 
-        self.save_file = save_file if save_file else tempfile.mktemp()
+        self.save_file = save_file
 
         self.h5_compression = 'gzip'
-        self.op_strings = defaultdict(list)
         self.probe_strings = defaultdict(list)
         self.all_probe_strings = []
 
+        # probe -> reduction string (see ProbeReduction in mpi_sim/probe.hpp)
+        self.probe_reductions = {
+            probe: reduction_string(reduction)
+            for probe, reduction in (probe_reductions or {}).items()}
+
         # component index (int) -> list of operators
         # stores the operators for each component
         self.component_ops = defaultdict(list)
@@ -345,6 +582,9 @@ class MpiModel(Model):
 
         self._mpi_tag = 0
 
+        # mpi tag (int) -> Connection whose signal is sent with that tag
+        self.tag_connections = {}
+
         self.pyfunc_ops = []
         self.probed_connections = set()
 
@@ -362,6 +602,16 @@ class MpiModel(Model):
         """
         return self.native_sim is not None
 
+    def probe_shape(self, probe):
+        """ The shape of each sample of ``probe`` in a single trial. A
+        reduction across the values of the probed signal leaves one. """
+
+        reduction = self.probe_reductions.get(probe)
+        if reduction is not None and not reduction.endswith(':none'):
+            return (1,)
+
+        return self.sig[probe]['in'].shape
+
     def get_value(self, signal):
         if not self.runnable:
             return 0
@@ -437,9 +687,10 @@ class MpiModel(Model):
                 self.object_ops[conn], signal, is_update)
 
             tag = self._next_mpi_tag()
+            self.tag_connections[tag] = conn
 
             self.send_signals[pre_component].append(
-                (signal, tag, post_component))
+                (signal, tag, post_component, is_update))
             self.recv_signals[post_component].append(
                 (signal, tag, pre_component, is_update))
 
@@ -461,6 +712,14 @@ class MpiModel(Model):
 
         """
         base = signal.base
+
+        # Base signals are numbered in the order they are assigned, which
+        # is the same each time a network is built, so that a simulator of
+        # the same network can reuse a cached chunk (see cache_memory).
+        if not hasattr(base, SIGNAL_KEY_ATTR):
+            self.n_signal_keys += 1
+            setattr(base, SIGNAL_KEY_ATTR, self.n_signal_keys)
+
         key = make_key(base)
 
         if key not in self.base_signals[component]:
@@ -502,20 +761,29 @@ class MpiModel(Model):
         """ Finalize the build step.
 
         Called once the MpiBuilder has finished running. Finalizes
-        operators and probes, converting them to strings. Then writes
+        operators and probes, and encodes them (in parallel, with
+        ``export_workers`` > 1). If self.native_sim is None, writes
         all relevant information (signals, ops and probes for each component)
-        to an HDF5 file. Then, if self.native_sim is not None (so we want to
-        create a runnable MPI simulator), calls self.native_sim.load_file which
-        tells the C++ code to load the HDF5 file we have just written and
-        create a working simulator.
+        to ``save_file``. Otherwise (so we want to create a runnable MPI
+        simulator), hands the same arrays to the native simulator in memory,
+        which scatters them to the processes that simulate each component.
 
         """
         all_ops = list(chain(
             *[self.component_ops[component]
               for component in range(self.n_components)]))
         dg = operator_depencency_graph(all_ops)
+
+        # Ordered as the operators were built rather than by their hashes,
+        # so that the same network gets the same ordering each time.
+        position = {op: i for i, op in enumerate(all_ops)}
+        dg = OrderedDict(
+            (op, sorted(dg.get(op, ()), key=position.get)) for op in all_ops)
+
+        is_pyfunc = lambda op: isinstance(op, builder.node.SimPyFunc)
         global_ordering = [
-            op for op in toposort(dg) if hasattr(op, 'make_step')]
+            op for op in gathering_toposort(dg, is_pyfunc)
+            if hasattr(op, 'make_step')]
         self.global_ordering = {op: i for i, op in enumerate(global_ordering)}
         self.global_ordering[self.time_update] = -1
 
@@ -528,117 +796,185 @@ class MpiModel(Model):
         self._finalize_ops()
         self._finalize_probes()
 
-        with h5.File(self.save_file, 'w') as save_file:
-            save_file.attrs['dt'] = self.dt
-            save_file.attrs['n_components'] = self.n_components
+        # index (float) -> high-level object implemented by the operator with
+        # that index, so that a cost profile of a simulation can be traced back
+        # to the network (see nengo_mpi.partition.profile).
+        self.op_objects = {
+            self.global_ordering[op]: obj
+            for obj, ops in self.object_ops.items() for op in ops
+            if op in self.global_ordering}
 
-            for component in range(self.n_components):
-                component_group = save_file.create_group(str(component))
-
-                # base signals
-                base_signals = self.base_signals[component]
-                signal_dset = component_group.create_dataset(
-                    'signals', (self.total_base_signal_size[component],),
-                    dtype='float64', compression=self.h5_compression)
-
-                offset = 0
-                for base in base_signals.values():
-                    shape = base.shape
-                    stride = base.elemstrides
-
-                    if base.ndim == 2:
-                        # assert that the signal is contiguous
-                        assert ((stride[1] == 1 and shape[1] == stride[0]) or
-                                (stride[0] == 1 and shape[0] == stride[1]))
-
-                        if base.elemstrides[1] == 1:
-                            values = base.initial_value.flatten()
-                        elif base.elemstrides[0] == 1:
-                            values = base.initial_value.T.flatten()
-                        else:
-                            raise ValueError(
-                                "Received a signal with strides that "
-                                "nengo_mpi cannot handle. Signal "
-                                "was %s, stride is %s." % (
-                                    base, base.elemstrides))
-
-                        signal_dset[offset:offset+base.size] = values
-                    else:
-                        # assert that the signal is contiguous
-                        assert base.ndim == 0 or stride[0] == 1
-                        signal_dset[
-                            offset:offset+base.size] = base.initial_value
-
-                    offset += base.size
-
-                # base signal keys
-                base_signal_keys = np.array([
-                    long(key) for key in base_signals.keys()])
-
-                component_group.create_dataset(
-                    'signal_keys', data=base_signal_keys,
-                    dtype='int64', compression=self.h5_compression)
-
-                # base signal shapes
-                base_signal_shapes = np.array([
-                    pad(sig.shape) for sig in base_signals.values()])
-
-                component_group.create_dataset(
-                    'signal_shapes', data=base_signal_shapes,
-                    dtype='int64', compression=self.h5_compression)
-
-                # base signal strides
-                base_signal_strides = np.array([
-                    pad(sig.elemstrides) for sig in base_signals.values()])
-
-                component_group.create_dataset(
-                    'signal_strides', data=base_signal_strides,
-                    dtype='int64', compression=self.h5_compression)
-
-                # base signal labels
-                if self.debug:
-                    signal_labels = [sig.name for sig in base_signals.values()]
-                else:
-                    signal_labels = ['' for sig in base_signals.values()]
+        if self.native_sim is None:
+            self._save_network()
+            return
+
+        # A python function would only see the signals of the first trial.
+        # Checked before the network is handed over, so that the processes
+        # of the simulator are never left waiting for the rest of the build.
+        if self.pyfunc_ops and self.n_trials > 1:
+            raise RuntimeError(
+                "Networks with python functions can only be simulated one "
+                "trial at a time.")
+
+        self._load_network()
+
+        for op in self.pyfunc_ops:
+            self.native_sim.create_PyFunc(op, self.global_ordering[op])
 
-                store_string_list(
-                    component_group, 'signal_labels', signal_labels,
-                    compression=self.h5_compression)
+        self.native_sim.finalize_build()
 
-                # operators
-                op_strings = self.op_strings[component]
-                store_string_list(
-                    component_group, 'operators', op_strings,
-                    compression=self.h5_compression)
+    def _save_network(self):
+        """ Write the encoded components, with the probes and the component
+        graph, to ``save_file``. """
 
-                # probes
-                probe_strings = self.probe_strings[component]
-                store_string_list(
-                    component_group, 'probes', probe_strings,
-                    compression=self.h5_compression)
+        with h5.File(self.save_file, 'w') as save_file:
+            save_file.attrs['dt'] = self.dt
+            save_file.attrs['n_components'] = self.n_components
+            save_file.attrs['op_format'] = BINARY_OP_FORMAT
+            save_file.attrs['component_layout'] = PACKED_COMPONENT_LAYOUT
+
+            # The data of all components is concatenated into one dataset per
+            # kind of data, so that each process can load its components with
+            # one read per dataset. See NetworkFile in mpi_sim/net_file.hpp.
+            packed_group = save_file.create_group('components')
+            packed = defaultdict(list)
+
+            # base signals, written a component at a time
+            signal_offsets = np.cumsum([0] + [
+                self.total_base_signal_size[component]
+                for component in range(self.n_components)])
+
+            signal_dset = packed_group.create_dataset(
+                'signals', (signal_offsets[-1],),
+                dtype='float64', compression=self.h5_compression)
+
+            packed_group.create_dataset(
+                'signals_offsets', data=signal_offsets.astype('int64'))
+
+            # Components arrive in order as they are encoded, and their
+            # signals are written straight away.
+            for component, arrays in self._export_components():
+                signal_dset[
+                    signal_offsets[component]:
+                    signal_offsets[component + 1]] = arrays.pop('signals')
+
+                for name, data in arrays.items():
+                    packed[name].append(data)
+
+            for name, arrays in packed.items():
+                offsets = np.cumsum([0] + [len(a) for a in arrays])
+                data = np.concatenate(arrays)
+
+                packed_group.create_dataset(
+                    name, data=data,
+                    compression=self.h5_compression if data.size else None)
+                packed_group.create_dataset(
+                    name + '_offsets', data=offsets.astype('int64'))
 
             store_string_list(
                 save_file, 'probe_info', self.all_probe_strings,
                 compression=self.h5_compression)
 
-        if self.native_sim is not None:
-            self.native_sim.load_network(self.save_file)
-            os.remove(self.save_file)
+            self._store_component_graph(save_file)
+
+            if self.toplevel is not None:
+                self._store_profile_tables(save_file)
 
-            for op in self.pyfunc_ops:
-                self.native_sim.create_PyFunc(op, self.global_ordering[op])
+    def _load_network(self):
+        """ Hand the encoded components to the native simulator, as the
+        arrays that _save_network would concatenate into each packed dataset
+        of the network file. Arrays of the types that the simulator reads
+        are used without being copied. """
 
-            self.native_sim.finalize_build()
+        packed = defaultdict(list)
+        for component, arrays in self._export_components():
+            for name, data in arrays.items():
+                packed[name].append(data)
+
+        datasets = {}
+        for name, arrays in packed.items():
+            offsets = np.cumsum([0] + [len(a) for a in arrays])
+            data = np.concatenate(arrays)
+
+            if name == 'op_args':
+                data = data.astype(NATIVE_OP_ARG_DTYPE)
+
+            datasets[name] = (data, offsets.astype('int64'))
+
+        self.native_sim.load_network_arrays(
+            self.dt, self.n_components, pack_strings(self.all_probe_strings),
+            datasets, self._component_graph(),
+            None if self.component_mapping is None else
+            np.array(self.component_mapping, dtype='int32'))
+
+    def _component_graph(self):
+        """ The number of values sent per step between each pair of
+        components, as rows of (src, dst, size). """
+
+        traffic = defaultdict(int)
+        for component in range(self.n_components):
+            for sig, tag, dst, is_update in self.send_signals[component]:
+                traffic[component, dst] += sig.size
+
+        return np.array(
+            [(src, dst, size) for (src, dst), size in sorted(traffic.items())],
+            dtype='int64').reshape(-1, 3)
+
+    def _store_component_graph(self, save_file):
+        """ Store the component graph, and the mapping of components
+        to processes if one was given. The simulator can rearrange components
+        by their traffic (see ComponentMapping in mpi_sim/mapping.hpp). """
+
+        save_file.create_dataset('component_graph', data=self._component_graph())
+
+        if self.component_mapping is not None:
+            save_file.create_dataset(
+                'component_mapping',
+                data=np.array(self.component_mapping, dtype='int32'))
+
+    def _store_profile_tables(self, save_file):
+        """ Store which object each operator implements, and which connection
+        each message belongs to, naming objects as ``object_ids`` does. Read
+        by CostProfile.from_network_file, to trace a profile of a simulation
+        of the saved network back to the network. """
+
+        ids = object_ids(self.toplevel)
+        names = sorted(set(ids.values()))
+        numbers = {name: i for i, name in enumerate(names)}
+
+        op_objects = [
+            (index, numbers[ids[obj]])
+            for index, obj in self.op_objects.items() if obj in ids]
+        tag_objects = [
+            (tag, numbers[ids[conn]])
+            for tag, conn in self.tag_connections.items() if conn in ids]
+
+        store_string_list(
+            save_file, 'profile_objects', names,
+            compression=self.h5_compression)
+
+        save_file.create_dataset(
+            'profile_op_indices',
+            data=np.array([i for i, _ in op_objects], dtype='float64'))
+        save_file.create_dataset(
+            'profile_op_objects',
+            data=np.array([o for _, o in op_objects], dtype='int64'))
+        save_file.create_dataset(
+            'profile_tags',
+            data=np.array([t for t, _ in tag_objects], dtype='int64'))
+        save_file.create_dataset(
+            'profile_tag_objects',
+            data=np.array([o for _, o in tag_objects], dtype='int64'))
 
     def _finalize_ops(self):
         """ Finalize operators.
 
         Main jobs are to create MpiSend and MpiRecv operators based on
-        send_signals and recv_signals, and to turn all ops belonging to
-        each component into strings, which are then stored in
-        self.op_strings. PyFunc ops are the only exception, as it is
-        not generally possible to encode an arbitrary python function
-        (and all its context) as a string.
+        send_signals and recv_signals, and to put the ops of each component
+        in the order they are simulated in, ready to be encoded by
+        _export_component. PyFunc ops are set aside, as it is not
+        generally possible to encode an arbitrary python function (and all
+        its context) in a file.
 
         """
         for component in range(self.n_components):
@@ -656,8 +992,8 @@ class MpiModel(Model):
                 for sig in op.reads:
                     read_by[sig].append(op)
 
-            for sig, tag, dst in send_signals:
-                mpi_send = MpiSend(dst, tag, sig)
+            for sig, tag, dst, is_update in send_signals:
+                mpi_send = MpiSend(dst, tag, sig, is_update)
 
                 assert len(written_by[sig]) > 0
 
@@ -684,9 +1020,7 @@ class MpiModel(Model):
             self.component_ops[component] = op_order
 
             for op in op_order:
-                op_type = type(op)
-
-                if op_type == builder.node.SimPyFunc:
+                if type(op) == builder.node.SimPyFunc:
                     if not self.runnable:
                         raise BuildError(
                             "Cannot create SimPyFunc operator "
@@ -698,45 +1032,162 @@ class MpiModel(Model):
                             "component other than component 0.")
 
                     self.pyfunc_ops.append(op)
+
+    def _export_components(self):
+        """ Yield (component, arrays) for every component in order, where
+        arrays is as returned by _export_component.
+
+        With ``export_workers`` > 1, the components are exported by a pool of
+        that many worker processes, forked so that they share the model
+        instead of having it sent to them. The arrays are sent back as they
+        are finished, so only the components that are still to be written
+        are held at once.
+
+        """
+        n_workers = min(self.export_workers, self.n_components)
+
+        if n_workers <= 1 or not hasattr(os, 'fork'):
+            for component in range(self.n_components):
+                yield component, self._export_component(component)
+            return
+
+        if hasattr(multiprocessing, 'get_context'):
+            context = multiprocessing.get_context('fork')
+        else:
+            context = multiprocessing
+
+        global _exporting_model
+        _exporting_model = self
+
+        # Processes without a seed draw from the global numpy generator,
+        # which the workers would otherwise all inherit in the same state.
+        pool = context.Pool(n_workers, initializer=np.random.seed)
+        try:
+            for result in pool.imap(
+                    _export_component, range(self.n_components)):
+                yield result
+
+            pool.close()
+        finally:
+            pool.terminate()
+            pool.join()
+            _exporting_model = None
+
+    def _export_component(self, component):
+        """ Encode the operators and base signals of a component.
+
+        Returns a dict from the names of datasets in the ``components``
+        group of the network file to this component's part of them, with
+        the initial values of its base signals, one after another, under
+        ``signals``. Only reads the model, so that components can be
+        exported in parallel.
+
+        """
+        encoder = OpEncoder()
+
+        for op in self.component_ops[component]:
+            if type(op) == builder.node.SimPyFunc:
+                continue
+
+            op_args = self._op_args(op)
+
+            if op_args:
+                index = self.global_ordering[op]
+
+                if logger.isEnabledFor(logging.DEBUG):
+                    logger.debug(
+                        "Component %d: Adding operator with string: %s",
+                        component, self._op_to_string(index, op_args))
+
+                encoder.add(index, op_args)
+
+        arrays = dict(encoder.arrays())
+
+        base_signals = self.base_signals[component]
+
+        values = []
+        for base in base_signals.values():
+            shape = base.shape
+            stride = base.elemstrides
+
+            if base.ndim == 2:
+                # assert that the signal is contiguous
+                assert ((stride[1] == 1 and shape[1] == stride[0]) or
+                        (stride[0] == 1 and shape[0] == stride[1]))
+
+                if stride[1] == 1:
+                    values.append(base.initial_value.ravel())
+                elif stride[0] == 1:
+                    values.append(base.initial_value.T.ravel())
                 else:
-                    op_string = self._op_to_string(op)
+                    raise ValueError(
+                        "Received a signal with strides that "
+                        "nengo_mpi cannot handle. Signal "
+                        "was %s, stride is %s." % (base, stride))
+            else:
+                # assert that the signal is contiguous
+                assert base.ndim == 0 or stride[0] == 1
+                values.append(np.ravel(base.initial_value))
+
+        arrays['signals'] = np.concatenate(
+            [np.asarray(v, dtype='float64') for v in values] or
+            [np.zeros(0)])
+
+        # base signal keys
+        arrays['signal_keys'] = np.array([
+            long(key) for key in base_signals.keys()], dtype='int64')
+
+        # base signal shapes
+        arrays['signal_shapes'] = np.array([
+            pad(sig.shape) for sig in base_signals.values()],
+            dtype='int64').reshape(-1, 2)
+
+        # base signal strides
+        arrays['signal_strides'] = np.array([
+            pad(sig.elemstrides) for sig in base_signals.values()],
+            dtype='int64').reshape(-1, 2)
+
+        # base signal labels
+        if self.debug:
+            signal_labels = [sig.name for sig in base_signals.values()]
+        else:
+            signal_labels = ['' for sig in base_signals.values()]
 
-                    if op_string:
-                        logger.debug(
-                            "Component %d: Adding operator with string: %s",
-                            component, op_string)
+        arrays['signal_labels'] = pack_strings(signal_labels)
 
-                        self.op_strings[component].append(op_string)
+        # probes
+        arrays['probes'] = pack_strings(self.probe_strings[component])
+
+        return arrays
 
     def signal_to_string(self, signal):
         return _signal_to_string(signal, self.debug)
 
-    def _op_to_string(self, op):
-        """ Convert operator to a string.
-
-        Such strings will eventually be used to construct operators in the
-        C++ code. See the MpiSimulatorChunk::add_op for details on how these
-        strings are used by the C++ code.
+    def _op_args(self, op):
+        """ Get the type and arguments of an operator.
 
-        We also prepend the operator's index in the global ordering of
-        operators, which allows the C++ code to put the operators in
-        the appropriate order.
+        Returns a list whose first element is the name of the operator type
+        and whose remaining elements are the arguments that the C++ code uses
+        to construct the operator (see MpiSimulatorChunk::add_op). Signals
+        are returned as Signal objects, and lists of values are wrapped in one
+        of OpValues, OpMatrix, OpIndices or OpStrings, so that the arguments
+        can be encoded either as a string or in the binary format. Returns an
+        empty list for operators that have no C++ counterpart.
 
         """
         op_type = type(op)
-        signal_to_string = self.signal_to_string
 
         if op_type == builder.operator.TimeUpdate:
             op_args = [
-                "TimeUpdate", signal_to_string(op.step),
-                signal_to_string(op.time), self.dt]
+                "TimeUpdate", op.step,
+                op.time, self.dt]
 
         elif op_type == builder.operator.Reset:
-            op_args = ["Reset", signal_to_string(op.dst), op.value]
+            op_args = ["Reset", op.dst, op.value]
 
         elif op_type == builder.operator.Copy:
             op_args = [
-                "Copy", signal_to_string(op.dst), signal_to_string(op.src)]
+                "Copy", op.dst, op.src]
 
         elif op_type == builder.operator.SlicedCopy:
             try:
@@ -763,19 +1214,19 @@ class MpiModel(Model):
 
             op_args = [
                 "SlicedCopy",
-                signal_to_string(op.src), signal_to_string(op.dst),
+                op.src, op.dst,
                 start_src, stop_src, step_src, start_dst, stop_dst, step_dst,
-                str(seq_src), str(seq_dst), int(op.inc)]
+                OpIndices(seq_src), OpIndices(seq_dst), int(op.inc)]
 
         elif op_type == builder.operator.DotInc:
             op_args = [
-                "DotInc", signal_to_string(op.A), signal_to_string(op.X),
-                signal_to_string(op.Y)]
+                "DotInc", op.A, op.X,
+                op.Y]
 
         elif op_type == builder.operator.ElementwiseInc:
             op_args = [
-                "ElementwiseInc", signal_to_string(op.A),
-                signal_to_string(op.X), signal_to_string(op.Y)]
+                "ElementwiseInc", op.A,
+                op.X, op.Y]
 
         elif op_type == builder.neurons.SimNeurons:
             n_neurons = op.J.size
@@ -786,12 +1237,12 @@ class MpiModel(Model):
                 tau_rc = op.neurons.tau_rc
                 min_voltage = op.neurons.min_voltage
 
-                voltage_signal = signal_to_string(op.states[0])
-                ref_time_signal = signal_to_string(op.states[1])
+                voltage_signal = op.states[0]
+                ref_time_signal = op.states[1]
 
                 op_args = [
                     "LIF", n_neurons, tau_rc, tau_ref, min_voltage, self.dt,
-                    signal_to_string(op.J), signal_to_string(op.output),
+                    op.J, op.output,
                     voltage_signal, ref_time_signal]
 
             elif neuron_type is LIFRate:
@@ -799,7 +1250,7 @@ class MpiModel(Model):
                 tau_rc = op.neurons.tau_rc
                 op_args = [
                     "LIFRate", n_neurons, tau_rc, tau_ref,
-                    signal_to_string(op.J), signal_to_string(op.output)]
+                    op.J, op.output]
 
             elif neuron_type is AdaptiveLIF:
                 tau_n = op.neurons.tau_n
@@ -810,14 +1261,14 @@ class MpiModel(Model):
 
                 min_voltage = op.neurons.min_voltage
 
-                voltage_signal = signal_to_string(op.states[0])
-                ref_time_signal = signal_to_string(op.states[1])
-                adaptation = signal_to_string(op.states[2])
+                voltage_signal = op.states[0]
+                ref_time_signal = op.states[1]
+                adaptation = op.states[2]
 
                 op_args = [
                     "AdaptiveLIF", n_neurons, tau_n, inc_n, tau_rc, tau_ref,
-                    min_voltage, self.dt, signal_to_string(op.J),
-                    signal_to_string(op.output), voltage_signal,
+                    min_voltage, self.dt, op.J,
+                    op.output, voltage_signal,
                     ref_time_signal, adaptation]
 
             elif neuron_type is AdaptiveLIFRate:
@@ -827,22 +1278,22 @@ class MpiModel(Model):
                 tau_rc = op.neurons.tau_rc
                 tau_ref = op.neurons.tau_ref
 
-                adaptation = signal_to_string(op.states[0])
+                adaptation = op.states[0]
 
                 op_args = [
                     "AdaptiveLIFRate", n_neurons, tau_n, inc_n,
-                    tau_rc, tau_ref, self.dt, signal_to_string(op.J),
-                    signal_to_string(op.output), adaptation]
+                    tau_rc, tau_ref, self.dt, op.J,
+                    op.output, adaptation]
 
             elif neuron_type is RectifiedLinear:
                 op_args = [
-                    "RectifiedLinear", n_neurons, signal_to_string(op.J),
-                    signal_to_string(op.output)]
+                    "RectifiedLinear", n_neurons, op.J,
+                    op.output]
 
             elif neuron_type is Sigmoid:
                 op_args = [
                     "Sigmoid", n_neurons, op.neurons.tau_ref,
-                    signal_to_string(op.J), signal_to_string(op.output)]
+                    op.J, op.output]
 
             elif neuron_type is Izhikevich:
                 tau_recovery = op.neurons.tau_recovery
@@ -850,13 +1301,13 @@ class MpiModel(Model):
                 reset_voltage = op.neurons.reset_voltage
                 reset_recovery = op.neurons.reset_recovery
 
-                voltage = signal_to_string(op.states[0])
-                recovery = signal_to_string(op.states[1])
+                voltage = op.states[0]
+                recovery = op.states[1]
 
                 op_args = [
                     "Izhikevich", n_neurons, tau_recovery, coupling,
                     reset_voltage, reset_recovery, self.dt,
-                    signal_to_string(op.J), signal_to_string(op.output),
+                    op.J, op.output,
                     voltage, recovery]
 
             else:
@@ -881,18 +1332,17 @@ class MpiModel(Model):
 
                 if len(num) == 1 and len(den) == 0:
                     op_args = [
-                        "NoDenSynapse", signal_to_string(op.input),
-                        signal_to_string(op.output), num[0]]
+                        "NoDenSynapse", op.input,
+                        op.output, num[0]]
                 elif len(num) == 1 and len(den) == 1:
                     op_args = [
-                        "SimpleSynapse", signal_to_string(op.input),
-                        signal_to_string(op.output), den[0], num[0]]
+                        "SimpleSynapse", op.input,
+                        op.output, den[0], num[0]]
                 else:
                     op_args = [
-                        "Synapse", signal_to_string(op.input),
-                        signal_to_string(op.output),
-                        ",".join(map(str, num)),
-                        ",".join(map(str, den))]
+                        "Synapse", op.input,
+                        op.output,
+                        OpValues(num), OpValues(den)]
 
             elif isinstance(op.process, Triangle):
                 shape_in = op.input.shape if op.input is not None else (0,)
@@ -909,8 +1359,8 @@ class MpiModel(Model):
                 n_taps = x.maxlen
 
                 op_args = [
-                    "TriangleSynapse", signal_to_string(op.input),
-                    signal_to_string(op.output), n0, ndiff, n_taps]
+                    "TriangleSynapse", op.input,
+                    op.output, n0, ndiff, n_taps]
 
             elif process_type is WhiteNoise:
                 assert type(op.process.dist) is nengo.dists.Gaussian
@@ -920,7 +1370,7 @@ class MpiModel(Model):
                 inc = op.mode == 'inc'
 
                 op_args = [
-                    "WhiteNoise", signal_to_string(op.output),
+                    "WhiteNoise", op.output,
                     float(mean), float(std), int(do_scale), int(inc),
                     self.dt]
 
@@ -933,9 +1383,9 @@ class MpiModel(Model):
                 coefs = closures['signal']
 
                 op_args = [
-                    "WhiteSignal", ndarray_to_string(coefs),
-                    signal_to_string(op.output),
-                    signal_to_string(op.t), self.dt]
+                    "WhiteSignal", OpMatrix(coefs),
+                    op.output,
+                    op.t, self.dt]
 
             elif process_type is PresentInput:
                 rng = op.process.get_rng(np.random)
@@ -947,9 +1397,9 @@ class MpiModel(Model):
                 presentation_time = closures['presentation_time']
 
                 op_args = [
-                    "PresentInput", ndarray_to_string(inputs),
-                    signal_to_string(op.output),
-                    signal_to_string(op.t), presentation_time, self.dt]
+                    "PresentInput", OpMatrix(inputs),
+                    op.output,
+                    op.t, presentation_time, self.dt]
 
             elif process_type in [FilteredNoise, BrownNoise]:
                 raise NotImplementedError(
@@ -961,40 +1411,41 @@ class MpiModel(Model):
 
         elif op_type == builder.learning_rules.SimBCM:
             op_args = [
-                "BCM", signal_to_string(op.pre_filtered),
-                signal_to_string(op.post_filtered),
-                signal_to_string(op.theta),
-                signal_to_string(op.delta),
+                "BCM", op.pre_filtered,
+                op.post_filtered,
+                op.theta,
+                op.delta,
                 op.learning_rate, self.dt]
 
         elif op_type == builder.learning_rules.SimOja:
             op_args = [
-                "Oja", signal_to_string(op.pre_filtered),
-                signal_to_string(op.post_filtered),
-                signal_to_string(op.weights),
-                signal_to_string(op.delta),
+                "Oja", op.pre_filtered,
+                op.post_filtered,
+                op.weights,
+                op.delta,
                 op.learning_rate, self.dt, op.beta]
 
         elif op_type == builder.learning_rules.SimVoja:
             op_args = [
-                "Voja", signal_to_string(op.pre_decoded),
-                signal_to_string(op.post_filtered),
-                signal_to_string(op.scaled_encoders),
-                signal_to_string(op.delta),
-                signal_to_string(op.learning_signal),
-                ",".join(map(str, op.scale)),
+                "Voja", op.pre_decoded,
+                op.post_filtered,
+                op.scaled_encoders,
+                op.delta,
+                op.learning_signal,
+                OpValues(op.scale),
                 op.learning_rate, self.dt]
 
         elif op_type == builder.operator.PreserveValue:
             logger.debug(
                 "Skipping PreserveValue, operator: %s, signal: %s",
-                str(op.dst), signal_to_string(op.dst))
+                str(op.dst), self.signal_to_string(op.dst))
 
             op_args = []
 
         elif op_type == MpiSend:
             signal_key = make_key(op.signal.base)
-            op_args = ["MpiSend", op.dst, op.tag, signal_key]
+            op_args = [
+                "MpiSend", op.dst, op.tag, signal_key, int(op.is_update)]
 
         elif op_type == MpiRecv:
             signal_key = make_key(op.signal.base)
@@ -1002,10 +1453,9 @@ class MpiModel(Model):
                 "MpiRecv", op.src, op.tag, signal_key, int(op.is_update)]
 
         elif op_type == SpaunStimulusOperator:
-            output = signal_to_string(op.output)
-
             op_args = [
-                "SpaunStimulus", output, self.time, op.stimulus_sequence,
+                "SpaunStimulus", op.output, self.time,
+                OpStrings(op.stimulus_sequence),
                 op.present_interval, op.present_blanks, op.identifier]
 
         else:
@@ -1013,11 +1463,20 @@ class MpiModel(Model):
                 "nengo_mpi cannot handle operator of "
                 "type %s" % str(op_type))
 
-        if op_args:
-            op_args = [self.global_ordering[op]] + op_args
+        return op_args
 
-        op_string = OP_DELIM.join(map(str, op_args))
-        return op_string
+    def _op_to_string(self, index, op_args):
+        """ Convert the index and arguments of an operator to a string.
+
+        This is the string encoding of operators that the C++ code accepts
+        from older network files, now only used for logging.
+
+        """
+        op_args = [index] + [
+            self.signal_to_string(arg) if isinstance(arg, Signal) else arg
+            for arg in op_args]
+
+        return OP_DELIM.join(map(str, op_args))
 
     def _finalize_probes(self):
         """ Finalize probes.
@@ -1045,9 +1504,11 @@ class MpiModel(Model):
                 component, str(signal), probe_key,
                 signal_string, period)
 
-            probe_string = PROBE_DELIM.join(
-                str(i) for i
-                in [component, probe_key, signal_string, period, str(probe)])
+            fields = [component, probe_key, signal_string, period, str(probe)]
+            if probe in self.probe_reductions:
+                fields.append(self.probe_reductions[probe])
+
+            probe_string = PROBE_DELIM.join(str(i) for i in fields)
 
             self.probe_strings[component].append(probe_string)
             self.all_probe_strings.append(probe_string)
@@ -21,13 +21,20 @@ def native_sim_available():
     return _native_sim_available
 
 
+def run_pyfuncs(calls):
+    """ Run a batch of python functions for the native simulator, which
+    passes every batch of consecutive functions to a single call of this. """
+    for fn, t, x, y in calls:
+        fn(t, x, y)
+
+
 class NativeSimulator(object):
     """ A python wrapper for the native simulator implemented by mpi_sim.so.
 
     Talks to the native simulator using ctypes.
 
     """
-    def __init__(self, sig):
+    def __init__(self, sig, options=None):
         if not native_sim_available():
             raise Exception(
                 "Created NativeSimulator, but mpi_sim.so is not available.")
@@ -35,17 +42,31 @@ class NativeSimulator(object):
         self.sig = sig
 
         self.callbacks = []
-        self.time_buffers = []
-        self.input_buffers = []
-        self.output_buffers = []
 
-        mpi_sim.create_simulator()
+        options = options or {}
+        options_string = ",".join(
+            "%s=%s" % (k, int(v) if isinstance(v, bool) else v)
+            for k, v in sorted(options.items()))
+
+        mpi_sim.create_simulator(options_string)
+        mpi_sim.set_PyFunc_dispatcher(run_pyfuncs)
 
     def load_network(self, filename):
         assert isinstance(filename,
                           six.text_type if six.PY3 else six.binary_type)
         mpi_sim.load_network(filename)
 
+    def load_network_arrays(
+            self, dt, n_components, probe_info, datasets,
+            component_graph, component_mapping):
+        """ Load a network from the arrays that would be stored in a network
+        file (see MpiModel.finalize_build), without writing them to one.
+        ``datasets`` maps the name of each packed dataset to a pair of its
+        data and offsets. """
+        mpi_sim.load_network_arrays(
+            float(dt), int(n_components), probe_info, datasets,
+            component_graph, component_mapping)
+
     def finalize_build(self):
         mpi_sim.finalize_build()
 
@@ -75,65 +96,73 @@ class NativeSimulator(object):
     def close(self):
         mpi_sim.close_simulator()
 
+    def checkpoint(self, filename):
+        assert isinstance(filename,
+                          six.text_type if six.PY3 else six.binary_type)
+        mpi_sim.checkpoint_simulator(filename)
+
+    def restore(self, filename):
+        assert isinstance(filename,
+                          six.text_type if six.PY3 else six.binary_type)
+        mpi_sim.restore_simulator(filename)
+
+    def rebalance(self):
+        return mpi_sim.rebalance_simulator()
+
     def create_PyFunc(self, op, index):
+        """ Create a PyFunc operator for a SimPyFunc operator.
+
+        The native simulator calls ``py_func(t, x, y)`` with arrays holding
+        the time and input signals, which are read-only views of the signals
+        where possible, and an array that the output is written to.
+
+        """
         fn = op.fn
 
         # Handle time.
         pass_time = op.t is not None
         t_signal = op.t if pass_time else self.sig['common'][0]
         t_string = signal_to_string(t_signal)
-        time_buffer = np.array([22.0])
-        self.time_buffers.append(time_buffer)
 
         # Handle input.
         pass_input = op.x is not None
         input_signal = op.x if pass_input else self.sig['common'][0]
         input_string = signal_to_string(input_signal)
-        if not input_signal.shape:
-            input_buffer = np.array([0.0])
-        else:
-            input_buffer = input_signal.initial_value.copy()
-        self.input_buffers.append(input_buffer)
 
         # Handle output.
         return_output = op.output is not None
         output_signal = (
             op.output if return_output else self.sig['common']['NULL'])
         output_string = signal_to_string(output_signal)
-        if not output_signal:
-            output_buffer = np.array([0.0])
-        else:
-            output_buffer = output_signal.initial_value.copy()
-        self.output_buffers.append(output_buffer)
 
-        def py_func():
+        def py_func(t, x, y):
             # extract time and input if applicable
             args = []
             if pass_time:
-                args.append(time_buffer[0])
+                args.append(t[0])
             if pass_input:
-                args.append(input_buffer)
+                args.append(x)
 
-            y = fn(*args)
+            value = fn(*args)
 
-            if return_output and y is None:
+            if return_output and value is None:
                 # required since Numpy turns None into NaN
                 raise SimulationError(
                     "Function %r returned None." % fn.__name__)
-            if y is None:
-                y = np.array([0.0])
+            if value is None:
+                value = np.array([0.0])
 
             try:
-                float(y[0])
+                float(value[0])
             except:
                 try:
-                    y = np.array([float(y)])
+                    value = np.array([float(value)])
                 except:
-                    raise Exception("Cannot use %s as output of Node." % y)
+                    raise Exception("Cannot use %s as output of Node." % value)
 
             # store output if applicable
             if return_output:
-                output_buffer[:] = y
+                y[:] = value
 
         # Need to store a handle for the callback so that
         # it doesn't get garbage collected.
@@ -142,5 +171,4 @@ class NativeSimulator(object):
             assert isinstance(s, six.text_type if six.PY3 else six.binary_type)
 
         mpi_sim.create_PyFunc(
-            py_func, t_string, input_string, output_string,
-            time_buffer, input_buffer, output_buffer, index)
+            py_func, t_string, input_string, output_string, index)
@@ -3,5 +3,6 @@ from nengo_mpi.partition.base import Partitioner, verify_assignments, partitione
 from nengo_mpi.partition.work_balanced import work_balanced_partitioner
 from nengo_mpi.partition.metis import metis_available, metis_partitioner
 from nengo_mpi.partition.random import random_partitioner
+from nengo_mpi.partition.profile import CostProfile
 
 from nengo_mpi.partition.split_ea import EnsembleArraySplitter
\ No newline at end of file
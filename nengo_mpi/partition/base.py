@@ -19,6 +19,7 @@ from nengo_mpi.spaun_mpi import SpaunStimulus
 from nengo_mpi.partition.work_balanced import work_balanced_partitioner
 from nengo_mpi.partition.metis import metis_available, metis_partitioner
 from nengo_mpi.partition.random import random_partitioner
+from nengo_mpi.partition.profile import object_ids
 
 logger = logging.getLogger(__name__)
 
@@ -137,6 +138,12 @@ class Partitioner(object):
         Connection that is bigger than this size are forced to be in the
         same component.
 
+    profile: CostProfile (optional)
+        Measured costs from an earlier run of the network (see
+        ``nengo_mpi.partition.profile``). If supplied, clusters are weighted
+        by the time their operators took, and edges by the bytes their
+        connections sent, instead of by neurons and connection sizes.
+
     args: Extra positional args passed to func.
 
     kwargs: Extra keyword args passed to func.
@@ -144,7 +151,7 @@ class Partitioner(object):
     """
     def __init__(
             self, n_components=1, func=None, cross_at_updates=True,
-            use_weights=True, straddle_conn_max_size=np.inf,
+            use_weights=True, straddle_conn_max_size=np.inf, profile=None,
             *args, **kwargs):
 
         self.n_components = n_components
@@ -155,6 +162,7 @@ class Partitioner(object):
 
         self.cross_at_updates = cross_at_updates
         self.straddle_conn_max_size = straddle_conn_max_size
+        self.profile = profile
         self.args = args
         self.kwargs = kwargs
 
@@ -210,7 +218,7 @@ class Partitioner(object):
         if self.n_components > 1:
             # component0 is also in the cluster graph
             component0, cluster_graph = network_to_cluster_graph(
-                network, can_cross_boundary)
+                network, can_cross_boundary, profile=self.profile)
 
             n_clusters = len(cluster_graph)
 
@@ -275,6 +283,7 @@ class NengoObjectCluster(object):
         self._n_neurons = 0
         self.connections = []
         self.head = obj
+        self._work = None
 
         self.add_object(obj)
 
@@ -285,6 +294,17 @@ class NengoObjectCluster(object):
     def n_neurons(self):
         return self._n_neurons
 
+    @property
+    def work(self):
+        """ How much work simulating the cluster takes, which the partitioners
+        balance. The measured cost if a profile was used, otherwise the
+        number of neurons. """
+        return self.n_neurons if self._work is None else self._work
+
+    @work.setter
+    def work(self, work):
+        self._work = work
+
     def add_object(self, obj):
         self.objects.add(obj)
 
@@ -418,7 +438,7 @@ class ClusterGraph(object):
                         "%s is in cluster %s, but maps to "
                         "cluster %s." % (obj, cluster, self[obj]))
 
-    def as_nx_graph(self, use_weights=True):
+    def as_nx_graph(self, use_weights=True, profile=None):
         self.check_overlap()
         self.check_validity()
         G = nx.Graph()
@@ -428,12 +448,25 @@ class ClusterGraph(object):
             c for c in self.network.all_connections
             if self.can_cross_boundary(c)]
 
+        if profile is not None:
+            ids = object_ids(self.network)
+            for cluster, work in iteritems(profile.cluster_work(self, ids)):
+                cluster.work = work
+
+            measured_weights = profile.connection_weights(
+                boundary_connections, ids)
+
         for conn in boundary_connections:
             pre_cluster = self[conn.pre_obj]
             post_cluster = self[conn.post_obj]
 
             if pre_cluster != post_cluster:
-                weight = conn.size_mid if use_weights else 1.0
+                if not use_weights:
+                    weight = 1.0
+                elif profile is not None:
+                    weight = measured_weights[conn]
+                else:
+                    weight = conn.size_mid
 
                 if G.has_edge(pre_cluster, post_cluster):
                     G[pre_cluster][post_cluster]['weight'] += weight
@@ -451,7 +484,7 @@ def neurons2ensemble(e):
 
 def network_to_cluster_graph(
         network, can_cross_boundary,
-        use_weights=True, merge_nengo_nodes=True):
+        use_weights=True, merge_nengo_nodes=True, profile=None):
     """ Create a cluster graph from a nengo Network.
 
     A cluster graph is a graph wherein the nodes are maximally large
@@ -474,6 +507,9 @@ def network_to_cluster_graph(
         merged with a neighboring cluster. This is done because it is typically
         not useful to have a processor simulating only Nodes, as it will only
         add extra communication without easing the computational burden.
+    profile: CostProfile
+        If not None, the ``work`` of each cluster and the weight of each edge
+        are taken from the costs it measured (see ``CostProfile``).
 
     Returns
     -------
@@ -553,7 +589,7 @@ def network_to_cluster_graph(
             if cluster is component0:
                 component0 = best_cluster
 
-    G = cluster_graph.as_nx_graph(use_weights)
+    G = cluster_graph.as_nx_graph(use_weights, profile)
     return component0, G
 
 
@@ -51,13 +51,8 @@ def write_metis_input_file(cluster_graph):
         for u in cluster_graph.nodes():
             f.write('\n')
 
-            vertex_weight = 0
-
-            for obj in u.objects:
-                if hasattr(obj, 'n_neurons'):
-                    vertex_weight += obj.n_neurons
-
-            f.write("%d" % vertex_weight)
+            # Neurons, or the measured cost if a profile was used.
+            f.write("%d" % u.work)
 
             for v, weight_dict in iteritems(cluster_graph[u]):
                 f.write(" %d %d" % (indices[v], weight_dict['weight']))
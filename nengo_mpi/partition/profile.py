@@ -0,0 +1,229 @@
+from __future__ import print_function
+import csv
+from collections import defaultdict
+
+import numpy as np
+
+# Datasets in a network file that record which object each operator
+# implements, and which connection each message belongs to.
+PROFILE_DATASETS = (
+    'profile_objects', 'profile_op_indices', 'profile_op_objects',
+    'profile_tags', 'profile_tag_objects')
+
+
+def object_ids(network):
+    """ Name the objects of a network by their position in it.
+
+    An object gets the same name each time the same script constructs the
+    network, so a profile of one run can be applied to the next.
+
+    Returns
+    -------
+    ids: dict
+        A mapping from each Ensemble, Node, Connection and Probe in the
+        network to its name.
+
+    """
+    ids = {}
+    kinds = [
+        ('ensemble', network.all_ensembles), ('node', network.all_nodes),
+        ('connection', network.all_connections), ('probe', network.all_probes)]
+
+    for kind, objs in kinds:
+        for i, obj in enumerate(objs):
+            ids[obj] = "%s%d" % (kind, i)
+
+    return ids
+
+
+def read_profile_file(filename):
+    """ Read a profile written by the simulator (see --profile).
+
+    Returns
+    -------
+    op_seconds: dict
+        Seconds per step spent in the operators with each index, summed over
+        processes and trials.
+    tag_bytes: dict
+        Bytes per step sent in the messages with each tag.
+
+    """
+    op_seconds = defaultdict(float)
+    tag_bytes = defaultdict(float)
+
+    with open(filename, 'r') as f:
+        for row in csv.DictReader(f):
+            if row['kind'] == 'op':
+                op_seconds[float(row['index'])] += float(row['seconds_per_step'])
+            elif row['kind'] == 'send':
+                tag_bytes[int(row['tag'])] += float(row['bytes_per_step'])
+
+    return op_seconds, tag_bytes
+
+
+class CostProfile(object):
+    """ The measured cost of simulating each object of a network.
+
+    Used by the Partitioner to weight the clusters it partitions by the time
+    their operators took to run, and the connections between them by the
+    bytes they sent, instead of by neuron counts and connection sizes.
+
+    Parameters
+    ----------
+    seconds: dict
+        Seconds per step spent simulating each object, by object name
+        (see ``object_ids``).
+    bytes: dict
+        Bytes per step sent over each connection that crossed between
+        processes, by connection name.
+
+    """
+    def __init__(self, seconds, bytes):
+        self.seconds = dict(seconds)
+        self.bytes = dict(bytes)
+
+    @classmethod
+    def from_model(cls, profile_filename, model):
+        """ Profile of a simulation of ``model``, an MpiModel. """
+        ids = object_ids(model.toplevel)
+        names = {index: ids.get(obj) for index, obj in model.op_objects.items()}
+        tag_names = {
+            tag: ids.get(conn) for tag, conn in model.tag_connections.items()}
+
+        return cls._from_names(profile_filename, names, tag_names)
+
+    @classmethod
+    def from_network_file(cls, profile_filename, network_filename):
+        """ Profile of a simulation of a network file saved by nengo_mpi. """
+        import h5py as h5
+
+        with h5.File(network_filename, 'r') as f:
+            if any(name not in f for name in PROFILE_DATASETS):
+                raise ValueError(
+                    "Network file %s does not record which objects its "
+                    "operators implement." % network_filename)
+
+            objects = f['profile_objects'][()].tobytes().decode('ascii')
+            objects = objects.split('\0')
+
+            names = {
+                index: objects[i] for index, i in zip(
+                    f['profile_op_indices'][()], f['profile_op_objects'][()])}
+            tag_names = {
+                tag: objects[i] for tag, i in zip(
+                    f['profile_tags'][()], f['profile_tag_objects'][()])}
+
+        return cls._from_names(profile_filename, names, tag_names)
+
+    @classmethod
+    def _from_names(cls, profile_filename, names, tag_names):
+        op_seconds, tag_bytes = read_profile_file(profile_filename)
+
+        seconds = defaultdict(float)
+        for index, s in op_seconds.items():
+            name = names.get(index)
+            if name is not None:
+                seconds[name] += s
+
+        bytes = defaultdict(float)
+        for tag, b in tag_bytes.items():
+            name = tag_names.get(tag)
+            if name is not None:
+                bytes[name] += b
+
+        print("Read cost profile of %d objects and %d connections "
+              "between processes from %s." % (
+                  len(seconds), len(bytes), profile_filename))
+
+        return cls(seconds, bytes)
+
+    def cluster_work(self, cluster_graph, ids):
+        """ Nanoseconds per step that each cluster of the graph takes.
+
+        A connection between two clusters is split evenly between them, and
+        a probe goes with the object it probes. Clusters with nothing that
+        was measured are estimated from the mean cost per neuron, so that
+        profiles from older versions of a network still apply.
+
+        Parameters
+        ----------
+        cluster_graph: ClusterGraph
+            The clusters of the network, still able to look up the cluster
+            of each object.
+        ids: dict
+            The names of the objects of the network, from ``object_ids``.
+
+        Returns
+        -------
+        work: dict
+            A mapping from each cluster to its cost, as a positive int.
+
+        """
+        seconds = defaultdict(float)
+        measured = set()
+
+        def add(target, obj, share=1.0):
+            name = ids.get(obj)
+            if name not in self.seconds:
+                return
+
+            try:
+                cluster = cluster_graph[target]
+            except KeyError:
+                return
+
+            seconds[cluster] += share * self.seconds[name]
+            measured.add(cluster)
+
+        network = cluster_graph.network
+        for obj in network.all_ensembles + network.all_nodes:
+            add(obj, obj)
+
+        for conn in network.all_connections:
+            add(conn.pre_obj, conn, 0.5)
+            add(conn.post_obj, conn, 0.5)
+
+        for probe in network.all_probes:
+            target = getattr(probe.target, 'obj', probe.target)
+            add(getattr(target, 'pre_obj', target), probe)
+
+        measured_neurons = sum(c.n_neurons for c in measured)
+        per_neuron = (
+            sum(seconds[c] for c in measured) / measured_neurons
+            if measured_neurons else 0.0)
+
+        work = {}
+        for cluster in cluster_graph.clusters:
+            s = seconds[cluster] if cluster in measured else (
+                cluster.n_neurons * per_neuron)
+            work[cluster] = max(1, int(round(s * 1e9)))
+
+        return work
+
+    def connection_weights(self, connections, ids):
+        """ Bytes per step that each connection sends when it crosses processes.
+
+        Connections that didn't cross in the profiled run are estimated from
+        their size, with the bytes per value of those that did.
+
+        Returns
+        -------
+        weights: dict
+            A mapping from each connection to its weight, as a positive int.
+
+        """
+        ratios = [
+            self.bytes[ids[conn]] / conn.size_mid for conn in connections
+            if ids.get(conn) in self.bytes and conn.size_mid > 0]
+
+        # Values are sent in double precision unless measured otherwise.
+        bytes_per_value = np.median(ratios) if ratios else 8.0
+
+        weights = {}
+        for conn in connections:
+            name = ids.get(conn)
+            b = (self.bytes[name] if name in self.bytes
+                 else conn.size_mid * bytes_per_value)
+            weights[conn] = max(1, int(round(b)))
+
+        return weights
@@ -8,6 +8,8 @@ from nengo_mpi import Simulator
 from nengo_mpi import Partitioner, PartitionError
 from nengo_mpi.partition import work_balanced_partitioner
 from nengo_mpi.partition import metis_available, metis_partitioner
+from nengo_mpi.partition import CostProfile
+from nengo_mpi.partition.profile import object_ids
 from nengo_mpi.partition.base import network_to_cluster_graph, make_boundary_predicate
 
 
@@ -94,6 +96,27 @@ def test_work_balanced(simple_network):
             pass
 
 
+def test_cost_profile():
+    """ The ensemble measured to be as expensive as all the others together
+    gets a component to itself, though all have the same number of neurons."""
+
+    with nengo.Network() as network:
+        ensembles = [nengo.Ensemble(10, 1) for i in range(4)]
+
+    ids = object_ids(network)
+    seconds = {ids[e]: 1.0 for e in ensembles}
+    seconds[ids[ensembles[0]]] = 3.0
+
+    partitioner = Partitioner(
+        2, func=work_balanced_partitioner,
+        profile=CostProfile(seconds, {}))
+    n_components, assignments = partitioner.partition(network)
+
+    assert n_components == 2
+    expensive = assignments[ensembles[0]]
+    assert all(assignments[e] != expensive for e in ensembles[1:])
+
+
 def test_no_partitioner(simple_network):
     save_file = 'test.net'
 
@@ -4,9 +4,10 @@ from six import iteritems
 
 def work_balanced_partitioner(cluster_graph, n_components):
     """
-    Tries to give each component of the partition an equal number of
-    neurons, making no attempt to minimize the weight of edges that
-    straddle component boundaries.
+    Tries to give each component of the partition an equal amount of work:
+    an equal number of neurons, or if the cluster graph was made with a cost
+    profile, an equal measured runtime. Makes no attempt to minimize the
+    weight of edges that straddle component boundaries.
 
     Parameters
     ----------
@@ -26,7 +27,7 @@ def work_balanced_partitioner(cluster_graph, n_components):
 
     components, _ = greedy_balanced_partition(
         cluster_graph.nodes(), n_components,
-        key=lambda n: n.n_neurons)
+        key=lambda n: n.work)
 
     assignments = {}
     for i, c in enumerate(components):
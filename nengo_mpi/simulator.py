@@ -1,7 +1,6 @@
 from __future__ import print_function
 import numpy as np
 import atexit
-from functools import partial
 import logging
 import time
 
@@ -9,6 +8,7 @@ import nengo
 from nengo.simulator import ProbeDict
 from nengo.cache import get_default_decoder_cache
 import nengo.utils.numpy as npext
+from nengo.utils.compat import is_string
 from nengo.exceptions import SimulatorClosed
 
 from nengo_mpi.model import MpiBuilder, MpiModel
@@ -23,9 +23,19 @@ class Simulator(nengo.Simulator):
     # Only one instance of nengo_mpi.Simulator can be unclosed at any time
     _open_simulators = []
 
+    # Defaults for simulators, such as the one that tests the native
+    # operators, that set up their model without calling __init__.
+    n_trials = 1
+    rebalance_tolerance = 0.0
+
     def __init__(
             self, network, dt=0.001, seed=None, model=None,
-            partitioner=None, assignments=None, save_file=""):
+            partitioner=None, assignments=None, save_file="", n_threads=1,
+            precision=None, checkpoint_every=0, checkpoint_file="", n_trials=1,
+            profile_file="", learning_every=1, async_pyfuncs=False,
+            mapping=None, rebalance=0.0, export_workers=1,
+            quiescence=0.0, backend="cpu", probe_reductions=None,
+            cache_memory=0, realtime=0.0, report_memory=False):
         """ A simulator that can be executed in parallel using MPI.
 
         Parameters
@@ -57,6 +67,97 @@ class Simulator(nengo.Simulator):
             Name of file that will store all data added to the simulator.
             The simulator can later be reconstructed from this file. If
             equal to the empty string, then no file is created.
+        n_threads: int
+            Number of threads used to run operators within each MPI process.
+            Operators that don't share any signals are run concurrently.
+        precision: string
+            Either "single" or "double". The precision of a simulation is
+            fixed when nengo_mpi is compiled; if supplied, an error is
+            raised when it does not match the precision of the build.
+        checkpoint_every: int
+            Number of steps between checkpoints written to ``checkpoint_file``
+            while the simulation runs (see ``checkpoint``). 0 writes none.
+        checkpoint_file: string
+            Name of the file that periodic checkpoints are written to.
+        n_trials: int
+            Number of trials of the network to simulate together. Trial k
+            behaves as a separate simulation with seed ``seed + k``, and
+            probe data gains a leading trial axis, so each sample has shape
+            ``(n_trials,) + shape``. Networks with python functions can only
+            be simulated one trial at a time.
+        profile_file: string
+            Name of a file that the measured cost of each operator, and the
+            size of each message between processes, are written to after
+            each run. ``CostProfile.from_model(profile_file, sim.model)``
+            reads it, and passing the result to a Partitioner balances the
+            next simulation of the network on the measured costs.
+        learning_every: int
+            Number of steps between updates of the learning rules in the
+            network. Each update is made with a learning rate scaled up by
+            the same factor, so rules whose timescales are long compared to
+            ``learning_every * dt`` learn about as they would every step.
+        async_pyfuncs: bool
+            Whether the python functions of Nodes are called by a thread of
+            their own while the simulation goes on. Each step, the simulation
+            then uses the output that a Node computed from its input on the
+            step before, so that slow Nodes don't hold up the simulation, at
+            the cost of a step of latency through each Node.
+        mapping: string or sequence of int
+            How components are placed on processes. Either a sequence giving
+            the process of each component, which is stored in ``save_file``,
+            or one of "default" (component ``c`` on process ``c % n``),
+            "graph" (MPI reorders the processes by the traffic between them,
+            where it supports that), or "node" (components that exchange the
+            most are kept on the same node).
+        rebalance: float
+            If positive, the cost of each component is measured while the
+            simulation runs, and before each run after the first, components
+            are moved from the busiest processes to the least busy ones when
+            the busiest costs more than this fraction above the mean (see
+            ``rebalance``). 0 never moves components.
+        export_workers: int
+            Number of processes that encode the components of the built
+            network for the simulator (or for ``save_file``) in parallel.
+        quiescence: float
+            If positive, values within this distance of zero count as zero,
+            and operators whose inputs are all zero skip their work:
+            connections from silent populations aren't computed, and
+            synapses whose input and state have decayed to zero stop
+            updating. Results then differ from a full simulation by about
+            this much, scaled by the weights of the connections.
+        backend: str
+            Where the operators are run: "cpu", or "cuda" to run those that
+            support it on the GPUs of each node, which requires nengo_mpi to
+            be compiled with ``make cuda``.
+        probe_reductions: dict
+            Maps probes to how the simulator reduces their data before it is
+            stored, each given by a dict with any of the keys ``synapse``
+            (the time constant of a lowpass filter applied to the signal
+            every step), ``window`` (what each sample holds of the steps
+            since the last one: "sample" for the value on the step of the
+            sample, "mean", "min", "max", or "count" for the number of steps
+            on which each value was non-zero, such as the spikes of each
+            neuron), and ``across`` (None, or "mean" or "sum" to combine the
+            values of each sample into one). Samples are taken every
+            ``sample_every`` of the probe, as without a reduction. The state
+            of the filter and of the window starts over on reset.
+        cache_memory: int
+            Memory in MiB that each process may use to keep the built
+            network once this Simulator is closed. A later Simulator of the
+            same network, with the same options, then starts from it instead
+            of building it again. Networks with python functions are not
+            kept. 0 keeps nothing.
+        realtime: float
+            If positive, each step is paced to take ``dt / realtime`` seconds
+            of wall-clock time, so 1 runs in real time, as when the network
+            drives a robot. After each run, the latency of the steps (p50,
+            p99 and max over every process) is printed along with the steps
+            that missed their deadline, each pinned on the busiest process in
+            the step and the class of operator it spent the most time in.
+            0 runs the steps as fast as possible.
+        report_memory: bool
+            Whether to print how much memory the signals and operators of
+            the built network take, on the busiest process and node.
 
         """
         print("Beginning build of MPI model...")
@@ -87,12 +188,61 @@ class Simulator(nengo.Simulator):
 
         self.n_components, self.assignments = p
 
+        sim_options = dict(threads=n_threads)
+        if precision is not None:
+            sim_options['precision'] = precision
+
+        self.n_trials = n_trials
+        if n_trials > 1:
+            sim_options['trials'] = n_trials
+
+        if checkpoint_every:
+            sim_options['checkpoint_every'] = checkpoint_every
+            sim_options['checkpoint_file'] = checkpoint_file
+
+        if profile_file:
+            sim_options['profile_file'] = profile_file
+
+        if learning_every > 1:
+            sim_options['learning_every'] = learning_every
+
+        if quiescence > 0:
+            sim_options['quiescence'] = quiescence
+
+        if backend != "cpu":
+            sim_options['backend'] = backend
+
+        if cache_memory > 0:
+            sim_options['cache_memory'] = int(cache_memory)
+
+        if realtime > 0:
+            sim_options['realtime'] = realtime
+
+        if async_pyfuncs:
+            sim_options['async_pyfuncs'] = True
+
+        if report_memory:
+            sim_options['report_memory'] = True
+
+        self.rebalance_tolerance = rebalance
+        if rebalance > 0:
+            sim_options['rebalance'] = rebalance
+
+        component_mapping = None
+        if is_string(mapping):
+            sim_options['mapping'] = mapping
+        elif mapping is not None:
+            component_mapping = mapping
+
         dt = float(dt)
         self.model = MpiModel(
             self.n_components, self.assignments, dt=dt,
             label="%s, dt=%f" % (network, dt),
             decoder_cache=get_default_decoder_cache(),
-            save_file=save_file)
+            save_file=save_file, sim_options=sim_options,
+            component_mapping=component_mapping,
+            export_workers=export_workers,
+            probe_reductions=probe_reductions)
 
         print("    Calling build...")
         MpiBuilder.build(self.model, network)
@@ -166,6 +316,50 @@ class Simulator(nengo.Simulator):
         for pk in self.model.probe_keys:
             self._probe_outputs[pk] = []
 
+    def checkpoint(self, filename):
+        """ Write the state of the simulation to a checkpoint file.
+
+        The checkpoint can be restored by a simulator of the same network
+        running on the same number of processes, possibly in a later job.
+        Probe data collected so far and the state of python Nodes are not
+        part of the checkpoint.
+
+        """
+        if self.closed:
+            raise SimulatorClosed("Cannot checkpoint closed MpiSimulator.")
+
+        self.native_sim.checkpoint(filename)
+
+    def restore(self, filename):
+        """ Restore the state of the simulation from a checkpoint file.
+
+        Replaces a reset: the simulation continues from the step at which
+        the checkpoint was written.
+
+        """
+        if self.closed:
+            raise SimulatorClosed("Cannot restore closed MpiSimulator.")
+
+        self.native_sim.restore(filename)
+
+        for pk in self.model.probe_keys:
+            self._probe_outputs[pk] = []
+
+    def rebalance(self):
+        """ Move components between processes to balance the simulation.
+
+        Uses the costs measured during the last run, and only does anything
+        if the Simulator was created with a positive ``rebalance``. The
+        simulation carries on from where it was, except that python Nodes
+        called with ``async_pyfuncs`` start over as after a reset. Returns
+        whether any component was moved.
+
+        """
+        if self.closed:
+            raise SimulatorClosed("Cannot rebalance closed MpiSimulator.")
+
+        return self.native_sim.rebalance()
+
     def run(self, time_in_seconds, progress_bar=True, log_filename=""):
         """ Simulate for the given length of time. """
 
@@ -180,17 +374,22 @@ class Simulator(nengo.Simulator):
             raise SimulatorClosed(
                 "MpiSimulator cannot run because it is closed.")
 
+        if self.rebalance_tolerance > 0 and self.n_steps > 0:
+            self.rebalance()
+
         self.native_sim.run_n_steps(steps, progress_bar, log_filename)
 
         if not log_filename:
             for probe, probe_key in self.model.probe_keys.items():
+                # One array holding every sample, which the samples are views of.
                 data = self.native_sim.get_probe_data(probe_key)
 
                 # The C++ code doesn't always exactly preserve the shape
-                true_shape = self.model.sig[probe]['in'].shape
-                if data[0].shape != true_shape:
-                    data = map(
-                        partial(np.reshape, newshape=true_shape), data)
+                true_shape = self.model.probe_shape(probe)
+                if self.n_trials > 1:
+                    true_shape = (self.n_trials,) + true_shape
+
+                data = list(data.reshape((data.shape[0],) + true_shape))
 
                 if probe not in self._probe_outputs:
                     self._probe_outputs[probe] = data
@@ -2,8 +2,16 @@ from nengo.builder.signal import Signal
 from nengo.builder.operator import Operator
 from nengo.node import Node
 
+import os
+import struct
+
 import numpy as np
 
+# See PackedLabel in mpi_sim/spaun.hpp.
+PACKED_IMAGES_MAGIC = b'SPAUNIM1'
+PACKED_IMAGES_FILENAME = 'images.bin'
+PACKED_LABEL_FORMAT = '<48sQQ'
+
 
 class SpaunStimulusOperator(Operator):
     """
@@ -78,3 +86,68 @@ def build_spaun_stimulus(model, ss):
         ss.present_blanks, identifier=ss.identifier)
 
     model.add_op(op)
+
+
+def read_image_counts(data_dir):
+    """ Read the number of images with each label in a Spaun vision dataset. """
+    with open(os.path.join(data_dir, 'counts'), 'r') as f:
+        lines = [line.strip() for line in f]
+
+    return {
+        label: int(count) for label, count in zip(lines[::2], lines[1::2])
+        if label}
+
+
+def pack_spaun_images(data_dir, labels=None):
+    """ Pack the images of a Spaun vision dataset into a single binary file.
+
+    The SpaunStimulus operators of the native simulator map the packed file
+    into memory, rather than reading a text file for each image, so that the
+    processes on a node share a single copy of the images.
+
+    Parameters
+    ----------
+    data_dir: string
+        The directory of the dataset, holding a ``counts`` file and a
+        directory of text files for each label. The packed file is written
+        to ``images.bin`` in the same directory.
+    labels: list of strings
+        The labels to pack. Defaults to every label in the dataset; the
+        native simulator can then only show images with the given labels.
+
+    """
+    counts = read_image_counts(data_dir)
+    labels = sorted(counts) if labels is None else list(labels)
+
+    images = []
+    for label in labels:
+        if len(label.encode('ascii')) >= 48:
+            raise ValueError("Label %s is too long to pack." % label)
+
+        for index in range(counts[label]):
+            filename = os.path.join(data_dir, label, str(index))
+            with open(filename, 'r') as f:
+                images.append(
+                    np.fromstring(f.readline().strip().strip('[]'), sep=','))
+
+    image_size = len(images[0]) if images else 0
+    if any(len(image) != image_size for image in images):
+        raise ValueError(
+            "Images in %s are not all the same size." % data_dir)
+
+    offset = (
+        len(PACKED_IMAGES_MAGIC) + 16 +
+        len(labels) * struct.calcsize(PACKED_LABEL_FORMAT))
+
+    with open(os.path.join(data_dir, PACKED_IMAGES_FILENAME), 'wb') as f:
+        f.write(PACKED_IMAGES_MAGIC)
+        f.write(struct.pack('<QQ', image_size, len(labels)))
+
+        for label in labels:
+            f.write(struct.pack(
+                PACKED_LABEL_FORMAT, label.encode('ascii'), counts[label],
+                offset))
+            offset += counts[label] * image_size * 8
+
+        for image in images:
+            f.write(image.astype('<f8').tobytes())
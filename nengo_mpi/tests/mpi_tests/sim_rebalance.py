@@ -0,0 +1,42 @@
+import nengo
+
+import nengo_mpi
+
+import numpy as np
+
+trun = 0.1
+
+# Components 0 and 4 are much costlier than the rest, and on 4 processes are
+# both simulated by the master, so a positive ``rebalance`` moves one of them
+# before the second run.
+with nengo.Network(seed=1) as model:
+    stim = nengo.Node([0.5])
+    ensembles = [
+        nengo.Ensemble(400 if c % 4 == 0 else 20, 1) for c in range(8)]
+
+    nengo.Connection(stim, ensembles[0], synapse=0.01)
+    for pre, post in zip(ensembles[:-1], ensembles[1:]):
+        nengo.Connection(pre, post, synapse=0.01)
+
+    probes = [nengo.Probe(e, synapse=0.01) for e in ensembles]
+
+assignments = {e: c for c, e in enumerate(ensembles)}
+
+
+def run(rebalance):
+    sim = nengo_mpi.Simulator(
+        model, assignments=assignments, rebalance=rebalance)
+
+    try:
+        sim.run(trun)
+        sim.run(trun)
+        return [np.array(sim.data[p]) for p in probes]
+    finally:
+        sim.close()
+
+x = run(0.0)
+y = run(0.01)
+
+for a, b in zip(x, y):
+    assert a.shape == b.shape
+    assert np.allclose(a, b, atol=0.00001, rtol=0.00)
@@ -65,3 +65,102 @@ def test_basic_cpp(neuron_type, synapse):
         refimpl_sim.data[A_p], results[str(id(A_p))], atol=0.00001, rtol=0.00)
     assert np.allclose(
         refimpl_sim.data[B_p], results[str(id(B_p))], atol=0.00001, rtol=0.00)
+
+
+def test_spike_events():
+    m = nengo.Network(seed=1)
+    with m:
+        input = nengo.Node([0.5, -0.5])
+        A = nengo.Ensemble(50, dimensions=2, neuron_type=LIF())
+        nengo.Connection(input, A, synapse=0.01)
+
+        spike_p = nengo.Probe(A.neurons)
+        value_p = nengo.Probe(A, synapse=0.01)
+
+    sim_time = 0.5
+
+    network_file = "test_spike_events.net"
+    dense_log_file = "test_spike_events_dense.h5"
+    events_log_file = "test_spike_events.h5"
+
+    try:
+        nengo_mpi.Simulator(m, save_file=network_file)
+        subprocess.check_output([
+            'nengo_cpp', '--noprog', '--log', dense_log_file,
+            network_file, str(sim_time)])
+        subprocess.check_output([
+            'nengo_cpp', '--noprog', '--spike-events', '--log',
+            events_log_file, network_file, str(sim_time)])
+
+        with h5py.File(dense_log_file, 'r') as results:
+            dense_spikes = np.array(results[str(id(spike_p))])
+            dense_values = np.array(results[str(id(value_p))])
+
+        with h5py.File(events_log_file, 'r') as results:
+            dset = results[str(id(spike_p))]
+            events = np.array(dset)
+            n_neurons = dset.attrs['n_neurons']
+            amplitude = dset.attrs['amplitude']
+            values = np.array(results[str(id(value_p))])
+    finally:
+        for filename in [network_file, dense_log_file, events_log_file]:
+            try:
+                os.remove(filename)
+            except:
+                pass
+
+    assert n_neurons == 50
+    assert events.shape[1] == 2
+    assert len(events) == np.count_nonzero(dense_spikes)
+
+    # Each (index, sample) event is a spike in the dense data.
+    spikes = np.zeros((len(dense_spikes), n_neurons))
+    spikes[events[:, 1], events[:, 0]] = amplitude
+    assert np.allclose(spikes, dense_spikes, atol=0.00001, rtol=0.00)
+
+    # Probes of anything but spikes are stored as before.
+    assert np.allclose(values, dense_values, atol=0.00001, rtol=0.00)
+
+
+def test_save_file_matches_memory():
+    m = nengo.Network(seed=1)
+    with m:
+        noise = nengo.Node(nengo.processes.WhiteNoise())
+        input = nengo.Node([0.1, 0.2])
+        A = nengo.Ensemble(50, dimensions=2, neuron_type=LIF())
+        nengo.Connection(input, A, synapse=0.01)
+        nengo.Connection(noise, A[0], synapse=0.01)
+
+        probes = [
+            nengo.Probe(noise), nengo.Probe(A, synapse=0.01),
+            nengo.Probe(A.neurons)]
+
+    seed = 10
+    steps = 500
+
+    # The network the simulator loads from memory is the one save_file writes.
+    with nengo_mpi.Simulator(m, seed=seed) as sim:
+        sim.run_steps(steps)
+        memory_data = [np.array(sim.data[p]) for p in probes]
+
+    network_file = "test_save_file.net"
+    log_file = "test_save_file.h5"
+
+    try:
+        nengo_mpi.Simulator(m, save_file=network_file)
+        subprocess.check_output([
+            'nengo_cpp', '--noprog', '--seed', str(seed), '--log', log_file,
+            network_file, str(steps * 0.001)])
+
+        with h5py.File(log_file, 'r') as results:
+            file_data = [np.array(results[str(id(p))]) for p in probes]
+    finally:
+        for filename in [network_file, log_file]:
+            try:
+                os.remove(filename)
+            except:
+                pass
+
+    for memory, saved in zip(memory_data, file_data):
+        assert memory.shape == saved.shape
+        assert np.array_equal(memory, saved)
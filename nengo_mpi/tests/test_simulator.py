@@ -1,3 +1,6 @@
+import os
+import time
+
 import nengo_mpi
 
 import nengo
@@ -244,6 +247,353 @@ def test_seeding():
             pass
 
 
+def test_async_pyfuncs():
+    network = nengo.Network()
+
+    with network:
+        clock = nengo.Node(lambda t: [t, 2 * t])
+        doubled = nengo.Node(lambda t, x: 2 * x, size_in=2)
+        nengo.Connection(clock, doubled, synapse=None)
+
+        clock_probe = nengo.Probe(clock)
+        doubled_probe = nengo.Probe(doubled)
+
+    with nengo_mpi.Simulator(network) as sim:
+        sim.run(0.05)
+        clock_data = sim.data[clock_probe]
+        doubled_data = sim.data[doubled_probe]
+
+    assert np.allclose(doubled_data, 2 * clock_data)
+
+    # Each Node gets the output of the ones before it a step late.
+    with nengo_mpi.Simulator(network, async_pyfuncs=True) as sim:
+        sim.run(0.05)
+        assert np.allclose(sim.data[clock_probe][1:], clock_data[:-1])
+        assert np.allclose(sim.data[clock_probe][0], 0.0)
+        assert np.allclose(
+            sim.data[doubled_probe][2:], 2 * clock_data[:-2])
+
+
+def test_checkpoint_restore():
+    network = nengo.Network(seed=1)
+
+    with network:
+        noise = nengo.Node(nengo.processes.WhiteNoise())
+        ens = nengo.Ensemble(50, 1)
+        nengo.Connection(noise, ens, synapse=0.01)
+
+        noise_probe = nengo.Probe(noise)
+        ens_probe = nengo.Probe(ens, synapse=0.01)
+
+    steps_a, steps_b = 60, 40
+    seed = 10
+    checkpoint_file = "test_checkpoint.chk"
+
+    try:
+        with nengo_mpi.Simulator(network, seed=seed) as sim:
+            sim.run_steps(steps_a + steps_b)
+            noise_data = np.array(sim.data[noise_probe])
+            ens_data = np.array(sim.data[ens_probe])
+
+        with nengo_mpi.Simulator(network, seed=seed) as sim:
+            sim.run_steps(steps_a)
+            sim.checkpoint(checkpoint_file)
+            sim.run_steps(steps_b)
+
+            # Restoring clears the probe data collected so far.
+            sim.restore(checkpoint_file)
+            assert len(sim.data[noise_probe]) == 0
+            assert len(sim.data[ens_probe]) == 0
+            assert sim.n_steps == steps_a
+
+            sim.run_steps(steps_b)
+            assert np.allclose(
+                sim.data[noise_probe], noise_data[steps_a:],
+                atol=0.00001, rtol=0.00)
+            assert np.allclose(
+                sim.data[ens_probe], ens_data[steps_a:],
+                atol=0.00001, rtol=0.00)
+
+        # A checkpoint written while running can be restored by a new
+        # simulator of the network, as in a later job.
+        with nengo_mpi.Simulator(
+                network, seed=seed, checkpoint_every=steps_a,
+                checkpoint_file=checkpoint_file) as sim:
+            sim.run_steps(steps_a + steps_b)
+
+        with nengo_mpi.Simulator(network, seed=seed + 1) as sim:
+            sim.restore(checkpoint_file)
+            sim.run_steps(steps_b)
+            assert np.allclose(
+                sim.data[noise_probe], noise_data[steps_a:],
+                atol=0.00001, rtol=0.00)
+            assert np.allclose(
+                sim.data[ens_probe], ens_data[steps_a:],
+                atol=0.00001, rtol=0.00)
+    finally:
+        try:
+            os.remove(checkpoint_file)
+        except:
+            pass
+
+
+def test_n_trials():
+    network = nengo.Network(seed=1)
+
+    with network:
+        noise = nengo.Node(nengo.processes.WhiteNoise())
+        ens = nengo.Ensemble(50, 2)
+        nengo.Connection(noise, ens[0], synapse=0.01)
+
+        noise_probe = nengo.Probe(noise)
+        ens_probe = nengo.Probe(ens, synapse=0.01)
+
+    n_trials = 3
+    steps = 50
+    seed = 10
+
+    with nengo_mpi.Simulator(network, seed=seed, n_trials=n_trials) as sim:
+        sim.run_steps(steps)
+        noise_data = np.array(sim.data[noise_probe])
+        ens_data = np.array(sim.data[ens_probe])
+
+    assert noise_data.shape == (steps, n_trials, 1)
+    assert ens_data.shape == (steps, n_trials, 2)
+
+    # The trials are given different seeds.
+    assert not np.allclose(
+        noise_data[:, 0], noise_data[:, 1], atol=0.00001, rtol=0.00)
+
+    # Trial k is simulated as by a separate simulator with seed + k.
+    for trial in range(n_trials):
+        with nengo_mpi.Simulator(network, seed=seed + trial) as sim:
+            sim.run_steps(steps)
+
+            assert np.allclose(
+                sim.data[noise_probe], noise_data[:, trial],
+                atol=0.00001, rtol=0.00)
+            assert np.allclose(
+                sim.data[ens_probe], ens_data[:, trial],
+                atol=0.00001, rtol=0.00)
+
+
+def test_n_trials_pyfuncs():
+    network = nengo.Network()
+
+    with network:
+        clock = nengo.Node(lambda t: t)
+        nengo.Probe(clock)
+
+    with pytest.raises(RuntimeError) as e:
+        nengo_mpi.Simulator(network, n_trials=2)
+
+    assert "one trial at a time" in str(e.value)
+    assert nengo_mpi.Simulator.all_closed()
+
+
+def test_quiescence():
+    network = nengo.Network(seed=1)
+
+    with network:
+        stim = nengo.Node([0.5])
+        silence = nengo.Node([0.0])
+
+        active = nengo.Ensemble(50, 1)
+        nengo.Connection(stim, active, synapse=0.01)
+
+        # Never fires, so the connections from it and the synapses they feed
+        # go quiet.
+        quiet = nengo.Ensemble(
+            50, 1, encoders=nengo.dists.Choice([[1.0]]),
+            intercepts=nengo.dists.Uniform(0.5, 0.9))
+        nengo.Connection(silence, quiet, synapse=0.01)
+
+        post = nengo.Ensemble(50, 1)
+        nengo.Connection(active, post, synapse=0.01)
+        nengo.Connection(quiet, post, synapse=0.01)
+
+        probes = [
+            nengo.Probe(active, synapse=0.01),
+            nengo.Probe(quiet, synapse=0.01),
+            nengo.Probe(post, synapse=0.01)]
+
+    steps = 200
+    seed = 10
+
+    with nengo_mpi.Simulator(network, seed=seed) as sim:
+        sim.run_steps(steps)
+        full_data = [np.array(sim.data[p]) for p in probes]
+
+    with nengo_mpi.Simulator(network, seed=seed, quiescence=1e-8) as sim:
+        sim.run_steps(steps)
+
+        for p, data in zip(probes, full_data):
+            assert np.allclose(sim.data[p], data, atol=0.00001, rtol=0.00)
+
+        assert np.all(sim.data[probes[1]] == 0.0)
+
+
+def test_probe_reductions():
+    dt = 0.001
+    period = 10
+    steps = 200
+    n_samples = steps // period
+
+    network = nengo.Network(seed=1)
+
+    with network:
+        noise = nengo.Node(nengo.processes.WhiteNoise())
+        A = nengo.Ensemble(50, 2)
+        nengo.Connection(noise, A[0], synapse=0.01)
+
+        value_probe = nengo.Probe(A, synapse=None)
+        spike_probe = nengo.Probe(A.neurons)
+
+        sample_every = period * dt
+        reduced = {
+            window: nengo.Probe(A, synapse=None, sample_every=sample_every)
+            for window in ['mean', 'min', 'max']}
+        count_probe = nengo.Probe(A.neurons, sample_every=sample_every)
+        filter_probe = nengo.Probe(A, synapse=None, sample_every=sample_every)
+        across_mean_probe = nengo.Probe(
+            A, synapse=None, sample_every=sample_every)
+        across_sum_probe = nengo.Probe(A.neurons, sample_every=sample_every)
+
+    probe_reductions = {
+        probe: dict(window=window) for window, probe in reduced.items()}
+    probe_reductions[count_probe] = dict(window='count')
+    probe_reductions[filter_probe] = dict(synapse=0.01)
+    probe_reductions[across_mean_probe] = dict(window='mean', across='mean')
+    probe_reductions[across_sum_probe] = dict(window='count', across='sum')
+
+    with nengo_mpi.Simulator(
+            network, dt=dt, seed=10, probe_reductions=probe_reductions) as sim:
+        sim.run_steps(steps)
+
+        values = np.array(sim.data[value_probe])
+        spikes = np.array(sim.data[spike_probe])
+
+        # Sample i reduces the steps since the last sample.
+        windows = values.reshape(n_samples, period, 2)
+        spike_windows = spikes.reshape(n_samples, period, A.n_neurons)
+
+        expected = {
+            'mean': windows.mean(axis=1),
+            'min': windows.min(axis=1),
+            'max': windows.max(axis=1)}
+
+        for window, probe in reduced.items():
+            assert sim.data[probe].shape == (n_samples, 2)
+            assert np.allclose(
+                sim.data[probe], expected[window], atol=0.00001, rtol=0.00)
+
+        counts = np.count_nonzero(spike_windows, axis=1)
+        assert sim.data[count_probe].shape == (n_samples, A.n_neurons)
+        assert np.allclose(
+            sim.data[count_probe], counts, atol=0.00001, rtol=0.00)
+
+        decay = np.exp(-dt / 0.01)
+        filtered = np.zeros_like(values)
+        state = np.zeros(2)
+        for i, x in enumerate(values):
+            state = decay * state + (1 - decay) * x
+            filtered[i] = state
+
+        assert np.allclose(
+            sim.data[filter_probe], filtered[period - 1::period],
+            atol=0.00001, rtol=0.00)
+
+        # A reduction across the values leaves one per sample.
+        assert sim.data[across_mean_probe].shape == (n_samples, 1)
+        assert np.allclose(
+            sim.data[across_mean_probe][:, 0], expected['mean'].mean(axis=1),
+            atol=0.00001, rtol=0.00)
+
+        assert sim.data[across_sum_probe].shape == (n_samples, 1)
+        assert np.allclose(
+            sim.data[across_sum_probe][:, 0], counts.sum(axis=1),
+            atol=0.00001, rtol=0.00)
+
+
+def test_cache_memory(capfd):
+    def make_network(transform):
+        network = nengo.Network(seed=1)
+
+        with network:
+            stim = nengo.Node([0.5])
+            ens = nengo.Ensemble(50, 1)
+            nengo.Connection(stim, ens, transform=transform, synapse=0.01)
+            probe = nengo.Probe(ens, synapse=0.01)
+
+        return network, probe
+
+    steps = 100
+    seed = 10
+
+    network, probe = make_network(1.0)
+
+    with nengo_mpi.Simulator(network, seed=seed, cache_memory=100) as sim:
+        sim.run_steps(steps)
+        data = np.array(sim.data[probe])
+
+    out, _ = capfd.readouterr()
+    assert "Reusing the chunk" not in out
+
+    # Building the same network again gives the chunk that was kept.
+    with nengo_mpi.Simulator(network, seed=seed, cache_memory=100) as sim:
+        sim.run_steps(steps)
+        assert np.allclose(sim.data[probe], data, atol=0.00001, rtol=0.00)
+
+    out, _ = capfd.readouterr()
+    assert "Reusing the chunk" in out
+
+    # A different network is built from scratch.
+    other, other_probe = make_network(-1.0)
+
+    with nengo_mpi.Simulator(other, seed=seed, cache_memory=100) as sim:
+        sim.run_steps(steps)
+        assert not np.allclose(
+            sim.data[other_probe], data, atol=0.00001, rtol=0.00)
+
+    out, _ = capfd.readouterr()
+    assert "Reusing the chunk" not in out
+
+
+def test_realtime(capfd):
+    network = nengo.Network(seed=1)
+
+    with network:
+        stim = nengo.Node([0.5])
+        ens = nengo.Ensemble(50, 1)
+        nengo.Connection(stim, ens, synapse=0.01)
+        probe = nengo.Probe(ens, synapse=0.01)
+
+    dt = 0.001
+    steps = 200
+    seed = 10
+
+    with nengo_mpi.Simulator(network, dt=dt, seed=seed) as sim:
+        sim.run_steps(steps)
+        data = np.array(sim.data[probe])
+
+    capfd.readouterr()
+
+    with nengo_mpi.Simulator(
+            network, dt=dt, seed=seed, realtime=1.0) as sim:
+        then = time.time()
+        sim.run_steps(steps)
+        elapsed = time.time() - then
+
+        # The first step begins at once, and each one after it a step later.
+        assert elapsed >= (steps - 1) * dt
+
+        assert np.allclose(sim.data[probe], data, atol=0.00001, rtol=0.00)
+
+    out, _ = capfd.readouterr()
+    assert "Real-time steps of" in out
+    assert "Deadlines missed:" in out
+
+
 def test_spaun_stim():
     spaun_vision = pytest.importorskip("_spaun.vision.lif_vision")
     spaun_config = pytest.importorskip("_spaun.config")
@@ -11,15 +11,51 @@ assert (
     and STAND_IN != OP_DELIM
     and STAND_IN != PROBE_DELIM)
 
+# Version of the binary encoding of operators. Must match BINARY_OP_FORMAT
+# in mpi_sim/spec.hpp.
+BINARY_OP_FORMAT = 1
+
+# Layout in which the data of all components is concatenated. Must match
+# PACKED_COMPONENT_LAYOUT in mpi_sim/net_file.hpp.
+PACKED_COMPONENT_LAYOUT = 1
+
+# Operator types in the binary encoding. Must match OpType in mpi_sim/spec.hpp.
+OP_TYPES = {
+    "TimeUpdate": 1, "Reset": 2, "Copy": 3, "SlicedCopy": 4, "DotInc": 5,
+    "ElementwiseInc": 6, "LIF": 7, "LIFRate": 8, "AdaptiveLIF": 9,
+    "AdaptiveLIFRate": 10, "RectifiedLinear": 11, "Sigmoid": 12,
+    "NoDenSynapse": 13, "SimpleSynapse": 14, "Synapse": 15,
+    "TriangleSynapse": 16, "WhiteNoise": 17, "WhiteSignal": 18,
+    "PresentInput": 19, "BCM": 20, "Oja": 21, "Voja": 22, "MpiSend": 23,
+    "MpiRecv": 24, "SpaunStimulus": 25}
+
+# Kinds of operator arguments. Must match OpArgKind in mpi_sim/spec.hpp.
+ARG_SIGNAL, ARG_INTEGER, ARG_REAL = 0, 1, 2
+ARG_VALUES, ARG_MATRIX, ARG_INDICES, ARG_STRINGS = 3, 4, 5, 6
+
+OP_ARG_DTYPE = np.dtype([
+    ('kind', '<i4'), ('value', '<i8'), ('rows', '<i8'),
+    ('cols', '<i8'), ('real', '<f8')])
+
+# The same records, padded like OpArgRecord, for handing them to mpi_sim.so
+# in memory.
+NATIVE_OP_ARG_DTYPE = np.dtype(OP_ARG_DTYPE.descr, align=True)
+
+
+# Attribute holding the key that an MpiModel gives each base signal.
+SIGNAL_KEY_ATTR = '_mpi_key'
+
 
 def make_key(obj):
     """ Create a unique key for an object.
 
     Must be reproducable (i.e. produce the same key if called with
-    the same object multiple times).
+    the same object multiple times). Base signals are keyed by the number
+    that the MpiModel gave them when they were assigned to a component;
+    anything else, such as a probe, by its id.
 
     """
-    return id(obj)
+    return getattr(obj, SIGNAL_KEY_ATTR, id(obj))
 
 
 def sanitize_label(s):
@@ -65,6 +101,42 @@ def ndarray_to_string(a):
     return s
 
 
+class OpValues(object):
+    """ A list of numbers passed as a single operator argument. """
+    def __init__(self, values):
+        self.values = values
+
+    def __str__(self):
+        return ",".join(map(str, self.values))
+
+
+class OpMatrix(object):
+    """ An array passed as a single operator argument, along with its shape. """
+    def __init__(self, values):
+        self.values = values
+
+    def __str__(self):
+        return ndarray_to_string(self.values)
+
+
+class OpIndices(object):
+    """ A list of indices passed as a single operator argument. """
+    def __init__(self, values):
+        self.values = values
+
+    def __str__(self):
+        return str(list(self.values))
+
+
+class OpStrings(object):
+    """ A list of strings passed as a single operator argument. """
+    def __init__(self, values):
+        self.values = values
+
+    def __str__(self):
+        return str(list(self.values))
+
+
 # Stole this from nengo_ocl
 def get_closures(f):
     return OrderedDict(zip(